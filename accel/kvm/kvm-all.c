@@ -93,6 +93,23 @@ enum KVMDirtyRingReaperState {
     KVM_DIRTY_RING_REAPER_REAPING,
 };
 
+/*
+ * Rings of up to KVM_DIRTY_RING_VCPUS_PER_SHARD vCPUs are harvested by a
+ * single thread; larger guests split the vCPUs into shards that are
+ * harvested in parallel, by at most KVM_DIRTY_RING_MAX_SHARDS threads.
+ */
+#define KVM_DIRTY_RING_VCPUS_PER_SHARD  32
+#define KVM_DIRTY_RING_MAX_SHARDS       8
+
+struct KVMDirtyRingReaper;
+
+typedef struct KVMDirtyRingHelper {
+    QemuThread thread;
+    struct KVMDirtyRingReaper *reaper;
+    int shard;
+    uint64_t total;     /* pages harvested in the last round */
+} KVMDirtyRingHelper;
+
 /*
  * KVM reaper instance, responsible for collecting the KVM dirty bits
  * via the dirty ring.
@@ -102,6 +119,17 @@ struct KVMDirtyRingReaper {
     QemuThread reaper_thr;
     volatile uint64_t reaper_iteration; /* iteration number of reaper thr */
     volatile enum KVMDirtyRingReaperState reaper_state; /* reap thr state */
+    int64_t rate_stamp;                 /* last update of vCPU dirty rates */
+
+    /* Threads harvesting shards 1..nr_helpers; shard 0 is the caller's */
+    int nr_helpers;
+    KVMDirtyRingHelper *helpers;
+    QemuMutex lock;
+    QemuCond round_cond;                /* a new round was started */
+    QemuCond done_cond;                 /* all helpers finished the round */
+    uint64_t round;
+    int nr_shards;                      /* shards in the current round */
+    int pending;                        /* helpers still harvesting */
 };
 
 struct KVMState
@@ -155,6 +183,10 @@ struct KVMState
     uint64_t kvm_dirty_ring_bytes;  /* Size of the per-vcpu dirty ring */
     uint32_t kvm_dirty_ring_size;   /* Number of dirty GFNs per ring */
     struct KVMDirtyRingReaper reaper;
+    /* KVM_CLEAR_DIRTY_LOG calls, pages they covered and time spent in them */
+    uint64_t dirty_log_clear_calls;
+    uint64_t dirty_log_clear_pages;
+    uint64_t dirty_log_clear_ns;
 };
 
 KVMState *kvm_state;
@@ -478,6 +510,8 @@ int kvm_init_vcpu(CPUState *cpu, Error **errp)
     cpu->kvm_state = s;
     cpu->vcpu_dirty = true;
     cpu->dirty_pages = 0;
+    cpu->dirty_pages_rate = 0;
+    cpu->dirty_pages_sampled = 0;
     cpu->throttle_us_per_full = 0;
 
     mmap_size = kvm_ioctl(s, KVM_GET_VCPU_MMAP_SIZE, 0);
@@ -695,26 +729,56 @@ static bool kvm_slot_get_dirty_log(KVMState *s, KVMSlot *slot)
     return ret == 0;
 }
 
+/*
+ * Dirty bits harvested for one word of a slot's dirty bitmap.  Consecutive
+ * GFNs usually hit the same slot and often the same word, so the slot is
+ * looked up and the bitmap written only when that changes.
+ */
+typedef struct KVMDirtyRingBatch {
+    uint32_t slot;          /* as_id << 16 | slot id, as in the ring */
+    KVMSlot *mem;           /* NULL if @slot is not valid */
+    uint64_t npages;
+    unsigned long *word;
+    unsigned long mask;
+} KVMDirtyRingBatch;
+
+static void kvm_dirty_ring_batch_flush(KVMDirtyRingBatch *batch)
+{
+    if (batch->mask) {
+        /* Other shards may be setting bits in the same word */
+        qatomic_or(batch->word, batch->mask);
+        batch->mask = 0;
+    }
+}
+
 /* Should be with all slots_lock held for the address spaces. */
-static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
-                                     uint32_t slot_id, uint64_t offset)
+static void kvm_dirty_ring_mark_page(KVMState *s, KVMDirtyRingBatch *batch,
+                                     uint32_t slot, uint64_t offset)
 {
-    KVMMemoryListener *kml;
-    KVMSlot *mem;
+    uint32_t as_id = slot >> 16, slot_id = slot & 0xffff;
+    unsigned long *word;
 
-    if (as_id >= s->nr_as) {
-        return;
+    if (!batch->mem || batch->slot != slot) {
+        kvm_dirty_ring_batch_flush(batch);
+        batch->slot = slot;
+        batch->mem = NULL;
+        if (as_id >= s->nr_as) {
+            return;
+        }
+        batch->mem = &s->as[as_id].ml->slots[slot_id];
+        batch->npages = batch->mem->memory_size / qemu_real_host_page_size();
     }
 
-    kml = s->as[as_id].ml;
-    mem = &kml->slots[slot_id];
-
-    if (!mem->memory_size || offset >=
-        (mem->memory_size / qemu_real_host_page_size())) {
+    if (offset >= batch->npages) {
         return;
     }
 
-    set_bit(offset, mem->dirty_bmap);
+    word = batch->mem->dirty_bmap + BIT_WORD(offset);
+    if (word != batch->word) {
+        kvm_dirty_ring_batch_flush(batch);
+        batch->word = word;
+    }
+    batch->mask |= BIT_MASK(offset);
 }
 
 static bool dirty_gfn_is_dirtied(struct kvm_dirty_gfn *gfn)
@@ -736,6 +800,7 @@ static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
     struct kvm_dirty_gfn *dirty_gfns = cpu->kvm_dirty_gfns, *cur;
     uint32_t ring_size = s->kvm_dirty_ring_size;
     uint32_t count = 0, fetch = cpu->kvm_fetch_index;
+    KVMDirtyRingBatch batch = {};
 
     assert(dirty_gfns && ring_size);
     trace_kvm_dirty_ring_reap_vcpu(cpu->cpu_index);
@@ -745,19 +810,78 @@ static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
         if (!dirty_gfn_is_dirtied(cur)) {
             break;
         }
-        kvm_dirty_ring_mark_page(s, cur->slot >> 16, cur->slot & 0xffff,
-                                 cur->offset);
+        kvm_dirty_ring_mark_page(s, &batch, cur->slot, cur->offset);
         dirty_gfn_set_collected(cur);
         trace_kvm_dirty_ring_page(cpu->cpu_index, fetch, cur->offset);
         fetch++;
         count++;
     }
+    kvm_dirty_ring_batch_flush(&batch);
     cpu->kvm_fetch_index = fetch;
     cpu->dirty_pages += count;
 
     return count;
 }
 
+/* Must be with slots_lock held */
+static uint64_t kvm_dirty_ring_reap_shard(KVMState *s, int shard,
+                                          int nr_shards)
+{
+    uint64_t total = 0;
+    CPUState *cpu;
+
+    RCU_READ_LOCK_GUARD();
+    CPU_FOREACH(cpu) {
+        if (cpu->cpu_index % nr_shards == shard) {
+            total += kvm_dirty_ring_reap_one(s, cpu);
+        }
+    }
+    return total;
+}
+
+/*
+ * Harvest all rings, handing shards 1..nr_shards-1 to the helper threads.
+ * Must be with slots_lock held; the helpers run on its behalf.
+ */
+static uint64_t kvm_dirty_ring_reap_all(KVMState *s)
+{
+    struct KVMDirtyRingReaper *r = &s->reaper;
+    unsigned int nr_cpus = 0;
+    uint64_t total;
+    CPUState *cpu;
+    int i, nr_shards;
+
+    CPU_FOREACH(cpu) {
+        nr_cpus++;
+    }
+    nr_shards = MIN(r->nr_helpers + 1,
+                    DIV_ROUND_UP(nr_cpus, KVM_DIRTY_RING_VCPUS_PER_SHARD));
+    if (nr_shards <= 1) {
+        return kvm_dirty_ring_reap_shard(s, 0, 1);
+    }
+
+    qemu_mutex_lock(&r->lock);
+    r->nr_shards = nr_shards;
+    r->pending = nr_shards - 1;
+    r->round++;
+    qemu_cond_broadcast(&r->round_cond);
+    qemu_mutex_unlock(&r->lock);
+
+    total = kvm_dirty_ring_reap_shard(s, 0, nr_shards);
+
+    qemu_mutex_lock(&r->lock);
+    while (r->pending) {
+        qemu_cond_wait(&r->done_cond, &r->lock);
+    }
+    qemu_mutex_unlock(&r->lock);
+
+    for (i = 0; i < nr_shards - 1; i++) {
+        total += r->helpers[i].total;
+    }
+    trace_kvm_dirty_ring_reap_shards(nr_shards);
+    return total;
+}
+
 /* Must be with slots_lock held */
 static uint64_t kvm_dirty_ring_reap_locked(KVMState *s, CPUState* cpu)
 {
@@ -770,9 +894,7 @@ static uint64_t kvm_dirty_ring_reap_locked(KVMState *s, CPUState* cpu)
     if (cpu) {
         total = kvm_dirty_ring_reap_one(s, cpu);
     } else {
-        CPU_FOREACH(cpu) {
-            total += kvm_dirty_ring_reap_one(s, cpu);
-        }
+        total = kvm_dirty_ring_reap_all(s);
     }
 
     if (total) {
@@ -911,6 +1033,7 @@ static int kvm_log_clear_one_slot(KVMSlot *mem, int as_id, uint64_t start,
     uint64_t end, bmap_start, start_delta, bmap_npages;
     struct kvm_clear_dirty_log d;
     unsigned long *bmap_clear = NULL, psize = qemu_real_host_page_size();
+    int64_t stamp;
     int ret;
 
     /*
@@ -987,7 +1110,11 @@ static int kvm_log_clear_one_slot(KVMSlot *mem, int as_id, uint64_t start,
     d.num_pages = bmap_npages;
     d.slot = mem->slot | (as_id << 16);
 
+    stamp = get_clock();
     ret = kvm_vm_ioctl(s, KVM_CLEAR_DIRTY_LOG, &d);
+    s->dirty_log_clear_ns += get_clock() - stamp;
+    s->dirty_log_clear_calls++;
+    s->dirty_log_clear_pages += bmap_npages;
     if (ret < 0 && ret != -ENOENT) {
         error_report("%s: KVM_CLEAR_DIRTY_LOG failed, slot=%d, "
                      "start=0x%"PRIx64", size=0x%"PRIx32", errno=%d",
@@ -1455,6 +1582,30 @@ out:
     kvm_slots_unlock();
 }
 
+/*
+ * Refresh each vCPU's dirty page rate from the pages harvested since the
+ * last update, whoever harvested them.  Must be called with the BQL held.
+ */
+static void kvm_dirty_ring_update_rates(KVMState *s)
+{
+    struct KVMDirtyRingReaper *r = &s->reaper;
+    int64_t now = get_clock();
+    int64_t elapsed = now - r->rate_stamp;
+    CPUState *cpu;
+
+    if (elapsed <= 0) {
+        return;
+    }
+
+    CPU_FOREACH(cpu) {
+        cpu->dirty_pages_rate = muldiv64(cpu->dirty_pages -
+                                         cpu->dirty_pages_sampled,
+                                         NANOSECONDS_PER_SECOND, elapsed);
+        cpu->dirty_pages_sampled = cpu->dirty_pages;
+    }
+    r->rate_stamp = now;
+}
+
 static void *kvm_dirty_ring_reaper_thread(void *data)
 {
     KVMState *s = data;
@@ -1474,6 +1625,9 @@ static void *kvm_dirty_ring_reaper_thread(void *data)
 
         /* keep sleeping so that dirtylimit not be interfered by reaper */
         if (dirtylimit_in_service()) {
+            qemu_mutex_lock_iothread();
+            kvm_dirty_ring_update_rates(s);
+            qemu_mutex_unlock_iothread();
             continue;
         }
 
@@ -1482,6 +1636,7 @@ static void *kvm_dirty_ring_reaper_thread(void *data)
 
         qemu_mutex_lock_iothread();
         kvm_dirty_ring_reap(s, NULL);
+        kvm_dirty_ring_update_rates(s);
         qemu_mutex_unlock_iothread();
 
         r->reaper_iteration++;
@@ -1494,9 +1649,62 @@ static void *kvm_dirty_ring_reaper_thread(void *data)
     return NULL;
 }
 
+static void *kvm_dirty_ring_helper_thread(void *opaque)
+{
+    KVMDirtyRingHelper *h = opaque;
+    struct KVMDirtyRingReaper *r = h->reaper;
+    uint64_t round = 0;
+    int nr_shards;
+
+    rcu_register_thread();
+
+    qemu_mutex_lock(&r->lock);
+    while (true) {
+        while (r->round == round) {
+            qemu_cond_wait(&r->round_cond, &r->lock);
+        }
+        round = r->round;
+        if (h->shard >= r->nr_shards) {
+            continue;
+        }
+
+        nr_shards = r->nr_shards;
+        qemu_mutex_unlock(&r->lock);
+        h->total = kvm_dirty_ring_reap_shard(kvm_state, h->shard, nr_shards);
+        qemu_mutex_lock(&r->lock);
+
+        if (!--r->pending) {
+            qemu_cond_signal(&r->done_cond);
+        }
+    }
+
+    rcu_unregister_thread();
+
+    return NULL;
+}
+
 static int kvm_dirty_ring_reaper_init(KVMState *s)
 {
     struct KVMDirtyRingReaper *r = &s->reaper;
+    MachineState *ms = MACHINE(qdev_get_machine());
+    int i;
+
+    r->rate_stamp = get_clock();
+
+    qemu_mutex_init(&r->lock);
+    qemu_cond_init(&r->round_cond);
+    qemu_cond_init(&r->done_cond);
+    r->nr_helpers = MIN(KVM_DIRTY_RING_MAX_SHARDS,
+                        DIV_ROUND_UP(ms->smp.max_cpus,
+                                     KVM_DIRTY_RING_VCPUS_PER_SHARD)) - 1;
+    r->helpers = g_new0(KVMDirtyRingHelper, r->nr_helpers);
+    for (i = 0; i < r->nr_helpers; i++) {
+        r->helpers[i].reaper = r;
+        r->helpers[i].shard = i + 1;
+        qemu_thread_create(&r->helpers[i].thread, "kvm-reaper-helper",
+                           kvm_dirty_ring_helper_thread,
+                           &r->helpers[i], QEMU_THREAD_DETACHED);
+    }
 
     qemu_thread_create(&r->reaper_thr, "kvm-reaper",
                        kvm_dirty_ring_reaper_thread,
@@ -2321,6 +2529,11 @@ bool kvm_dirty_ring_enabled(void)
     return kvm_state->kvm_dirty_ring_size ? true : false;
 }
 
+bool kvm_dirty_log_manual_protect_enabled(void)
+{
+    return kvm_state->manual_dirty_log_protect ? true : false;
+}
+
 static void query_stats_cb(StatsResultList **result, StatsTarget target,
                            strList *names, strList *targets, Error **errp);
 static void query_stats_schemas_cb(StatsSchemaList **result, Error **errp);
@@ -3951,6 +4164,122 @@ static StatsDescriptors *find_stats_descriptors(StatsTarget target, int stats_fd
     return descriptors;
 }
 
+/*
+ * Statistics kept by QEMU rather than KVM, reported along with KVM's own.
+ * Scaled by 10^exponent like the KVM statistics.
+ */
+typedef struct QEMUStatDesc {
+    const char *name;
+    StatsType type;
+    bool has_unit;
+    StatsUnit unit;
+    int exponent;
+} QEMUStatDesc;
+
+/* Per vCPU: pages harvested from the dirty ring, in total and per second */
+static const QEMUStatDesc dirty_ring_stats[] = {
+    { "dirty-ring-pages", STATS_TYPE_CUMULATIVE },
+    { "dirty-ring-rate", STATS_TYPE_INSTANT },
+};
+
+/* Per VM: KVM_CLEAR_DIRTY_LOG calls, pages covered and time spent */
+static const QEMUStatDesc dirty_log_clear_stats[] = {
+    { "dirty-log-clear-calls", STATS_TYPE_CUMULATIVE },
+    { "dirty-log-clear-pages", STATS_TYPE_CUMULATIVE },
+    { "dirty-log-clear-time", STATS_TYPE_CUMULATIVE,
+      true, STATS_UNIT_SECONDS, -9 },
+};
+
+static StatsList *add_qemu_stats(const QEMUStatDesc *desc,
+                                 const uint64_t *values, int n,
+                                 strList *names, StatsList *stats_list)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        Stats *stats;
+
+        if (!apply_str_list_filter(desc[i].name, names)) {
+            continue;
+        }
+        stats = g_new0(Stats, 1);
+        stats->name = g_strdup(desc[i].name);
+        stats->value = g_new0(StatsValue, 1);
+        stats->value->u.scalar = values[i];
+        stats->value->type = QTYPE_QNUM;
+        QAPI_LIST_PREPEND(stats_list, stats);
+    }
+    return stats_list;
+}
+
+static StatsSchemaValueList *add_qemu_schema(const QEMUStatDesc *desc, int n,
+                                             StatsSchemaValueList *list)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+        value->name = g_strdup(desc[i].name);
+        value->type = desc[i].type;
+        value->has_unit = desc[i].has_unit;
+        value->unit = desc[i].unit;
+        value->exponent = desc[i].exponent;
+        if (desc[i].exponent) {
+            value->has_base = true;
+            value->base = 10;
+        }
+        QAPI_LIST_PREPEND(list, value);
+    }
+    return list;
+}
+
+static StatsList *add_dirty_tracking_stats(StatsTarget target,
+                                           strList *names,
+                                           StatsList *stats_list)
+{
+    KVMState *s = kvm_state;
+
+    if (target == STATS_TARGET_VCPU && s->kvm_dirty_ring_size) {
+        uint64_t values[] = {
+            current_cpu->dirty_pages,
+            current_cpu->dirty_pages_rate,
+        };
+
+        stats_list = add_qemu_stats(dirty_ring_stats, values,
+                                    ARRAY_SIZE(dirty_ring_stats),
+                                    names, stats_list);
+    } else if (target == STATS_TARGET_VM && s->manual_dirty_log_protect) {
+        uint64_t values[3];
+
+        kvm_slots_lock();
+        values[0] = s->dirty_log_clear_calls;
+        values[1] = s->dirty_log_clear_pages;
+        values[2] = s->dirty_log_clear_ns;
+        kvm_slots_unlock();
+
+        stats_list = add_qemu_stats(dirty_log_clear_stats, values,
+                                    ARRAY_SIZE(dirty_log_clear_stats),
+                                    names, stats_list);
+    }
+    return stats_list;
+}
+
+static StatsSchemaValueList *
+add_dirty_tracking_schema(StatsTarget target, StatsSchemaValueList *list)
+{
+    KVMState *s = kvm_state;
+
+    if (target == STATS_TARGET_VCPU && s->kvm_dirty_ring_size) {
+        list = add_qemu_schema(dirty_ring_stats, ARRAY_SIZE(dirty_ring_stats),
+                               list);
+    } else if (target == STATS_TARGET_VM && s->manual_dirty_log_protect) {
+        list = add_qemu_schema(dirty_log_clear_stats,
+                               ARRAY_SIZE(dirty_log_clear_stats), list);
+    }
+    return list;
+}
+
 static void query_stats(StatsResultList **result, StatsTarget target,
                         strList *names, int stats_fd, Error **errp)
 {
@@ -4000,6 +4329,8 @@ static void query_stats(StatsResultList **result, StatsTarget target,
         stats_list = add_kvmstat_entry(pdesc, stats, stats_list, errp);
     }
 
+    stats_list = add_dirty_tracking_stats(target, names, stats_list);
+
     if (!stats_list) {
         return;
     }
@@ -4044,6 +4375,8 @@ static void query_stats_schema(StatsSchemaList **result, StatsTarget target,
         stats_list = add_kvmschema_entry(pdesc, stats_list, errp);
     }
 
+    stats_list = add_dirty_tracking_schema(target, stats_list);
+
     add_stats_schema(result, STATS_PROVIDER_KVM, target, stats_list);
 }
 
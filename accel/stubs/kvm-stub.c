@@ -149,6 +149,11 @@ bool kvm_dirty_ring_enabled(void)
     return false;
 }
 
+bool kvm_dirty_log_manual_protect_enabled(void)
+{
+    return false;
+}
+
 uint32_t kvm_dirty_ring_size(void)
 {
     return 0;
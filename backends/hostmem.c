@@ -338,6 +338,9 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
             goto out;
         }
 
+        const unsigned long *prealloc_nodes = NULL;
+        unsigned long prealloc_max_node = 0;
+
         ptr = memory_region_get_ram_ptr(&backend->mr);
         sz = memory_region_size(&backend->mr);
 
@@ -387,12 +390,30 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
                 return;
             }
         }
+        if (maxnode) {
+            prealloc_nodes = backend->host_nodes;
+            prealloc_max_node = maxnode;
+        }
 #endif
         /* Preallocate memory after the NUMA policy has been instantiated.
          * This is necessary to guarantee memory is allocated with
          * specified NUMA policy in place.
          */
-        if (backend->prealloc) {
+        if (backend->prealloc && !phase_check(PHASE_MACHINE_INITIALIZED)) {
+            /*
+             * Backends created at startup are preallocated concurrently;
+             * machine_run_board_init() waits for them.
+             */
+            const char *id = object_get_canonical_path_component(OBJECT(uc));
+
+            os_mem_prealloc_async(id, memory_region_get_fd(&backend->mr),
+                                  ptr, sz, backend->prealloc_threads,
+                                  prealloc_nodes, prealloc_max_node,
+                                  &local_err);
+            if (local_err) {
+                goto out;
+            }
+        } else if (backend->prealloc) {
             os_mem_prealloc(memory_region_get_fd(&backend->mr), ptr, sz,
                             backend->prealloc_threads, &local_err);
             if (local_err) {
@@ -407,7 +428,11 @@ out:
 static bool
 host_memory_backend_can_be_deleted(UserCreatable *uc)
 {
-    if (host_memory_backend_is_mapped(MEMORY_BACKEND(uc))) {
+    HostMemoryBackend *backend = MEMORY_BACKEND(uc);
+
+    /* Preallocation threads may still be writing to the memory */
+    if (host_memory_backend_is_mapped(backend) ||
+        (backend->prealloc && !os_mem_prealloc_async_done())) {
         return false;
     } else {
         return true;
@@ -43,6 +43,23 @@ struct VirtIOBlockDataPlane {
      */
     IOThread *iothread;
     AioContext *ctx;
+
+    /*
+     * IOThreads from the iothread-vq-mapping property.  Virtqueues are
+     * assigned to them round-robin and vq_aio_context[i] is the AioContext
+     * that runs virtqueue i's handler and completes its requests.  The
+     * BlockBackend lives in ctx, which is the AioContext of the first
+     * IOThread in the list.
+     */
+    IOThread **vq_iothreads;
+    unsigned num_vq_iothreads;
+    AioContext **vq_aio_context;
+
+    /*
+     * Whether requests are completed in vq_aio_context.  Only set while the
+     * BlockBackend is in ctx and the virtqueue handlers are attached.
+     */
+    bool vq_completion;
 };
 
 /* Raise an interrupt to signal guest, if necessary */
@@ -56,6 +73,20 @@ void virtio_blk_data_plane_notify(VirtIOBlockDataPlane *s, VirtQueue *vq)
     }
 }
 
+/*
+ * Returns the AioContext in which requests from virtqueue @index complete,
+ * or NULL if they complete in the BlockBackend's AioContext.
+ */
+AioContext *virtio_blk_data_plane_get_vq_context(VirtIOBlockDataPlane *s,
+                                                 unsigned index)
+{
+    if (!qatomic_read(&s->vq_completion) ||
+        s->vq_aio_context[index] == s->ctx) {
+        return NULL;
+    }
+    return s->vq_aio_context[index];
+}
+
 static void notify_guest_bh(void *opaque)
 {
     VirtIOBlockDataPlane *s = opaque;
@@ -80,6 +111,63 @@ static void notify_guest_bh(void *opaque)
     }
 }
 
+/* Context: QEMU global mutex held */
+static bool virtio_blk_data_plane_parse_vq_mapping(VirtIOBlockDataPlane *s,
+                                                   const char *mapping,
+                                                   Error **errp)
+{
+    g_auto(GStrv) ids = g_strsplit(mapping, ":", -1);
+    unsigned n = g_strv_length(ids);
+    unsigned i, j;
+
+    if (n == 0) {
+        error_setg(errp, "iothread-vq-mapping must not be empty");
+        return false;
+    }
+
+    s->vq_iothreads = g_new0(IOThread *, n);
+    for (i = 0; i < n; i++) {
+        IOThread *iothread = iothread_by_id(ids[i]);
+
+        if (!iothread) {
+            error_setg(errp, "IOThread \"%s\" not found", ids[i]);
+            return false;
+        }
+        for (j = 0; j < i; j++) {
+            if (s->vq_iothreads[j] == iothread) {
+                error_setg(errp, "IOThread \"%s\" listed more than once in "
+                           "iothread-vq-mapping", ids[i]);
+                return false;
+            }
+        }
+
+        object_ref(OBJECT(iothread));
+        s->vq_iothreads[i] = iothread;
+        s->num_vq_iothreads++;
+    }
+    return true;
+}
+
+/* Context: QEMU global mutex held */
+static void virtio_blk_data_plane_free(VirtIOBlockDataPlane *s)
+{
+    unsigned i;
+
+    for (i = 0; i < s->num_vq_iothreads; i++) {
+        object_unref(OBJECT(s->vq_iothreads[i]));
+    }
+    g_free(s->vq_iothreads);
+    g_free(s->vq_aio_context);
+    g_free(s->batch_notify_vqs);
+    if (s->bh) {
+        qemu_bh_delete(s->bh);
+    }
+    if (s->iothread) {
+        object_unref(OBJECT(s->iothread));
+    }
+    g_free(s);
+}
+
 /* Context: QEMU global mutex held */
 bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
                                   VirtIOBlockDataPlane **dataplane,
@@ -88,10 +176,18 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     VirtIOBlockDataPlane *s;
     BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    unsigned i;
 
     *dataplane = NULL;
 
-    if (conf->iothread) {
+    if (conf->iothread && conf->iothread_vq_mapping) {
+        error_setg(errp,
+                   "iothread and iothread-vq-mapping properties cannot be set "
+                   "at the same time");
+        return false;
+    }
+
+    if (conf->iothread || conf->iothread_vq_mapping) {
         if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
             error_setg(errp,
                        "device is incompatible with iothread "
@@ -119,13 +215,32 @@ bool virtio_blk_data_plane_create(VirtIODevice *vdev, VirtIOBlkConf *conf,
     s = g_new0(VirtIOBlockDataPlane, 1);
     s->vdev = vdev;
     s->conf = conf;
+    s->vq_aio_context = g_new(AioContext *, conf->num_queues);
 
-    if (conf->iothread) {
-        s->iothread = conf->iothread;
-        object_ref(OBJECT(s->iothread));
-        s->ctx = iothread_get_aio_context(s->iothread);
+    if (conf->iothread_vq_mapping) {
+        if (!virtio_blk_data_plane_parse_vq_mapping(s,
+                                                    conf->iothread_vq_mapping,
+                                                    errp)) {
+            virtio_blk_data_plane_free(s);
+            return false;
+        }
+        s->ctx = iothread_get_aio_context(s->vq_iothreads[0]);
+        for (i = 0; i < conf->num_queues; i++) {
+            IOThread *iothread = s->vq_iothreads[i % s->num_vq_iothreads];
+
+            s->vq_aio_context[i] = iothread_get_aio_context(iothread);
+        }
     } else {
-        s->ctx = qemu_get_aio_context();
+        if (conf->iothread) {
+            s->iothread = conf->iothread;
+            object_ref(OBJECT(s->iothread));
+            s->ctx = iothread_get_aio_context(s->iothread);
+        } else {
+            s->ctx = qemu_get_aio_context();
+        }
+        for (i = 0; i < conf->num_queues; i++) {
+            s->vq_aio_context[i] = s->ctx;
+        }
     }
     s->bh = aio_bh_new(s->ctx, notify_guest_bh, s);
     s->batch_notify_vqs = bitmap_new(conf->num_queues);
@@ -146,12 +261,7 @@ void virtio_blk_data_plane_destroy(VirtIOBlockDataPlane *s)
 
     vblk = VIRTIO_BLK(s->vdev);
     assert(!vblk->dataplane_started);
-    g_free(s->batch_notify_vqs);
-    qemu_bh_delete(s->bh);
-    if (s->iothread) {
-        object_unref(OBJECT(s->iothread));
-    }
-    g_free(s);
+    virtio_blk_data_plane_free(s);
 }
 
 /* Context: QEMU global mutex held */
@@ -231,6 +341,7 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
         error_report_err(local_err);
         goto fail_aio_context;
     }
+    qatomic_set(&s->vq_completion, s->num_vq_iothreads > 1);
 
     /* Process queued requests before the ones in vring */
     virtio_blk_process_queued_requests(vblk, false);
@@ -243,13 +354,14 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
     }
 
     /* Get this show started by hooking up our callbacks */
-    aio_context_acquire(s->ctx);
     for (i = 0; i < nvqs; i++) {
         VirtQueue *vq = virtio_get_queue(s->vdev, i);
+        AioContext *ctx = s->vq_aio_context[i];
 
-        virtio_queue_aio_attach_host_notifier(vq, s->ctx);
+        aio_context_acquire(ctx);
+        virtio_queue_aio_attach_host_notifier(vq, ctx);
+        aio_context_release(ctx);
     }
-    aio_context_release(s->ctx);
     return 0;
 
   fail_aio_context:
@@ -278,19 +390,23 @@ int virtio_blk_data_plane_start(VirtIODevice *vdev)
     return -ENOSYS;
 }
 
-/* Stop notifications for new requests from guest.
+/* Stop notifications for new requests from guest on the virtqueues
+ * handled by the current AioContext.
  *
  * Context: BH in IOThread
  */
 static void virtio_blk_data_plane_stop_bh(void *opaque)
 {
     VirtIOBlockDataPlane *s = opaque;
+    AioContext *ctx = qemu_get_current_aio_context();
     unsigned i;
 
     for (i = 0; i < s->conf->num_queues; i++) {
         VirtQueue *vq = virtio_get_queue(s->vdev, i);
 
-        virtio_queue_aio_detach_host_notifier(vq, s->ctx);
+        if (s->vq_aio_context[i] == ctx) {
+            virtio_queue_aio_detach_host_notifier(vq, ctx);
+        }
     }
 }
 
@@ -317,9 +433,25 @@ void virtio_blk_data_plane_stop(VirtIODevice *vdev)
     s->stopping = true;
     trace_virtio_blk_data_plane_stop(s);
 
+    for (i = 0; i < s->num_vq_iothreads; i++) {
+        AioContext *ctx = iothread_get_aio_context(s->vq_iothreads[i]);
+
+        if (ctx != s->ctx) {
+            aio_context_acquire(ctx);
+            aio_wait_bh_oneshot(ctx, virtio_blk_data_plane_stop_bh, s);
+            aio_context_release(ctx);
+        }
+    }
+
     aio_context_acquire(s->ctx);
     aio_wait_bh_oneshot(s->ctx, virtio_blk_data_plane_stop_bh, s);
 
+    /* Wait for completions that were handed to other IOThreads */
+    if (s->vq_completion) {
+        blk_drain(s->conf->conf.blk);
+        qatomic_set(&s->vq_completion, false);
+    }
+
     /* Drain and try to switch bs back to the QEMU main loop. If other users
      * keep the BlockBackend in the iothread, that's ok */
     blk_set_aio_context(s->conf->conf.blk, qemu_get_aio_context(), NULL);
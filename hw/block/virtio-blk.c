@@ -14,6 +14,7 @@
 #include "qemu/osdep.h"
 #include "qapi/error.h"
 #include "qemu/iov.h"
+#include "qemu/bitmap.h"
 #include "qemu/module.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
@@ -70,24 +71,133 @@ static void virtio_blk_init_request(VirtIOBlock *s, VirtQueue *vq,
 
 static void virtio_blk_free_request(VirtIOBlockReq *req)
 {
-    g_free(req);
+    virtqueue_element_free(&req->elem);
 }
 
+/*
+ * Completed requests are filled into the used ring right away, but the used
+ * index is published and the guest notified from a bottom half.  A burst of
+ * completions then costs one used index update and one notification per
+ * virtqueue.  The bottom half counts as an in-flight request, so draining
+ * the BlockBackend also publishes pending completions.
+ */
+static void virtio_blk_complete_bh(void *opaque)
+{
+    VirtIOBlock *s = opaque;
+    VirtIODevice *vdev = VIRTIO_DEVICE(s);
+    AioContext *ctx = blk_get_aio_context(s->conf.conf.blk);
+    unsigned nvqs = s->conf.num_queues;
+    unsigned i;
+
+    aio_context_acquire(ctx);
+    s->complete_bh_scheduled = false;
+    for (i = find_first_bit(s->complete_vqs, nvqs); i < nvqs;
+         i = find_next_bit(s->complete_vqs, nvqs, i + 1)) {
+        VirtQueue *vq = virtio_get_queue(vdev, i);
+
+        clear_bit(i, s->complete_vqs);
+        if (!virtqueue_flush_deferred(vq)) {
+            continue;
+        }
+        if (s->dataplane_started && !s->dataplane_disabled) {
+            virtio_blk_data_plane_notify(s->dataplane, vq);
+        } else {
+            virtio_notify(vdev, vq);
+        }
+    }
+    blk_dec_in_flight(s->conf.conf.blk);
+    aio_context_release(ctx);
+}
+
+/*
+ * With iothread-vq-mapping, requests are completed in the IOThread of their
+ * virtqueue instead of the BlockBackend's, so that each virtqueue is only
+ * accessed by one thread and each IOThread notifies the guest about its own
+ * virtqueues.  Completed requests are handed over through a lock-free list.
+ * Like virtio_blk_complete_bh(), the bottom half counts as an in-flight
+ * request.
+ */
+typedef struct VirtIOBlockVqCompletion {
+    VirtIOBlock *dev;
+    VirtQueue *vq;
+    VirtIOBlockReq *reqs; /* most recent first, linked through next */
+    bool bh_scheduled;
+} VirtIOBlockVqCompletion;
+
+static void virtio_blk_vq_complete_bh(void *opaque)
+{
+    VirtIOBlockVqCompletion *c = opaque;
+    VirtIOBlock *s = c->dev;
+    VirtIOBlockReq *req, *next, *reqs = NULL;
+
+    qatomic_set(&c->bh_scheduled, false);
+    /* Requests added from now on schedule the bottom half again */
+    smp_mb();
+
+    /* Complete the requests in order */
+    for (req = qatomic_xchg(&c->reqs, NULL); req; req = next) {
+        next = req->next;
+        req->next = reqs;
+        reqs = req;
+    }
+    for (req = reqs; req; req = next) {
+        next = req->next;
+        virtqueue_push_deferred(c->vq, &req->elem, req->in_len);
+        virtio_blk_free_request(req);
+    }
+
+    if (virtqueue_flush_deferred(c->vq)) {
+        virtio_notify_irqfd(VIRTIO_DEVICE(s), c->vq);
+    }
+    blk_dec_in_flight(s->conf.conf.blk);
+}
+
+static void virtio_blk_vq_complete(VirtIOBlockVqCompletion *c,
+                                   AioContext *ctx, VirtIOBlockReq *req)
+{
+    VirtIOBlockReq *old;
+
+    do {
+        old = qatomic_read(&c->reqs);
+        req->next = old;
+    } while (qatomic_cmpxchg(&c->reqs, old, req) != old);
+
+    if (!qatomic_xchg(&c->bh_scheduled, true)) {
+        blk_inc_in_flight(c->dev->conf.conf.blk);
+        aio_bh_schedule_oneshot(ctx, virtio_blk_vq_complete_bh, c);
+    }
+}
+
+/* Complete @req with @status and free it */
 static void virtio_blk_req_complete(VirtIOBlockReq *req, unsigned char status)
 {
     VirtIOBlock *s = req->dev;
     VirtIODevice *vdev = VIRTIO_DEVICE(s);
+    unsigned index = virtio_get_queue_index(req->vq);
+    AioContext *ctx = NULL;
 
     trace_virtio_blk_req_complete(vdev, req, status);
 
     stb_p(&req->in->status, status);
     iov_discard_undo(&req->inhdr_undo);
     iov_discard_undo(&req->outhdr_undo);
-    virtqueue_push(req->vq, &req->elem, req->in_len);
-    if (s->dataplane_started && !s->dataplane_disabled) {
-        virtio_blk_data_plane_notify(s->dataplane, req->vq);
-    } else {
-        virtio_notify(vdev, req->vq);
+
+    if (s->dataplane) {
+        ctx = virtio_blk_data_plane_get_vq_context(s->dataplane, index);
+    }
+    if (ctx) {
+        virtio_blk_vq_complete(&s->vq_completions[index], ctx, req);
+        return;
+    }
+
+    virtqueue_push_deferred(req->vq, &req->elem, req->in_len);
+    virtio_blk_free_request(req);
+    set_bit(index, s->complete_vqs);
+    if (!s->complete_bh_scheduled) {
+        s->complete_bh_scheduled = true;
+        blk_inc_in_flight(s->conf.conf.blk);
+        aio_bh_schedule_oneshot(blk_get_aio_context(s->conf.conf.blk),
+                                virtio_blk_complete_bh, s);
     }
 }
 
@@ -104,11 +214,10 @@ static int virtio_blk_handle_rw_error(VirtIOBlockReq *req, int error,
         req->next = s->rq;
         s->rq = req;
     } else if (action == BLOCK_ERROR_ACTION_REPORT) {
-        virtio_blk_req_complete(req, VIRTIO_BLK_S_IOERR);
         if (acct_failed) {
             block_acct_failed(blk_get_stats(s->blk), &req->acct);
         }
-        virtio_blk_free_request(req);
+        virtio_blk_req_complete(req, VIRTIO_BLK_S_IOERR);
     }
 
     blk_error_action(s->blk, action, is_read, error);
@@ -150,9 +259,8 @@ static void virtio_blk_rw_complete(void *opaque, int ret)
             }
         }
 
-        virtio_blk_req_complete(req, VIRTIO_BLK_S_OK);
         block_acct_done(blk_get_stats(s->blk), &req->acct);
-        virtio_blk_free_request(req);
+        virtio_blk_req_complete(req, VIRTIO_BLK_S_OK);
     }
     aio_context_release(blk_get_aio_context(s->conf.conf.blk));
 }
@@ -169,9 +277,8 @@ static void virtio_blk_flush_complete(void *opaque, int ret)
         }
     }
 
-    virtio_blk_req_complete(req, VIRTIO_BLK_S_OK);
     block_acct_done(blk_get_stats(s->blk), &req->acct);
-    virtio_blk_free_request(req);
+    virtio_blk_req_complete(req, VIRTIO_BLK_S_OK);
 
 out:
     aio_context_release(blk_get_aio_context(s->conf.conf.blk));
@@ -191,11 +298,10 @@ static void virtio_blk_discard_write_zeroes_complete(void *opaque, int ret)
         }
     }
 
-    virtio_blk_req_complete(req, VIRTIO_BLK_S_OK);
     if (is_write_zeroes) {
         block_acct_done(blk_get_stats(s->blk), &req->acct);
     }
-    virtio_blk_free_request(req);
+    virtio_blk_req_complete(req, VIRTIO_BLK_S_OK);
 
 out:
     aio_context_release(blk_get_aio_context(s->conf.conf.blk));
@@ -247,23 +353,12 @@ static void virtio_blk_ioctl_complete(void *opaque, int status)
 out:
     aio_context_acquire(blk_get_aio_context(s->conf.conf.blk));
     virtio_blk_req_complete(req, status);
-    virtio_blk_free_request(req);
     aio_context_release(blk_get_aio_context(s->conf.conf.blk));
     g_free(ioctl_req);
 }
 
 #endif
 
-static VirtIOBlockReq *virtio_blk_get_request(VirtIOBlock *s, VirtQueue *vq)
-{
-    VirtIOBlockReq *req = virtqueue_pop(vq, sizeof(VirtIOBlockReq));
-
-    if (req) {
-        virtio_blk_init_request(s, vq, req);
-    }
-    return req;
-}
-
 static int virtio_blk_handle_scsi_req(VirtIOBlockReq *req)
 {
     int status = VIRTIO_BLK_S_OK;
@@ -380,7 +475,6 @@ static void virtio_blk_handle_scsi(VirtIOBlockReq *req)
     status = virtio_blk_handle_scsi_req(req);
     if (status != -EINPROGRESS) {
         virtio_blk_req_complete(req, status);
-        virtio_blk_free_request(req);
     }
 }
 
@@ -674,10 +768,9 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
         }
 
         if (!virtio_blk_sect_range_ok(s, req->sector_num, req->qiov.size)) {
-            virtio_blk_req_complete(req, VIRTIO_BLK_S_IOERR);
             block_acct_invalid(blk_get_stats(s->blk),
                                is_write ? BLOCK_ACCT_WRITE : BLOCK_ACCT_READ);
-            virtio_blk_free_request(req);
+            virtio_blk_req_complete(req, VIRTIO_BLK_S_IOERR);
             return 0;
         }
 
@@ -715,7 +808,6 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
                               VIRTIO_BLK_ID_BYTES));
         iov_from_buf(in_iov, in_num, 0, serial, size);
         virtio_blk_req_complete(req, VIRTIO_BLK_S_OK);
-        virtio_blk_free_request(req);
         break;
     }
     /*
@@ -739,7 +831,6 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
         if (unlikely(!(type & VIRTIO_BLK_T_OUT) ||
                      out_len > sizeof(dwz_hdr))) {
             virtio_blk_req_complete(req, VIRTIO_BLK_S_UNSUPP);
-            virtio_blk_free_request(req);
             return 0;
         }
 
@@ -756,23 +847,22 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
                                                             is_write_zeroes);
         if (err_status != VIRTIO_BLK_S_OK) {
             virtio_blk_req_complete(req, err_status);
-            virtio_blk_free_request(req);
         }
 
         break;
     }
     default:
         virtio_blk_req_complete(req, VIRTIO_BLK_S_UNSUPP);
-        virtio_blk_free_request(req);
     }
     return 0;
 }
 
 void virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
 {
-    VirtIOBlockReq *req;
+    VirtIOBlockReq *reqs[VIRTIO_BLK_POP_BATCH];
     MultiReqBuffer mrb = {};
     bool suppress_notifications = virtio_queue_get_notification(vq);
+    unsigned int i, n;
 
     aio_context_acquire(blk_get_aio_context(s->blk));
     blk_io_plug(s->blk);
@@ -782,10 +872,20 @@ void virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
             virtio_queue_set_notification(vq, 0);
         }
 
-        while ((req = virtio_blk_get_request(s, vq))) {
-            if (virtio_blk_handle_request(req, &mrb)) {
-                virtqueue_detach_element(req->vq, &req->elem, 0);
-                virtio_blk_free_request(req);
+        while ((n = virtqueue_pop_batch(vq, sizeof(VirtIOBlockReq),
+                                        (void **)reqs, ARRAY_SIZE(reqs)))) {
+            for (i = 0; i < n; i++) {
+                virtio_blk_init_request(s, vq, reqs[i]);
+                if (virtio_blk_handle_request(reqs[i], &mrb)) {
+                    break;
+                }
+            }
+            if (i < n) {
+                /* The device is broken, drop the rest of the batch */
+                for (; i < n; i++) {
+                    virtqueue_detach_element(vq, &reqs[i]->elem, 0);
+                    virtio_blk_free_request(reqs[i]);
+                }
                 break;
             }
         }
@@ -1225,6 +1325,12 @@ static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
         virtio_cleanup(vdev);
         return;
     }
+    s->complete_vqs = bitmap_new(conf->num_queues);
+    s->vq_completions = g_new0(VirtIOBlockVqCompletion, conf->num_queues);
+    for (i = 0; i < conf->num_queues; i++) {
+        s->vq_completions[i].dev = s;
+        s->vq_completions[i].vq = virtio_get_queue(vdev, i);
+    }
 
     s->change = qemu_add_vm_change_state_handler(virtio_blk_dma_restart_cb, s);
     blk_set_dev_ops(s->blk, &virtio_block_ops, s);
@@ -1251,6 +1357,10 @@ static void virtio_blk_device_unrealize(DeviceState *dev)
     for (i = 0; i < conf->num_queues; i++) {
         virtio_del_queue(vdev, i);
     }
+    g_free(s->complete_vqs);
+    s->complete_vqs = NULL;
+    g_free(s->vq_completions);
+    s->vq_completions = NULL;
     qemu_coroutine_dec_pool_size(conf->num_queues * conf->queue_size / 2);
     qemu_del_vm_change_state_handler(s->change);
     blockdev_mark_auto_del(s->blk);
@@ -1295,6 +1405,8 @@ static Property virtio_blk_properties[] = {
     DEFINE_PROP_BOOL("seg-max-adjust", VirtIOBlock, conf.seg_max_adjust, true),
     DEFINE_PROP_LINK("iothread", VirtIOBlock, conf.iothread, TYPE_IOTHREAD,
                      IOThread *),
+    DEFINE_PROP_STRING("iothread-vq-mapping", VirtIOBlock,
+                       conf.iothread_vq_mapping),
     DEFINE_PROP_BIT64("discard", VirtIOBlock, host_features,
                       VIRTIO_BLK_F_DISCARD, true),
     DEFINE_PROP_BOOL("report-discard-granularity", VirtIOBlock,
@@ -206,6 +206,27 @@ MemdevList *qmp_query_memdev(Error **errp)
     return list;
 }
 
+static void query_memory_prealloc(const char *name, size_t size, size_t done,
+                                  int threads, void *opaque)
+{
+    MemoryPreallocInfoList **list = opaque;
+    MemoryPreallocInfo *info = g_new0(MemoryPreallocInfo, 1);
+
+    info->id = g_strdup(name);
+    info->size = size;
+    info->done = done;
+    info->threads = threads;
+    QAPI_LIST_PREPEND(*list, info);
+}
+
+MemoryPreallocInfoList *qmp_query_memory_prealloc(Error **errp)
+{
+    MemoryPreallocInfoList *list = NULL;
+
+    os_mem_prealloc_foreach(query_memory_prealloc, &list);
+    return list;
+}
+
 HumanReadableText *qmp_x_query_numa(Error **errp)
 {
     g_autoptr(GString) buf = g_string_new("");
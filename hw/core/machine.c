@@ -1328,6 +1328,11 @@ void machine_run_board_init(MachineState *machine, const char *mem_path, Error *
         }
     }
 
+    /* Guest RAM must not be written while it is preallocated */
+    if (!os_mem_prealloc_async_finish(errp)) {
+        return;
+    }
+
     if (machine->numa_state) {
         numa_complete_configuration(machine);
         if (machine->numa_state->num_nodes) {
@@ -588,7 +588,8 @@ e1000e_rss_calc_hash(E1000ECore *core,
         return 0;
     }
 
-    return net_rx_pkt_calc_rss_hash(pkt, type, (uint8_t *) &core->mac[RSSRK]);
+    net_toeplitz_set_key(&core->rss_toeplitz, (uint8_t *) &core->mac[RSSRK]);
+    return net_rx_pkt_calc_rss_hash(pkt, type, &core->rss_toeplitz);
 }
 
 static void
@@ -36,6 +36,8 @@
 #ifndef HW_NET_E1000E_CORE_H
 #define HW_NET_E1000E_CORE_H
 
+#include "net/toeplitz.h"
+
 #define E1000E_PHY_PAGE_SIZE    (0x20)
 #define E1000E_PHY_PAGES        (0x07)
 #define E1000E_MAC_SIZE         (0x8000)
@@ -80,6 +82,7 @@ struct E1000Core {
     } tx[E1000E_NUM_QUEUES];
 
     struct NetRxPkt *rx_pkt;
+    NetToeplitz rss_toeplitz;
 
     bool has_vnet;
     int max_queue_num;
@@ -324,12 +324,11 @@ _net_rx_rss_prepare_udp(uint8_t *rss_input,
 uint32_t
 net_rx_pkt_calc_rss_hash(struct NetRxPkt *pkt,
                          NetRxPktRssType type,
-                         uint8_t *key)
+                         const NetToeplitz *toeplitz)
 {
-    uint8_t rss_input[36];
+    uint8_t rss_input[NET_TOEPLITZ_MAX_INPUT];
     size_t rss_length = 0;
-    uint32_t rss_hash = 0;
-    net_toeplitz_key key_data;
+    uint32_t rss_hash;
 
     switch (type) {
     case NetPktRssIpV4:
@@ -394,8 +393,7 @@ net_rx_pkt_calc_rss_hash(struct NetRxPkt *pkt,
         break;
     }
 
-    net_toeplitz_key_init(&key_data, key);
-    net_toeplitz_add(&rss_hash, rss_input, rss_length, &key_data);
+    rss_hash = net_toeplitz_hash(toeplitz, rss_input, rss_length);
 
     trace_net_rx_pkt_rss_hash(rss_length, rss_hash);
 
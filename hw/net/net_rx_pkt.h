@@ -19,6 +19,7 @@
 #define NET_RX_PKT_H
 
 #include "net/eth.h"
+#include "net/toeplitz.h"
 
 /* defines to enable packet dump functions */
 /*#define NET_RX_PKT_DEBUG*/
@@ -145,6 +146,7 @@ typedef enum {
 *
 * @pkt:            packet
 * @type:           RSS hash type
+* @toeplitz:       hash state prepared with the device's RSS key
 *
 * Return:  Toeplitz RSS hash.
 *
@@ -152,7 +154,7 @@ typedef enum {
 uint32_t
 net_rx_pkt_calc_rss_hash(struct NetRxPkt *pkt,
                          NetRxPktRssType type,
-                         uint8_t *key);
+                         const NetToeplitz *toeplitz);
 
 /**
 * fetches IP identification for the packet
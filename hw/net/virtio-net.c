@@ -13,6 +13,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/atomic.h"
+#include "block/aio-wait.h"
 #include "qemu/iov.h"
 #include "qemu/log.h"
 #include "qemu/main-loop.h"
@@ -353,11 +354,98 @@ static void virtio_net_vnet_endian_status(VirtIONet *n, uint8_t status)
     }
 }
 
+/*
+ * Queues serviced by an IOThread raise interrupts through their guest
+ * notifier since they run without the QEMU global mutex.
+ */
+static void virtio_net_notify_queue(VirtIONet *n, VirtQueue *vq)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+
+    if (n->dataplane_started) {
+        virtio_notify_irqfd(vdev, vq);
+    } else {
+        virtio_notify(vdev, vq);
+    }
+}
+
+static void virtio_net_queue_acquire(VirtIONetQueue *q)
+{
+    if (q->ctx) {
+        aio_context_acquire(q->ctx);
+    }
+}
+
+static void virtio_net_queue_release(VirtIONetQueue *q)
+{
+    if (q->ctx) {
+        aio_context_release(q->ctx);
+    }
+}
+
+/*
+ * Software RSS reads rss_data in the IOThreads that receive packets, so
+ * keep them out while the guest reconfigures it.
+ *
+ * Context: QEMU global mutex held
+ */
+static void virtio_net_acquire_queues(VirtIONet *n)
+{
+    int i;
+
+    for (i = 0; i < n->max_queue_pairs; i++) {
+        virtio_net_queue_acquire(&n->vqs[i]);
+    }
+}
+
+static void virtio_net_release_queues(VirtIONet *n)
+{
+    int i;
+
+    for (i = n->max_queue_pairs - 1; i >= 0; i--) {
+        virtio_net_queue_release(&n->vqs[i]);
+    }
+}
+
 static void virtio_net_drop_tx_queue_data(VirtIODevice *vdev, VirtQueue *vq)
 {
     unsigned int dropped = virtqueue_drop_all(vq);
     if (dropped) {
-        virtio_notify(vdev, vq);
+        virtio_net_notify_queue(VIRTIO_NET(vdev), vq);
+    }
+}
+
+static void virtio_net_queue_set_tx_status(VirtIONetQueue *q,
+                                           uint8_t queue_status,
+                                           bool queue_started)
+{
+    VirtIONet *n = q->n;
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+
+    if (queue_started) {
+        if (q->tx_timer) {
+            timer_mod(q->tx_timer,
+                      qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + n->tx_timeout);
+        } else {
+            qemu_bh_schedule(q->tx_bh);
+        }
+    } else {
+        if (q->tx_timer) {
+            timer_del(q->tx_timer);
+        } else {
+            qemu_bh_cancel(q->tx_bh);
+        }
+        if ((n->status & VIRTIO_NET_S_LINK_UP) == 0 &&
+            (queue_status & VIRTIO_CONFIG_S_DRIVER_OK) &&
+            vdev->vm_running) {
+            /*
+             * if tx is waiting we are likely have some packets in tx queue
+             * and disabled notification
+             */
+            q->tx_waiting = 0;
+            virtio_queue_set_notification(q->tx_vq, 1);
+            virtio_net_drop_tx_queue_data(vdev, q->tx_vq);
+        }
     }
 }
 
@@ -384,37 +472,15 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
         queue_started =
             virtio_net_started(n, queue_status) && !n->vhost_started;
 
+        /* The TX timer/BH and the backend may run in q->ctx */
+        virtio_net_queue_acquire(q);
         if (queue_started) {
             qemu_flush_queued_packets(ncs);
         }
-
-        if (!q->tx_waiting) {
-            continue;
-        }
-
-        if (queue_started) {
-            if (q->tx_timer) {
-                timer_mod(q->tx_timer,
-                               qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + n->tx_timeout);
-            } else {
-                qemu_bh_schedule(q->tx_bh);
-            }
-        } else {
-            if (q->tx_timer) {
-                timer_del(q->tx_timer);
-            } else {
-                qemu_bh_cancel(q->tx_bh);
-            }
-            if ((n->status & VIRTIO_NET_S_LINK_UP) == 0 &&
-                (queue_status & VIRTIO_CONFIG_S_DRIVER_OK) &&
-                vdev->vm_running) {
-                /* if tx is waiting we are likely have some packets in tx queue
-                 * and disabled notification */
-                q->tx_waiting = 0;
-                virtio_queue_set_notification(q->tx_vq, 1);
-                virtio_net_drop_tx_queue_data(vdev, q->tx_vq);
-            }
+        if (q->tx_waiting) {
+            virtio_net_queue_set_tx_status(q, queue_status, queue_started);
         }
+        virtio_net_queue_release(q);
     }
 }
 
@@ -1345,6 +1411,7 @@ static uint16_t virtio_net_handle_rss(VirtIONet *n,
         err_value = (uint32_t)s;
         goto error;
     }
+    net_toeplitz_set_key(&n->rss_toeplitz, n->rss_data.key);
     n->rss_data.enabled = true;
 
     if (!n->rss_data.populate_hash) {
@@ -1375,8 +1442,8 @@ error:
     return 0;
 }
 
-static int virtio_net_handle_mq(VirtIONet *n, uint8_t cmd,
-                                struct iovec *iov, unsigned int iov_cnt)
+static int virtio_net_do_handle_mq(VirtIONet *n, uint8_t cmd,
+                                   struct iovec *iov, unsigned int iov_cnt)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
     uint16_t queue_pairs;
@@ -1433,6 +1500,17 @@ static int virtio_net_handle_mq(VirtIONet *n, uint8_t cmd,
     return VIRTIO_NET_OK;
 }
 
+static int virtio_net_handle_mq(VirtIONet *n, uint8_t cmd,
+                                struct iovec *iov, unsigned int iov_cnt)
+{
+    int ret;
+
+    virtio_net_acquire_queues(n);
+    ret = virtio_net_do_handle_mq(n, cmd, iov, iov_cnt);
+    virtio_net_release_queues(n);
+    return ret;
+}
+
 size_t virtio_net_handle_ctrl_iov(VirtIODevice *vdev,
                                   const struct iovec *in_sg, unsigned in_num,
                                   const struct iovec *out_sg,
@@ -1476,8 +1554,28 @@ size_t virtio_net_handle_ctrl_iov(VirtIODevice *vdev,
     return sizeof(status);
 }
 
+/* Serialize with the IOThreads that service the data queues */
+static void virtio_net_iothreads_acquire(VirtIONet *n)
+{
+    unsigned i;
+
+    for (i = 0; i < n->num_iothreads; i++) {
+        aio_context_acquire(iothread_get_aio_context(n->iothreads[i]));
+    }
+}
+
+static void virtio_net_iothreads_release(VirtIONet *n)
+{
+    unsigned i;
+
+    for (i = 0; i < n->num_iothreads; i++) {
+        aio_context_release(iothread_get_aio_context(n->iothreads[i]));
+    }
+}
+
 static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
 {
+    VirtIONet *n = VIRTIO_NET(vdev);
     VirtQueueElement *elem;
 
     for (;;) {
@@ -1487,8 +1585,10 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
             break;
         }
 
+        virtio_net_iothreads_acquire(n);
         written = virtio_net_handle_ctrl_iov(vdev, elem->in_sg, elem->in_num,
                                              elem->out_sg, elem->out_num);
+        virtio_net_iothreads_release(n);
         if (written > 0) {
             virtqueue_push(vq, elem, written);
             virtio_notify(vdev, vq);
@@ -1507,8 +1607,11 @@ static void virtio_net_handle_rx(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     int queue_index = vq2q(virtio_get_queue_index(vq));
+    VirtIONetQueue *q = &n->vqs[queue_index];
 
+    virtio_net_queue_acquire(q);
     qemu_flush_queued_packets(qemu_get_subqueue(n->nic, queue_index));
+    virtio_net_queue_release(q);
 }
 
 static bool virtio_net_can_receive(NetClientState *nc)
@@ -1714,8 +1817,9 @@ static int virtio_net_process_rss(NetClientState *nc, const uint8_t *buf,
                                   size_t size)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
     unsigned int index = nc->queue_index, new_index = index;
-    struct NetRxPkt *pkt = n->rx_pkt;
+    struct NetRxPkt *pkt = q->rx_pkt ? q->rx_pkt : n->rx_pkt;
     uint8_t net_hash_type;
     uint32_t hash;
     bool isip4, isip6, isudp, istcp;
@@ -1749,7 +1853,7 @@ static int virtio_net_process_rss(NetClientState *nc, const uint8_t *buf,
         return n->rss_data.redirect ? n->rss_data.default_queue : -1;
     }
 
-    hash = net_rx_pkt_calc_rss_hash(pkt, net_hash_type, n->rss_data.key);
+    hash = net_rx_pkt_calc_rss_hash(pkt, net_hash_type, &n->rss_toeplitz);
 
     if (n->rss_data.populate_hash) {
         virtio_set_packet_hash(buf, reports[net_hash_type], hash);
@@ -1763,6 +1867,73 @@ static int virtio_net_process_rss(NetClientState *nc, const uint8_t *buf,
     return (index == new_index) ? -1 : new_index;
 }
 
+/* Make the buffers filled since the last flush visible to the guest */
+static void virtio_net_rx_flush(VirtIONet *n, VirtIONetQueue *q)
+{
+    if (q->rx_pending) {
+        virtqueue_flush(q->rx_vq, q->rx_pending);
+        q->rx_pending = 0;
+        virtio_net_notify_queue(n, q->rx_vq);
+    }
+}
+
+/* Packets that may wait to be steered to a queue of another IOThread */
+#define VIRTIO_NET_RX_STEERED_MAX 256
+
+typedef struct VirtIONetSteeredPacket {
+    NetClientState *nc;
+    size_t size;
+    uint8_t buf[];
+} VirtIONetSteeredPacket;
+
+static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
+                                      size_t size, bool no_rss);
+
+static void virtio_net_steered_bh(void *opaque)
+{
+    VirtIONetSteeredPacket *pkt = opaque;
+    VirtIONetQueue *q = virtio_net_get_subqueue(pkt->nc);
+
+    aio_context_acquire(q->ctx);
+    WITH_RCU_READ_LOCK_GUARD() {
+        /* Like a full ring on real hardware, a full queue drops it */
+        virtio_net_receive_rcu(pkt->nc, pkt->buf, pkt->size, true);
+    }
+    aio_context_release(q->ctx);
+
+    qatomic_dec(&q->rx_steered);
+    aio_wait_kick();
+    g_free(pkt);
+}
+
+/*
+ * Software RSS picked queue @index for a packet received on @q.  Queues
+ * serviced by the same thread take it at once; otherwise it is copied and
+ * delivered by a bottom half in the IOThread of the other queue.
+ */
+static ssize_t virtio_net_steer(VirtIONet *n, VirtIONetQueue *q, int index,
+                                const uint8_t *buf, size_t size)
+{
+    NetClientState *nc2 = qemu_get_subqueue(n->nic, index);
+    VirtIONetQueue *q2 = &n->vqs[index];
+    VirtIONetSteeredPacket *pkt;
+
+    if (!n->dataplane_started || q2->ctx == q->ctx) {
+        return virtio_net_receive_rcu(nc2, buf, size, true);
+    }
+
+    if (qatomic_fetch_inc(&q2->rx_steered) >= VIRTIO_NET_RX_STEERED_MAX) {
+        qatomic_dec(&q2->rx_steered);
+        return size;
+    }
+    pkt = g_malloc(sizeof(*pkt) + size);
+    pkt->nc = nc2;
+    pkt->size = size;
+    memcpy(pkt->buf, buf, size);
+    aio_bh_schedule_oneshot(q2->ctx, virtio_net_steered_bh, pkt);
+    return size;
+}
+
 static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
                                       size_t size, bool no_rss)
 {
@@ -1784,8 +1955,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
     if (!no_rss && n->rss_data.enabled && n->rss_data.enabled_software_rss) {
         int index = virtio_net_process_rss(nc, buf, size);
         if (index >= 0) {
-            NetClientState *nc2 = qemu_get_subqueue(n->nic, index);
-            return virtio_net_receive_rcu(nc2, buf, size, true);
+            return virtio_net_steer(n, q, index, buf, size);
         }
     }
 
@@ -1888,12 +2058,14 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
 
     for (j = 0; j < i; j++) {
         /* signal other side */
-        virtqueue_fill(q->rx_vq, elems[j], lens[j], j);
+        virtqueue_fill(q->rx_vq, elems[j], lens[j], q->rx_pending + j);
         g_free(elems[j]);
     }
 
-    virtqueue_flush(q->rx_vq, i);
-    virtio_notify(vdev, q->rx_vq);
+    q->rx_pending += i;
+    if (!q->rx_plugged && !(n->rx_plugged && !n->dataplane_started)) {
+        virtio_net_rx_flush(n, q);
+    }
 
     return size;
 
@@ -2518,32 +2690,173 @@ static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf,
     }
 }
 
+/*
+ * While the peer delivers a burst, used buffers are published and the guest
+ * is notified once per queue at the end instead of once per packet.  In the
+ * main loop software RSS can steer any packet of the burst to any queue, so
+ * every queue is held back until the last plugged queue is unplugged; with
+ * IOThreads only the plugged queue is held back, and packets steered to
+ * other queues are published at once.
+ */
+static void virtio_net_io_plug(NetClientState *nc)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+
+    if (q->rx_plugged++ == 0 && !n->dataplane_started) {
+        q->rx_plugged_device = true;
+        n->rx_plugged++;
+    }
+}
+
+static void virtio_net_io_unplug(NetClientState *nc)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+    int i;
+
+    assert(q->rx_plugged > 0);
+    if (--q->rx_plugged) {
+        return;
+    }
+
+    RCU_READ_LOCK_GUARD();
+
+    if (!q->rx_plugged_device) {
+        virtio_net_rx_flush(n, q);
+        return;
+    }
+
+    q->rx_plugged_device = false;
+    if (--n->rx_plugged == 0) {
+        for (i = 0; i < n->max_queue_pairs; i++) {
+            virtio_net_rx_flush(n, &n->vqs[i]);
+        }
+    }
+}
+
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q);
 
 static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
     VirtIONetQueue *q = virtio_net_get_subqueue(nc);
-    VirtIODevice *vdev = VIRTIO_DEVICE(n);
 
     virtqueue_push(q->tx_vq, q->async_tx.elem, 0);
-    virtio_notify(vdev, q->tx_vq);
+    virtio_net_notify_queue(n, q->tx_vq);
 
-    g_free(q->async_tx.elem);
+    virtqueue_element_free(q->async_tx.elem);
     q->async_tx.elem = NULL;
 
     virtio_queue_set_notification(q->tx_vq, 1);
     virtio_net_flush_tx(q);
 }
 
+/* Number of transmitted elements popped and completed together */
+#define VIRTIO_NET_TX_BATCH 64
+
+static void virtio_net_tx_push_batch(VirtIONetQueue *q,
+                                     VirtQueueElement **elems,
+                                     unsigned int num)
+{
+    unsigned int i;
+
+    if (!num) {
+        return;
+    }
+
+    /* Nothing is written to transmitted buffers */
+    virtqueue_push_batch(q->tx_vq, elems, NULL, num);
+    virtio_net_notify_queue(q->n, q->tx_vq);
+    for (i = 0; i < num; i++) {
+        virtqueue_element_free(elems[i]);
+    }
+}
+
+/*
+ * Send the packet in @elem.  Returns 0 if @elem can be completed, -EBUSY if
+ * the backend queued the packet and virtio_net_tx_complete() will complete
+ * it, or -EINVAL if the device is broken; @elem is then detached and freed.
+ * A byte-swapped header is built in @mhdr, which like the buffers of @elem
+ * must stay valid until the peer is unplugged.
+ */
+static int virtio_net_tx_one(VirtIONetQueue *q, VirtQueueElement *elem,
+                             struct virtio_net_hdr_mrg_rxbuf *mhdr)
+{
+    VirtIONet *n = q->n;
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
+    ssize_t ret;
+    unsigned int out_num;
+    struct iovec sg[VIRTQUEUE_MAX_SIZE], sg2[VIRTQUEUE_MAX_SIZE + 1], *out_sg;
+
+    out_num = elem->out_num;
+    out_sg = elem->out_sg;
+    if (out_num < 1) {
+        virtio_error(vdev, "virtio-net header not in first element");
+        virtqueue_detach_element(q->tx_vq, elem, 0);
+        virtqueue_element_free(elem);
+        return -EINVAL;
+    }
+
+    if (n->has_vnet_hdr) {
+        if (iov_to_buf(out_sg, out_num, 0, mhdr, n->guest_hdr_len) <
+            n->guest_hdr_len) {
+            virtio_error(vdev, "virtio-net header incorrect");
+            virtqueue_detach_element(q->tx_vq, elem, 0);
+            virtqueue_element_free(elem);
+            return -EINVAL;
+        }
+        if (n->needs_vnet_hdr_swap) {
+            virtio_net_hdr_swap(vdev, (void *) mhdr);
+            sg2[0].iov_base = mhdr;
+            sg2[0].iov_len = n->guest_hdr_len;
+            out_num = iov_copy(&sg2[1], ARRAY_SIZE(sg2) - 1,
+                               out_sg, out_num,
+                               n->guest_hdr_len, -1);
+            if (out_num == VIRTQUEUE_MAX_SIZE) {
+                /* Drop the packet */
+                return 0;
+            }
+            out_num += 1;
+            out_sg = sg2;
+        }
+    }
+    /*
+     * If host wants to see the guest header as is, we can
+     * pass it on unchanged. Otherwise, copy just the parts
+     * that host is interested in.
+     */
+    assert(n->host_hdr_len <= n->guest_hdr_len);
+    if (n->host_hdr_len != n->guest_hdr_len) {
+        unsigned sg_num = iov_copy(sg, ARRAY_SIZE(sg),
+                                   out_sg, out_num,
+                                   0, n->host_hdr_len);
+        sg_num += iov_copy(sg + sg_num, ARRAY_SIZE(sg) - sg_num,
+                         out_sg, out_num,
+                         n->guest_hdr_len, -1);
+        out_num = sg_num;
+        out_sg = sg;
+    }
+
+    ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
+                                  out_sg, out_num, virtio_net_tx_complete);
+    return ret == 0 ? -EBUSY : 0;
+}
+
 /* TX */
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 {
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
-    VirtQueueElement *elem;
-    int32_t num_packets = 0;
     int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
+    NetClientState *nc = qemu_get_subqueue(n->nic, queue_index);
+    VirtQueueElement *elems[VIRTIO_NET_TX_BATCH];
+    struct virtio_net_hdr_mrg_rxbuf mhdrs[VIRTIO_NET_TX_BATCH];
+    unsigned int i, want, num;
+    int32_t num_packets = 0;
+    int ret = 0;
+
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
         return num_packets;
     }
@@ -2553,86 +2866,52 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
         return num_packets;
     }
 
-    for (;;) {
-        ssize_t ret;
-        unsigned int out_num;
-        struct iovec sg[VIRTQUEUE_MAX_SIZE], sg2[VIRTQUEUE_MAX_SIZE + 1], *out_sg;
-        struct virtio_net_hdr_mrg_rxbuf mhdr;
+    do {
+        want = MIN(VIRTIO_NET_TX_BATCH, n->tx_burst - num_packets);
+        num = virtqueue_pop_batch(q->tx_vq, sizeof(VirtQueueElement),
+                                  (void **)elems, want);
 
-        elem = virtqueue_pop(q->tx_vq, sizeof(VirtQueueElement));
-        if (!elem) {
-            break;
+        /*
+         * Let the backend batch the packets, e.g. into a single system call.
+         * It may refer to the buffers until it is unplugged, so the
+         * elements are completed only afterwards.
+         */
+        qemu_net_io_plug(nc);
+        for (i = 0; i < num; i++) {
+            ret = virtio_net_tx_one(q, elems[i], &mhdrs[i]);
+            if (ret) {
+                break;
+            }
         }
+        qemu_net_io_unplug(nc);
 
-        out_num = elem->out_num;
-        out_sg = elem->out_sg;
-        if (out_num < 1) {
-            virtio_error(vdev, "virtio-net header not in first element");
-            virtqueue_detach_element(q->tx_vq, elem, 0);
-            g_free(elem);
-            return -EINVAL;
-        }
+        /* Do not hold back completions while a packet is in flight */
+        virtio_net_tx_push_batch(q, elems, i);
+        num_packets += i;
 
-        if (n->has_vnet_hdr) {
-            if (iov_to_buf(out_sg, out_num, 0, &mhdr, n->guest_hdr_len) <
-                n->guest_hdr_len) {
-                virtio_error(vdev, "virtio-net header incorrect");
-                virtqueue_detach_element(q->tx_vq, elem, 0);
-                g_free(elem);
-                return -EINVAL;
-            }
-            if (n->needs_vnet_hdr_swap) {
-                virtio_net_hdr_swap(vdev, (void *) &mhdr);
-                sg2[0].iov_base = &mhdr;
-                sg2[0].iov_len = n->guest_hdr_len;
-                out_num = iov_copy(&sg2[1], ARRAY_SIZE(sg2) - 1,
-                                   out_sg, out_num,
-                                   n->guest_hdr_len, -1);
-                if (out_num == VIRTQUEUE_MAX_SIZE) {
-                    goto drop;
-                }
-                out_num += 1;
-                out_sg = sg2;
-            }
-        }
-        /*
-         * If host wants to see the guest header as is, we can
-         * pass it on unchanged. Otherwise, copy just the parts
-         * that host is interested in.
-         */
-        assert(n->host_hdr_len <= n->guest_hdr_len);
-        if (n->host_hdr_len != n->guest_hdr_len) {
-            unsigned sg_num = iov_copy(sg, ARRAY_SIZE(sg),
-                                       out_sg, out_num,
-                                       0, n->host_hdr_len);
-            sg_num += iov_copy(sg + sg_num, ARRAY_SIZE(sg) - sg_num,
-                             out_sg, out_num,
-                             n->guest_hdr_len, -1);
-            out_num = sg_num;
-            out_sg = sg;
-        }
-
-        ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
-                                      out_sg, out_num, virtio_net_tx_complete);
-        if (ret == 0) {
+        if (ret == -EBUSY) {
+            q->async_tx.elem = elems[i];
             virtio_queue_set_notification(q->tx_vq, 0);
-            q->async_tx.elem = elem;
+            /* The rest is sent after the queued packet, pop it again then */
+            while (--num > i) {
+                virtqueue_unpop(q->tx_vq, elems[num], 0);
+                virtqueue_element_free(elems[num]);
+            }
             return -EBUSY;
+        } else if (ret == -EINVAL) {
+            while (++i < num) {
+                virtqueue_detach_element(q->tx_vq, elems[i], 0);
+                virtqueue_element_free(elems[i]);
+            }
+            return -EINVAL;
         }
+    } while (num == want && num_packets < n->tx_burst);
 
-drop:
-        virtqueue_push(q->tx_vq, elem, 0);
-        virtio_notify(vdev, q->tx_vq);
-        g_free(elem);
-
-        if (++num_packets >= n->tx_burst) {
-            break;
-        }
-    }
     return num_packets;
 }
 
-static void virtio_net_handle_tx_timer(VirtIODevice *vdev, VirtQueue *vq)
+static void virtio_net_handle_tx_timer_locked(VirtIODevice *vdev,
+                                              VirtQueue *vq)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     VirtIONetQueue *q = &n->vqs[vq2q(virtio_get_queue_index(vq))];
@@ -2663,7 +2942,17 @@ static void virtio_net_handle_tx_timer(VirtIODevice *vdev, VirtQueue *vq)
     }
 }
 
-static void virtio_net_handle_tx_bh(VirtIODevice *vdev, VirtQueue *vq)
+static void virtio_net_handle_tx_timer(VirtIODevice *vdev, VirtQueue *vq)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    VirtIONetQueue *q = &n->vqs[vq2q(virtio_get_queue_index(vq))];
+
+    virtio_net_queue_acquire(q);
+    virtio_net_handle_tx_timer_locked(vdev, vq);
+    virtio_net_queue_release(q);
+}
+
+static void virtio_net_handle_tx_bh_locked(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     VirtIONetQueue *q = &n->vqs[vq2q(virtio_get_queue_index(vq))];
@@ -2685,9 +2974,18 @@ static void virtio_net_handle_tx_bh(VirtIODevice *vdev, VirtQueue *vq)
     qemu_bh_schedule(q->tx_bh);
 }
 
-static void virtio_net_tx_timer(void *opaque)
+static void virtio_net_handle_tx_bh(VirtIODevice *vdev, VirtQueue *vq)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    VirtIONetQueue *q = &n->vqs[vq2q(virtio_get_queue_index(vq))];
+
+    virtio_net_queue_acquire(q);
+    virtio_net_handle_tx_bh_locked(vdev, vq);
+    virtio_net_queue_release(q);
+}
+
+static void virtio_net_tx_timer_locked(VirtIONetQueue *q)
 {
-    VirtIONetQueue *q = opaque;
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
     /* This happens when device was stopped but BH wasn't. */
@@ -2708,9 +3006,17 @@ static void virtio_net_tx_timer(void *opaque)
     virtio_net_flush_tx(q);
 }
 
-static void virtio_net_tx_bh(void *opaque)
+static void virtio_net_tx_timer(void *opaque)
 {
     VirtIONetQueue *q = opaque;
+
+    virtio_net_queue_acquire(q);
+    virtio_net_tx_timer_locked(q);
+    virtio_net_queue_release(q);
+}
+
+static void virtio_net_tx_bh_locked(VirtIONetQueue *q)
+{
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
     int32_t ret;
@@ -2757,6 +3063,266 @@ static void virtio_net_tx_bh(void *opaque)
     }
 }
 
+static void virtio_net_tx_bh(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+
+    virtio_net_queue_acquire(q);
+    virtio_net_tx_bh_locked(q);
+    virtio_net_queue_release(q);
+}
+
+/*
+ * Recreate the TX timer or BH in @ctx, or in the main loop if @ctx is NULL.
+ * The queue must not be processed concurrently.
+ */
+static void virtio_net_queue_move_tx(VirtIONetQueue *q, AioContext *ctx)
+{
+    VirtIONet *n = q->n;
+
+    if (q->tx_timer) {
+        timer_free(q->tx_timer);
+        if (ctx) {
+            q->tx_timer = aio_timer_new(ctx, QEMU_CLOCK_VIRTUAL, SCALE_NS,
+                                        virtio_net_tx_timer, q);
+        } else {
+            q->tx_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
+                                       virtio_net_tx_timer, q);
+        }
+        if (q->tx_waiting) {
+            timer_mod(q->tx_timer,
+                      qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + n->tx_timeout);
+        }
+    } else {
+        qemu_bh_delete(q->tx_bh);
+        if (ctx) {
+            q->tx_bh = aio_bh_new(ctx, virtio_net_tx_bh, q);
+        } else {
+            q->tx_bh = qemu_bh_new(virtio_net_tx_bh, q);
+        }
+        if (q->tx_waiting) {
+            qemu_bh_schedule(q->tx_bh);
+        }
+    }
+}
+
+/*
+ * Move the data queues of each queue pair, their TX timer or BH and the
+ * backend to the queue pair's IOThread.  Interrupts are then raised through
+ * irqfds, so the transport must support guest notifiers.
+ *
+ * Context: QEMU global mutex held, host notifiers assigned
+ */
+static void virtio_net_dataplane_start(VirtIONet *n)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int queue_pairs = n->multiqueue ? n->max_queue_pairs : 1;
+    int i, r;
+
+    if (!k->set_guest_notifiers) {
+        error_report("virtio-net: binding does not support guest notifiers, "
+                     "queues stay in the main loop");
+        return;
+    }
+
+    vdev->use_guest_notifier_mask = false;
+    r = k->set_guest_notifiers(qbus->parent, true,
+                               virtio_get_num_queues(vdev));
+    if (r != 0) {
+        vdev->use_guest_notifier_mask = true;
+        error_report("virtio-net: failed to set guest notifier (%d), "
+                     "queues stay in the main loop", r);
+        return;
+    }
+
+    n->dataplane_started = true;
+
+    for (i = 0; i < queue_pairs; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+        NetClientState *nc = qemu_get_subqueue(n->nic, i);
+
+        event_notifier_set_handler(virtio_queue_get_host_notifier(q->rx_vq),
+                                   NULL);
+        event_notifier_set_handler(virtio_queue_get_host_notifier(q->tx_vq),
+                                   NULL);
+
+        aio_context_acquire(q->ctx);
+        virtio_net_queue_move_tx(q, q->ctx);
+        qemu_set_net_aio_context(nc->peer, q->ctx);
+        virtio_queue_aio_attach_host_notifier(q->rx_vq, q->ctx);
+        virtio_queue_aio_attach_host_notifier(q->tx_vq, q->ctx);
+        aio_context_release(q->ctx);
+    }
+}
+
+/* Context: QEMU global mutex held, host notifiers assigned */
+static void virtio_net_dataplane_stop(VirtIONet *n)
+{
+    int queue_pairs = n->multiqueue ? n->max_queue_pairs : 1;
+    int i;
+
+    for (i = 0; i < queue_pairs; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+        NetClientState *nc = qemu_get_subqueue(n->nic, i);
+
+        aio_context_acquire(q->ctx);
+        virtio_queue_aio_detach_host_notifier(q->rx_vq, q->ctx);
+        virtio_queue_aio_detach_host_notifier(q->tx_vq, q->ctx);
+        qemu_set_net_aio_context(nc->peer, NULL);
+        virtio_net_queue_move_tx(q, NULL);
+        aio_context_release(q->ctx);
+    }
+
+    /* No more packets are steered now, deliver those on their way */
+    for (i = 0; i < queue_pairs; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+
+        aio_context_acquire(q->ctx);
+        AIO_WAIT_WHILE(q->ctx, qatomic_read(&q->rx_steered));
+        aio_context_release(q->ctx);
+    }
+
+    /*
+     * Guest notifiers stay assigned until the default implementation has
+     * processed the requests left in the host notifiers.
+     */
+}
+
+static int virtio_net_start_ioeventfd(VirtIODevice *vdev)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    int r;
+
+    r = virtio_device_start_ioeventfd_impl(vdev);
+    if (r < 0 || !n->num_iothreads) {
+        return r;
+    }
+
+    virtio_net_dataplane_start(n);
+    return 0;
+}
+
+static void virtio_net_stop_ioeventfd(VirtIODevice *vdev)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+
+    if (!n->dataplane_started) {
+        virtio_device_stop_ioeventfd_impl(vdev);
+        return;
+    }
+
+    virtio_net_dataplane_stop(n);
+    virtio_device_stop_ioeventfd_impl(vdev);
+
+    n->dataplane_started = false;
+    k->set_guest_notifiers(qbus->parent, false, virtio_get_num_queues(vdev));
+    vdev->use_guest_notifier_mask = true;
+}
+
+static bool virtio_net_parse_iothread_mapping(VirtIONet *n, Error **errp)
+{
+    g_auto(GStrv) ids = g_strsplit(n->net_conf.iothread_queue_mapping, ":",
+                                   -1);
+    unsigned num = g_strv_length(ids);
+    unsigned i, j;
+
+    if (num == 0) {
+        error_setg(errp, "iothread-queue-mapping must not be empty");
+        return false;
+    }
+
+    n->iothreads = g_new0(IOThread *, num);
+    for (i = 0; i < num; i++) {
+        IOThread *iothread = iothread_by_id(ids[i]);
+
+        if (!iothread) {
+            error_setg(errp, "IOThread \"%s\" not found", ids[i]);
+            return false;
+        }
+        for (j = 0; j < i; j++) {
+            if (n->iothreads[j] == iothread) {
+                error_setg(errp, "IOThread \"%s\" listed more than once in "
+                           "iothread-queue-mapping", ids[i]);
+                return false;
+            }
+        }
+
+        object_ref(OBJECT(iothread));
+        n->iothreads[i] = iothread;
+        n->num_iothreads++;
+    }
+    return true;
+}
+
+static void virtio_net_free_iothreads(VirtIONet *n)
+{
+    unsigned i;
+
+    for (i = 0; i < n->num_iothreads; i++) {
+        object_unref(OBJECT(n->iothreads[i]));
+    }
+    g_free(n->iothreads);
+    n->iothreads = NULL;
+    n->num_iothreads = 0;
+}
+
+/* Only tap backends without vhost can be serviced from an IOThread */
+static bool virtio_net_check_iothread_peers(VirtIONet *n, Error **errp)
+{
+    int i;
+
+    if (virtio_has_feature(n->host_features, VIRTIO_NET_F_RSC_EXT)) {
+        error_setg(errp, "iothread-queue-mapping is not supported with "
+                   "guest_rsc_ext");
+        return false;
+    }
+
+    for (i = 0; i < n->nic_conf.peers.queues; i++) {
+        NetClientState *peer = n->nic_conf.peers.ncs[i];
+
+        if (!peer->is_datapath) {
+            continue;
+        }
+        if (get_vhost_net(peer)) {
+            error_setg(errp, "iothread-queue-mapping is not supported with "
+                       "vhost backends");
+            return false;
+        }
+        if (!QTAILQ_EMPTY(&peer->filters)) {
+            error_setg(errp, "iothread-queue-mapping is not supported with "
+                       "netdev '%s' because it has filters", peer->name);
+            return false;
+        }
+        if (!qemu_can_set_net_aio_context(peer)) {
+            error_setg(errp, "netdev '%s' cannot be used with "
+                       "iothread-queue-mapping", peer->name);
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Filters would run in the IOThread without the QEMU global mutex, so
+ * refuse to add them to the backends for as long as the device exists.
+ */
+static void virtio_net_block_iothread_peer_filters(VirtIONet *n, bool block)
+{
+    int i;
+
+    for (i = 0; i < n->max_queue_pairs; i++) {
+        NetClientState *peer = qemu_get_subqueue(n->nic, i)->peer;
+
+        if (peer) {
+            peer->filters_blocked = block;
+        }
+    }
+}
+
 static void virtio_net_add_queue(VirtIONet *n, int index)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
@@ -2780,6 +3346,12 @@ static void virtio_net_add_queue(VirtIONet *n, int index)
 
     n->vqs[index].tx_waiting = 0;
     n->vqs[index].n = n;
+    if (n->num_iothreads) {
+        IOThread *iothread = n->iothreads[index % n->num_iothreads];
+
+        n->vqs[index].ctx = iothread_get_aio_context(iothread);
+        net_rx_pkt_init(&n->vqs[index].rx_pkt, false);
+    }
 }
 
 static void virtio_net_del_queue(VirtIONet *n, int index)
@@ -2800,6 +3372,10 @@ static void virtio_net_del_queue(VirtIONet *n, int index)
     }
     q->tx_waiting = 0;
     virtio_del_queue(vdev, index * 2 + 1);
+    if (q->rx_pkt) {
+        net_rx_pkt_uninit(q->rx_pkt);
+        q->rx_pkt = NULL;
+    }
 }
 
 static void virtio_net_change_num_queue_pairs(VirtIONet *n, int new_max_queue_pairs)
@@ -2908,6 +3484,7 @@ static int virtio_net_post_load_device(void *opaque, int version_id)
     }
 
     if (n->rss_data.enabled) {
+        net_toeplitz_set_key(&n->rss_toeplitz, n->rss_data.key);
         n->rss_data.enabled_software_rss = n->rss_data.populate_hash;
         if (!n->rss_data.populate_hash) {
             if (!virtio_net_attach_epbf_rss(n)) {
@@ -3191,6 +3768,8 @@ static NetClientInfo net_virtio_info = {
     .size = sizeof(NICState),
     .can_receive = virtio_net_can_receive,
     .receive = virtio_net_receive,
+    .io_plug = virtio_net_io_plug,
+    .io_unplug = virtio_net_io_unplug,
     .link_status_changed = virtio_net_set_link_status,
     .query_rx_filter = virtio_net_query_rxfilter,
     .announce = virtio_net_announce,
@@ -3200,6 +3779,14 @@ static bool virtio_net_guest_notifier_pending(VirtIODevice *vdev, int idx)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
     NetClientState *nc;
+
+    if (n->dataplane_started) {
+        EventNotifier *notifier =
+            virtio_queue_get_guest_notifier(virtio_get_queue(vdev, idx));
+
+        return event_notifier_test_and_clear(notifier);
+    }
+
     assert(n->vhost_started);
     if (!virtio_vdev_has_feature(vdev, VIRTIO_NET_F_MQ) && idx == 2) {
         /* Must guard against invalid features and bogus queue index
@@ -3500,6 +4087,15 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
         virtio_cleanup(vdev);
         return;
     }
+
+    if (n->net_conf.iothread_queue_mapping &&
+        (!virtio_net_check_iothread_peers(n, errp) ||
+         !virtio_net_parse_iothread_mapping(n, errp))) {
+        virtio_net_free_iothreads(n);
+        virtio_cleanup(vdev);
+        return;
+    }
+
     n->vqs = g_new0(VirtIONetQueue, n->max_queue_pairs);
     n->curr_queue_pairs = 1;
     n->tx_timeout = n->net_conf.txtimer;
@@ -3542,6 +4138,9 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
     for (i = 0; i < n->max_queue_pairs; i++) {
         n->nic->ncs[i].do_not_pad = true;
     }
+    if (n->num_iothreads) {
+        virtio_net_block_iothread_peer_filters(n, true);
+    }
 
     peer_test_vnet_hdr(n);
     if (peer_has_vnet_hdr(n)) {
@@ -3620,10 +4219,14 @@ static void virtio_net_device_unrealize(DeviceState *dev)
     virtio_del_queue(vdev, max_queue_pairs * 2);
     qemu_announce_timer_del(&n->announce_timer, false);
     g_free(n->vqs);
+    if (n->num_iothreads) {
+        virtio_net_block_iothread_peer_filters(n, false);
+    }
     qemu_del_nic(n->nic);
     virtio_net_rsc_cleanup(n);
     g_free(n->rss_data.indirections_table);
     net_rx_pkt_uninit(n->rx_pkt);
+    virtio_net_free_iothreads(n);
     virtio_cleanup(vdev);
 }
 
@@ -3760,6 +4363,8 @@ static Property virtio_net_properties[] = {
     DEFINE_PROP_INT32("speed", VirtIONet, net_conf.speed, SPEED_UNKNOWN),
     DEFINE_PROP_STRING("duplex", VirtIONet, net_conf.duplex_str),
     DEFINE_PROP_BOOL("failover", VirtIONet, failover, false),
+    DEFINE_PROP_STRING("iothread-queue-mapping", VirtIONet,
+                       net_conf.iothread_queue_mapping),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -3782,6 +4387,8 @@ static void virtio_net_class_init(ObjectClass *klass, void *data)
     vdc->set_status = virtio_net_set_status;
     vdc->guest_notifier_mask = virtio_net_guest_notifier_mask;
     vdc->guest_notifier_pending = virtio_net_guest_notifier_pending;
+    vdc->start_ioeventfd = virtio_net_start_ioeventfd;
+    vdc->stop_ioeventfd = virtio_net_stop_ioeventfd;
     vdc->legacy_features |= (0x1 << VIRTIO_NET_F_GSO);
     vdc->post_load = virtio_net_post_load_virtio;
     vdc->vmsd = &vmstate_virtio_net_device;
@@ -1975,17 +1975,11 @@ vmxnet3_rx_filter_may_indicate(VMXNET3State *s, const void *data,
 }
 
 static ssize_t
-vmxnet3_receive(NetClientState *nc, const uint8_t *buf, size_t size)
+vmxnet3_do_receive(VMXNET3State *s, const uint8_t *buf, size_t size)
 {
-    VMXNET3State *s = qemu_get_nic_opaque(nc);
     size_t bytes_indicated;
     uint8_t min_buf[MIN_BUF_SIZE];
 
-    if (!vmxnet3_can_receive(nc)) {
-        VMW_PKPRN("Cannot receive now");
-        return -1;
-    }
-
     if (s->peer_has_vhdr) {
         net_rx_pkt_set_vhdr(s->rx_pkt, (struct virtio_net_hdr *)buf);
         buf += sizeof(struct virtio_net_hdr);
@@ -2021,6 +2015,72 @@ vmxnet3_receive(NetClientState *nc, const uint8_t *buf, size_t size)
     return bytes_indicated;
 }
 
+/*
+ * A peer with a virtio-net header already hands us coalesced packets; for
+ * the others, merge TCP segments that arrive in one burst if the guest
+ * enabled LRO.
+ */
+static bool vmxnet3_rx_gro_enabled(VMXNET3State *s)
+{
+    return s->rx_plugged && s->lro_supported && !s->peer_has_vhdr;
+}
+
+static void vmxnet3_rx_gro_flush(void *opaque, const uint8_t *buf,
+                                 size_t size, unsigned segs, uint16_t mss)
+{
+    VMXNET3State *s = opaque;
+    struct UPT1_RxStats *stats = &s->rxq_descr[RXQ_IDX].rxq_stats;
+
+    /*
+     * The segments were accepted already, so like a real LRO engine
+     * running out of receive buffers we can only drop them here.  Count
+     * every segment in the guest-visible statistics; a failed indication
+     * has already counted one.
+     */
+    if (!vmxnet3_can_receive(qemu_get_queue(s->nic))) {
+        stats->pktsRxOutOfBuf += segs;
+    } else if (vmxnet3_do_receive(s, buf, size) < 0) {
+        stats->pktsRxOutOfBuf += segs - 1;
+    } else {
+        return;
+    }
+    VMW_PKPRN("RX: dropped %u coalesced segments (%zu bytes)", segs, size);
+}
+
+static ssize_t
+vmxnet3_receive(NetClientState *nc, const uint8_t *buf, size_t size)
+{
+    VMXNET3State *s = qemu_get_nic_opaque(nc);
+
+    if (!vmxnet3_can_receive(nc)) {
+        VMW_PKPRN("Cannot receive now");
+        return -1;
+    }
+
+    if (vmxnet3_rx_gro_enabled(s) && net_gro_receive(s->rx_gro, buf, size)) {
+        return size;
+    }
+
+    return vmxnet3_do_receive(s, buf, size);
+}
+
+static void vmxnet3_io_plug(NetClientState *nc)
+{
+    VMXNET3State *s = qemu_get_nic_opaque(nc);
+
+    s->rx_plugged++;
+}
+
+static void vmxnet3_io_unplug(NetClientState *nc)
+{
+    VMXNET3State *s = qemu_get_nic_opaque(nc);
+
+    assert(s->rx_plugged > 0);
+    if (--s->rx_plugged == 0) {
+        net_gro_flush(s->rx_gro);
+    }
+}
+
 static void vmxnet3_set_link_status(NetClientState *nc)
 {
     VMXNET3State *s = qemu_get_nic_opaque(nc);
@@ -2040,6 +2100,8 @@ static NetClientInfo net_vmxnet3_info = {
         .size = sizeof(NICState),
         .receive = vmxnet3_receive,
         .link_status_changed = vmxnet3_set_link_status,
+        .io_plug = vmxnet3_io_plug,
+        .io_unplug = vmxnet3_io_unplug,
 };
 
 static bool vmxnet3_peer_has_vnet_hdr(VMXNET3State *s)
@@ -2058,6 +2120,7 @@ static void vmxnet3_net_uninit(VMXNET3State *s)
     g_free(s->mcast_list);
     vmxnet3_deactivate_device(s);
     qemu_del_nic(s->nic);
+    net_gro_free(s->rx_gro);
 }
 
 static void vmxnet3_net_init(VMXNET3State *s)
@@ -2089,6 +2152,8 @@ static void vmxnet3_net_init(VMXNET3State *s)
     s->rx_pkt = NULL;
     s->rx_vlan_stripping = false;
     s->lro_supported = false;
+    s->rx_gro = net_gro_new(vmxnet3_rx_gro_flush, s);
+    s->rx_plugged = 0;
 
     if (s->peer_has_vhdr) {
         qemu_set_vnet_hdr_len(qemu_get_queue(s->nic)->peer,
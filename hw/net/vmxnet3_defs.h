@@ -18,6 +18,7 @@
 #define HW_NET_VMXNET3_DEFS_H
 
 #include "net/net.h"
+#include "net/gro.h"
 #include "hw/net/vmxnet3.h"
 #include "qom/object.h"
 
@@ -114,6 +115,10 @@ struct VMXNET3State {
 
         struct NetRxPkt *rx_pkt;
 
+        /* Software LRO for peers that cannot pass large packets */
+        NetGro *rx_gro;
+        unsigned rx_plugged;
+
         bool tx_sop;
         bool skip_current_tx_pkt;
 
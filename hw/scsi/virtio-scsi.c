@@ -19,6 +19,7 @@
 #include "hw/virtio/virtio-scsi.h"
 #include "migration/qemu-file-types.h"
 #include "qemu/error-report.h"
+#include "qemu/bitmap.h"
 #include "qemu/iov.h"
 #include "qemu/module.h"
 #include "sysemu/block-backend.h"
@@ -99,22 +100,85 @@ static void virtio_scsi_free_req(VirtIOSCSIReq *req)
 {
     qemu_iovec_destroy(&req->resp_iov);
     qemu_sglist_destroy(&req->qsgl);
-    g_free(req);
+    virtqueue_element_free(&req->elem);
 }
 
-static void virtio_scsi_complete_req(VirtIOSCSIReq *req)
+static void virtio_scsi_notify(VirtIOSCSI *s, VirtQueue *vq)
 {
-    VirtIOSCSI *s = req->dev;
-    VirtQueue *vq = req->vq;
     VirtIODevice *vdev = VIRTIO_DEVICE(s);
 
-    qemu_iovec_from_buf(&req->resp_iov, 0, &req->resp, req->resp_size);
-    virtqueue_push(vq, &req->elem, req->qsgl.size + req->resp_iov.size);
     if (s->dataplane_started && !s->dataplane_fenced) {
         virtio_notify_irqfd(vdev, vq);
     } else {
         virtio_notify(vdev, vq);
     }
+}
+
+/*
+ * Publish the command completions filled by virtio_scsi_complete_req() with
+ * one used index update and one notification per virtqueue.
+ */
+static void virtio_scsi_complete_bh(void *opaque)
+{
+    VirtIOSCSI *s = opaque;
+    VirtIOSCSICommon *vs = VIRTIO_SCSI_COMMON(s);
+    unsigned nvqs = vs->conf.num_queues;
+    g_autoptr(GPtrArray) blks = NULL;
+    unsigned i;
+
+    virtio_scsi_acquire(s);
+    for (i = find_first_bit(s->complete_vqs, nvqs); i < nvqs;
+         i = find_next_bit(s->complete_vqs, nvqs, i + 1)) {
+        clear_bit(i, s->complete_vqs);
+        if (virtqueue_flush_deferred(vs->cmd_vqs[i])) {
+            virtio_scsi_notify(s, vs->cmd_vqs[i]);
+        }
+    }
+    blks = g_steal_pointer(&s->complete_blks);
+    s->complete_blks = g_ptr_array_new();
+    virtio_scsi_release(s);
+
+    for (i = 0; i < blks->len; i++) {
+        blk_dec_in_flight(g_ptr_array_index(blks, i));
+    }
+}
+
+static void virtio_scsi_complete_req(VirtIOSCSIReq *req)
+{
+    VirtIOSCSI *s = req->dev;
+    VirtQueue *vq = req->vq;
+    unsigned int len;
+    int index = virtio_get_queue_index(vq) - VIRTIO_SCSI_VQ_NUM_FIXED;
+
+    qemu_iovec_from_buf(&req->resp_iov, 0, &req->resp, req->resp_size);
+    len = req->qsgl.size + req->resp_iov.size;
+
+    /*
+     * Completions of commands that reached a BlockBackend are batched; the
+     * bottom half is accounted as a request in flight on every BlockBackend
+     * with a completion in the batch, so that draining any of them also
+     * waits for it.
+     */
+    if (index >= 0 && req->sreq && req->sreq->dev->conf.blk) {
+        BlockBackend *blk = req->sreq->dev->conf.blk;
+
+        virtqueue_push_deferred(vq, &req->elem, len);
+        set_bit(index, s->complete_vqs);
+        if (!s->complete_blks->len) {
+            aio_bh_schedule_oneshot(qemu_get_current_aio_context(),
+                                    virtio_scsi_complete_bh, s);
+        }
+        if (!g_ptr_array_find(s->complete_blks, blk, NULL)) {
+            blk_inc_in_flight(blk);
+            g_ptr_array_add(s->complete_blks, blk);
+        }
+    } else {
+        if (index >= 0 && virtqueue_flush_deferred(vq)) {
+            clear_bit(index, s->complete_vqs);
+        }
+        virtqueue_push(vq, &req->elem, len);
+        virtio_scsi_notify(s, vq);
+    }
 
     if (req->sreq) {
         req->sreq->hba_private = NULL;
@@ -722,9 +786,15 @@ static void virtio_scsi_handle_cmd_req_submit(VirtIOSCSI *s, VirtIOSCSIReq *req)
     scsi_req_unref(sreq);
 }
 
+/* Number of command requests taken from a virtqueue at once */
+#define VIRTIO_SCSI_CMD_POP_BATCH 32
+
 static void virtio_scsi_handle_cmd_vq(VirtIOSCSI *s, VirtQueue *vq)
 {
+    VirtIOSCSICommon *vs = (VirtIOSCSICommon *)s;
+    VirtIOSCSIReq *batch[VIRTIO_SCSI_CMD_POP_BATCH];
     VirtIOSCSIReq *req, *next;
+    unsigned int i, n;
     int ret = 0;
     bool suppress_notifications = virtio_queue_get_notification(vq);
 
@@ -735,19 +805,32 @@ static void virtio_scsi_handle_cmd_vq(VirtIOSCSI *s, VirtQueue *vq)
             virtio_queue_set_notification(vq, 0);
         }
 
-        while ((req = virtio_scsi_pop_req(s, vq))) {
-            ret = virtio_scsi_handle_cmd_req_prepare(s, req);
-            if (!ret) {
-                QTAILQ_INSERT_TAIL(&reqs, req, next);
-            } else if (ret == -EINVAL) {
-                /* The device is broken and shouldn't process any request */
-                while (!QTAILQ_EMPTY(&reqs)) {
-                    req = QTAILQ_FIRST(&reqs);
-                    QTAILQ_REMOVE(&reqs, req, next);
-                    blk_io_unplug(req->sreq->dev->conf.blk);
-                    scsi_req_unref(req->sreq);
-                    virtqueue_detach_element(req->vq, &req->elem, 0);
-                    virtio_scsi_free_req(req);
+        while ((n = virtqueue_pop_batch(vq,
+                                        sizeof(VirtIOSCSIReq) + vs->cdb_size,
+                                        (void **)batch, ARRAY_SIZE(batch)))) {
+            for (i = 0; i < n; i++) {
+                req = batch[i];
+                if (ret == -EINVAL) {
+                    /* Not initialized yet, just give the element back */
+                    virtqueue_detach_element(vq, &req->elem, 0);
+                    virtqueue_element_free(&req->elem);
+                    continue;
+                }
+
+                virtio_scsi_init_req(s, vq, req);
+                ret = virtio_scsi_handle_cmd_req_prepare(s, req);
+                if (!ret) {
+                    QTAILQ_INSERT_TAIL(&reqs, req, next);
+                } else if (ret == -EINVAL) {
+                    /* The device is broken and shouldn't process any request */
+                    while (!QTAILQ_EMPTY(&reqs)) {
+                        req = QTAILQ_FIRST(&reqs);
+                        QTAILQ_REMOVE(&reqs, req, next);
+                        blk_io_unplug(req->sreq->dev->conf.blk);
+                        scsi_req_unref(req->sreq);
+                        virtqueue_detach_element(req->vq, &req->elem, 0);
+                        virtio_scsi_free_req(req);
+                    }
                 }
             }
         }
@@ -1058,6 +1141,8 @@ static void virtio_scsi_device_realize(DeviceState *dev, Error **errp)
         error_propagate(errp, err);
         return;
     }
+    s->complete_vqs = bitmap_new(VIRTIO_SCSI_COMMON(s)->conf.num_queues);
+    s->complete_blks = g_ptr_array_new();
 
     scsi_bus_init_named(&s->bus, sizeof(s->bus), dev,
                        &virtio_scsi_scsi_info, vdev->bus_name);
@@ -1087,6 +1172,10 @@ static void virtio_scsi_device_unrealize(DeviceState *dev)
     VirtIOSCSI *s = VIRTIO_SCSI(dev);
 
     qbus_set_hotplug_handler(BUS(&s->bus), NULL);
+    g_free(s->complete_vqs);
+    s->complete_vqs = NULL;
+    g_ptr_array_free(s->complete_blks, true);
+    s->complete_blks = NULL;
     virtio_scsi_common_unrealize(dev);
 }
 
@@ -28,6 +28,9 @@ struct VhostIOVATree {
 
     /* IOVA address to qemu memory maps. */
     IOVATree *iova_taddr_map;
+
+    /* Bumped whenever a mapping is added or removed */
+    uint64_t generation;
 };
 
 /**
@@ -37,7 +40,7 @@ struct VhostIOVATree {
  */
 VhostIOVATree *vhost_iova_tree_new(hwaddr iova_first, hwaddr iova_last)
 {
-    VhostIOVATree *tree = g_new(VhostIOVATree, 1);
+    VhostIOVATree *tree = g_new0(VhostIOVATree, 1);
 
     /* Some devices do not like 0 addresses */
     tree->iova_first = MAX(iova_first, iova_min_addr);
@@ -70,6 +73,19 @@ const DMAMap *vhost_iova_tree_find_iova(const VhostIOVATree *tree,
     return iova_tree_find_iova(tree->iova_taddr_map, map);
 }
 
+/**
+ * Get the generation of the tree
+ *
+ * @tree: The iova tree
+ *
+ * The generation changes every time a mapping is added or removed, so
+ * that users can tell whether copies of mappings they keep are stale.
+ */
+uint64_t vhost_iova_tree_generation(const VhostIOVATree *tree)
+{
+    return tree->generation;
+}
+
 /**
  * Allocate a new mapping
  *
@@ -94,6 +110,7 @@ int vhost_iova_tree_map_alloc(VhostIOVATree *tree, DMAMap *map)
     }
 
     /* Allocate a node in IOVA address */
+    tree->generation++;
     return iova_tree_alloc_map(tree->iova_taddr_map, map, iova_first,
                                tree->iova_last);
 }
@@ -106,5 +123,6 @@ int vhost_iova_tree_map_alloc(VhostIOVATree *tree, DMAMap *map)
  */
 void vhost_iova_tree_remove(VhostIOVATree *iova_tree, const DMAMap *map)
 {
+    iova_tree->generation++;
     iova_tree_remove(iova_tree->iova_taddr_map, map);
 }
@@ -33,6 +33,7 @@ bool vhost_svq_valid_features(uint64_t features, Error **errp)
          ++b) {
         switch (b) {
         case VIRTIO_F_ANY_LAYOUT:
+        case VIRTIO_RING_F_EVENT_IDX:
             continue;
 
         case VIRTIO_F_ACCESS_PLATFORM:
@@ -70,6 +71,49 @@ static uint16_t vhost_svq_available_slots(const VhostShadowVirtqueue *svq)
     return svq->vring.num - (svq->shadow_avail_idx - svq->shadow_used_idx);
 }
 
+/**
+ * Find the IOVA mapping of a qemu's virtual address
+ *
+ * @svq: Shadow VirtQueue
+ * @needle: The qemu's VA to look up
+ *
+ * Guest buffers come from a handful of memory regions, so the mappings used
+ * last are tried before walking the IOVA tree.
+ */
+static const DMAMap *vhost_svq_find_iova(VhostShadowVirtqueue *svq,
+                                         const DMAMap *needle)
+{
+    uint64_t gen = vhost_iova_tree_generation(svq->iova_tree);
+    const DMAMap *map;
+    DMAMap *slot;
+
+    if (unlikely(svq->iova_cache_gen != gen)) {
+        svq->iova_cache_used = 0;
+        svq->iova_cache_gen = gen;
+    }
+
+    for (unsigned i = 0; i < svq->iova_cache_used; ++i) {
+        map = &svq->iova_cache[i];
+        if (needle->translated_addr >= map->translated_addr &&
+            needle->translated_addr - map->translated_addr <= map->size) {
+            return map;
+        }
+    }
+
+    map = vhost_iova_tree_find_iova(svq->iova_tree, needle);
+    if (unlikely(!map)) {
+        return NULL;
+    }
+
+    slot = &svq->iova_cache[svq->iova_cache_next];
+    *slot = *map;
+    svq->iova_cache_next = (svq->iova_cache_next + 1) %
+                           VHOST_SVQ_IOVA_CACHE_SIZE;
+    svq->iova_cache_used = MIN(svq->iova_cache_used + 1,
+                               VHOST_SVQ_IOVA_CACHE_SIZE);
+    return slot;
+}
+
 /**
  * Translate addresses between the qemu's virtual address and the SVQ IOVA
  *
@@ -78,7 +122,7 @@ static uint16_t vhost_svq_available_slots(const VhostShadowVirtqueue *svq)
  * @iovec: Source qemu's VA addresses
  * @num: Length of iovec and minimum length of vaddr
  */
-static bool vhost_svq_translate_addr(const VhostShadowVirtqueue *svq,
+static bool vhost_svq_translate_addr(VhostShadowVirtqueue *svq,
                                      hwaddr *addrs, const struct iovec *iovec,
                                      size_t num)
 {
@@ -94,7 +138,7 @@ static bool vhost_svq_translate_addr(const VhostShadowVirtqueue *svq,
         Int128 needle_last, map_last;
         size_t off;
 
-        const DMAMap *map = vhost_iova_tree_find_iova(svq->iova_tree, &needle);
+        const DMAMap *map = vhost_svq_find_iova(svq, &needle);
         /*
          * Map cannot be NULL since iova map contains all guest space and
          * qemu already has a physical address mapped
@@ -179,7 +223,7 @@ static bool vhost_svq_add_split(VhostShadowVirtqueue *svq,
     unsigned avail_idx;
     vring_avail_t *avail = svq->vring.avail;
     bool ok;
-    g_autofree hwaddr *sgs = g_new(hwaddr, MAX(out_num, in_num));
+    hwaddr *sgs = svq->desc_iova;
 
     *head = svq->free_head;
 
@@ -203,44 +247,59 @@ static bool vhost_svq_add_split(VhostShadowVirtqueue *svq,
 
     /*
      * Put the entry in the available array (but don't update avail->idx until
-     * they do sync).
+     * vhost_svq_kick, so a batch of them is exposed at once).
      */
     avail_idx = svq->shadow_avail_idx & (svq->vring.num - 1);
     avail->ring[avail_idx] = cpu_to_le16(*head);
     svq->shadow_avail_idx++;
 
-    /* Update the avail index after write the descriptor */
-    smp_wmb();
-    avail->idx = cpu_to_le16(svq->shadow_avail_idx);
-
     return true;
 }
 
+/**
+ * Expose the descriptors added since the last call to the device, and
+ * notify it unless it asked not to be.
+ */
 static void vhost_svq_kick(VhostShadowVirtqueue *svq)
 {
+    uint16_t old = svq->kicked_avail_idx;
+    bool needs_kick;
+
+    if (svq->shadow_avail_idx == old) {
+        return;
+    }
+
+    /* Update the avail index after write the descriptor */
+    smp_wmb();
+    svq->vring.avail->idx = cpu_to_le16(svq->shadow_avail_idx);
+    svq->kicked_avail_idx = svq->shadow_avail_idx;
+
     /*
      * We need to expose the available array entries before checking the used
      * flags
      */
     smp_mb();
-    if (svq->vring.used->flags & VRING_USED_F_NO_NOTIFY) {
-        return;
+    if (svq->event_idx) {
+        uint16_t avail_event = le16_to_cpu(vring_avail_event(&svq->vring));
+
+        needs_kick = vring_need_event(avail_event, svq->shadow_avail_idx, old);
+    } else {
+        needs_kick = !(svq->vring.used->flags & VRING_USED_F_NO_NOTIFY);
     }
 
-    event_notifier_set(&svq->hdev_kick);
+    if (needs_kick) {
+        event_notifier_set(&svq->hdev_kick);
+    }
 }
 
-/**
- * Add an element to a SVQ.
- *
- * The caller must check that there is enough slots for the new element. It
- * takes ownership of the element: In case of failure not ENOSPC, it is free.
- *
- * Return -EINVAL if element is invalid, -ENOSPC if dev queue is full
+/*
+ * Add an element to the SVQ vring without exposing it to the device yet.
+ * Same contract as vhost_svq_add.
  */
-int vhost_svq_add(VhostShadowVirtqueue *svq, const struct iovec *out_sg,
-                  size_t out_num, const struct iovec *in_sg, size_t in_num,
-                  VirtQueueElement *elem)
+static int vhost_svq_add_avail(VhostShadowVirtqueue *svq,
+                               const struct iovec *out_sg, size_t out_num,
+                               const struct iovec *in_sg, size_t in_num,
+                               VirtQueueElement *elem)
 {
     unsigned qemu_head;
     unsigned ndescs = in_num + out_num;
@@ -258,16 +317,38 @@ int vhost_svq_add(VhostShadowVirtqueue *svq, const struct iovec *out_sg,
 
     svq->desc_state[qemu_head].elem = elem;
     svq->desc_state[qemu_head].ndescs = ndescs;
-    vhost_svq_kick(svq);
     return 0;
 }
 
-/* Convenience wrapper to add a guest's element to SVQ */
+/**
+ * Add an element to a SVQ.
+ *
+ * The caller must check that there is enough slots for the new element. It
+ * takes ownership of the element: In case of failure not ENOSPC, it is free.
+ *
+ * Return -EINVAL if element is invalid, -ENOSPC if dev queue is full
+ */
+int vhost_svq_add(VhostShadowVirtqueue *svq, const struct iovec *out_sg,
+                  size_t out_num, const struct iovec *in_sg, size_t in_num,
+                  VirtQueueElement *elem)
+{
+    int r = vhost_svq_add_avail(svq, out_sg, out_num, in_sg, in_num, elem);
+
+    if (likely(r == 0)) {
+        vhost_svq_kick(svq);
+    }
+    return r;
+}
+
+/*
+ * Convenience wrapper to add a guest's element to SVQ. The device is not
+ * notified until vhost_svq_kick.
+ */
 static int vhost_svq_add_element(VhostShadowVirtqueue *svq,
                                  VirtQueueElement *elem)
 {
-    return vhost_svq_add(svq, elem->out_sg, elem->out_num, elem->in_sg,
-                         elem->in_num, elem);
+    return vhost_svq_add_avail(svq, elem->out_sg, elem->out_num, elem->in_sg,
+                               elem->in_num, elem);
 }
 
 /**
@@ -282,6 +363,9 @@ static int vhost_svq_add_element(VhostShadowVirtqueue *svq,
  *
  * If that happens, guest's kick notifications will be disabled until the
  * device uses some buffers.
+ *
+ * The buffers are exposed to the device in batches, with one avail idx
+ * update and at most one notification for all the buffers popped in a row.
  */
 static void vhost_handle_guest_kick(VhostShadowVirtqueue *svq)
 {
@@ -328,10 +412,12 @@ static void vhost_handle_guest_kick(VhostShadowVirtqueue *svq)
                 }
 
                 /* VQ is full or broken, just return and ignore kicks */
+                vhost_svq_kick(svq);
                 return;
             }
         }
 
+        vhost_svq_kick(svq);
         virtio_queue_set_notification(svq->vq, true);
     } while (!virtio_queue_empty(svq->vq));
 }
@@ -371,7 +457,11 @@ static bool vhost_svq_more_used(VhostShadowVirtqueue *svq)
  */
 static bool vhost_svq_enable_notification(VhostShadowVirtqueue *svq)
 {
-    svq->vring.avail->flags &= ~cpu_to_le16(VRING_AVAIL_F_NO_INTERRUPT);
+    if (svq->event_idx) {
+        vring_used_event(&svq->vring) = cpu_to_le16(svq->last_used_idx);
+    } else {
+        svq->vring.avail->flags &= ~cpu_to_le16(VRING_AVAIL_F_NO_INTERRUPT);
+    }
     /* Make sure the flag is written before the read of used_idx */
     smp_mb();
     return !vhost_svq_more_used(svq);
@@ -379,7 +469,10 @@ static bool vhost_svq_enable_notification(VhostShadowVirtqueue *svq)
 
 static void vhost_svq_disable_notification(VhostShadowVirtqueue *svq)
 {
-    svq->vring.avail->flags |= cpu_to_le16(VRING_AVAIL_F_NO_INTERRUPT);
+    /* With event idx, the device calls only when it crosses used_event */
+    if (!svq->event_idx) {
+        svq->vring.avail->flags |= cpu_to_le16(VRING_AVAIL_F_NO_INTERRUPT);
+    }
 }
 
 static uint16_t vhost_svq_last_desc_of_chain(const VhostShadowVirtqueue *svq,
@@ -477,7 +570,9 @@ static void vhost_svq_flush(VhostShadowVirtqueue *svq,
         }
 
         virtqueue_flush(vq, i);
-        event_notifier_set(&svq->svq_call);
+        if (virtio_queue_should_notify(svq->vdev, vq)) {
+            event_notifier_set(&svq->svq_call);
+        }
 
         if (check_for_avail_queue && svq->next_guest_avail_elem) {
             /*
@@ -571,16 +666,19 @@ void vhost_svq_get_vring_addr(const VhostShadowVirtqueue *svq,
 size_t vhost_svq_driver_area_size(const VhostShadowVirtqueue *svq)
 {
     size_t desc_size = sizeof(vring_desc_t) * svq->vring.num;
+    /* Includes used_event */
     size_t avail_size = offsetof(vring_avail_t, ring) +
-                                             sizeof(uint16_t) * svq->vring.num;
+                                       sizeof(uint16_t) * (svq->vring.num + 1);
 
     return ROUND_UP(desc_size + avail_size, qemu_real_host_page_size());
 }
 
 size_t vhost_svq_device_area_size(const VhostShadowVirtqueue *svq)
 {
+    /* Includes avail_event */
     size_t used_size = offsetof(vring_used_t, ring) +
-                                    sizeof(vring_used_elem_t) * svq->vring.num;
+                                    sizeof(vring_used_elem_t) * svq->vring.num +
+                                    sizeof(uint16_t);
     return ROUND_UP(used_size, qemu_real_host_page_size());
 }
 
@@ -628,10 +726,13 @@ void vhost_svq_start(VhostShadowVirtqueue *svq, VirtIODevice *vdev,
 
     svq->next_guest_avail_elem = NULL;
     svq->shadow_avail_idx = 0;
+    svq->kicked_avail_idx = 0;
     svq->shadow_used_idx = 0;
     svq->last_used_idx = 0;
     svq->vdev = vdev;
     svq->vq = vq;
+    svq->event_idx = virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX);
+    svq->iova_cache_used = 0;
 
     svq->vring.num = virtio_queue_get_num(vdev, virtio_get_queue_index(vq));
     driver_size = vhost_svq_driver_area_size(svq);
@@ -644,6 +745,7 @@ void vhost_svq_start(VhostShadowVirtqueue *svq, VirtIODevice *vdev,
     memset(svq->vring.used, 0, device_size);
     svq->desc_state = g_new0(SVQDescState, svq->vring.num);
     svq->desc_next = g_new0(uint16_t, svq->vring.num);
+    svq->desc_iova = g_new(hwaddr, svq->vring.num);
     for (unsigned i = 0; i < svq->vring.num - 1; i++) {
         svq->desc_next[i] = cpu_to_le16(i + 1);
     }
@@ -679,6 +781,7 @@ void vhost_svq_stop(VhostShadowVirtqueue *svq)
     }
     svq->vq = NULL;
     g_free(svq->desc_next);
+    g_free(svq->desc_iova);
     g_free(svq->desc_state);
     qemu_vfree(svq->vring.desc);
     qemu_vfree(svq->vring.used);
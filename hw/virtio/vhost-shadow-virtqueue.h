@@ -27,6 +27,9 @@ typedef struct SVQDescState {
 
 typedef struct VhostShadowVirtqueue VhostShadowVirtqueue;
 
+/* Number of recently used IOVA mappings each SVQ keeps a copy of */
+#define VHOST_SVQ_IOVA_CACHE_SIZE 4
+
 /**
  * Callback to handle an avail buffer.
  *
@@ -78,6 +81,19 @@ typedef struct VhostShadowVirtqueue {
     /* IOVA mapping */
     VhostIOVATree *iova_tree;
 
+    /*
+     * Copies of the last IOVA mappings used to translate descriptors, so
+     * that most lookups do not walk iova_tree.  Valid while the tree is at
+     * generation iova_cache_gen.
+     */
+    DMAMap iova_cache[VHOST_SVQ_IOVA_CACHE_SIZE];
+    unsigned int iova_cache_used;
+    unsigned int iova_cache_next;
+    uint64_t iova_cache_gen;
+
+    /* Scratch space for the IOVA of each descriptor of an element */
+    hwaddr *desc_iova;
+
     /* SVQ vring descriptors state */
     SVQDescState *desc_state;
 
@@ -99,6 +115,12 @@ typedef struct VhostShadowVirtqueue {
     /* Next head to expose to the device */
     uint16_t shadow_avail_idx;
 
+    /* Avail idx the last time the device was considered for a kick */
+    uint16_t kicked_avail_idx;
+
+    /* The device negotiated VIRTIO_RING_F_EVENT_IDX */
+    bool event_idx;
+
     /* Next free descriptor */
     uint16_t free_head;
 
@@ -664,27 +664,28 @@ static void scrub_shadow_regions(struct vhost_dev *dev,
         for (j = 0; j < dev->mem->nregions; j++) {
             reg = &dev->mem->regions[j];
 
-            mr = vhost_user_get_mr_data(reg->userspace_addr, &offset, &fd);
-
-            if (reg_equal(shadow_reg, reg)) {
-                matching = true;
-                found[j] = true;
-                if (track_ramblocks) {
-                    /*
-                     * Reset postcopy client bases, region_rb, and
-                     * region_rb_offset in case regions are removed.
-                     */
-                    if (fd > 0) {
-                        u->region_rb_offset[j] = offset;
-                        u->region_rb[j] = mr->ram_block;
-                        shadow_pcb[j] = u->postcopy_client_bases[i];
-                    } else {
-                        u->region_rb_offset[j] = 0;
-                        u->region_rb[j] = NULL;
-                    }
+            if (found[j] || !reg_equal(shadow_reg, reg)) {
+                continue;
+            }
+
+            matching = true;
+            found[j] = true;
+            if (track_ramblocks) {
+                mr = vhost_user_get_mr_data(reg->userspace_addr, &offset, &fd);
+                /*
+                 * Reset postcopy client bases, region_rb, and
+                 * region_rb_offset in case regions are removed.
+                 */
+                if (fd > 0) {
+                    u->region_rb_offset[j] = offset;
+                    u->region_rb[j] = mr->ram_block;
+                    shadow_pcb[j] = u->postcopy_client_bases[i];
+                } else {
+                    u->region_rb_offset[j] = 0;
+                    u->region_rb[j] = NULL;
                 }
-                break;
             }
+            break;
         }
 
         /*
@@ -728,6 +729,34 @@ static void scrub_shadow_regions(struct vhost_dev *dev,
     return;
 }
 
+static void shadow_remove_region(struct vhost_user *u, int shadow_reg_idx)
+{
+    memmove(&u->shadow_regions[shadow_reg_idx],
+            &u->shadow_regions[shadow_reg_idx + 1],
+            sizeof(struct vhost_memory_region) *
+            (u->num_shadow_regions - shadow_reg_idx - 1));
+    u->num_shadow_regions--;
+}
+
+static void shadow_add_region(struct vhost_user *u,
+                              struct vhost_memory_region *reg)
+{
+    u->shadow_regions[u->num_shadow_regions].guest_phys_addr =
+        reg->guest_phys_addr;
+    u->shadow_regions[u->num_shadow_regions].userspace_addr =
+        reg->userspace_addr;
+    u->shadow_regions[u->num_shadow_regions].memory_size =
+        reg->memory_size;
+    u->num_shadow_regions++;
+}
+
+/*
+ * Both send_remove_regions() and send_add_regions() write all their
+ * messages before collecting the backend's acknowledgements, so that an
+ * update touching many regions costs one round trip rather than one per
+ * region.  The backend handles messages in order, so the replies arrive
+ * in the order the messages were sent.
+ */
 static int send_remove_regions(struct vhost_dev *dev,
                                struct scrub_regions *remove_reg,
                                int nr_rem_reg, VhostUserMsg *msg,
@@ -735,7 +764,8 @@ static int send_remove_regions(struct vhost_dev *dev,
 {
     struct vhost_user *u = dev->opaque;
     struct vhost_memory_region *shadow_reg;
-    int i, fd, shadow_reg_idx, ret;
+    bool sent[VHOST_USER_MAX_RAM_SLOTS] = {};
+    int i, fd, ret, last, err = 0;
     ram_addr_t offset;
     VhostUserMemoryRegion region_buffer;
 
@@ -744,9 +774,8 @@ static int send_remove_regions(struct vhost_dev *dev,
      * shadow table. Therefore we can minimize memory copies by iterating
      * through remove_reg backwards.
      */
-    for (i = nr_rem_reg - 1; i >= 0; i--) {
-        shadow_reg = remove_reg[i].region;
-        shadow_reg_idx = remove_reg[i].reg_idx;
+    for (last = nr_rem_reg - 1; last >= 0; last--) {
+        shadow_reg = remove_reg[last].region;
 
         vhost_user_get_mr_data(shadow_reg->userspace_addr, &offset, &fd);
 
@@ -755,16 +784,20 @@ static int send_remove_regions(struct vhost_dev *dev,
             vhost_user_fill_msg_region(&region_buffer, shadow_reg, 0);
             msg->payload.mem_reg.region = region_buffer;
 
-            ret = vhost_user_write(dev, msg, NULL, 0);
-            if (ret < 0) {
-                return ret;
+            err = vhost_user_write(dev, msg, NULL, 0);
+            if (err < 0) {
+                break;
             }
+            sent[last] = true;
+        }
+    }
 
-            if (reply_supported) {
-                ret = process_message_reply(dev, msg);
-                if (ret) {
-                    return ret;
-                }
+    for (i = nr_rem_reg - 1; i > last; i--) {
+        if (sent[i] && reply_supported) {
+            ret = process_message_reply(dev, msg);
+            if (ret) {
+                err = err ? err : ret;
+                continue;
             }
         }
 
@@ -772,14 +805,10 @@ static int send_remove_regions(struct vhost_dev *dev,
          * At this point we know the backend has unmapped the region. It is now
          * safe to remove it from the shadow table.
          */
-        memmove(&u->shadow_regions[shadow_reg_idx],
-                &u->shadow_regions[shadow_reg_idx + 1],
-                sizeof(struct vhost_memory_region) *
-                (u->num_shadow_regions - shadow_reg_idx - 1));
-        u->num_shadow_regions--;
+        shadow_remove_region(u, remove_reg[i].reg_idx);
     }
 
-    return 0;
+    return err;
 }
 
 static int send_add_regions(struct vhost_dev *dev,
@@ -788,7 +817,8 @@ static int send_add_regions(struct vhost_dev *dev,
                             bool reply_supported, bool track_ramblocks)
 {
     struct vhost_user *u = dev->opaque;
-    int i, fd, ret, reg_idx, reg_fd_idx;
+    bool sent[VHOST_USER_MAX_RAM_SLOTS] = {};
+    int i, j, fd, ret, reg_idx, reg_fd_idx, err = 0;
     struct vhost_memory_region *reg;
     MemoryRegion *mr;
     ram_addr_t offset;
@@ -816,9 +846,9 @@ static int send_add_regions(struct vhost_dev *dev,
             vhost_user_fill_msg_region(&region_buffer, reg, offset);
             msg->payload.mem_reg.region = region_buffer;
 
-            ret = vhost_user_write(dev, msg, &fd, 1);
-            if (ret < 0) {
-                return ret;
+            err = vhost_user_write(dev, msg, &fd, 1);
+            if (err < 0) {
+                break;
             }
 
             if (track_ramblocks) {
@@ -866,10 +896,9 @@ static int send_add_regions(struct vhost_dev *dev,
                     return -EPROTO;
                 }
             } else if (reply_supported) {
-                ret = process_message_reply(dev, msg);
-                if (ret) {
-                    return ret;
-                }
+                /* The region is added to the shadow table once acked */
+                sent[i] = true;
+                continue;
             }
         } else if (track_ramblocks) {
             u->region_rb_offset[reg_idx] = 0;
@@ -882,16 +911,24 @@ static int send_add_regions(struct vhost_dev *dev,
          *
          * The region should now be added to the shadow table.
          */
-        u->shadow_regions[u->num_shadow_regions].guest_phys_addr =
-            reg->guest_phys_addr;
-        u->shadow_regions[u->num_shadow_regions].userspace_addr =
-            reg->userspace_addr;
-        u->shadow_regions[u->num_shadow_regions].memory_size =
-            reg->memory_size;
-        u->num_shadow_regions++;
+        shadow_add_region(u, reg);
     }
 
-    return 0;
+    for (j = 0; j < i; j++) {
+        if (!sent[j]) {
+            continue;
+        }
+
+        msg->hdr.request = VHOST_USER_ADD_MEM_REG;
+        ret = process_message_reply(dev, msg);
+        if (ret) {
+            err = err ? err : ret;
+            continue;
+        }
+        shadow_add_region(u, add_reg[j].region);
+    }
+
+    return err;
 }
 
 static int vhost_user_add_remove_regions(struct vhost_dev *dev,
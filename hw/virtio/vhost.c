@@ -17,7 +17,9 @@
 #include "qapi/error.h"
 #include "hw/virtio/vhost.h"
 #include "qemu/atomic.h"
+#include "qemu/cutils.h"
 #include "qemu/range.h"
+#include "qemu/timer.h"
 #include "qemu/error-report.h"
 #include "qemu/memfd.h"
 #include "standard-headers/linux/vhost_types.h"
@@ -61,6 +63,23 @@ bool vhost_has_free_slot(void)
     return slots_limit > used_memslots;
 }
 
+/*
+ * Number of log words checked at once with buffer_is_zero() before the
+ * words of a block are looked at one by one.  Dirty pages tend to cluster,
+ * so most of the log can be skipped a block at a time.
+ */
+#define VHOST_LOG_SCAN_BLOCK 64
+
+static void vhost_dev_set_dirty(MemoryRegionSection *section,
+                                hwaddr addr, hwaddr len)
+{
+    hwaddr section_offset = addr - section->offset_within_address_space;
+
+    memory_region_set_dirty(section->mr,
+                            section_offset + section->offset_within_region,
+                            len);
+}
+
 static void vhost_dev_sync_region(struct vhost_dev *dev,
                                   MemoryRegionSection *section,
                                   uint64_t mfirst, uint64_t mlast,
@@ -73,6 +92,7 @@ static void vhost_dev_sync_region(struct vhost_dev *dev,
     vhost_log_chunk_t *from = log + start / VHOST_LOG_CHUNK;
     vhost_log_chunk_t *to = log + end / VHOST_LOG_CHUNK + 1;
     uint64_t addr = QEMU_ALIGN_DOWN(start, VHOST_LOG_CHUNK);
+    hwaddr run_addr = 0, run_len = 0;
 
     if (end < start) {
         return;
@@ -80,29 +100,48 @@ static void vhost_dev_sync_region(struct vhost_dev *dev,
     assert(end / VHOST_LOG_CHUNK < dev->log_size);
     assert(start / VHOST_LOG_CHUNK < dev->log_size);
 
-    for (;from < to; ++from) {
-        vhost_log_chunk_t log;
-        /* We first check with non-atomic: much cheaper,
-         * and we expect non-dirty to be the common case. */
-        if (!*from) {
-            addr += VHOST_LOG_CHUNK;
+    while (from < to) {
+        size_t n = MIN(to - from, VHOST_LOG_SCAN_BLOCK);
+
+        if (buffer_is_zero(from, n * sizeof(*from))) {
+            from += n;
+            addr += n * VHOST_LOG_CHUNK;
             continue;
         }
-        /* Data must be read atomically. We don't really need barrier semantics
-         * but it's easier to use atomic_* than roll our own. */
-        log = qatomic_xchg(from, 0);
-        while (log) {
-            int bit = ctzl(log);
-            hwaddr page_addr;
-            hwaddr section_offset;
-            hwaddr mr_offset;
-            page_addr = addr + bit * VHOST_LOG_PAGE;
-            section_offset = page_addr - section->offset_within_address_space;
-            mr_offset = section_offset + section->offset_within_region;
-            memory_region_set_dirty(section->mr, mr_offset, VHOST_LOG_PAGE);
-            log &= ~(0x1ull << bit);
+
+        for (; n; n--, from++, addr += VHOST_LOG_CHUNK) {
+            vhost_log_chunk_t log;
+            /* We first check with non-atomic: much cheaper,
+             * and we expect non-dirty to be the common case. */
+            if (!*from) {
+                continue;
+            }
+            /* Data must be read atomically. We don't really need barrier
+             * semantics but it's easier to use atomic_* than roll our own. */
+            log = qatomic_xchg(from, 0);
+            while (log) {
+                int bit = ctzl(log);
+                int len = ctzl(~(log >> bit));
+                hwaddr page_addr = addr + bit * VHOST_LOG_PAGE;
+
+                /* Mark runs of dirty pages, also across log words, at once */
+                if (run_len && run_addr + run_len == page_addr) {
+                    run_len += len * VHOST_LOG_PAGE;
+                } else {
+                    if (run_len) {
+                        vhost_dev_set_dirty(section, run_addr, run_len);
+                    }
+                    run_addr = page_addr;
+                    run_len = len * VHOST_LOG_PAGE;
+                }
+                log &= ~((~(vhost_log_chunk_t)0 >> (VHOST_LOG_BITS - len))
+                         << bit);
+            }
         }
-        addr += VHOST_LOG_CHUNK;
+    }
+
+    if (run_len) {
+        vhost_dev_set_dirty(section, run_addr, run_len);
     }
 }
 
@@ -111,7 +150,6 @@ static int vhost_sync_dirty_bitmap(struct vhost_dev *dev,
                                    hwaddr first,
                                    hwaddr last)
 {
-    int i;
     hwaddr start_addr;
     hwaddr end_addr;
 
@@ -123,24 +161,34 @@ static int vhost_sync_dirty_bitmap(struct vhost_dev *dev,
     start_addr = MAX(first, start_addr);
     end_addr = MIN(last, end_addr);
 
-    for (i = 0; i < dev->mem->nregions; ++i) {
-        struct vhost_memory_region *reg = dev->mem->regions + i;
-        vhost_dev_sync_region(dev, section, start_addr, end_addr,
-                              reg->guest_phys_addr,
-                              range_get_last(reg->guest_phys_addr,
-                                             reg->memory_size));
-    }
-    for (i = 0; i < dev->nvqs; ++i) {
-        struct vhost_virtqueue *vq = dev->vqs + i;
+    /*
+     * The log is indexed by guest physical address, and both the memory
+     * regions and the used rings of the device live in guest memory, so
+     * scanning the part of the section that the log covers picks up
+     * everything in a single pass.  Words the backend cannot write are
+     * always zero and skipped cheaply.
+     */
+    vhost_dev_sync_region(dev, section, start_addr, end_addr,
+                          0, dev->log_size * VHOST_LOG_CHUNK - 1);
+    return 0;
+}
 
-        if (!vq->used_phys && !vq->used_size) {
-            continue;
-        }
+/*
+ * Devices sharing a log would all scan the same words, so only the first
+ * running device with logging enabled scans it on behalf of the others.
+ * Whatever it misses stays in the log for the next sync, and the final
+ * vhost_log_put() always scans.
+ */
+static bool vhost_dev_log_scanner(struct vhost_dev *dev)
+{
+    struct vhost_dev *hdev;
 
-        vhost_dev_sync_region(dev, section, start_addr, end_addr, vq->used_phys,
-                              range_get_last(vq->used_phys, vq->used_size));
+    QLIST_FOREACH(hdev, &vhost_devices, entry) {
+        if (hdev->log == dev->log && hdev->log_enabled && hdev->started) {
+            return hdev == dev;
+        }
     }
-    return 0;
+    return true;
 }
 
 static void vhost_log_sync(MemoryListener *listener,
@@ -148,6 +196,10 @@ static void vhost_log_sync(MemoryListener *listener,
 {
     struct vhost_dev *dev = container_of(listener, struct vhost_dev,
                                          memory_listener);
+
+    if (!dev->log_enabled || !dev->started || !vhost_dev_log_scanner(dev)) {
+        return;
+    }
     vhost_sync_dirty_bitmap(dev, section, 0x0, ~0x0ULL);
 }
 
@@ -477,6 +529,29 @@ static void vhost_begin(MemoryListener *listener)
     dev->n_tmp_sections = 0;
 }
 
+/*
+ * Push dev->mem to the backend, accounting the time it takes: with many
+ * devices, memory hotplug stalls the guest for the sum of these.
+ */
+static int vhost_dev_set_mem_table(struct vhost_dev *dev)
+{
+    int64_t start = get_clock();
+    int64_t elapsed;
+    int r;
+
+    r = dev->vhost_ops->vhost_set_mem_table(dev, dev->mem);
+
+    elapsed = get_clock() - start;
+    dev->mem_table_updates++;
+    dev->mem_table_update_ns += elapsed;
+    dev->mem_table_update_max_ns = MAX(dev->mem_table_update_max_ns, elapsed);
+    trace_vhost_dev_set_mem_table(dev, dev->mem->nregions, elapsed,
+                                  dev->mem_table_updates,
+                                  dev->mem_table_update_ns,
+                                  dev->mem_table_update_max_ns);
+    return r;
+}
+
 static void vhost_commit(MemoryListener *listener)
 {
     struct vhost_dev *dev = container_of(listener, struct vhost_dev,
@@ -549,7 +624,7 @@ static void vhost_commit(MemoryListener *listener)
     }
 
     if (!dev->log_enabled) {
-        r = dev->vhost_ops->vhost_set_mem_table(dev, dev->mem);
+        r = vhost_dev_set_mem_table(dev);
         if (r < 0) {
             VHOST_OPS_DEBUG(r, "vhost_set_mem_table failed");
         }
@@ -563,7 +638,7 @@ static void vhost_commit(MemoryListener *listener)
     if (dev->log_size < log_size) {
         vhost_dev_log_resize(dev, log_size + VHOST_LOG_BUFFER);
     }
-    r = dev->vhost_ops->vhost_set_mem_table(dev, dev->mem);
+    r = vhost_dev_set_mem_table(dev);
     if (r < 0) {
         VHOST_OPS_DEBUG(r, "vhost_set_mem_table failed");
     }
@@ -1792,7 +1867,7 @@ int vhost_dev_start(struct vhost_dev *hdev, VirtIODevice *vdev)
         memory_listener_register(&hdev->iommu_listener, vdev->dma_as);
     }
 
-    r = hdev->vhost_ops->vhost_set_mem_table(hdev, hdev->mem);
+    r = vhost_dev_set_mem_table(hdev);
     if (r < 0) {
         VHOST_OPS_DEBUG(r, "vhost_set_mem_table failed");
         goto fail_mem;
@@ -18,6 +18,8 @@
 #include "qemu/module.h"
 #include "qemu/timer.h"
 #include "qemu/madvise.h"
+#include "block/aio-wait.h"
+#include "block/thread-pool.h"
 #include "hw/virtio/virtio.h"
 #include "hw/mem/pc-dimm.h"
 #include "hw/qdev-properties.h"
@@ -326,30 +328,172 @@ static void balloon_stats_set_poll_interval(Object *obj, Visitor *v,
     balloon_stats_change_timer(s, 0);
 }
 
+/* The reporting queue has 32 entries, so one batch can take all of them */
+#define BALLOON_REPORT_BATCH_MAX 32
+
+typedef struct BalloonReportRange {
+    RAMBlock *rb;
+    ram_addr_t offset;
+    size_t size;
+} BalloonReportRange;
+
+/*
+ * Reported elements are handed to the thread pool a batch at a time.  The
+ * elements stay mapped until the batch completes, which keeps the RAMBlocks
+ * they point into alive while the worker discards them.
+ */
+typedef struct VirtIOBalloonReport {
+    VirtIOBalloon *dev;
+    VirtQueueElement *elems[BALLOON_REPORT_BATCH_MAX];
+    unsigned int nelems;
+    GArray *ranges;
+    uint64_t discarded_bytes;
+    int64_t discard_ns;
+} VirtIOBalloonReport;
+
+static gint balloon_report_range_cmp(gconstpointer a, gconstpointer b)
+{
+    const BalloonReportRange *ra = a, *rb = b;
+
+    if (ra->rb != rb->rb) {
+        return (uintptr_t)ra->rb < (uintptr_t)rb->rb ? -1 : 1;
+    }
+    if (ra->offset != rb->offset) {
+        return ra->offset < rb->offset ? -1 : 1;
+    }
+    return 0;
+}
+
+/* Sort the ranges and merge those that touch, so each gets one syscall */
+static void balloon_report_coalesce(GArray *ranges)
+{
+    BalloonReportRange *r = (BalloonReportRange *)ranges->data;
+    guint i, n = 0;
+
+    if (!ranges->len) {
+        return;
+    }
+
+    g_array_sort(ranges, balloon_report_range_cmp);
+    for (i = 1; i < ranges->len; i++) {
+        if (r[i].rb == r[n].rb && r[i].offset <= r[n].offset + r[n].size) {
+            r[n].size = MAX(r[n].offset + r[n].size,
+                            r[i].offset + r[i].size) - r[n].offset;
+        } else {
+            r[++n] = r[i];
+        }
+    }
+    g_array_set_size(ranges, n + 1);
+}
+
+static int virtio_balloon_report_discard(void *opaque)
+{
+    VirtIOBalloonReport *report = opaque;
+    int64_t start = get_clock();
+    guint i;
+
+    for (i = 0; i < report->ranges->len; i++) {
+        BalloonReportRange *r = &g_array_index(report->ranges,
+                                               BalloonReportRange, i);
+
+        /* A device may have disabled discards since the batch was queued */
+        if (!ram_block_discard_range_unless_disabled(r->rb, r->offset,
+                                                     r->size)) {
+            report->discarded_bytes += r->size;
+        }
+    }
+    report->discard_ns = get_clock() - start;
+    return 0;
+}
+
+/* Hand the batch back to the guest, with a single notification */
+static void virtio_balloon_report_complete(VirtIOBalloonReport *report)
+{
+    VirtIOBalloon *dev = report->dev;
+    VirtIODevice *vdev = VIRTIO_DEVICE(dev);
+    unsigned int i;
+
+    for (i = 0; i < report->nelems; i++) {
+        virtqueue_push(dev->reporting_vq, report->elems[i], 0);
+        g_free(report->elems[i]);
+    }
+    virtio_notify(vdev, dev->reporting_vq);
+
+    g_array_free(report->ranges, true);
+    g_free(report);
+}
+
+static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq);
+
+static void virtio_balloon_report_done(void *opaque, int ret)
+{
+    VirtIOBalloonReport *report = opaque;
+    VirtIOBalloon *dev = report->dev;
+    VirtIODevice *vdev = VIRTIO_DEVICE(dev);
+
+    dev->report_batches++;
+    dev->report_discarded_bytes += report->discarded_bytes;
+    dev->report_discard_ns += report->discard_ns;
+    trace_virtio_balloon_report_done(report->nelems, report->ranges->len,
+                                     report->discarded_bytes,
+                                     report->discard_ns);
+
+    assert(dev->report == report);
+    dev->report = NULL;
+    virtio_balloon_report_complete(report);
+    aio_wait_kick();
+
+    /* The guest may have queued more while this batch was in flight */
+    if (vdev->vm_running) {
+        virtio_balloon_handle_report(vdev, dev->reporting_vq);
+    }
+}
+
+/* Wait for the batch in flight, so that no element is held by the worker */
+static void virtio_balloon_report_drain(VirtIOBalloon *dev)
+{
+    AIO_WAIT_WHILE(NULL, dev->report);
+}
+
 static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIOBalloon *dev = VIRTIO_BALLOON(vdev);
+    VirtIOBalloonReport *report;
     VirtQueueElement *elem;
+    bool inhibited;
 
-    while ((elem = virtqueue_pop(vq, sizeof(VirtQueueElement)))) {
+    if (dev->report) {
+        /* Picked up again when the batch in flight completes */
+        return;
+    }
+
+    report = g_new0(VirtIOBalloonReport, 1);
+    report->dev = dev;
+    report->ranges = g_array_new(false, false, sizeof(BalloonReportRange));
+
+    /*
+     * When we discard the page it has the effect of removing the page
+     * from the hypervisor itself and causing it to be zeroed when it
+     * is returned to us. So we must not discard the page if it is
+     * accessible by another device or process, or if the guest is
+     * expecting it to retain a non-zero value.  The worker checks again
+     * whether discards were disabled before each range.
+     */
+    inhibited = virtio_balloon_inhibited() || dev->poison_val;
+
+    while (report->nelems < BALLOON_REPORT_BATCH_MAX &&
+           (elem = virtqueue_pop(vq, sizeof(VirtQueueElement)))) {
         unsigned int i;
 
-        /*
-         * When we discard the page it has the effect of removing the page
-         * from the hypervisor itself and causing it to be zeroed when it
-         * is returned to us. So we must not discard the page if it is
-         * accessible by another device or process, or if the guest is
-         * expecting it to retain a non-zero value.
-         */
-        if (virtio_balloon_inhibited() || dev->poison_val) {
-            goto skip_element;
+        report->elems[report->nelems++] = elem;
+        if (inhibited) {
+            continue;
         }
 
         for (i = 0; i < elem->in_num; i++) {
             void *addr = elem->in_sg[i].iov_base;
             size_t size = elem->in_sg[i].iov_len;
-            ram_addr_t ram_offset;
-            RAMBlock *rb;
+            BalloonReportRange range;
 
             /*
              * There is no need to check the memory section to see if
@@ -362,8 +506,8 @@ static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
              * will return NULL after the first bounce buffer and fail
              * to map any resources.
              */
-            rb = qemu_ram_block_from_host(addr, false, &ram_offset);
-            if (!rb) {
+            range.rb = qemu_ram_block_from_host(addr, false, &range.offset);
+            if (!range.rb) {
                 trace_virtio_balloon_bad_addr(elem->in_addr[i]);
                 continue;
             }
@@ -372,19 +516,32 @@ static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
              * For now we will simply ignore unaligned memory regions, or
              * regions that overrun the end of the RAMBlock.
              */
-            if (!QEMU_IS_ALIGNED(ram_offset | size, qemu_ram_pagesize(rb)) ||
-                (ram_offset + size) > qemu_ram_get_used_length(rb)) {
+            if (!QEMU_IS_ALIGNED(range.offset | size,
+                                 qemu_ram_pagesize(range.rb)) ||
+                (range.offset + size) > qemu_ram_get_used_length(range.rb)) {
                 continue;
             }
 
-            ram_block_discard_range(rb, ram_offset, size);
+            range.size = size;
+            g_array_append_val(report->ranges, range);
         }
+    }
 
-skip_element:
-        virtqueue_push(vq, elem, 0);
-        virtio_notify(vdev, vq);
-        g_free(elem);
+    if (!report->ranges->len) {
+        if (report->nelems) {
+            virtio_balloon_report_complete(report);
+        } else {
+            g_array_free(report->ranges, true);
+            g_free(report);
+        }
+        return;
     }
+
+    balloon_report_coalesce(report->ranges);
+    dev->report = report;
+    thread_pool_submit_aio(aio_get_thread_pool(qemu_get_aio_context()),
+                           virtio_balloon_report_discard, report,
+                           virtio_balloon_report_done, report);
 }
 
 static void virtio_balloon_handle_output(VirtIODevice *vdev, VirtQueue *vq)
@@ -539,10 +696,20 @@ static bool get_free_page_hints(VirtIOBalloon *dev)
     }
 
     if (elem->in_num && dev->free_page_hint_status == FREE_PAGE_HINT_S_START) {
-        for (i = 0; i < elem->in_num; i++) {
-            qemu_guest_free_page_hint(elem->in_sg[i].iov_base,
-                                      elem->in_sg[i].iov_len);
+        void *base = elem->in_sg[0].iov_base;
+        size_t len = elem->in_sg[0].iov_len;
+
+        /* Hint host-contiguous entries together, one bitmap walk each */
+        for (i = 1; i < elem->in_num; i++) {
+            if (elem->in_sg[i].iov_base == base + len) {
+                len += elem->in_sg[i].iov_len;
+                continue;
+            }
+            qemu_guest_free_page_hint(base, len);
+            base = elem->in_sg[i].iov_base;
+            len = elem->in_sg[i].iov_len;
         }
+        qemu_guest_free_page_hint(base, len);
     }
 
 out:
@@ -927,6 +1094,7 @@ static void virtio_balloon_device_unrealize(DeviceState *dev)
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
     VirtIOBalloon *s = VIRTIO_BALLOON(dev);
 
+    virtio_balloon_report_drain(s);
     if (s->free_page_bh) {
         qemu_bh_delete(s->free_page_bh);
         object_unref(OBJECT(s->iothread));
@@ -952,6 +1120,7 @@ static void virtio_balloon_device_reset(VirtIODevice *vdev)
 {
     VirtIOBalloon *s = VIRTIO_BALLOON(vdev);
 
+    virtio_balloon_report_drain(s);
     if (virtio_balloon_free_page_support(s)) {
         virtio_balloon_free_page_stop(s);
     }
@@ -976,6 +1145,16 @@ static void virtio_balloon_set_status(VirtIODevice *vdev, uint8_t status)
         virtio_balloon_receive_stats(vdev, s->svq);
     }
 
+    if (s->reporting_vq) {
+        if (!vdev->vm_running) {
+            /* Don't leave reported pages half discarded across migration */
+            virtio_balloon_report_drain(s);
+        } else if (status & VIRTIO_CONFIG_S_DRIVER_OK) {
+            /* Reports kicked while the VM was stopping have not been seen */
+            virtio_balloon_handle_report(vdev, s->reporting_vq);
+        }
+    }
+
     if (virtio_balloon_free_page_support(s)) {
         /*
          * The VM is woken up and the iothread was blocked, so signal it to
@@ -1013,6 +1192,14 @@ static void virtio_balloon_instance_init(Object *obj)
                         balloon_stats_get_poll_interval,
                         balloon_stats_set_poll_interval,
                         NULL, NULL);
+
+    object_property_add_uint64_ptr(obj, "free-page-reporting-batches",
+                                   &s->report_batches, OBJ_PROP_FLAG_READ);
+    object_property_add_uint64_ptr(obj, "free-page-reporting-bytes",
+                                   &s->report_discarded_bytes,
+                                   OBJ_PROP_FLAG_READ);
+    object_property_add_uint64_ptr(obj, "free-page-reporting-time-ns",
+                                   &s->report_discard_ns, OBJ_PROP_FLAG_READ);
 }
 
 static const VMStateDescription vmstate_virtio_balloon = {
@@ -13,12 +13,15 @@
 
 #include "qemu/osdep.h"
 #include "qapi/error.h"
+#include "qapi/visitor.h"
 #include "cpu.h"
 #include "trace.h"
 #include "qemu/error-report.h"
 #include "qemu/log.h"
 #include "qemu/main-loop.h"
 #include "qemu/module.h"
+#include "qemu/lockable.h"
+#include "qemu/units.h"
 #include "hw/virtio/virtio.h"
 #include "migration/qemu-file-types.h"
 #include "qemu/atomic.h"
@@ -27,6 +30,7 @@
 #include "hw/virtio/virtio-access.h"
 #include "sysemu/dma.h"
 #include "sysemu/runstate.h"
+#include "sysemu/xen.h"
 #include "standard-headers/linux/virtio_ids.h"
 
 /*
@@ -94,6 +98,62 @@ typedef struct VRingPackedDescEvent {
     uint16_t flags;
 } VRingPackedDescEvent ;
 
+/*
+ * Guest-physical to host translations of RAM used by descriptor buffers.
+ * Each entry covers [gpa, gpa + len) of writable RAM in vdev->dma_as, and
+ * mr is the RAM region that address_space_map() would have referenced.
+ */
+typedef struct VirtQueueMapCacheEntry {
+    hwaddr gpa;
+    hwaddr len;
+    void *hva;
+    MemoryRegion *mr;
+} VirtQueueMapCacheEntry;
+
+#define VIRTQUEUE_MAP_CACHE_ENTRIES 4
+
+/* Entries start at this alignment when the RAM section allows it */
+#define VIRTQUEUE_MAP_CACHE_ALIGN (2 * MiB)
+
+/*
+ * Interrupt moderation state, allocated for each virtqueue when the
+ * x-irq-coalesce-max-delay-us property is non-zero.
+ *
+ * The timer always runs in the main loop, with the BQL held.  Held back
+ * interrupts are delivered with the AioContext that processes the queue
+ * acquired, so that signalled_used is not updated concurrently with the
+ * device pushing to the used ring.
+ *
+ * Lock order: BQL, then ctx, then lock.
+ */
+typedef struct VirtQueueIRQCoalesce {
+    QemuMutex lock;
+    QEMUTimer *timer;
+    AioContext *ctx;            /* AioContext of the held back interrupt */
+    bool pending;               /* an interrupt is being held back */
+    bool irqfd;                 /* deliver it with virtio_notify_irqfd() */
+    uint32_t frames;            /* notifications since the last interrupt */
+    int64_t delay_ns;           /* current delay, 0 delivers immediately */
+    int64_t window_start_ns;
+    uint64_t window_requests;
+
+    /* Statistics */
+    uint64_t requests;          /* virtio_notify{,_irqfd}() calls */
+    uint64_t deferred;          /* calls folded into a held back interrupt */
+    uint64_t frames_flushes;    /* interrupts sent because of max-frames */
+    uint64_t timer_flushes;     /* interrupts sent because of max-delay */
+} VirtQueueIRQCoalesce;
+
+/* Period over which the notification rate is measured */
+#define VIRTQUEUE_IRQ_COALESCE_WINDOW_NS (10 * SCALE_MS)
+
+typedef struct VirtQueueMapCache {
+    VirtQueueMapCacheEntry entries[VIRTQUEUE_MAP_CACHE_ENTRIES];
+    unsigned int next;
+    /* Entries are valid while this matches vdev->map_cache_gen */
+    unsigned int gen;
+} VirtQueueMapCache;
+
 struct VirtQueue
 {
     VRing vring;
@@ -130,8 +190,37 @@ struct VirtQueue
     EventNotifier host_notifier;
     bool host_notifier_enabled;
     QLIST_ENTRY(VirtQueue) node;
+
+    /*
+     * Element pool for virtqueue_pop_batch().  Elements are taken from
+     * elem_alloc_pool by the thread that pops from the virtqueue and
+     * returned to elem_release_pool by virtqueue_element_free() from any
+     * thread.
+     */
+    QSLIST_HEAD(, VirtQueueElement) elem_alloc_pool;
+    QSLIST_HEAD(, VirtQueueElement) elem_release_pool;
+    unsigned int elem_pool_size;
+    size_t elem_pool_sz;
+
+    /* Only accessed by the thread that pops from the virtqueue */
+    VirtQueueMapCache map_cache;
+
+    /* Entries filled by virtqueue_push_deferred() and not flushed yet */
+    unsigned int used_pending;
+
+    VirtQueueIRQCoalesce *irq_coalesce;
 };
 
+static void virtio_queue_irq_coalesce_init(VirtQueue *vq);
+static void virtio_queue_irq_coalesce_cancel(VirtQueue *vq);
+static void virtio_queue_irq_coalesce_cleanup(VirtQueue *vq);
+
+/*
+ * Pooled elements are allocated with room for this many scatter-gather
+ * entries; larger requests fall back to g_malloc().
+ */
+#define VIRTQUEUE_ELEM_POOL_MAX_SG 16
+
 const char *virtio_device_names[] = {
     [VIRTIO_ID_NET] = "virtio-net",
     [VIRTIO_ID_BLOCK] = "virtio-blk",
@@ -391,6 +480,42 @@ static inline void vring_used_write(VirtQueue *vq, VRingUsedElem *uelem,
     address_space_cache_invalidate(&caches->used, pa, sizeof(VRingUsedElem));
 }
 
+/* Called within rcu_read_lock().  */
+static void vring_used_write_batch(VirtQueue *vq,
+                                   VirtQueueElement *const *elems,
+                                   const unsigned int *lens,
+                                   unsigned int count)
+{
+    VRingMemoryRegionCaches *caches = vring_get_region_caches(vq);
+    VRingUsedElem uelems[64];
+    unsigned int i = 0;
+
+    if (!caches) {
+        return;
+    }
+
+    /* Write contiguous runs of the used ring with a single access each */
+    while (i < count) {
+        unsigned int idx = (vq->used_idx + i) % vq->vring.num;
+        unsigned int run = MIN(count - i, vq->vring.num - idx);
+        hwaddr pa = offsetof(VRingUsed, ring[idx]);
+        unsigned int j;
+
+        run = MIN(run, ARRAY_SIZE(uelems));
+        for (j = 0; j < run; j++) {
+            uelems[j].id = elems[i + j]->index;
+            uelems[j].len = lens ? lens[i + j] : 0;
+            virtio_tswap32s(vq->vdev, &uelems[j].id);
+            virtio_tswap32s(vq->vdev, &uelems[j].len);
+        }
+        address_space_write_cached(&caches->used, pa, uelems,
+                                   run * sizeof(VRingUsedElem));
+        address_space_cache_invalidate(&caches->used, pa,
+                                       run * sizeof(VRingUsedElem));
+        i += run;
+    }
+}
+
 /* Called within rcu_read_lock().  */
 static uint16_t vring_used_idx(VirtQueue *vq)
 {
@@ -955,11 +1080,98 @@ void virtqueue_flush(VirtQueue *vq, unsigned int count)
 void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
                     unsigned int len)
 {
+    assert(!vq->used_pending);
+
     RCU_READ_LOCK_GUARD();
     virtqueue_fill(vq, elem, len, 0);
     virtqueue_flush(vq, 1);
 }
 
+/*
+ * virtqueue_push_deferred:
+ * @vq: The #VirtQueue
+ * @elem: The #VirtQueueElement
+ * @len: number of bytes written to the element
+ *
+ * Like virtqueue_push(), but the entry only becomes visible to the driver
+ * on the next virtqueue_flush_deferred().  Devices whose requests complete
+ * one at a time use this to publish a burst of completions with a single
+ * used index update and a single notification.  @elem may be freed as soon
+ * as this function returns.
+ *
+ * Until the next virtqueue_flush_deferred(), all completions on @vq must go
+ * through this function.
+ */
+void virtqueue_push_deferred(VirtQueue *vq, const VirtQueueElement *elem,
+                             unsigned int len)
+{
+    RCU_READ_LOCK_GUARD();
+    virtqueue_fill(vq, elem, len, vq->used_pending++);
+}
+
+/*
+ * virtqueue_flush_deferred:
+ * @vq: The #VirtQueue
+ *
+ * Publish the entries filled by virtqueue_push_deferred().  Returns true
+ * if there were any, in which case the caller should notify the driver.
+ */
+bool virtqueue_flush_deferred(VirtQueue *vq)
+{
+    unsigned int count = vq->used_pending;
+
+    if (!count) {
+        return false;
+    }
+
+    vq->used_pending = 0;
+    RCU_READ_LOCK_GUARD();
+    virtqueue_flush(vq, count);
+    return true;
+}
+
+/*
+ * virtqueue_push_batch:
+ * @vq: The #VirtQueue
+ * @elems: elements to complete, in the order they should appear in the
+ *         used ring
+ * @lens: number of bytes written to each element, or NULL if nothing was
+ *        written to any of them
+ * @count: number of elements, at most the virtqueue size
+ *
+ * Equivalent to virtqueue_fill() for each element followed by a single
+ * virtqueue_flush(), but writes split ring used entries in one pass.
+ */
+void virtqueue_push_batch(VirtQueue *vq, VirtQueueElement *const *elems,
+                          const unsigned int *lens, unsigned int count)
+{
+    unsigned int i;
+
+    if (!count) {
+        return;
+    }
+
+    assert(!vq->used_pending);
+
+    RCU_READ_LOCK_GUARD();
+    if (virtio_device_disabled(vq->vdev) ||
+        virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED) ||
+        unlikely(!vq->vring.used)) {
+        for (i = 0; i < count; i++) {
+            virtqueue_fill(vq, elems[i], lens ? lens[i] : 0, i);
+        }
+    } else {
+        for (i = 0; i < count; i++) {
+            unsigned int len = lens ? lens[i] : 0;
+
+            trace_virtqueue_fill(vq, elems[i], len, i);
+            virtqueue_unmap_sg(vq, elems[i], len);
+        }
+        vring_used_write_batch(vq, elems, lens, count);
+    }
+    virtqueue_flush(vq, count);
+}
+
 /* Called within rcu_read_lock().  */
 static int virtqueue_num_heads(VirtQueue *vq, unsigned int idx)
 {
@@ -1330,11 +1542,91 @@ int virtqueue_avail_bytes(VirtQueue *vq, unsigned int in_bytes,
     return in_bytes <= in_total && out_bytes <= out_total;
 }
 
-static bool virtqueue_map_desc(VirtIODevice *vdev, unsigned int *p_num_sg,
+/* Called within rcu_read_lock().  */
+static bool virtqueue_map_cache_fill(VirtQueue *vq, hwaddr pa,
+                                     VirtQueueMapCacheEntry *e)
+{
+    AddressSpace *as = vq->vdev->dma_as;
+    hwaddr base = QEMU_ALIGN_DOWN(pa, VIRTQUEUE_MAP_CACHE_ALIGN);
+    hwaddr xlat, len;
+    MemoryRegion *mr;
+
+    /* Try to cover the whole aligned window, then just the address itself */
+    len = HWADDR_MAX - base;
+    mr = address_space_translate(as, base, &xlat, &len, true,
+                                 MEMTXATTRS_UNSPECIFIED);
+    if (!memory_access_is_direct(mr, true) || len <= pa - base) {
+        base = pa;
+        len = HWADDR_MAX - base;
+        mr = address_space_translate(as, base, &xlat, &len, true,
+                                     MEMTXATTRS_UNSPECIFIED);
+        if (!memory_access_is_direct(mr, true)) {
+            return false;
+        }
+    }
+
+    e->gpa = base;
+    e->len = len;
+    e->hva = qemu_map_ram_ptr(mr->ram_block, xlat);
+    e->mr = mr;
+    return true;
+}
+
+/*
+ * Map a descriptor buffer through the virtqueue's translation cache.  On
+ * success the returned pointer behaves exactly like one from
+ * dma_memory_map() and must be released with dma_memory_unmap().  Returns
+ * NULL if the address is not in cacheable RAM, in which case the caller
+ * falls back to dma_memory_map().
+ *
+ * Called within rcu_read_lock().
+ */
+static void *virtqueue_map_cache_lookup(VirtQueue *vq, hwaddr pa,
+                                        hwaddr *plen)
+{
+    VirtIODevice *vdev = vq->vdev;
+    VirtQueueMapCache *cache = &vq->map_cache;
+    unsigned int gen = qatomic_read(&vdev->map_cache_gen);
+    VirtQueueMapCacheEntry *e;
+    unsigned int i;
+
+    /* IOMMU translations and the Xen map cache are not handled here */
+    if (vdev->dma_as != &address_space_memory || xen_enabled()) {
+        return NULL;
+    }
+
+    if (cache->gen != gen) {
+        memset(cache->entries, 0, sizeof(cache->entries));
+        cache->gen = gen;
+    }
+
+    for (i = 0; i < VIRTQUEUE_MAP_CACHE_ENTRIES; i++) {
+        e = &cache->entries[i];
+        if (pa - e->gpa < e->len) {
+            goto hit;
+        }
+    }
+
+    e = &cache->entries[cache->next];
+    if (!virtqueue_map_cache_fill(vq, pa, e)) {
+        e->len = 0;
+        return NULL;
+    }
+    cache->next = (cache->next + 1) % VIRTQUEUE_MAP_CACHE_ENTRIES;
+
+hit:
+    *plen = MIN(*plen, e->gpa + e->len - pa);
+    /* Balanced by the memory_region_unref() in address_space_unmap() */
+    memory_region_ref(e->mr);
+    return e->hva + (pa - e->gpa);
+}
+
+static bool virtqueue_map_desc(VirtQueue *vq, unsigned int *p_num_sg,
                                hwaddr *addr, struct iovec *iov,
                                unsigned int max_num_sg, bool is_write,
                                hwaddr pa, size_t sz)
 {
+    VirtIODevice *vdev = vq->vdev;
     bool ok = false;
     unsigned num_sg = *p_num_sg;
     assert(num_sg <= max_num_sg);
@@ -1353,11 +1645,14 @@ static bool virtqueue_map_desc(VirtIODevice *vdev, unsigned int *p_num_sg,
             goto out;
         }
 
-        iov[num_sg].iov_base = dma_memory_map(vdev->dma_as, pa, &len,
-                                              is_write ?
-                                              DMA_DIRECTION_FROM_DEVICE :
-                                              DMA_DIRECTION_TO_DEVICE,
-                                              MEMTXATTRS_UNSPECIFIED);
+        iov[num_sg].iov_base = virtqueue_map_cache_lookup(vq, pa, &len);
+        if (!iov[num_sg].iov_base) {
+            iov[num_sg].iov_base = dma_memory_map(vdev->dma_as, pa, &len,
+                                                  is_write ?
+                                                  DMA_DIRECTION_FROM_DEVICE :
+                                                  DMA_DIRECTION_TO_DEVICE,
+                                                  MEMTXATTRS_UNSPECIFIED);
+        }
         if (!iov[num_sg].iov_base) {
             virtio_error(vdev, "virtio: bogus descriptor or out of resources");
             goto out;
@@ -1426,9 +1721,14 @@ void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem)
                                                                         false);
 }
 
-static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_num)
+/*
+ * Lay out the scatter-gather arrays after the first @sz bytes of @elem and
+ * return the total size.  If @elem is NULL only the size is computed.  The
+ * size depends only on @sz and out_num + in_num.
+ */
+static size_t virtqueue_layout_element(VirtQueueElement *elem, size_t sz,
+                                       unsigned out_num, unsigned in_num)
 {
-    VirtQueueElement *elem;
     size_t in_addr_ofs = QEMU_ALIGN_UP(sz, __alignof__(elem->in_addr[0]));
     size_t out_addr_ofs = in_addr_ofs + in_num * sizeof(elem->in_addr[0]);
     size_t out_addr_end = out_addr_ofs + out_num * sizeof(elem->out_addr[0]);
@@ -1436,19 +1736,108 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     size_t out_sg_ofs = in_sg_ofs + in_num * sizeof(elem->in_sg[0]);
     size_t out_sg_end = out_sg_ofs + out_num * sizeof(elem->out_sg[0]);
 
+    if (elem) {
+        elem->out_num = out_num;
+        elem->in_num = in_num;
+        elem->in_addr = (void *)elem + in_addr_ofs;
+        elem->out_addr = (void *)elem + out_addr_ofs;
+        elem->in_sg = (void *)elem + in_sg_ofs;
+        elem->out_sg = (void *)elem + out_sg_ofs;
+    }
+    return out_sg_end;
+}
+
+static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_num)
+{
+    VirtQueueElement *elem;
+
     assert(sz >= sizeof(VirtQueueElement));
-    elem = g_malloc(out_sg_end);
+    elem = g_malloc(virtqueue_layout_element(NULL, sz, out_num, in_num));
+    trace_virtqueue_alloc_element(elem, sz, in_num, out_num);
+    virtqueue_layout_element(elem, sz, out_num, in_num);
+    elem->pool_vq = NULL;
+    return elem;
+}
+
+/* Called by the thread that pops from @vq */
+static void *virtqueue_pool_alloc_element(VirtQueue *vq, size_t sz,
+                                          unsigned out_num, unsigned in_num)
+{
+    VirtQueueElement *elem;
+
+    if (sz != vq->elem_pool_sz ||
+        out_num + in_num > VIRTQUEUE_ELEM_POOL_MAX_SG) {
+        return virtqueue_alloc_element(sz, out_num, in_num);
+    }
+
+    elem = QSLIST_FIRST(&vq->elem_alloc_pool);
+    if (!elem) {
+        QSLIST_MOVE_ATOMIC(&vq->elem_alloc_pool, &vq->elem_release_pool);
+        elem = QSLIST_FIRST(&vq->elem_alloc_pool);
+    }
+    if (elem) {
+        QSLIST_REMOVE_HEAD(&vq->elem_alloc_pool, pool_next);
+        qatomic_dec(&vq->elem_pool_size);
+    } else {
+        elem = g_malloc(virtqueue_layout_element(NULL, sz,
+                                                 VIRTQUEUE_ELEM_POOL_MAX_SG,
+                                                 0));
+    }
+
     trace_virtqueue_alloc_element(elem, sz, in_num, out_num);
-    elem->out_num = out_num;
-    elem->in_num = in_num;
-    elem->in_addr = (void *)elem + in_addr_ofs;
-    elem->out_addr = (void *)elem + out_addr_ofs;
-    elem->in_sg = (void *)elem + in_sg_ofs;
-    elem->out_sg = (void *)elem + out_sg_ofs;
+    virtqueue_layout_element(elem, sz, out_num, in_num);
+    elem->pool_vq = vq;
     return elem;
 }
 
-static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+/*
+ * virtqueue_element_free:
+ * @elem: element returned by virtqueue_pop() or virtqueue_pop_batch()
+ *
+ * Release an element, returning it to its virtqueue's pool if it was
+ * allocated from one.  Elements that were not pooled are simply freed, so
+ * this is always a valid replacement for g_free().  May be called from
+ * any thread.
+ */
+void virtqueue_element_free(VirtQueueElement *elem)
+{
+    VirtQueue *vq;
+
+    if (!elem) {
+        return;
+    }
+
+    vq = elem->pool_vq;
+    if (vq && qatomic_read(&vq->elem_pool_size) < vq->vring.num) {
+        QSLIST_INSERT_HEAD_ATOMIC(&vq->elem_release_pool, elem, pool_next);
+        qatomic_inc(&vq->elem_pool_size);
+        return;
+    }
+    g_free(elem);
+}
+
+static void virtqueue_elem_pool_destroy(VirtQueue *vq)
+{
+    VirtQueueElement *elem, *next;
+
+    QSLIST_FOREACH_SAFE(elem, &vq->elem_alloc_pool, pool_next, next) {
+        g_free(elem);
+    }
+    QSLIST_MOVE_ATOMIC(&vq->elem_alloc_pool, &vq->elem_release_pool);
+    QSLIST_FOREACH_SAFE(elem, &vq->elem_alloc_pool, pool_next, next) {
+        g_free(elem);
+    }
+    QSLIST_INIT(&vq->elem_alloc_pool);
+    vq->elem_pool_size = 0;
+    vq->elem_pool_sz = 0;
+}
+
+/*
+ * Called within rcu_read_lock().  When @batch is true the element is taken
+ * from the virtqueue's element pool and the caller is responsible for
+ * updating the avail event.
+ */
+static void *virtqueue_split_pop_rcu(VirtQueue *vq, size_t sz, bool batch)
 {
     unsigned int i, head, max;
     VRingMemoryRegionCaches *caches;
@@ -1463,7 +1852,6 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     VRingDesc desc;
     int rc;
 
-    RCU_READ_LOCK_GUARD();
     if (virtio_queue_empty_rcu(vq)) {
         goto done;
     }
@@ -1485,7 +1873,7 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
         goto done;
     }
 
-    if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
+    if (!batch && virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
         vring_set_avail_event(vq, vq->last_avail_idx);
     }
 
@@ -1529,7 +1917,7 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
         bool map_ok;
 
         if (desc.flags & VRING_DESC_F_WRITE) {
-            map_ok = virtqueue_map_desc(vdev, &in_num, addr + out_num,
+            map_ok = virtqueue_map_desc(vq, &in_num, addr + out_num,
                                         iov + out_num,
                                         VIRTQUEUE_MAX_SIZE - out_num, true,
                                         desc.addr, desc.len);
@@ -1538,7 +1926,7 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
                 virtio_error(vdev, "Incorrect order for descriptors");
                 goto err_undo_map;
             }
-            map_ok = virtqueue_map_desc(vdev, &out_num, addr, iov,
+            map_ok = virtqueue_map_desc(vq, &out_num, addr, iov,
                                         VIRTQUEUE_MAX_SIZE, false,
                                         desc.addr, desc.len);
         }
@@ -1560,7 +1948,11 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     }
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    if (batch) {
+        elem = virtqueue_pool_alloc_element(vq, sz, out_num, in_num);
+    } else {
+        elem = virtqueue_alloc_element(sz, out_num, in_num);
+    }
     elem->index = head;
     elem->ndescs = 1;
     for (i = 0; i < out_num; i++) {
@@ -1585,7 +1977,11 @@ err_undo_map:
     goto done;
 }
 
-static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
+/*
+ * Called within rcu_read_lock().  When @batch is true the element is taken
+ * from the virtqueue's element pool.
+ */
+static void *virtqueue_packed_pop_rcu(VirtQueue *vq, size_t sz, bool batch)
 {
     unsigned int i, max;
     VRingMemoryRegionCaches *caches;
@@ -1601,7 +1997,6 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
     uint16_t id;
     int rc;
 
-    RCU_READ_LOCK_GUARD();
     if (virtio_queue_packed_empty_rcu(vq)) {
         goto done;
     }
@@ -1657,7 +2052,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
         bool map_ok;
 
         if (desc.flags & VRING_DESC_F_WRITE) {
-            map_ok = virtqueue_map_desc(vdev, &in_num, addr + out_num,
+            map_ok = virtqueue_map_desc(vq, &in_num, addr + out_num,
                                         iov + out_num,
                                         VIRTQUEUE_MAX_SIZE - out_num, true,
                                         desc.addr, desc.len);
@@ -1666,7 +2061,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
                 virtio_error(vdev, "Incorrect order for descriptors");
                 goto err_undo_map;
             }
-            map_ok = virtqueue_map_desc(vdev, &out_num, addr, iov,
+            map_ok = virtqueue_map_desc(vq, &out_num, addr, iov,
                                         VIRTQUEUE_MAX_SIZE, false,
                                         desc.addr, desc.len);
         }
@@ -1686,7 +2081,11 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
     } while (rc == VIRTQUEUE_READ_DESC_MORE);
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    if (batch) {
+        elem = virtqueue_pool_alloc_element(vq, sz, out_num, in_num);
+    } else {
+        elem = virtqueue_alloc_element(sz, out_num, in_num);
+    }
     for (i = 0; i < out_num; i++) {
         elem->out_addr[i] = addr[i];
         elem->out_sg[i] = iov[i];
@@ -1726,13 +2125,65 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
         return NULL;
     }
 
+    RCU_READ_LOCK_GUARD();
     if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
-        return virtqueue_packed_pop(vq, sz);
+        return virtqueue_packed_pop_rcu(vq, sz, false);
     } else {
-        return virtqueue_split_pop(vq, sz);
+        return virtqueue_split_pop_rcu(vq, sz, false);
     }
 }
 
+/*
+ * virtqueue_pop_batch:
+ * @vq: The #VirtQueue
+ * @sz: size of the element structure to allocate, as for virtqueue_pop()
+ * @elems: array receiving the popped elements
+ * @max: maximum number of elements to pop
+ *
+ * Pop up to @max elements with a single RCU critical section.  Elements
+ * come from a per-virtqueue pool and must be released with
+ * virtqueue_element_free().  With VIRTIO_RING_F_EVENT_IDX the avail event
+ * is published once for the whole batch.
+ *
+ * Returns: the number of elements stored in @elems.
+ */
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int max)
+{
+    VirtIODevice *vdev = vq->vdev;
+    bool packed = virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED);
+    unsigned int n = 0;
+
+    if (virtio_device_disabled(vdev)) {
+        return 0;
+    }
+
+    assert(sz >= sizeof(VirtQueueElement));
+    if (!vq->elem_pool_sz) {
+        vq->elem_pool_sz = sz;
+    }
+
+    RCU_READ_LOCK_GUARD();
+    while (n < max) {
+        void *elem;
+
+        if (packed) {
+            elem = virtqueue_packed_pop_rcu(vq, sz, true);
+        } else {
+            elem = virtqueue_split_pop_rcu(vq, sz, true);
+        }
+        if (!elem) {
+            break;
+        }
+        elems[n++] = elem;
+    }
+
+    if (n && !packed && virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+    return n;
+}
+
 static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
 {
     VRingMemoryRegionCaches *caches;
@@ -2065,6 +2516,8 @@ void virtio_reset(void *opaque)
         vdev->vq[i].notification = true;
         vdev->vq[i].vring.num = vdev->vq[i].vring.num_default;
         vdev->vq[i].inuse = 0;
+        vdev->vq[i].used_pending = 0;
+        virtio_queue_irq_coalesce_cancel(&vdev->vq[i]);
         virtio_virtqueue_reset_region_cache(&vdev->vq[i]);
     }
 }
@@ -2431,6 +2884,7 @@ VirtQueue *virtio_add_queue(VirtIODevice *vdev, int queue_size,
     vdev->vq[i].vring.align = VIRTIO_PCI_VRING_ALIGN;
     vdev->vq[i].handle_output = handle_output;
     vdev->vq[i].used_elems = g_new0(VirtQueueElement, queue_size);
+    virtio_queue_irq_coalesce_init(&vdev->vq[i]);
 
     return &vdev->vq[i];
 }
@@ -2442,6 +2896,8 @@ void virtio_delete_queue(VirtQueue *vq)
     vq->handle_output = NULL;
     g_free(vq->used_elems);
     vq->used_elems = NULL;
+    virtqueue_elem_pool_destroy(vq);
+    virtio_queue_irq_coalesce_cleanup(vq);
     virtio_virtqueue_reset_region_cache(vq);
 }
 
@@ -2467,7 +2923,8 @@ static void virtio_set_isr(VirtIODevice *vdev, int value)
 }
 
 /* Called within rcu_read_lock(). */
-static bool virtio_split_should_notify(VirtIODevice *vdev, VirtQueue *vq)
+static bool virtio_split_should_notify(VirtIODevice *vdev, VirtQueue *vq,
+                                       bool update)
 {
     uint16_t old, new;
     bool v;
@@ -2484,9 +2941,12 @@ static bool virtio_split_should_notify(VirtIODevice *vdev, VirtQueue *vq)
     }
 
     v = vq->signalled_used_valid;
-    vq->signalled_used_valid = true;
     old = vq->signalled_used;
-    new = vq->signalled_used = vq->used_idx;
+    new = vq->used_idx;
+    if (update) {
+        vq->signalled_used_valid = true;
+        vq->signalled_used = new;
+    }
     return !v || vring_need_event(vring_get_used_event(vq), new, old);
 }
 
@@ -2504,7 +2964,8 @@ static bool vring_packed_need_event(VirtQueue *vq, bool wrap,
 }
 
 /* Called within rcu_read_lock(). */
-static bool virtio_packed_should_notify(VirtIODevice *vdev, VirtQueue *vq)
+static bool virtio_packed_should_notify(VirtIODevice *vdev, VirtQueue *vq,
+                                        bool update)
 {
     VRingPackedDescEvent e;
     uint16_t old, new;
@@ -2519,9 +2980,12 @@ static bool virtio_packed_should_notify(VirtIODevice *vdev, VirtQueue *vq)
     vring_packed_event_read(vdev, &caches->avail, &e);
 
     old = vq->signalled_used;
-    new = vq->signalled_used = vq->used_idx;
+    new = vq->used_idx;
     v = vq->signalled_used_valid;
-    vq->signalled_used_valid = true;
+    if (update) {
+        vq->signalled_used = new;
+        vq->signalled_used_valid = true;
+    }
 
     if (e.flags == VRING_PACKED_EVENT_FLAG_DISABLE) {
         return false;
@@ -2533,20 +2997,238 @@ static bool virtio_packed_should_notify(VirtIODevice *vdev, VirtQueue *vq)
                                          e.off_wrap, new, old);
 }
 
-/* Called within rcu_read_lock().  */
-static bool virtio_should_notify(VirtIODevice *vdev, VirtQueue *vq)
+/*
+ * Called within rcu_read_lock().  With @update false the signalled used
+ * index is left alone, so that the used event check can be repeated later
+ * over a larger range of used entries.
+ */
+static bool virtio_should_notify(VirtIODevice *vdev, VirtQueue *vq,
+                                 bool update)
 {
     if (virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
-        return virtio_packed_should_notify(vdev, vq);
+        return virtio_packed_should_notify(vdev, vq, update);
     } else {
-        return virtio_split_should_notify(vdev, vq);
+        return virtio_split_should_notify(vdev, vq, update);
     }
 }
 
-void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
+/*
+ * For devices that relay used buffers themselves, such as vhost shadow
+ * virtqueues: tell whether the driver wants an interrupt for the entries
+ * flushed since the last one.
+ */
+bool virtio_queue_should_notify(VirtIODevice *vdev, VirtQueue *vq)
+{
+    RCU_READ_LOCK_GUARD();
+    return virtio_should_notify(vdev, vq, true);
+}
+
+static void virtio_notify_irqfd_deliver(VirtIODevice *vdev, VirtQueue *vq);
+static void virtio_notify_deliver(VirtIODevice *vdev, VirtQueue *vq);
+
+/*
+ * Send the interrupt that is being held back, if any.  Called from the main
+ * loop with the BQL held; @from_timer tells whether max-delay expired.
+ */
+static void virtio_queue_irq_coalesce_deliver(VirtQueue *vq, bool from_timer)
+{
+    VirtQueueIRQCoalesce *c = vq->irq_coalesce;
+    AioContext *ctx;
+    bool irqfd;
+
+    WITH_QEMU_LOCK_GUARD(&c->lock) {
+        if (!c->pending) {
+            return;
+        }
+        ctx = c->ctx;
+    }
+
+    aio_context_acquire(ctx);
+    WITH_QEMU_LOCK_GUARD(&c->lock) {
+        if (!c->pending) {
+            aio_context_release(ctx);
+            return;
+        }
+        timer_del(c->timer);
+        c->pending = false;
+        c->frames = 0;
+        if (from_timer) {
+            c->timer_flushes++;
+        }
+        irqfd = c->irqfd;
+    }
+
+    trace_virtio_irq_coalesce_flush(vq->vdev, vq, false);
+    if (irqfd) {
+        virtio_notify_irqfd_deliver(vq->vdev, vq);
+    } else {
+        virtio_notify_deliver(vq->vdev, vq);
+    }
+    aio_context_release(ctx);
+}
+
+static void virtio_queue_irq_coalesce_timer_cb(void *opaque)
+{
+    virtio_queue_irq_coalesce_deliver(opaque, true);
+}
+
+/*
+ * Pick the delay from the notification rate seen in the last window: idle
+ * queues get their interrupts immediately, busy ones wait longer, up to
+ * max-delay once max-frames notifications arrive within that time.
+ *
+ * Called with c->lock held.
+ */
+static void virtio_queue_irq_coalesce_adapt(VirtIODevice *vdev,
+                                            VirtQueueIRQCoalesce *c,
+                                            int64_t now)
+{
+    int64_t max_delay_ns = vdev->irq_coalesce_max_delay_us * SCALE_US;
+    int64_t elapsed = now - c->window_start_ns;
+    uint64_t rate;
+
+    c->window_requests++;
+    if (elapsed < VIRTQUEUE_IRQ_COALESCE_WINDOW_NS) {
+        return;
+    }
+
+    if (!vdev->irq_coalesce_adaptive) {
+        c->delay_ns = max_delay_ns;
+    } else {
+        /* Notifications expected during one max-delay period */
+        rate = c->window_requests * max_delay_ns / elapsed;
+        if (rate < 2) {
+            c->delay_ns = 0;
+        } else {
+            rate = MIN(rate, vdev->irq_coalesce_max_frames);
+            c->delay_ns = max_delay_ns * rate / vdev->irq_coalesce_max_frames;
+        }
+    }
+    c->window_start_ns = now;
+    c->window_requests = 0;
+}
+
+/*
+ * Decide whether a notification should be held back.  Returns true if the
+ * interrupt was deferred or is not wanted by the driver yet, false if the
+ * caller must deliver it now.
+ */
+static bool virtio_queue_irq_coalesce(VirtQueue *vq, bool irqfd)
 {
+    VirtIODevice *vdev = vq->vdev;
+    VirtQueueIRQCoalesce *c = vq->irq_coalesce;
+    AioContext *ctx = qemu_get_current_aio_context();
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+
+    QEMU_LOCK_GUARD(&c->lock);
+
+    c->requests++;
+    virtio_queue_irq_coalesce_adapt(vdev, c, now);
+
+    /*
+     * Once the VM is stopping, the virtual clock no longer runs the timer
+     * and the pending state is not migrated: completions from the drains
+     * that follow must be delivered at once.
+     */
+    if (c->delay_ns == 0 || !qatomic_read(&vdev->vm_running) ||
+        ++c->frames >= vdev->irq_coalesce_max_frames) {
+        if (c->pending) {
+            timer_del(c->timer);
+            c->pending = false;
+            c->frames_flushes++;
+            trace_virtio_irq_coalesce_flush(vdev, vq, true);
+        }
+        c->frames = 0;
+        return false;
+    }
+
+    if (c->pending) {
+        c->deferred++;
+        c->irqfd |= irqfd;
+        return true;
+    }
+
+    /*
+     * If the driver has suppressed interrupts (flags or used event) there
+     * is nothing to hold back yet.  The signalled used index is left alone
+     * so that the used event is checked against all entries used since the
+     * last interrupt when a later completion crosses it.
+     */
     WITH_RCU_READ_LOCK_GUARD() {
-        if (!virtio_should_notify(vdev, vq)) {
+        if (!virtio_should_notify(vdev, vq, false)) {
+            return true;
+        }
+    }
+
+    c->deferred++;
+    c->ctx = ctx;
+    c->pending = true;
+    c->irqfd = irqfd;
+    timer_mod(c->timer, now + c->delay_ns);
+    trace_virtio_irq_coalesce_defer(vdev, vq, c->delay_ns);
+    return true;
+}
+
+/* Deliver an interrupt that is being held back, if any */
+static void virtio_queue_irq_coalesce_flush(VirtQueue *vq)
+{
+    if (vq->irq_coalesce) {
+        virtio_queue_irq_coalesce_deliver(vq, false);
+    }
+}
+
+/* Drop an interrupt that is being held back, e.g. on reset */
+static void virtio_queue_irq_coalesce_cancel(VirtQueue *vq)
+{
+    VirtQueueIRQCoalesce *c = vq->irq_coalesce;
+
+    if (!c) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&c->lock);
+    timer_del(c->timer);
+    c->pending = false;
+    c->frames = 0;
+}
+
+static void virtio_queue_irq_coalesce_init(VirtQueue *vq)
+{
+    VirtQueueIRQCoalesce *c;
+
+    if (!vq->vdev->irq_coalesce_max_delay_us) {
+        return;
+    }
+
+    c = g_new0(VirtQueueIRQCoalesce, 1);
+    qemu_mutex_init(&c->lock);
+    c->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
+                            virtio_queue_irq_coalesce_timer_cb, vq);
+    c->window_start_ns = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    if (!vq->vdev->irq_coalesce_adaptive) {
+        c->delay_ns = vq->vdev->irq_coalesce_max_delay_us * SCALE_US;
+    }
+    vq->irq_coalesce = c;
+}
+
+static void virtio_queue_irq_coalesce_cleanup(VirtQueue *vq)
+{
+    VirtQueueIRQCoalesce *c = vq->irq_coalesce;
+
+    if (!c) {
+        return;
+    }
+
+    timer_free(c->timer);
+    qemu_mutex_destroy(&c->lock);
+    g_free(c);
+    vq->irq_coalesce = NULL;
+}
+
+static void virtio_notify_irqfd_deliver(VirtIODevice *vdev, VirtQueue *vq)
+{
+    WITH_RCU_READ_LOCK_GUARD() {
+        if (!virtio_should_notify(vdev, vq, true)) {
             return;
         }
     }
@@ -2572,16 +3254,24 @@ void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
     event_notifier_set(&vq->guest_notifier);
 }
 
+void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
+{
+    if (vq->irq_coalesce && virtio_queue_irq_coalesce(vq, true)) {
+        return;
+    }
+    virtio_notify_irqfd_deliver(vdev, vq);
+}
+
 static void virtio_irq(VirtQueue *vq)
 {
     virtio_set_isr(vq->vdev, 0x1);
     virtio_notify_vector(vq->vdev, vq->vector);
 }
 
-void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
+static void virtio_notify_deliver(VirtIODevice *vdev, VirtQueue *vq)
 {
     WITH_RCU_READ_LOCK_GUARD() {
-        if (!virtio_should_notify(vdev, vq)) {
+        if (!virtio_should_notify(vdev, vq, true)) {
             return;
         }
     }
@@ -2590,6 +3280,14 @@ void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
     virtio_irq(vq);
 }
 
+void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
+{
+    if (vq->irq_coalesce && virtio_queue_irq_coalesce(vq, false)) {
+        return;
+    }
+    virtio_notify_deliver(vdev, vq);
+}
+
 void virtio_notify_config(VirtIODevice *vdev)
 {
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK))
@@ -3231,7 +3929,9 @@ static void virtio_vmstate_change(void *opaque, bool running, RunState state)
     BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
     bool backend_run = running && virtio_device_started(vdev, vdev->status);
-    vdev->vm_running = running;
+    int i;
+
+    qatomic_set(&vdev->vm_running, running);
 
     if (backend_run) {
         virtio_set_status(vdev, vdev->status);
@@ -3244,6 +3944,17 @@ static void virtio_vmstate_change(void *opaque, bool running, RunState state)
     if (!backend_run) {
         virtio_set_status(vdev, vdev->status);
     }
+
+    /*
+     * Held back interrupts must reach the guest before it is saved.  Do it
+     * after the backend was stopped, so that nothing it completed while
+     * draining is left behind.
+     */
+    if (!running) {
+        for (i = 0; i < VIRTIO_QUEUE_MAX && vdev->vq[i].vring.num; i++) {
+            virtio_queue_irq_coalesce_flush(&vdev->vq[i]);
+        }
+    }
 }
 
 void virtio_instance_init_common(Object *proxy_obj, void *data,
@@ -3642,6 +4353,25 @@ void virtio_device_set_child_bus_name(VirtIODevice *vdev, char *bus_name)
     vdev->bus_name = g_strdup(bus_name);
 }
 
+static void virtio_set_needs_reset(VirtIODevice *vdev)
+{
+    if (virtio_vdev_has_feature(vdev, VIRTIO_F_VERSION_1)) {
+        vdev->status = vdev->status | VIRTIO_CONFIG_S_NEEDS_RESET;
+        virtio_notify_config(vdev);
+    }
+}
+
+static void virtio_error_bh(void *opaque)
+{
+    VirtIODevice *vdev = opaque;
+
+    /* Nothing to report if the device was reset in the meantime */
+    if (vdev->broken) {
+        virtio_set_needs_reset(vdev);
+    }
+    object_unref(OBJECT(vdev));
+}
+
 void G_GNUC_PRINTF(2, 3) virtio_error(VirtIODevice *vdev, const char *fmt, ...)
 {
     va_list ap;
@@ -3650,12 +4380,30 @@ void G_GNUC_PRINTF(2, 3) virtio_error(VirtIODevice *vdev, const char *fmt, ...)
     error_vreport(fmt, ap);
     va_end(ap);
 
-    if (virtio_vdev_has_feature(vdev, VIRTIO_F_VERSION_1)) {
-        vdev->status = vdev->status | VIRTIO_CONFIG_S_NEEDS_RESET;
-        virtio_notify_config(vdev);
+    vdev->broken = true;
+
+    /*
+     * Device status and the config interrupt belong to the main loop.  An
+     * IOThread that finds the device broken leaves them to a bottom half.
+     */
+    if (qemu_mutex_iothread_locked()) {
+        virtio_set_needs_reset(vdev);
+    } else {
+        object_ref(OBJECT(vdev));
+        aio_bh_schedule_oneshot(qemu_get_aio_context(), virtio_error_bh, vdev);
     }
+}
 
-    vdev->broken = true;
+static void virtio_memory_listener_begin(MemoryListener *listener)
+{
+    VirtIODevice *vdev = container_of(listener, VirtIODevice, listener);
+
+    /*
+     * Invalidate descriptor translation caches both before the new memory
+     * map is published and after it is complete, so that entries created
+     * from the old map during the transaction are not used later.
+     */
+    qatomic_inc(&vdev->map_cache_gen);
 }
 
 static void virtio_memory_listener_commit(MemoryListener *listener)
@@ -3663,6 +4411,8 @@ static void virtio_memory_listener_commit(MemoryListener *listener)
     VirtIODevice *vdev = container_of(listener, VirtIODevice, listener);
     int i;
 
+    qatomic_inc(&vdev->map_cache_gen);
+
     for (i = 0; i < VIRTIO_QUEUE_MAX; i++) {
         if (vdev->vq[i].vring.num == 0) {
             break;
@@ -3680,6 +4430,11 @@ static void virtio_device_realize(DeviceState *dev, Error **errp)
     /* Devices should either use vmsd or the load/save methods */
     assert(!vdc->vmsd || !vdc->load);
 
+    if (vdev->irq_coalesce_max_delay_us && !vdev->irq_coalesce_max_frames) {
+        error_setg(errp, "x-irq-coalesce-max-frames must be at least 1");
+        return;
+    }
+
     if (vdc->realize != NULL) {
         vdc->realize(dev, &err);
         if (err != NULL) {
@@ -3695,6 +4450,7 @@ static void virtio_device_realize(DeviceState *dev, Error **errp)
         return;
     }
 
+    vdev->listener.begin = virtio_memory_listener_begin;
     vdev->listener.commit = virtio_memory_listener_commit;
     vdev->listener.name = "virtio";
     memory_listener_register(&vdev->listener, vdev->dma_as);
@@ -3748,10 +4504,68 @@ static Property virtio_properties[] = {
     DEFINE_PROP_BOOL("use-disabled-flag", VirtIODevice, use_disabled_flag, true),
     DEFINE_PROP_BOOL("x-disable-legacy-check", VirtIODevice,
                      disable_legacy_check, false),
+    DEFINE_PROP_UINT32("x-irq-coalesce-max-delay-us", VirtIODevice,
+                       irq_coalesce_max_delay_us, 0),
+    DEFINE_PROP_UINT32("x-irq-coalesce-max-frames", VirtIODevice,
+                       irq_coalesce_max_frames, 32),
+    DEFINE_PROP_BOOL("x-irq-coalesce-adaptive", VirtIODevice,
+                     irq_coalesce_adaptive, true),
     DEFINE_PROP_END_OF_LIST(),
 };
 
-static int virtio_device_start_ioeventfd_impl(VirtIODevice *vdev)
+static void virtio_get_irq_coalesce_stats(Object *obj, Visitor *v,
+                                          const char *name, void *opaque,
+                                          Error **errp)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(obj);
+    Error *err = NULL;
+    int i;
+
+    if (!visit_start_struct(v, name, NULL, 0, &err)) {
+        goto out;
+    }
+    for (i = 0; i < VIRTIO_QUEUE_MAX && vdev->vq[i].vring.num; i++) {
+        VirtQueueIRQCoalesce *c = vdev->vq[i].irq_coalesce;
+        g_autofree char *vq_name = g_strdup_printf("vq%d", i);
+        uint64_t requests, deferred, frames_flushes, timer_flushes;
+        int64_t delay_ns;
+
+        if (!c) {
+            continue;
+        }
+
+        WITH_QEMU_LOCK_GUARD(&c->lock) {
+            requests = c->requests;
+            deferred = c->deferred;
+            frames_flushes = c->frames_flushes;
+            timer_flushes = c->timer_flushes;
+            delay_ns = c->delay_ns;
+        }
+
+        if (!visit_start_struct(v, vq_name, NULL, 0, &err)) {
+            goto out_end;
+        }
+        if (visit_type_uint64(v, "requests", &requests, &err) &&
+            visit_type_uint64(v, "deferred", &deferred, &err) &&
+            visit_type_uint64(v, "max-frames-flushes", &frames_flushes,
+                              &err) &&
+            visit_type_uint64(v, "max-delay-flushes", &timer_flushes, &err) &&
+            visit_type_int(v, "delay-ns", &delay_ns, &err)) {
+            visit_check_struct(v, &err);
+        }
+        visit_end_struct(v, NULL);
+        if (err) {
+            goto out_end;
+        }
+    }
+    visit_check_struct(v, &err);
+out_end:
+    visit_end_struct(v, NULL);
+out:
+    error_propagate(errp, err);
+}
+
+int virtio_device_start_ioeventfd_impl(VirtIODevice *vdev)
 {
     VirtioBusState *qbus = VIRTIO_BUS(qdev_get_parent_bus(DEVICE(vdev)));
     int i, n, r, err;
@@ -3821,7 +4635,7 @@ int virtio_device_start_ioeventfd(VirtIODevice *vdev)
     return virtio_bus_start_ioeventfd(vbus);
 }
 
-static void virtio_device_stop_ioeventfd_impl(VirtIODevice *vdev)
+void virtio_device_stop_ioeventfd_impl(VirtIODevice *vdev)
 {
     VirtioBusState *qbus = VIRTIO_BUS(qdev_get_parent_bus(DEVICE(vdev)));
     int n, r;
@@ -3881,6 +4695,8 @@ static void virtio_device_class_init(ObjectClass *klass, void *data)
     dc->unrealize = virtio_device_unrealize;
     dc->bus_type = TYPE_VIRTIO_BUS;
     device_class_set_props(dc, virtio_properties);
+    object_class_property_add(klass, "x-irq-coalesce-stats", "any",
+                              virtio_get_irq_coalesce_stats, NULL, NULL, NULL);
     vdc->start_ioeventfd = virtio_device_start_ioeventfd_impl;
     vdc->stop_ioeventfd = virtio_device_stop_ioeventfd_impl;
 
@@ -229,7 +229,8 @@ struct AioContext {
     int poll_disable_cnt;
 
     /* Polling mode parameters */
-    int64_t poll_ns;        /* current polling time in nanoseconds */
+    int64_t poll_ns;        /* current polling time in nanoseconds, the
+                               maximum of the per-handler polling times */
     int64_t poll_max_ns;    /* maximum polling time in nanoseconds */
     int64_t poll_grow;      /* polling time growth factor */
     int64_t poll_shrink;    /* polling time shrink factor */
@@ -762,6 +763,30 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
                                  int64_t grow, int64_t shrink,
                                  Error **errp);
 
+typedef struct {
+    int fd;
+    int64_t poll_ns;        /* current polling time of the handler */
+    uint64_t poll_hits;     /* events detected by userspace polling */
+    uint64_t poll_misses;   /* events detected by fd monitoring instead */
+    uint64_t poll_time_ns;  /* time spent polling while handler was polled */
+} AioPollHandlerStats;
+
+typedef void AioPollHandlerStatsFn(const AioPollHandlerStats *stats,
+                                   void *opaque);
+
+/**
+ * aio_context_foreach_poll_handler:
+ * @ctx: the aio context
+ * @fn: function called with the statistics of each handler
+ * @opaque: user data passed to @fn
+ *
+ * Report adaptive polling statistics for every handler in @ctx that
+ * supports polling.  May be called from any thread.
+ */
+void aio_context_foreach_poll_handler(AioContext *ctx,
+                                      AioPollHandlerStatsFn *fn,
+                                      void *opaque);
+
 /**
  * aio_context_set_aio_params:
  * @ctx: the aio context
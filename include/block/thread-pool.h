@@ -37,4 +37,24 @@ int coroutine_fn thread_pool_submit_co(ThreadPool *pool,
 void thread_pool_submit(ThreadPool *pool, ThreadPoolFunc *func, void *arg);
 void thread_pool_update_params(ThreadPool *pool, struct AioContext *ctx);
 
+typedef struct ThreadPoolStats {
+    uint64_t submitted;
+    uint64_t completed;
+    uint64_t canceled;
+    /* Completion bottom half runs that found finished requests */
+    uint64_t batches;
+    /* Time from submission until a worker picked the request up */
+    uint64_t queue_ns;
+    uint64_t max_queue_ns;
+    /* Time spent running requests in workers */
+    uint64_t run_ns;
+    /* Requests waiting for a worker, now and at most */
+    unsigned int queue_depth;
+    unsigned int max_queue_depth;
+    int threads;
+} ThreadPoolStats;
+
+/* Must be called from the AioContext the pool belongs to. */
+void thread_pool_get_stats(ThreadPool *pool, ThreadPoolStats *stats);
+
 #endif
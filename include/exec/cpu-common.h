@@ -152,6 +152,8 @@ typedef int (RAMBlockIterFunc)(RAMBlock *rb, void *opaque);
 
 int qemu_ram_foreach_block(RAMBlockIterFunc func, void *opaque);
 int ram_block_discard_range(RAMBlock *rb, uint64_t start, size_t length);
+int ram_block_discard_range_unless_disabled(RAMBlock *rb, uint64_t start,
+                                            size_t length);
 
 #endif
 
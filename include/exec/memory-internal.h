@@ -23,9 +23,17 @@
 #include "cpu.h"
 
 #ifndef CONFIG_USER_ONLY
+AddressSpaceDispatch *flatview_build_dispatch(FlatView *fv);
+
+/*
+ * Dispatch tables are built the first time a FlatView is used for an
+ * access, so that views nobody accesses never pay for one.
+ */
 static inline AddressSpaceDispatch *flatview_to_dispatch(FlatView *fv)
 {
-    return fv->dispatch;
+    AddressSpaceDispatch *d = qatomic_rcu_read(&fv->dispatch);
+
+    return likely(d) ? d : flatview_build_dispatch(fv);
 }
 
 static inline AddressSpaceDispatch *address_space_to_dispatch(AddressSpace *as)
@@ -42,7 +50,8 @@ bool memory_region_access_valid(MemoryRegion *mr, hwaddr addr,
                                 unsigned size, bool is_write,
                                 MemTxAttrs attrs);
 
-void flatview_add_to_dispatch(FlatView *fv, MemoryRegionSection *section);
+void flatview_add_to_dispatch(FlatView *fv, AddressSpaceDispatch *d,
+                              MemoryRegionSection *section);
 AddressSpaceDispatch *address_space_dispatch_new(FlatView *fv);
 void address_space_dispatch_compact(AddressSpaceDispatch *d);
 void address_space_dispatch_free(AddressSpaceDispatch *d);
@@ -1044,9 +1044,12 @@ struct AddressSpace {
     struct FlatView *current_map;
 
     int ioeventfd_nb;
+    int ioeventfd_notifiers;
     struct MemoryRegionIoeventfd *ioeventfds;
     QTAILQ_HEAD(, MemoryListener) listeners;
     QTAILQ_ENTRY(AddressSpace) address_spaces_link;
+    /* Switching to a different FlatView in the current topology commit */
+    bool flatview_changing;
 };
 
 typedef struct AddressSpaceDispatch AddressSpaceDispatch;
@@ -1063,6 +1066,8 @@ struct FlatView {
     unsigned nr_allocated;
     struct AddressSpaceDispatch *dispatch;
     MemoryRegion *root;
+    /* Alias targets reached while rendering, compared as pointers only */
+    GHashTable *alias_targets;
 };
 
 static inline FlatView *address_space_to_flatview(AddressSpace *as)
@@ -61,6 +61,13 @@ struct RAMBlock {
      */
     unsigned long *clear_bmap;
     uint8_t clear_bmap_shift;
+    /*
+     * How many clear_bmap chunks the migration clear thread may clear
+     * with one call, ahead of the migration thread; 0 leaves clearing to
+     * the migration thread.  Adjusted after every bitmap sync from how
+     * much of the block the guest dirtied again.
+     */
+    unsigned int clear_batch;
 
     /*
      * RAM block length that corresponds to the used_length on the migration
@@ -389,6 +389,9 @@ struct CPUState {
     struct kvm_dirty_gfn *kvm_dirty_gfns;
     uint32_t kvm_fetch_index;
     uint64_t dirty_pages;
+    /* Pages harvested per second from the dirty ring, and its baseline */
+    uint64_t dirty_pages_rate;
+    uint64_t dirty_pages_sampled;
 
     /* Used for events with 'vcpu' and *without* the 'disabled' properties */
     DECLARE_BITMAP(trace_dstate_delayed, CPU_TRACE_DSTATE_MAX_EVENTS);
@@ -98,6 +98,10 @@ struct vhost_dev {
     const VhostOps *vhost_ops;
     void *opaque;
     struct vhost_log *log;
+    /* Memory table updates sent to the backend and the time they took */
+    uint64_t mem_table_updates;
+    uint64_t mem_table_update_ns;
+    uint64_t mem_table_update_max_ns;
     QLIST_ENTRY(vhost_dev) entry;
     QLIST_HEAD(, vhost_iommu) iommu_list;
     IOMMUNotifier n;
@@ -26,6 +26,7 @@ OBJECT_DECLARE_SIMPLE_TYPE(VirtIOBalloon, VIRTIO_BALLOON)
 #define VIRTIO_BALLOON_FREE_PAGE_HINT_CMD_ID_MIN 0x80000000
 
 typedef struct virtio_balloon_stat VirtIOBalloonStat;
+typedef struct VirtIOBalloonReport VirtIOBalloonReport;
 
 typedef struct virtio_balloon_stat_modern {
        uint16_t tag;
@@ -71,6 +72,12 @@ struct VirtIOBalloon {
 
     bool qemu_4_0_config_size;
     uint32_t poison_val;
+
+    /* Free page reporting batch being discarded by the thread pool */
+    VirtIOBalloonReport *report;
+    uint64_t report_batches;
+    uint64_t report_discarded_bytes;
+    uint64_t report_discard_ns;
 };
 
 #endif
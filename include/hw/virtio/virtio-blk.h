@@ -36,6 +36,7 @@ struct VirtIOBlkConf
 {
     BlockConf conf;
     IOThread *iothread;
+    char *iothread_vq_mapping;  /* colon-separated list of IOThread ids */
     char *serial;
     uint32_t request_merging;
     uint16_t num_queues;
@@ -50,6 +51,7 @@ struct VirtIOBlkConf
 struct VirtIOBlockDataPlane;
 
 struct VirtIOBlockReq;
+struct VirtIOBlockVqCompletion;
 struct VirtIOBlock {
     VirtIODevice parent_obj;
     BlockBackend *blk;
@@ -64,6 +66,16 @@ struct VirtIOBlock {
     struct VirtIOBlockDataPlane *dataplane;
     uint64_t host_features;
     size_t config_size;
+
+    /*
+     * Virtqueues with completions waiting to be published by
+     * virtio_blk_complete_bh().  Protected by the BlockBackend's AioContext.
+     */
+    unsigned long *complete_vqs;
+    bool complete_bh_scheduled;
+
+    /* Completions for virtqueues with an IOThread of their own */
+    struct VirtIOBlockVqCompletion *vq_completions;
 };
 
 typedef struct VirtIOBlockReq {
@@ -84,6 +96,9 @@ typedef struct VirtIOBlockReq {
 
 #define VIRTIO_BLK_MAX_MERGE_REQS 32
 
+/* Number of requests taken from a virtqueue at once */
+#define VIRTIO_BLK_POP_BATCH 32
+
 typedef struct MultiReqBuffer {
     VirtIOBlockReq *reqs[VIRTIO_BLK_MAX_MERGE_REQS];
     unsigned int num_reqs;
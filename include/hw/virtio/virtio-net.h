@@ -18,10 +18,12 @@
 #include "standard-headers/linux/virtio_net.h"
 #include "hw/virtio/virtio.h"
 #include "net/announce.h"
+#include "net/toeplitz.h"
 #include "qemu/option_int.h"
 #include "qom/object.h"
 
 #include "ebpf/ebpf_rss.h"
+#include "sysemu/iothread.h"
 
 #define TYPE_VIRTIO_NET "virtio-net-device"
 OBJECT_DECLARE_SIMPLE_TYPE(VirtIONet, VIRTIO_NET)
@@ -50,6 +52,7 @@ typedef struct virtio_net_conf
     char *duplex_str;
     uint8_t duplex;
     char *primary_id_str;
+    char *iothread_queue_mapping; /* colon-separated list of IOThread ids */
 } virtio_net_conf;
 
 /* Coalesced packets type & status */
@@ -150,10 +153,18 @@ typedef struct VirtIONetQueue {
     VirtQueue *tx_vq;
     QEMUTimer *tx_timer;
     QEMUBH *tx_bh;
+    AioContext *ctx; /* IOThread AioContext, NULL for the main loop */
     uint32_t tx_waiting;
     struct {
         VirtQueueElement *elem;
     } async_tx;
+    /* Receive completions held back while the peer delivers a burst */
+    unsigned rx_plugged;
+    unsigned rx_pending;
+    bool rx_plugged_device;
+    /* Software RSS state of a queue serviced by an IOThread */
+    struct NetRxPkt *rx_pkt;
+    unsigned rx_steered; /* packets on their way from other IOThreads */
     struct VirtIONet *n;
 } VirtIONetQueue;
 
@@ -217,8 +228,14 @@ struct VirtIONet {
     bool primary_opts_from_json;
     Notifier migration_state;
     VirtioNetRssData rss_data;
+    NetToeplitz rss_toeplitz;
     struct NetRxPkt *rx_pkt;
     struct EBPFRSSContext ebpf_rss;
+    IOThread **iothreads; /* from net_conf.iothread_queue_mapping */
+    unsigned num_iothreads;
+    bool dataplane_started;
+    /* Queues plugged from the main loop, where RSS may steer to any queue */
+    unsigned rx_plugged;
 };
 
 size_t virtio_net_handle_ctrl_iov(VirtIODevice *vdev,
@@ -90,6 +90,14 @@ struct VirtIOSCSI {
     bool dataplane_stopping;
     bool dataplane_fenced;
     uint32_t host_features;
+
+    /*
+     * Command virtqueues with completions waiting to be published by
+     * virtio_scsi_complete_bh(), and the BlockBackends of those completions;
+     * the bottom half is accounted as in flight on each of them.
+     */
+    unsigned long *complete_vqs;
+    GPtrArray *complete_blks;
 };
 
 static inline void virtio_scsi_acquire(VirtIOSCSI *s)
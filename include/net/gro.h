@@ -0,0 +1,58 @@
+/*
+ * Software coalescing of received TCP segments
+ *
+ * Copyright (c) 2022 The QEMU Project Developers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_NET_GRO_H
+#define QEMU_NET_GRO_H
+
+typedef struct NetGro NetGro;
+
+/*
+ * Called with each packet leaving the coalescer.  @segs is the number of
+ * received segments merged into it, @mss the payload size of the first one.
+ * @buf is only valid during the call.
+ */
+typedef void NetGroFlushFn(void *opaque, const uint8_t *buf, size_t size,
+                           unsigned segs, uint16_t mss);
+
+/**
+ * net_gro_new: create a TCP segment coalescer
+ *
+ * @flush: called for every packet released by the coalescer
+ * @opaque: passed to @flush
+ *
+ * The coalescer keeps a handful of TCP flows open.  In-order segments of
+ * an open flow are appended to it until the flow reaches 64 KiB, a segment
+ * carries PSH or is shorter than the first one, or net_gro_flush() is
+ * called.  Checksums of merged segments are verified on the way in and the
+ * released packet carries valid IP and TCP checksums.
+ */
+NetGro *net_gro_new(NetGroFlushFn *flush, void *opaque);
+
+void net_gro_free(NetGro *gro);
+
+/**
+ * net_gro_receive: offer a packet to the coalescer
+ *
+ * @gro: the coalescer
+ * @buf: the Ethernet frame, without virtio-net header
+ * @size: size of @buf
+ *
+ * Returns true if the packet was consumed; it will be delivered through the
+ * flush callback, possibly merged with others.  Returns false if the caller
+ * must deliver it itself.  Any data of the same flow that the coalescer was
+ * holding has been flushed by then, so ordering is preserved.
+ */
+bool net_gro_receive(NetGro *gro, const uint8_t *buf, size_t size);
+
+/**
+ * net_gro_flush: release every packet held by the coalescer
+ */
+void net_gro_flush(NetGro *gro);
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ * Software segmentation of offloaded packets
+ *
+ * Copyright (c) 2022 The QEMU Project Developers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_NET_GSO_H
+#define QEMU_NET_GSO_H
+
+#include "standard-headers/linux/virtio_net.h"
+
+/* Largest L2 + L3 + L4 header that can be replicated into each segment */
+#define NET_GSO_MAX_HDR_LEN 256
+
+/*
+ * Called once per segment.  @iov starts with the rewritten headers and the
+ * rest points into the original packet; it is only valid during the call.
+ */
+typedef void NetGsoSegmentFn(void *opaque, const struct iovec *iov,
+                             int iovcnt);
+
+/**
+ * net_gso_segment: split a large offloaded packet into wire-sized packets
+ *
+ * @iov: the Ethernet frame, without virtio-net header
+ * @iovcnt: number of elements in @iov
+ * @vhdr: virtio-net header describing the offload requested by the sender
+ * @cb: called for each resulting packet, in order
+ * @opaque: passed to @cb
+ *
+ * TCPv4 and TCPv6 packets are segmented on @vhdr->gso_size boundaries with
+ * sequence numbers, IP identifiers, lengths and checksums fixed up in each
+ * segment.  UDPv4 packets are split into IP fragments.  Every packet passed
+ * to @cb carries complete checksums, whether or not @vhdr requested checksum
+ * offload.
+ *
+ * Returns the number of packets produced, or -EINVAL if the packet cannot be
+ * parsed or the offload type is not supported.  Nothing is passed to @cb in
+ * the error case.
+ */
+int net_gso_segment(const struct iovec *iov, int iovcnt,
+                    const struct virtio_net_hdr *vhdr,
+                    NetGsoSegmentFn *cb, void *opaque);
+
+#endif
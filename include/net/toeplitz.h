@@ -0,0 +1,61 @@
+/*
+ * Toeplitz hash for receive side scaling
+ *
+ * Copyright (c) 2022 The QEMU Project Developers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_NET_TOEPLITZ_H
+#define QEMU_NET_TOEPLITZ_H
+
+/* RSS keys are 40 bytes, enough to hash an IPv6 address pair and ports */
+#define NET_TOEPLITZ_KEY_LEN    40
+#define NET_TOEPLITZ_MAX_INPUT  (NET_TOEPLITZ_KEY_LEN - sizeof(uint32_t))
+
+/*
+ * Hash state derived from one RSS key.  Computing it costs a few
+ * microseconds, so devices keep one around and let net_toeplitz_set_key()
+ * rebuild it only when the guest programs a different key.
+ */
+typedef struct NetToeplitz {
+    uint8_t key[NET_TOEPLITZ_KEY_LEN];
+    bool valid;
+    /* Bit-reversed 64-bit key window for each 32-bit word of input */
+    uint64_t windows[NET_TOEPLITZ_MAX_INPUT / sizeof(uint32_t)];
+    /* Contribution of each byte value at each input position */
+    uint32_t table[NET_TOEPLITZ_MAX_INPUT][256];
+} NetToeplitz;
+
+/**
+ * net_toeplitz_set_key: prepare @t for hashing with @key
+ *
+ * @t: hash state
+ * @key: NET_TOEPLITZ_KEY_LEN bytes of key
+ *
+ * Does nothing if @t was already prepared for the same key.
+ */
+void net_toeplitz_set_key(NetToeplitz *t, const uint8_t *key);
+
+/**
+ * net_toeplitz_hash: compute the Toeplitz hash of @input
+ *
+ * @t: hash state, prepared with net_toeplitz_set_key()
+ * @input: the tuple to hash
+ * @len: length of @input, at most NET_TOEPLITZ_MAX_INPUT
+ *
+ * Uses carry-less multiplication where the host has it and per-byte lookup
+ * tables otherwise.
+ */
+uint32_t net_toeplitz_hash(const NetToeplitz *t, const uint8_t *input,
+                           size_t len);
+
+/*
+ * Switch to the next slower implementation, for tests.  Returns false once
+ * the lookup tables are in use.  States prepared before the switch must be
+ * prepared again from scratch.
+ */
+bool test_net_toeplitz_next_accel(void);
+
+#endif
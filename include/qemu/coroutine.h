@@ -369,6 +369,26 @@ void qemu_coroutine_inc_pool_size(unsigned int additional_pool_size);
  */
 void qemu_coroutine_dec_pool_size(unsigned int additional_pool_size);
 
+typedef struct CoroutinePoolStats {
+    /* Coroutines created with a new stack, i.e. pool misses */
+    uint64_t allocated;
+    /* Stacks given back to the system */
+    uint64_t freed;
+    /* Coroutines created from a pooled stack */
+    uint64_t pool_hits;
+    /* Deepest stack usage seen when freeing a stack, in bytes */
+    uint64_t stack_high_water;
+} CoroutinePoolStats;
+
+/**
+ * Get coroutine pool statistics
+ *
+ * pool_hits only includes other threads' hits in batches, so it can lag
+ * behind by a few dozen per thread.  stack_high_water is only available on
+ * hosts where the coroutine backend can measure it, and is 0 otherwise.
+ */
+void qemu_coroutine_get_pool_stats(CoroutinePoolStats *stats);
+
 #include "qemu/lockable.h"
 
 /**
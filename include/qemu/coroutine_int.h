@@ -33,7 +33,8 @@
 extern __thread void *__safestack_unsafe_stack_ptr;
 #endif
 
-#define COROUTINE_STACK_SIZE (1 << 20)
+/* A power of two, picked with --coroutine-stack-size */
+#define COROUTINE_STACK_SIZE CONFIG_COROUTINE_STACK_SIZE
 
 typedef enum {
     COROUTINE_YIELD = 1,
@@ -71,6 +72,8 @@ struct Coroutine {
 
 Coroutine *qemu_coroutine_new(void);
 void qemu_coroutine_delete(Coroutine *co);
+/* Report the stack usage of a coroutine that qemu_coroutine_delete() frees */
+void qemu_coroutine_note_stack_usage(size_t usage, size_t stack_size);
 CoroutineAction qemu_coroutine_switch(Coroutine *from, Coroutine *to,
                                       CoroutineAction action);
 
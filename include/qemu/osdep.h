@@ -571,6 +571,49 @@ void qemu_set_tty_echo(int fd, bool echo);
 void os_mem_prealloc(int fd, char *area, size_t sz, int smp_cpus,
                      Error **errp);
 
+/**
+ * os_mem_prealloc_async:
+ * @name: name of the memory, for os_mem_prealloc_foreach()
+ * @fd, @area, @sz, @smp_cpus: as for os_mem_prealloc()
+ * @host_nodes: host NUMA nodes the memory is bound to, or NULL
+ * @max_node: number of bits in @host_nodes
+ *
+ * Start preallocating @area in the background and return.  Memory started
+ * this way is preallocated concurrently, by threads running on the CPUs of
+ * @host_nodes where the host supports it.  The caller must not write to
+ * @area or unmap it before os_mem_prealloc_async_finish().
+ */
+void os_mem_prealloc_async(const char *name, int fd, char *area, size_t sz,
+                           int smp_cpus, const unsigned long *host_nodes,
+                           unsigned long max_node, Error **errp);
+
+/**
+ * os_mem_prealloc_async_done:
+ *
+ * Returns true if os_mem_prealloc_async_finish() would not block.
+ * qemu_notify_event() is called when the last preallocation completes.
+ */
+bool os_mem_prealloc_async_done(void);
+
+/**
+ * os_mem_prealloc_async_finish:
+ * @errp: pointer to error object
+ *
+ * Wait for all preallocation started with os_mem_prealloc_async().
+ * Returns false and sets @errp if any of it failed.
+ */
+bool os_mem_prealloc_async_finish(Error **errp);
+
+typedef void OsMemPreallocFunc(const char *name, size_t size, size_t done,
+                               int threads, void *opaque);
+
+/**
+ * os_mem_prealloc_foreach:
+ * @func: called with the progress of each background preallocation
+ * @opaque: passed to @func
+ */
+void os_mem_prealloc_foreach(OsMemPreallocFunc *func, void *opaque);
+
 /**
  * qemu_get_pid_name:
  * @pid: pid of a process
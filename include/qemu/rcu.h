@@ -65,6 +65,13 @@ struct rcu_reader_data {
 
     /* Data used by reader only */
     unsigned depth;
+    bool registered;
+
+    /*
+     * Callbacks queued by call_rcu1() on this thread, newest first.
+     * Pushed by this thread and taken over by the call_rcu thread.
+     */
+    struct rcu_head *batch;
 
     /* Data used for registry, protected by rcu_registry_lock */
     QLIST_ENTRY(rcu_reader_data) node;
@@ -121,6 +128,12 @@ static inline void rcu_read_unlock(void)
 
 extern void synchronize_rcu(void);
 
+/*
+ * Like synchronize_rcu(), but also ask readers that are in a long read-side
+ * critical section to leave it, through the force-RCU notifiers.
+ */
+extern void synchronize_rcu_expedited(void);
+
 /*
  * Reader thread registration.
  */
@@ -144,6 +157,26 @@ struct rcu_head {
 extern void call_rcu1(struct rcu_head *head, RCUCBFunc *func);
 extern void drain_call_rcu(void);
 
+typedef struct RcuStats {
+    /* synchronize_rcu() calls, and how many of them were expedited */
+    uint64_t grace_periods;
+    uint64_t expedited_grace_periods;
+    /* Time spent in synchronize_rcu(), including waiting for other writers */
+    uint64_t grace_period_ns;
+    uint64_t max_grace_period_ns;
+    /* Per-thread callback batches taken over by the call_rcu thread */
+    uint64_t batches;
+    /* Callbacks invoked by the call_rcu thread */
+    uint64_t callbacks;
+    /*
+     * Callbacks handed to the call_rcu thread and not invoked yet.  Those
+     * still in a per-thread batch are not counted.
+     */
+    uint64_t pending_callbacks;
+} RcuStats;
+
+extern void rcu_get_stats(RcuStats *stats);
+
 /* The operands of the minus operator must have the same type,
  * which must be the one that we specify in the cast.
  */
@@ -86,7 +86,9 @@ struct QEMUTimer {
     QEMUTimerList *timer_list;
     QEMUTimerCB *cb;
     void *opaque;
-    QEMUTimer *next;
+    /* Position in the timer list's heap and arming order, while pending */
+    size_t heap_index;
+    uint64_t seq;
     int attributes;
     int scale;
 };
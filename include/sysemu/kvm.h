@@ -583,5 +583,7 @@ bool kvm_arch_cpu_check_are_resettable(void);
 
 bool kvm_dirty_ring_enabled(void);
 
+bool kvm_dirty_log_manual_protect_enabled(void);
+
 uint32_t kvm_dirty_ring_size(void);
 #endif
@@ -84,6 +84,19 @@ void *qemu_alloc_stack(size_t *sz);
  */
 void qemu_free_stack(void *stack, size_t sz);
 
+/**
+ * qemu_stack_usage:
+ * @stack: stack allocated via qemu_alloc_stack()
+ * @sz: size of stack in bytes, as returned by qemu_alloc_stack()
+ *
+ * Estimate how deep the stack has grown since it was allocated, for
+ * statistics.  This is cheap enough to call before every qemu_free_stack().
+ *
+ * Returns: the high-water mark in bytes, or 0 if it cannot be measured
+ * on this host.
+ */
+size_t qemu_stack_usage(void *stack, size_t sz);
+
 /* POSIX and Mingw32 differ in the name of the stdio lock functions.  */
 
 static inline void qemu_flockfile(FILE *f)
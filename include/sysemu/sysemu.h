@@ -9,6 +9,7 @@
 /* vl.c */
 
 extern int only_migratable;
+extern bool startup_prealloc_pending;
 extern const char *qemu_name;
 extern QemuUUID qemu_uuid;
 extern bool qemu_uuid_set;
@@ -342,10 +342,26 @@ AioContext *iothread_get_aio_context(IOThread *iothread)
     return iothread->ctx;
 }
 
+static void query_one_poll_handler(const AioPollHandlerStats *stats,
+                                   void *opaque)
+{
+    IOThreadPollHandlerInfoList ***tail = opaque;
+    IOThreadPollHandlerInfo *info = g_new0(IOThreadPollHandlerInfo, 1);
+
+    info->fd = stats->fd;
+    info->poll_ns = stats->poll_ns;
+    info->poll_hits = stats->poll_hits;
+    info->poll_misses = stats->poll_misses;
+    info->poll_time_ns = stats->poll_time_ns;
+
+    QAPI_LIST_APPEND(*tail, info);
+}
+
 static int query_one_iothread(Object *object, void *opaque)
 {
     IOThreadInfoList ***tail = opaque;
     IOThreadInfo *info;
+    IOThreadPollHandlerInfoList **handlers_tail;
     IOThread *iothread;
 
     iothread = (IOThread *)object_dynamic_cast(object, TYPE_IOTHREAD);
@@ -361,6 +377,12 @@ static int query_one_iothread(Object *object, void *opaque)
     info->poll_shrink = iothread->poll_shrink;
     info->aio_max_batch = iothread->parent_obj.aio_max_batch;
 
+    handlers_tail = &info->poll_handlers;
+    if (iothread->ctx) {
+        aio_context_foreach_poll_handler(iothread->ctx, query_one_poll_handler,
+                                         &handlers_tail);
+    }
+
     QAPI_LIST_APPEND(*tail, info);
     return 0;
 }
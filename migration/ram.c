@@ -53,6 +53,8 @@
 #include "migration/colo.h"
 #include "block.h"
 #include "sysemu/cpu-throttle.h"
+#include "sysemu/dirtylimit.h"
+#include "sysemu/kvm.h"
 #include "savevm.h"
 #include "qemu/iov.h"
 #include "multifd.h"
@@ -372,6 +374,22 @@ struct RAMState {
      * is enabled.
      */
     unsigned int postcopy_channel;
+
+    /*
+     * Thread clearing the dirty log of RAMBlocks with a non-zero
+     * clear_batch after every bitmap sync, ahead of the migration thread.
+     */
+    QemuThread clear_thread;
+    bool clear_thread_running;
+    QemuMutex clear_mutex;
+    QemuCond clear_cond;            /* a sync happened, or quit */
+    QemuCond clear_done_cond;       /* the in-flight chunks were cleared */
+    bool clear_quit;
+    uint64_t clear_requested;       /* bumped after every bitmap sync */
+    /* Chunks of clear_inflight_block that the clear thread may be clearing */
+    RAMBlock *clear_inflight_block;
+    unsigned long clear_inflight_start;
+    unsigned long clear_inflight_end;
 };
 typedef struct RAMState RAMState;
 
@@ -871,13 +889,39 @@ unsigned long migration_bitmap_find_dirty(RAMState *rs, RAMBlock *rb,
     return find_next_bit(bitmap, size, start);
 }
 
+/*
+ * The clear thread takes a chunk by clearing its clear_bmap bit, but the
+ * dirty log is only cleared once memory_region_clear_dirty_bitmap()
+ * returns.  Wait for that before the caller sends pages of the chunk.
+ */
+static void ram_clear_wait_inflight(RAMBlock *rb, unsigned long chunk)
+{
+    RAMState *rs = ram_state;
+
+    if (qatomic_read(&rs->clear_inflight_block) != rb) {
+        return;
+    }
+
+    qemu_mutex_lock(&rs->clear_mutex);
+    while (rs->clear_inflight_block == rb &&
+           chunk >= rs->clear_inflight_start &&
+           chunk < rs->clear_inflight_end) {
+        qemu_cond_wait(&rs->clear_done_cond, &rs->clear_mutex);
+    }
+    qemu_mutex_unlock(&rs->clear_mutex);
+}
+
 static void migration_clear_memory_region_dirty_bitmap(RAMBlock *rb,
                                                        unsigned long page)
 {
     uint8_t shift;
     hwaddr size, start;
 
-    if (!rb->clear_bmap || !clear_bmap_test_and_clear(rb, page)) {
+    if (!rb->clear_bmap) {
+        return;
+    }
+    if (!clear_bmap_test_and_clear(rb, page)) {
+        ram_clear_wait_inflight(rb, page >> rb->clear_bmap_shift);
         return;
     }
 
@@ -1050,6 +1094,34 @@ bool ramblock_page_is_discarded(RAMBlock *rb, ram_addr_t start)
     return false;
 }
 
+/* Most clear_bmap chunks cleared with one call by the clear thread */
+#define CLEAR_BATCH_MAX         64
+/*
+ * Blocks with more than 1/CLEAR_REDIRTY_RATIO of their pages dirtied again
+ * between two syncs are cleared chunk by chunk by the migration thread,
+ * right before it sends them: clearing them early would only catch more
+ * writes that get sent again in the next round.
+ */
+#define CLEAR_REDIRTY_RATIO     8
+
+static void ramblock_update_clear_batch(RAMBlock *rb, uint64_t new_dirty_pages)
+{
+    uint64_t pages = rb->used_length >> TARGET_PAGE_BITS;
+    uint64_t batch;
+
+    if (ram_counters.dirty_sync_count <= 1) {
+        /* The first sync reports every page; nothing is known yet */
+        batch = CLEAR_BATCH_MAX;
+    } else if (new_dirty_pages * CLEAR_REDIRTY_RATIO >= pages) {
+        batch = 0;
+    } else {
+        /* The fewer pages come back dirty, the larger the batch */
+        batch = pages / (new_dirty_pages * CLEAR_REDIRTY_RATIO + 1);
+        batch = MIN(batch, CLEAR_BATCH_MAX);
+    }
+    qatomic_set(&rb->clear_batch, batch);
+}
+
 /* Called with RCU critical section */
 static void ramblock_sync_dirty_bitmap(RAMState *rs, RAMBlock *rb)
 {
@@ -1058,6 +1130,132 @@ static void ramblock_sync_dirty_bitmap(RAMState *rs, RAMBlock *rb)
 
     rs->migration_dirty_pages += new_dirty_pages;
     rs->num_dirty_pages_period += new_dirty_pages;
+    ramblock_update_clear_batch(rb, new_dirty_pages);
+}
+
+static void ram_clear_set_inflight(RAMState *rs, RAMBlock *rb,
+                                   unsigned long start, unsigned long end)
+{
+    qemu_mutex_lock(&rs->clear_mutex);
+    rs->clear_inflight_start = start;
+    rs->clear_inflight_end = end;
+    qatomic_set(&rs->clear_inflight_block, rb);
+    if (!rb) {
+        qemu_cond_broadcast(&rs->clear_done_cond);
+    }
+    qemu_mutex_unlock(&rs->clear_mutex);
+}
+
+/*
+ * Clear the dirty log for the chunks of @rb that still need it, in runs of
+ * up to rb->clear_batch chunks.  Returns false if asked to quit.
+ */
+static bool ram_clear_block(RAMState *rs, RAMBlock *rb)
+{
+    unsigned int batch = qatomic_read(&rb->clear_batch);
+    uint8_t shift = rb->clear_bmap_shift;
+    unsigned long nchunks, chunk, end, i;
+
+    if (!rb->clear_bmap || !batch) {
+        return true;
+    }
+
+    nchunks = clear_bmap_size(rb->used_length >> TARGET_PAGE_BITS, shift);
+    for (chunk = find_first_bit(rb->clear_bmap, nchunks); chunk < nchunks;
+         chunk = find_next_bit(rb->clear_bmap, nchunks, end)) {
+        if (qatomic_read(&rs->clear_quit)) {
+            return false;
+        }
+
+        /* Publish the run before taking any chunk of it */
+        end = MIN(chunk + batch, nchunks);
+        ram_clear_set_inflight(rs, rb, chunk, end);
+        for (i = chunk; i < end; i++) {
+            if (!bitmap_test_and_clear_atomic(rb->clear_bmap, i, 1)) {
+                break;
+            }
+        }
+        if (i > chunk) {
+            trace_migration_bitmap_clear_ahead(rb->idstr, chunk, i - chunk);
+            memory_region_clear_dirty_bitmap(rb->mr,
+                (ram_addr_t)chunk << (shift + TARGET_PAGE_BITS),
+                (ram_addr_t)(i - chunk) << (shift + TARGET_PAGE_BITS));
+        }
+        ram_clear_set_inflight(rs, NULL, 0, 0);
+
+        /* Carry on after the run, or after @chunk if someone else took it */
+        end = MAX(i, chunk + 1);
+    }
+    return true;
+}
+
+static void *ram_clear_thread(void *opaque)
+{
+    RAMState *rs = opaque;
+    uint64_t done = 0;
+    RAMBlock *block;
+
+    rcu_register_thread();
+
+    qemu_mutex_lock(&rs->clear_mutex);
+    while (!rs->clear_quit) {
+        if (rs->clear_requested == done) {
+            qemu_cond_wait(&rs->clear_cond, &rs->clear_mutex);
+            continue;
+        }
+        done = rs->clear_requested;
+        qemu_mutex_unlock(&rs->clear_mutex);
+
+        WITH_RCU_READ_LOCK_GUARD() {
+            RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+                if (!ram_clear_block(rs, block)) {
+                    break;
+                }
+            }
+        }
+
+        qemu_mutex_lock(&rs->clear_mutex);
+    }
+    qemu_mutex_unlock(&rs->clear_mutex);
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void ram_clear_thread_start(RAMState *rs)
+{
+    rs->clear_quit = false;
+    rs->clear_requested = 1;
+    rs->clear_thread_running = true;
+    qemu_thread_create(&rs->clear_thread, "mig/src/clear",
+                       ram_clear_thread, rs, QEMU_THREAD_JOINABLE);
+}
+
+static void ram_clear_thread_stop(RAMState *rs)
+{
+    if (!rs->clear_thread_running) {
+        return;
+    }
+
+    qemu_mutex_lock(&rs->clear_mutex);
+    qatomic_set(&rs->clear_quit, true);
+    qemu_cond_signal(&rs->clear_cond);
+    qemu_mutex_unlock(&rs->clear_mutex);
+
+    qemu_thread_join(&rs->clear_thread);
+    rs->clear_thread_running = false;
+}
+
+static void ram_clear_thread_kick(RAMState *rs)
+{
+    if (!rs->clear_thread_running) {
+        return;
+    }
+
+    qemu_mutex_lock(&rs->clear_mutex);
+    rs->clear_requested++;
+    qemu_cond_signal(&rs->clear_cond);
+    qemu_mutex_unlock(&rs->clear_mutex);
 }
 
 /**
@@ -1139,7 +1337,28 @@ static void migration_update_rates(RAMState *rs, int64_t end_time)
     }
 }
 
-static void migration_trigger_throttle(RAMState *rs)
+/*
+ * Give the per-vCPU dirty limiter a budget such that what the guest dirties
+ * during one sync period can be sent within the downtime limit at the rate
+ * the last period achieved.  vCPUs dirtying less than their share of the
+ * budget keep running at full speed.
+ */
+static void mig_dirty_limit_guest(uint64_t bytes_xfer_period,
+                                  int64_t period_ms)
+{
+    MigrationState *s = migrate_get_current();
+    uint64_t budget;
+
+    /* bytes per ms that may be dirtied, then MB/s */
+    budget = bytes_xfer_period / period_ms;
+    budget = budget * s->parameters.downtime_limit / period_ms;
+    budget = budget * 1000 / MiB;
+
+    trace_mig_dirty_limit_guest(budget);
+    dirtylimit_set_budget(MAX(budget, 1));
+}
+
+static void migration_trigger_throttle(RAMState *rs, int64_t end_time)
 {
     MigrationState *s = migrate_get_current();
     uint64_t threshold = s->parameters.throttle_trigger_threshold;
@@ -1166,6 +1385,18 @@ static void migration_trigger_throttle(RAMState *rs)
                                     bytes_dirty_threshold);
         }
     }
+
+    /*
+     * With dirty-limit, only the vCPUs responsible for the excess are
+     * slowed down.  Once limiting started the budget is recomputed every
+     * period, so that limits are lifted again when no longer needed.
+     */
+    if (migrate_dirty_limit() && !blk_mig_bulk_active() &&
+        (bytes_dirty_period > bytes_dirty_threshold ||
+         dirtylimit_in_service())) {
+        mig_dirty_limit_guest(bytes_xfer_period,
+                              end_time - rs->time_last_bitmap_sync);
+    }
 }
 
 static void migration_bitmap_sync(RAMState *rs)
@@ -1193,12 +1424,13 @@ static void migration_bitmap_sync(RAMState *rs)
 
     memory_global_after_dirty_log_sync();
     trace_migration_bitmap_sync_end(rs->num_dirty_pages_period);
+    ram_clear_thread_kick(rs);
 
     end_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
 
     /* more than 1 second = 1000 millisecons */
     if (end_time > rs->time_last_bitmap_sync + 1000) {
-        migration_trigger_throttle(rs);
+        migration_trigger_throttle(rs, end_time);
 
         migration_update_rates(rs, end_time);
 
@@ -2622,6 +2854,9 @@ static void ram_state_cleanup(RAMState **rsp)
         migration_page_queue_free(*rsp);
         qemu_mutex_destroy(&(*rsp)->bitmap_mutex);
         qemu_mutex_destroy(&(*rsp)->src_page_req_mutex);
+        qemu_mutex_destroy(&(*rsp)->clear_mutex);
+        qemu_cond_destroy(&(*rsp)->clear_cond);
+        qemu_cond_destroy(&(*rsp)->clear_done_cond);
         g_free(*rsp);
         *rsp = NULL;
     }
@@ -2648,6 +2883,11 @@ static void ram_save_cleanup(void *opaque)
     RAMState **rsp = opaque;
     RAMBlock *block;
 
+    /* The clear thread must not touch the dirty log once it is stopped */
+    if (*rsp) {
+        ram_clear_thread_stop(*rsp);
+    }
+
     /* We don't use dirty log with background snapshots */
     if (!migrate_background_snapshot()) {
         /* caller have hold iothread lock or is in a bh, so there is
@@ -2984,6 +3224,9 @@ static int ram_state_init(RAMState **rsp)
     qemu_mutex_init(&(*rsp)->bitmap_mutex);
     qemu_mutex_init(&(*rsp)->src_page_req_mutex);
     QSIMPLEQ_INIT(&(*rsp)->src_page_requests);
+    qemu_mutex_init(&(*rsp)->clear_mutex);
+    qemu_cond_init(&(*rsp)->clear_cond);
+    qemu_cond_init(&(*rsp)->clear_done_cond);
 
     /*
      * Count the total number of pages used by ram blocks not including any
@@ -3031,6 +3274,7 @@ static void ram_list_init_bitmaps(void)
             bitmap_set(block->bmap, 0, pages);
             block->clear_bmap_shift = shift;
             block->clear_bmap = bitmap_new(clear_bmap_size(pages, shift));
+            block->clear_batch = 0;
         }
     }
 }
@@ -3070,6 +3314,12 @@ static void ram_init_bitmaps(RAMState *rs)
      * containing all 1s to exclude any discarded pages from migration.
      */
     migration_bitmap_clear_discarded_pages(rs);
+
+    /* Without manual protect, syncing the dirty log already cleared it */
+    if (!migrate_background_snapshot() && kvm_enabled() &&
+        kvm_dirty_log_manual_protect_enabled()) {
+        ram_clear_thread_start(rs);
+    }
 }
 
 static int ram_init_all(RAMState **rsp)
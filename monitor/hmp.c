@@ -38,6 +38,7 @@
 #include "qemu/units.h"
 #include "sysemu/block-backend.h"
 #include "sysemu/runstate.h"
+#include "sysemu/sysemu.h"
 #include "trace.h"
 
 static void monitor_command_cb(void *opaque, const char *cmdline,
@@ -217,7 +218,8 @@ static bool cmd_can_preconfig(const HMPCommand *cmd)
 
 static bool cmd_available(const HMPCommand *cmd)
 {
-    return phase_check(PHASE_MACHINE_READY) || cmd_can_preconfig(cmd);
+    return phase_check(PHASE_MACHINE_READY) ||
+           (cmd_can_preconfig(cmd) && !startup_prealloc_pending);
 }
 
 static void help_cmd_dump_one(Monitor *mon,
@@ -33,6 +33,8 @@
 
 #include "block/aio-wait.h"
 #include "qemu/coroutine.h"
+#include "qemu/stats64.h"
+#include "qemu/thread.h"
 
 #define TYPE_COLO_COMPARE "colo-compare"
 typedef struct CompareState CompareState;
@@ -54,6 +56,8 @@ static NotifierList colo_compare_notifiers =
 #define REGULAR_PACKET_CHECK_MS 1000
 #define DEFAULT_TIME_OUT_MS 3000
 
+#define MAX_COMPARE_THREADS 64
+
 /* #define DEBUG_COLO_PACKETS */
 
 static QemuMutex colo_compare_mutex;
@@ -102,6 +106,27 @@ typedef struct SendEntry {
     uint8_t *buf;
 } SendEntry;
 
+/*
+ * With compare_threads=N, connections are spread over N compare threads by
+ * hash of their key.  The IOThread still parses and queues packets, under
+ * the lock of the connection's shard, and sends whatever the compare
+ * threads release.
+ */
+typedef struct CompareShard {
+    struct CompareState *s;
+    QemuThread thread;
+    /* Protects the packet queues of the connections of this shard too */
+    QemuMutex lock;
+    QemuCond cond;
+    /* Connections with packets not compared yet */
+    GQueue pending;
+    /* Primary packets that compared equal, to be sent by the IOThread */
+    GQueue release;
+    /* A miscompare must be reported by the IOThread */
+    bool inconsistent;
+    bool stopping;
+} CompareShard;
+
 struct CompareState {
     Object parent;
 
@@ -137,6 +162,17 @@ struct CompareState {
     QEMUBH *event_bh;
     enum colo_event event;
 
+    uint32_t compare_threads;
+    CompareShard *shards;
+    QEMUBH *release_bh;
+
+    /* Statistics, updated from the compare threads */
+    Stat64 released_packets;
+    Stat64 miscompares;
+    /* Time from primary packet arrival to its release */
+    Stat64 compare_latency_ns_total;
+    Stat64 compare_latency_ns_max;
+
     QTAILQ_ENTRY(CompareState) next;
 };
 
@@ -193,10 +229,19 @@ static void colo_compare_inconsistency_notify(CompareState *s)
     }
 }
 
-/* Use restricted to colo_insert_packet() */
-static gint seq_sorter(Packet *a, Packet *b, gpointer data)
+/*
+ * Report a miscompare.  Compare threads leave that to the IOThread, which
+ * owns the chardevs.  Called with the shard lock held, if any.
+ */
+static void colo_compare_miscompare(CompareState *s, CompareShard *shard)
 {
-    return b->tcp_seq - a->tcp_seq;
+    stat64_add(&s->miscompares, 1);
+    if (shard) {
+        shard->inconsistent = true;
+        qemu_bh_schedule(s->release_bh);
+    } else {
+        colo_compare_inconsistency_notify(s);
+    }
 }
 
 static void fill_pkt_tcp_info(void *data, uint32_t *max_ack)
@@ -221,23 +266,68 @@ static void fill_pkt_tcp_info(void *data, uint32_t *max_ack)
  * Return 1 on success, if return 0 means the
  * packet will be dropped
  */
-static int colo_insert_packet(GQueue *queue, Packet *pkt, uint32_t *max_ack)
+static int colo_insert_packet(PacketRing *queue, Packet *pkt,
+                              uint32_t *max_ack)
 {
-    if (g_queue_get_length(queue) <= max_queue_size) {
+    if (packet_ring_length(queue) <= max_queue_size) {
         if (pkt->ip->ip_p == IPPROTO_TCP) {
             fill_pkt_tcp_info(pkt, max_ack);
-            g_queue_insert_sorted(queue,
-                                  pkt,
-                                  (GCompareDataFunc)seq_sorter,
-                                  NULL);
+            packet_ring_insert_sorted(queue, pkt);
         } else {
-            g_queue_push_tail(queue, pkt);
+            packet_ring_push_tail(queue, pkt);
         }
         return 1;
     }
     return 0;
 }
 
+static void colo_compare_lock_all(CompareState *s)
+{
+    uint32_t i;
+
+    for (i = 0; s->shards && i < s->compare_threads; i++) {
+        qemu_mutex_lock(&s->shards[i].lock);
+    }
+}
+
+static void colo_compare_unlock_all(CompareState *s)
+{
+    uint32_t i;
+
+    for (i = 0; s->shards && i < s->compare_threads; i++) {
+        qemu_mutex_unlock(&s->shards[i].lock);
+    }
+}
+
+static CompareShard *colo_compare_shard(CompareState *s, ConnectionKey *key)
+{
+    if (!s->shards) {
+        return NULL;
+    }
+    return &s->shards[connection_key_hash(key) % s->compare_threads];
+}
+
+static Connection *colo_compare_conn_get(CompareState *s, ConnectionKey *key)
+{
+    Connection *conn;
+    uint32_t i;
+
+    if (!s->shards ||
+        connection_has_tracked(s->connection_track_table, key) ||
+        g_hash_table_size(s->connection_track_table) <= HASHTABLE_MAX_SIZE) {
+        return connection_get(s->connection_track_table, key, &s->conn_list);
+    }
+
+    /* The table is full and every connection is about to be dropped */
+    colo_compare_lock_all(s);
+    conn = connection_get(s->connection_track_table, key, &s->conn_list);
+    for (i = 0; i < s->compare_threads; i++) {
+        g_queue_clear(&s->shards[i].pending);
+    }
+    colo_compare_unlock_all(s);
+    return conn;
+}
+
 /*
  * Return 0 on success, if return -1 means the pkt
  * is unsupported(arp and ipv6) and will be sent later
@@ -247,6 +337,7 @@ static int packet_enqueue(CompareState *s, int mode, Connection **con)
     ConnectionKey key;
     Packet *pkt = NULL;
     Connection *conn;
+    CompareShard *shard;
     int ret;
 
     if (mode == PRIMARY_IN) {
@@ -266,15 +357,18 @@ static int packet_enqueue(CompareState *s, int mode, Connection **con)
     }
     fill_connection_key(pkt, &key, false);
 
-    conn = connection_get(s->connection_track_table,
-                          &key,
-                          &s->conn_list);
+    conn = colo_compare_conn_get(s, &key);
 
     if (!conn->processing) {
         g_queue_push_tail(&s->conn_list, conn);
         conn->processing = true;
     }
 
+    shard = colo_compare_shard(s, &key);
+    if (shard) {
+        qemu_mutex_lock(&shard->lock);
+    }
+
     if (mode == PRIMARY_IN) {
         ret = colo_insert_packet(&conn->primary_list, pkt, &conn->pack);
     } else {
@@ -288,6 +382,15 @@ static int packet_enqueue(CompareState *s, int mode, Connection **con)
         pkt = NULL;
     }
 
+    if (shard) {
+        if (!conn->compare_pending) {
+            conn->compare_pending = true;
+            g_queue_push_tail(&shard->pending, conn);
+            qemu_cond_signal(&shard->cond);
+        }
+        qemu_mutex_unlock(&shard->lock);
+    }
+
     *con = conn;
 
     return 0;
@@ -298,7 +401,7 @@ static inline bool after(uint32_t seq1, uint32_t seq2)
         return (int32_t)(seq1 - seq2) > 0;
 }
 
-static void colo_release_primary_pkt(CompareState *s, Packet *pkt)
+static void colo_send_primary_pkt(CompareState *s, Packet *pkt)
 {
     int ret;
     ret = compare_chr_send(s,
@@ -314,6 +417,24 @@ static void colo_release_primary_pkt(CompareState *s, Packet *pkt)
     packet_destroy_partial(pkt, NULL);
 }
 
+/* Called with the shard lock held, if any */
+static void colo_release_primary_pkt(CompareState *s, CompareShard *shard,
+                                     Packet *pkt)
+{
+    int64_t latency = get_clock() - pkt->creation_ns;
+
+    stat64_add(&s->released_packets, 1);
+    stat64_add(&s->compare_latency_ns_total, latency);
+    stat64_max(&s->compare_latency_ns_max, latency);
+
+    if (shard) {
+        g_queue_push_tail(&shard->release, pkt);
+        qemu_bh_schedule(s->release_bh);
+    } else {
+        colo_send_primary_pkt(s, pkt);
+    }
+}
+
 /*
  * The IP packets sent by primary and secondary
  * will be compared in here
@@ -397,7 +518,8 @@ static bool colo_mark_tcp_pkt(Packet *ppkt, Packet *spkt,
     return false;
 }
 
-static void colo_compare_tcp(CompareState *s, Connection *conn)
+static void colo_compare_tcp(CompareState *s, CompareShard *shard,
+                             Connection *conn)
 {
     Packet *ppkt = NULL, *spkt = NULL;
     int8_t mark;
@@ -417,25 +539,25 @@ static void colo_compare_tcp(CompareState *s, Connection *conn)
                        conn->sack : conn->pack;
 
 pri:
-    if (g_queue_is_empty(&conn->primary_list)) {
+    if (packet_ring_is_empty(&conn->primary_list)) {
         return;
     }
-    ppkt = g_queue_pop_tail(&conn->primary_list);
+    ppkt = packet_ring_pop_head(&conn->primary_list);
 sec:
-    if (g_queue_is_empty(&conn->secondary_list)) {
-        g_queue_push_tail(&conn->primary_list, ppkt);
+    if (packet_ring_is_empty(&conn->secondary_list)) {
+        packet_ring_push_head(&conn->primary_list, ppkt);
         return;
     }
-    spkt = g_queue_pop_tail(&conn->secondary_list);
+    spkt = packet_ring_pop_head(&conn->secondary_list);
 
     if (ppkt->tcp_seq == ppkt->seq_end) {
-        colo_release_primary_pkt(s, ppkt);
+        colo_release_primary_pkt(s, shard, ppkt);
         ppkt = NULL;
     }
 
     if (ppkt && conn->compare_seq && !after(ppkt->seq_end, conn->compare_seq)) {
         trace_colo_compare_main("pri: this packet has compared");
-        colo_release_primary_pkt(s, ppkt);
+        colo_release_primary_pkt(s, shard, ppkt);
         ppkt = NULL;
     }
 
@@ -457,7 +579,7 @@ sec:
             }
         }
         if (!ppkt) {
-            g_queue_push_tail(&conn->secondary_list, spkt);
+            packet_ring_push_head(&conn->secondary_list, spkt);
             goto pri;
         }
     }
@@ -475,8 +597,8 @@ sec:
 
         if (mark == COLO_COMPARE_FREE_PRIMARY) {
             conn->compare_seq = ppkt->seq_end;
-            colo_release_primary_pkt(s, ppkt);
-            g_queue_push_tail(&conn->secondary_list, spkt);
+            colo_release_primary_pkt(s, shard, ppkt);
+            packet_ring_push_head(&conn->secondary_list, spkt);
             goto pri;
         } else if (mark == COLO_COMPARE_FREE_SECONDARY) {
             conn->compare_seq = spkt->seq_end;
@@ -484,20 +606,20 @@ sec:
             goto sec;
         } else if (mark == (COLO_COMPARE_FREE_PRIMARY | COLO_COMPARE_FREE_SECONDARY)) {
             conn->compare_seq = ppkt->seq_end;
-            colo_release_primary_pkt(s, ppkt);
+            colo_release_primary_pkt(s, shard, ppkt);
             packet_destroy(spkt, NULL);
             goto pri;
         }
     } else {
-        g_queue_push_tail(&conn->primary_list, ppkt);
-        g_queue_push_tail(&conn->secondary_list, spkt);
+        packet_ring_push_head(&conn->primary_list, ppkt);
+        packet_ring_push_head(&conn->secondary_list, spkt);
 
 #ifdef DEBUG_COLO_PACKETS
         qemu_hexdump(stderr, "colo-compare ppkt", ppkt->data, ppkt->size);
         qemu_hexdump(stderr, "colo-compare spkt", spkt->data, spkt->size);
 #endif
 
-        colo_compare_inconsistency_notify(s);
+        colo_compare_miscompare(s, shard);
     }
 }
 
@@ -599,16 +721,20 @@ static int colo_packet_compare_other(Packet *spkt, Packet *ppkt)
                                        ppkt->size - offset);
 }
 
-static int colo_old_packet_check_one(Packet *pkt, int64_t *check_time)
+static bool colo_old_packet_check_ring(PacketRing *ring, uint64_t check_time)
 {
     int64_t now = qemu_clock_get_ms(QEMU_CLOCK_HOST);
+    uint32_t i;
 
-    if ((now - pkt->creation_ms) > (*check_time)) {
-        trace_colo_old_packet_check_found(pkt->creation_ms);
-        return 0;
-    } else {
-        return 1;
+    for (i = 0; i < packet_ring_length(ring); i++) {
+        Packet *pkt = packet_ring_get(ring, i);
+
+        if ((now - pkt->creation_ms) > (int64_t)check_time) {
+            trace_colo_old_packet_check_found(pkt->creation_ms);
+            return true;
+        }
     }
+    return false;
 }
 
 void colo_compare_register_notifier(Notifier *notify)
@@ -624,18 +750,10 @@ void colo_compare_unregister_notifier(Notifier *notify)
 static int colo_old_packet_check_one_conn(Connection *conn,
                                           CompareState *s)
 {
-    if (!g_queue_is_empty(&conn->primary_list)) {
-        if (g_queue_find_custom(&conn->primary_list,
-                                &s->compare_timeout,
-                                (GCompareFunc)colo_old_packet_check_one))
-            goto out;
-    }
-
-    if (!g_queue_is_empty(&conn->secondary_list)) {
-        if (g_queue_find_custom(&conn->secondary_list,
-                                &s->compare_timeout,
-                                (GCompareFunc)colo_old_packet_check_one))
-            goto out;
+    if (colo_old_packet_check_ring(&conn->primary_list, s->compare_timeout) ||
+        colo_old_packet_check_ring(&conn->secondary_list,
+                                   s->compare_timeout)) {
+        goto out;
     }
 
     return 1;
@@ -659,27 +777,33 @@ static void colo_old_packet_check(void *opaque)
      * If we find one old packet, stop finding job and notify
      * COLO frame do checkpoint.
      */
+    colo_compare_lock_all(s);
     g_queue_find_custom(&s->conn_list, s,
                         (GCompareFunc)colo_old_packet_check_one_conn);
+    colo_compare_unlock_all(s);
 }
 
-static void colo_compare_packet(CompareState *s, Connection *conn,
+static void colo_compare_packet(CompareState *s, CompareShard *shard,
+                                Connection *conn,
                                 int (*HandlePacket)(Packet *spkt,
                                 Packet *ppkt))
 {
     Packet *pkt = NULL;
-    GList *result = NULL;
-
-    while (!g_queue_is_empty(&conn->primary_list) &&
-           !g_queue_is_empty(&conn->secondary_list)) {
-        pkt = g_queue_pop_tail(&conn->primary_list);
-        result = g_queue_find_custom(&conn->secondary_list,
-                 pkt, (GCompareFunc)HandlePacket);
-
-        if (result) {
-            colo_release_primary_pkt(s, pkt);
-            packet_destroy(result->data, NULL);
-            g_queue_delete_link(&conn->secondary_list, result);
+    uint32_t i, len;
+
+    while (!packet_ring_is_empty(&conn->primary_list) &&
+           !packet_ring_is_empty(&conn->secondary_list)) {
+        pkt = packet_ring_pop_head(&conn->primary_list);
+        len = packet_ring_length(&conn->secondary_list);
+        for (i = 0; i < len; i++) {
+            if (!HandlePacket(packet_ring_get(&conn->secondary_list, i), pkt)) {
+                break;
+            }
+        }
+
+        if (i < len) {
+            colo_release_primary_pkt(s, shard, pkt);
+            packet_destroy(packet_ring_remove(&conn->secondary_list, i), NULL);
         } else {
             /*
              * If one packet arrive late, the secondary_list or
@@ -688,9 +812,9 @@ static void colo_compare_packet(CompareState *s, Connection *conn,
              * timeout, it will trigger a checkpoint request.
              */
             trace_colo_compare_main("packet different");
-            g_queue_push_tail(&conn->primary_list, pkt);
+            packet_ring_push_head(&conn->primary_list, pkt);
 
-            colo_compare_inconsistency_notify(s);
+            colo_compare_miscompare(s, shard);
             break;
         }
     }
@@ -700,29 +824,125 @@ static void colo_compare_packet(CompareState *s, Connection *conn,
  * Called from the compare thread on the primary
  * for compare packet with secondary list of the
  * specified connection when a new packet was
- * queued to it.
+ * queued to it.  @shard is NULL if the IOThread
+ * does the comparison itself.
  */
-static void colo_compare_connection(void *opaque, void *user_data)
+static void colo_compare_connection(CompareState *s, CompareShard *shard,
+                                    Connection *conn)
 {
-    CompareState *s = user_data;
-    Connection *conn = opaque;
-
     switch (conn->ip_proto) {
     case IPPROTO_TCP:
-        colo_compare_tcp(s, conn);
+        colo_compare_tcp(s, shard, conn);
         break;
     case IPPROTO_UDP:
-        colo_compare_packet(s, conn, colo_packet_compare_udp);
+        colo_compare_packet(s, shard, conn, colo_packet_compare_udp);
         break;
     case IPPROTO_ICMP:
-        colo_compare_packet(s, conn, colo_packet_compare_icmp);
+        colo_compare_packet(s, shard, conn, colo_packet_compare_icmp);
         break;
     default:
-        colo_compare_packet(s, conn, colo_packet_compare_other);
+        colo_compare_packet(s, shard, conn, colo_packet_compare_other);
         break;
     }
 }
 
+static void *colo_compare_thread(void *opaque)
+{
+    CompareShard *shard = opaque;
+    Connection *conn;
+
+    qemu_mutex_lock(&shard->lock);
+    while (!shard->stopping) {
+        conn = g_queue_pop_head(&shard->pending);
+        if (!conn) {
+            qemu_cond_wait(&shard->cond, &shard->lock);
+            continue;
+        }
+        conn->compare_pending = false;
+        colo_compare_connection(shard->s, shard, conn);
+    }
+    qemu_mutex_unlock(&shard->lock);
+
+    return NULL;
+}
+
+/* Send what the compare threads released, from the IOThread */
+static void colo_compare_release_bh(void *opaque)
+{
+    CompareState *s = opaque;
+    bool inconsistent = false;
+    uint32_t i;
+
+    for (i = 0; i < s->compare_threads; i++) {
+        CompareShard *shard = &s->shards[i];
+        GQueue release;
+
+        qemu_mutex_lock(&shard->lock);
+        release = shard->release;
+        g_queue_init(&shard->release);
+        inconsistent |= shard->inconsistent;
+        shard->inconsistent = false;
+        qemu_mutex_unlock(&shard->lock);
+
+        while (!g_queue_is_empty(&release)) {
+            colo_send_primary_pkt(s, g_queue_pop_head(&release));
+        }
+    }
+
+    if (inconsistent) {
+        colo_compare_inconsistency_notify(s);
+    }
+}
+
+static void colo_compare_start_threads(CompareState *s)
+{
+    uint32_t i;
+
+    s->shards = g_new0(CompareShard, s->compare_threads);
+    for (i = 0; i < s->compare_threads; i++) {
+        CompareShard *shard = &s->shards[i];
+
+        shard->s = s;
+        qemu_mutex_init(&shard->lock);
+        qemu_cond_init(&shard->cond);
+        g_queue_init(&shard->pending);
+        g_queue_init(&shard->release);
+        qemu_thread_create(&shard->thread, "colo-compare",
+                           colo_compare_thread, shard, QEMU_THREAD_JOINABLE);
+    }
+}
+
+static void colo_compare_stop_threads(CompareState *s)
+{
+    uint32_t i;
+
+    for (i = 0; s->shards && i < s->compare_threads; i++) {
+        CompareShard *shard = &s->shards[i];
+
+        qemu_mutex_lock(&shard->lock);
+        shard->stopping = true;
+        qemu_cond_signal(&shard->cond);
+        qemu_mutex_unlock(&shard->lock);
+        qemu_thread_join(&shard->thread);
+    }
+}
+
+static void colo_compare_free_shards(CompareState *s)
+{
+    uint32_t i;
+
+    for (i = 0; s->shards && i < s->compare_threads; i++) {
+        CompareShard *shard = &s->shards[i];
+
+        assert(g_queue_is_empty(&shard->release));
+        g_queue_clear(&shard->pending);
+        qemu_cond_destroy(&shard->cond);
+        qemu_mutex_destroy(&shard->lock);
+    }
+    g_free(s->shards);
+    s->shards = NULL;
+}
+
 static void coroutine_fn _compare_chr_send(void *opaque)
 {
     SendCo *sendco = opaque;
@@ -947,13 +1167,32 @@ static void colo_compare_timer_del(CompareState *s)
 
 static void colo_flush_packets(void *opaque, void *user_data);
 
+/* Checkpoint: release every primary packet and drop the secondary ones */
+static void colo_compare_flush_all(CompareState *s)
+{
+    uint32_t i;
+
+    colo_compare_lock_all(s);
+    for (i = 0; s->shards && i < s->compare_threads; i++) {
+        CompareShard *shard = &s->shards[i];
+
+        /* These are older than anything still queued on their connection */
+        while (!g_queue_is_empty(&shard->release)) {
+            colo_send_primary_pkt(s, g_queue_pop_head(&shard->release));
+        }
+        shard->inconsistent = false;
+    }
+    g_queue_foreach(&s->conn_list, colo_flush_packets, s);
+    colo_compare_unlock_all(s);
+}
+
 static void colo_compare_handle_event(void *opaque)
 {
     CompareState *s = opaque;
 
     switch (s->event) {
     case COLO_EVENT_CHECKPOINT:
-        g_queue_foreach(&s->conn_list, colo_flush_packets, s);
+        colo_compare_flush_all(s);
         break;
     case COLO_EVENT_FAILOVER:
         break;
@@ -974,6 +1213,11 @@ static void colo_compare_iothread(CompareState *s)
     object_ref(OBJECT(s->iothread));
     s->worker_context = iothread_get_g_main_context(s->iothread);
 
+    if (s->compare_threads) {
+        s->release_bh = aio_bh_new(ctx, colo_compare_release_bh, s);
+        colo_compare_start_threads(s);
+    }
+
     qemu_chr_fe_set_handlers(&s->chr_pri_in, compare_chr_can_read,
                              compare_pri_chr_in, NULL, NULL,
                              s, s->worker_context, true);
@@ -1153,6 +1397,68 @@ out:
     error_propagate(errp, local_err);
 }
 
+static void compare_get_compare_threads(Object *obj, Visitor *v,
+                                        const char *name, void *opaque,
+                                        Error **errp)
+{
+    CompareState *s = COLO_COMPARE(obj);
+    uint32_t value = s->compare_threads;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void compare_set_compare_threads(Object *obj, Visitor *v,
+                                        const char *name, void *opaque,
+                                        Error **errp)
+{
+    CompareState *s = COLO_COMPARE(obj);
+    uint32_t value;
+
+    /* Shards are sized and connections hashed over them by complete() */
+    if (s->worker_context) {
+        error_setg(errp, "Property '%s.%s' cannot be changed after the "
+                   "object is created", object_get_typename(obj), name);
+        return;
+    }
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (!value) {
+        error_setg(errp, "Property '%s.%s' requires a positive value",
+                   object_get_typename(obj), name);
+        return;
+    }
+    if (value > MAX_COMPARE_THREADS) {
+        error_setg(errp, "Property '%s.%s' must be at most %d",
+                   object_get_typename(obj), name, MAX_COMPARE_THREADS);
+        return;
+    }
+    s->compare_threads = value;
+}
+
+static void compare_get_stat(Object *obj, Visitor *v,
+                             const char *name, void *opaque,
+                             Error **errp)
+{
+    uint64_t value = stat64_get(opaque);
+
+    visit_type_uint64(v, name, &value, errp);
+}
+
+static void compare_get_avg_latency(Object *obj, Visitor *v,
+                                    const char *name, void *opaque,
+                                    Error **errp)
+{
+    CompareState *s = COLO_COMPARE(obj);
+    uint64_t count = stat64_get(&s->released_packets);
+    uint64_t value = 0;
+
+    if (count) {
+        value = stat64_get(&s->compare_latency_ns_total) / count;
+    }
+    visit_type_uint64(v, name, &value, errp);
+}
+
 static void compare_pri_rs_finalize(SocketReadState *pri_rs)
 {
     CompareState *s = container_of(pri_rs, CompareState, pri_rs);
@@ -1166,9 +1472,9 @@ static void compare_pri_rs_finalize(SocketReadState *pri_rs)
                          pri_rs->vnet_hdr_len,
                          false,
                          false);
-    } else {
+    } else if (!s->shards) {
         /* compare packet in the specified connection */
-        colo_compare_connection(conn, s);
+        colo_compare_connection(s, NULL, conn);
     }
 }
 
@@ -1179,9 +1485,9 @@ static void compare_sec_rs_finalize(SocketReadState *sec_rs)
 
     if (packet_enqueue(s, SECONDARY_IN, &conn)) {
         trace_colo_compare_main("secondary: unsupported packet in");
-    } else {
+    } else if (!s->shards) {
         /* compare packet in the specified connection */
-        colo_compare_connection(conn, s);
+        colo_compare_connection(s, NULL, conn);
     }
 }
 
@@ -1203,7 +1509,7 @@ static void compare_notify_rs_finalize(SocketReadState *notify_rs)
                                   notify_rs->buf,
                                   notify_rs->packet_len)) {
         /* colo-compare do checkpoint, flush pri packet and remove sec packet */
-        g_queue_foreach(&s->conn_list, colo_flush_packets, s);
+        colo_compare_flush_all(s);
     } else {
         error_report("COLO compare got unsupported instruction");
     }
@@ -1345,8 +1651,8 @@ static void colo_flush_packets(void *opaque, void *user_data)
     Connection *conn = opaque;
     Packet *pkt = NULL;
 
-    while (!g_queue_is_empty(&conn->primary_list)) {
-        pkt = g_queue_pop_tail(&conn->primary_list);
+    while (!packet_ring_is_empty(&conn->primary_list)) {
+        pkt = packet_ring_pop_head(&conn->primary_list);
         compare_chr_send(s,
                          pkt->data,
                          pkt->size,
@@ -1355,8 +1661,8 @@ static void colo_flush_packets(void *opaque, void *user_data)
                          true);
         packet_destroy_partial(pkt, NULL);
     }
-    while (!g_queue_is_empty(&conn->secondary_list)) {
-        pkt = g_queue_pop_tail(&conn->secondary_list);
+    while (!packet_ring_is_empty(&conn->secondary_list)) {
+        pkt = packet_ring_pop_head(&conn->secondary_list);
         packet_destroy(pkt, NULL);
     }
 }
@@ -1398,6 +1704,21 @@ static void colo_compare_init(Object *obj)
                         get_max_queue_size,
                         set_max_queue_size, NULL, NULL);
 
+    object_property_add(obj, "compare_threads", "uint32",
+                        compare_get_compare_threads,
+                        compare_set_compare_threads, NULL, NULL);
+
+    /* Statistics */
+    object_property_add(obj, "released_packets", "uint64",
+                        compare_get_stat, NULL, NULL, &s->released_packets);
+    object_property_add(obj, "miscompares", "uint64",
+                        compare_get_stat, NULL, NULL, &s->miscompares);
+    object_property_add(obj, "compare_latency_avg_ns", "uint64",
+                        compare_get_avg_latency, NULL, NULL, NULL);
+    object_property_add(obj, "compare_latency_max_ns", "uint64",
+                        compare_get_stat, NULL, NULL,
+                        &s->compare_latency_ns_max);
+
     s->vnet_hdr = false;
     object_property_add_bool(obj, "vnet_hdr_support", compare_get_vnet_hdr,
                              compare_set_vnet_hdr);
@@ -1443,6 +1764,11 @@ static void colo_compare_finalize(Object *obj)
 
     qemu_bh_delete(s->event_bh);
 
+    colo_compare_stop_threads(s);
+    if (s->release_bh) {
+        qemu_bh_delete(s->release_bh);
+    }
+
     AioContext *ctx = iothread_get_aio_context(s->iothread);
     aio_context_acquire(ctx);
     AIO_WAIT_WHILE(ctx, !s->out_sendco.done);
@@ -1452,8 +1778,9 @@ static void colo_compare_finalize(Object *obj)
     aio_context_release(ctx);
 
     /* Release all unhandled packets after compare thead exited */
-    g_queue_foreach(&s->conn_list, colo_flush_packets, s);
+    colo_compare_flush_all(s);
     AIO_WAIT_WHILE(NULL, !s->out_sendco.done);
+    colo_compare_free_shards(s);
 
     g_queue_clear(&s->conn_list);
     g_queue_clear(&s->out_sendco.send_list);
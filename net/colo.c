@@ -138,8 +138,8 @@ Connection *connection_new(ConnectionKey *key)
     conn->ip_proto = key->ip_proto;
     conn->processing = false;
     conn->tcp_state = TCPS_CLOSED;
-    g_queue_init(&conn->primary_list);
-    g_queue_init(&conn->secondary_list);
+    packet_ring_init(&conn->primary_list);
+    packet_ring_init(&conn->secondary_list);
 
     return conn;
 }
@@ -148,10 +148,8 @@ void connection_destroy(void *opaque)
 {
     Connection *conn = opaque;
 
-    g_queue_foreach(&conn->primary_list, packet_destroy, NULL);
-    g_queue_clear(&conn->primary_list);
-    g_queue_foreach(&conn->secondary_list, packet_destroy, NULL);
-    g_queue_clear(&conn->secondary_list);
+    packet_ring_destroy(&conn->primary_list);
+    packet_ring_destroy(&conn->secondary_list);
     g_slice_free(Connection, conn);
 }
 
@@ -162,6 +160,7 @@ Packet *packet_new(const void *data, int size, int vnet_hdr_len)
     pkt->data = g_memdup(data, size);
     pkt->size = size;
     pkt->creation_ms = qemu_clock_get_ms(QEMU_CLOCK_HOST);
+    pkt->creation_ns = get_clock();
     pkt->vnet_hdr_len = vnet_hdr_len;
 
     return pkt;
@@ -178,6 +177,7 @@ Packet *packet_new_nocopy(void *data, int size, int vnet_hdr_len)
     pkt->data = data;
     pkt->size = size;
     pkt->creation_ms = qemu_clock_get_ms(QEMU_CLOCK_HOST);
+    pkt->creation_ns = get_clock();
     pkt->vnet_hdr_len = vnet_hdr_len;
 
     return pkt;
@@ -198,6 +198,147 @@ void packet_destroy_partial(void *opaque, void *user_data)
     g_slice_free(Packet, pkt);
 }
 
+#define PACKET_RING_MIN_SIZE 16
+
+void packet_ring_init(PacketRing *ring)
+{
+    ring->pkts = NULL;
+    ring->head = 0;
+    ring->count = 0;
+    ring->capacity = 0;
+}
+
+void packet_ring_destroy(PacketRing *ring)
+{
+    while (!packet_ring_is_empty(ring)) {
+        packet_destroy(packet_ring_pop_head(ring), NULL);
+    }
+    g_free(ring->pkts);
+    packet_ring_init(ring);
+}
+
+static inline Packet **packet_ring_slot(PacketRing *ring, uint32_t i)
+{
+    return &ring->pkts[(ring->head + i) & (ring->capacity - 1)];
+}
+
+static void packet_ring_reserve(PacketRing *ring)
+{
+    Packet **pkts;
+    uint32_t i;
+
+    if (ring->count < ring->capacity) {
+        return;
+    }
+
+    /* Grow and unwrap, so that the oldest packet is at index 0 again */
+    pkts = g_new(Packet *, MAX(ring->capacity * 2, PACKET_RING_MIN_SIZE));
+    for (i = 0; i < ring->count; i++) {
+        pkts[i] = packet_ring_get(ring, i);
+    }
+    g_free(ring->pkts);
+    ring->pkts = pkts;
+    ring->head = 0;
+    ring->capacity = MAX(ring->capacity * 2, PACKET_RING_MIN_SIZE);
+}
+
+void packet_ring_push_tail(PacketRing *ring, Packet *pkt)
+{
+    packet_ring_reserve(ring);
+    *packet_ring_slot(ring, ring->count++) = pkt;
+}
+
+void packet_ring_push_head(PacketRing *ring, Packet *pkt)
+{
+    packet_ring_reserve(ring);
+    ring->head = (ring->head - 1) & (ring->capacity - 1);
+    ring->pkts[ring->head] = pkt;
+    ring->count++;
+}
+
+Packet *packet_ring_pop_head(PacketRing *ring)
+{
+    Packet *pkt;
+
+    if (packet_ring_is_empty(ring)) {
+        return NULL;
+    }
+    pkt = ring->pkts[ring->head];
+    ring->head = (ring->head + 1) & (ring->capacity - 1);
+    ring->count--;
+    return pkt;
+}
+
+/* Remove the @i-th oldest packet, closing the gap */
+Packet *packet_ring_remove(PacketRing *ring, uint32_t i)
+{
+    Packet *pkt = packet_ring_get(ring, i);
+
+    if (i < ring->count / 2) {
+        for (; i > 0; i--) {
+            *packet_ring_slot(ring, i) = *packet_ring_slot(ring, i - 1);
+        }
+        ring->head = (ring->head + 1) & (ring->capacity - 1);
+    } else {
+        for (; i + 1 < ring->count; i++) {
+            *packet_ring_slot(ring, i) = *packet_ring_slot(ring, i + 1);
+        }
+    }
+    ring->count--;
+    return pkt;
+}
+
+/* Sequence numbers wrap, compare them the way TCP does */
+static inline bool packet_seq_before(uint32_t seq1, uint32_t seq2)
+{
+    return (int32_t)(seq1 - seq2) < 0;
+}
+
+/*
+ * Insert @pkt after every packet whose sequence number does not come after
+ * its own, so that packets with equal sequence numbers stay in arrival order.
+ *
+ * TCP segments nearly always arrive in order, and those are appended in
+ * constant time.  A reordered packet is placed with a binary search, and
+ * only the shorter side of the ring is shifted to make room for it.
+ */
+void packet_ring_insert_sorted(PacketRing *ring, Packet *pkt)
+{
+    uint32_t lo = 0, hi = ring->count, i;
+
+    if (packet_ring_is_empty(ring) ||
+        !packet_seq_before(pkt->tcp_seq,
+                           packet_ring_get(ring, ring->count - 1)->tcp_seq)) {
+        packet_ring_push_tail(ring, pkt);
+        return;
+    }
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+
+        if (packet_seq_before(pkt->tcp_seq,
+                              packet_ring_get(ring, mid)->tcp_seq)) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+
+    packet_ring_reserve(ring);
+    if (lo < ring->count / 2) {
+        ring->head = (ring->head - 1) & (ring->capacity - 1);
+        for (i = 0; i < lo; i++) {
+            *packet_ring_slot(ring, i) = *packet_ring_slot(ring, i + 1);
+        }
+    } else {
+        for (i = ring->count; i > lo; i--) {
+            *packet_ring_slot(ring, i) = *packet_ring_slot(ring, i - 1);
+        }
+    }
+    *packet_ring_slot(ring, lo) = pkt;
+    ring->count++;
+}
+
 /*
  * Clear hashtable, stop this hash growing really huge
  */
@@ -47,6 +47,8 @@ typedef struct Packet {
     uint32_t vnet_hdr_len;
     uint32_t tcp_seq; /* sequence number */
     uint32_t tcp_ack; /* acknowledgement number */
+    /* Time of packet creation, in ns, for compare latency accounting */
+    int64_t creation_ns;
     /* the sequence number of the last byte of the packet */
     uint32_t seq_end;
     uint8_t header_size;  /* the header length */
@@ -56,6 +58,18 @@ typedef struct Packet {
     uint8_t flags; /* Flags(aka Control bits) */
 } Packet;
 
+/*
+ * Packets of one direction of a connection, oldest first.  TCP packets are
+ * kept sorted by sequence number: in-order packets are appended in O(1) and
+ * the position of a reordered one is found by binary search.
+ */
+typedef struct PacketRing {
+    Packet **pkts;
+    uint32_t head;
+    uint32_t count;
+    uint32_t capacity;
+} PacketRing;
+
 typedef struct ConnectionKey {
     /* (src, dst) must be grouped, in the same way than in IP header */
     struct in_addr src;
@@ -66,12 +80,14 @@ typedef struct ConnectionKey {
 } QEMU_PACKED ConnectionKey;
 
 typedef struct Connection {
-    /* connection primary send queue: element type: Packet */
-    GQueue primary_list;
-    /* connection secondary send queue: element type: Packet */
-    GQueue secondary_list;
+    /* connection primary send queue */
+    PacketRing primary_list;
+    /* connection secondary send queue */
+    PacketRing secondary_list;
     /* flag to enqueue unprocessed_connections */
     bool processing;
+    /* queued for comparison by a colo-compare thread */
+    bool compare_pending;
     uint8_t ip_proto;
     /* record the sequence number that has been compared */
     uint32_t compare_seq;
@@ -105,4 +121,28 @@ Packet *packet_new_nocopy(void *data, int size, int vnet_hdr_len);
 void packet_destroy(void *opaque, void *user_data);
 void packet_destroy_partial(void *opaque, void *user_data);
 
+void packet_ring_init(PacketRing *ring);
+void packet_ring_destroy(PacketRing *ring);
+void packet_ring_push_tail(PacketRing *ring, Packet *pkt);
+void packet_ring_push_head(PacketRing *ring, Packet *pkt);
+void packet_ring_insert_sorted(PacketRing *ring, Packet *pkt);
+Packet *packet_ring_pop_head(PacketRing *ring);
+Packet *packet_ring_remove(PacketRing *ring, uint32_t i);
+
+static inline uint32_t packet_ring_length(const PacketRing *ring)
+{
+    return ring->count;
+}
+
+static inline bool packet_ring_is_empty(const PacketRing *ring)
+{
+    return ring->count == 0;
+}
+
+/* The @i-th oldest packet */
+static inline Packet *packet_ring_get(const PacketRing *ring, uint32_t i)
+{
+    return ring->pkts[(ring->head + i) & (ring->capacity - 1)];
+}
+
 #endif /* NET_COLO_H */
@@ -12,6 +12,7 @@
 #include "qemu/osdep.h"
 #include "net/filter.h"
 #include "net/net.h"
+#include "net/gso.h"
 #include "qapi/error.h"
 #include "qom/object.h"
 #include "qemu/main-loop.h"
@@ -41,6 +42,7 @@ struct MirrorState {
     CharBackend chr_out;
     SocketReadState rs;
     bool vnet_hdr;
+    bool strip_vnet_hdr;
 };
 
 typedef struct FilterSendCo {
@@ -134,6 +136,68 @@ static int filter_send(MirrorState *s,
     return data.ret;
 }
 
+typedef struct FilterSegmentCtx {
+    MirrorState *s;
+    int ret;
+} FilterSegmentCtx;
+
+static void filter_send_segment(void *opaque, const struct iovec *iov,
+                                int iovcnt)
+{
+    FilterSegmentCtx *ctx = opaque;
+    int ret;
+
+    ret = filter_send(ctx->s, iov, iovcnt);
+    if (ret < 0 && ctx->ret >= 0) {
+        ctx->ret = ret;
+    }
+}
+
+/*
+ * Without vnet_hdr the other end cannot tell where the packet starts nor
+ * take offloaded packets.  With strip_vnet_hdr, strip the virtio-net header
+ * and split large packets into wire-sized ones.  Otherwise packets go out
+ * unmodified, which existing setups whose far end expects the netdev's
+ * header rely on.
+ */
+static int filter_send_packet(MirrorState *s,
+                              const struct iovec *iov,
+                              int iovcnt)
+{
+    NetFilterState *nf = NETFILTER(s);
+    size_t vnet_hdr_len = nf->netdev->vnet_hdr_len;
+    size_t size = iov_size(iov, iovcnt);
+    g_autofree struct iovec *pkt = NULL;
+    struct virtio_net_hdr vhdr;
+    FilterSegmentCtx ctx = {
+        .s = s,
+    };
+    unsigned cnt;
+    int ret;
+
+    if (s->vnet_hdr || !s->strip_vnet_hdr || !vnet_hdr_len) {
+        return filter_send(s, iov, iovcnt);
+    }
+
+    if (size < vnet_hdr_len ||
+        iov_to_buf(iov, iovcnt, 0, &vhdr, sizeof(vhdr)) < sizeof(vhdr)) {
+        return -EINVAL;
+    }
+
+    pkt = g_new(struct iovec, iovcnt);
+    cnt = iov_copy(pkt, iovcnt, iov, iovcnt, vnet_hdr_len,
+                   size - vnet_hdr_len);
+    if (vhdr.gso_type == VIRTIO_NET_HDR_GSO_NONE) {
+        return filter_send(s, pkt, cnt);
+    }
+
+    ret = net_gso_segment(pkt, cnt, &vhdr, filter_send_segment, &ctx);
+    if (ret < 0) {
+        return ret;
+    }
+    return ctx.ret < 0 ? ctx.ret : size;
+}
+
 static void redirector_to_filter(NetFilterState *nf,
                                  const uint8_t *buf,
                                  int len)
@@ -198,7 +262,7 @@ static ssize_t filter_mirror_receive_iov(NetFilterState *nf,
     MirrorState *s = FILTER_MIRROR(nf);
     int ret;
 
-    ret = filter_send(s, iov, iovcnt);
+    ret = filter_send_packet(s, iov, iovcnt);
     if (ret < 0) {
         error_report("filter mirror send failed(%s)", strerror(-ret));
     }
@@ -221,7 +285,7 @@ static ssize_t filter_redirector_receive_iov(NetFilterState *nf,
     int ret;
 
     if (qemu_chr_fe_backend_connected(&s->chr_out)) {
-        ret = filter_send(s, iov, iovcnt);
+        ret = filter_send_packet(s, iov, iovcnt);
         if (ret < 0) {
             error_report("filter redirector send failed(%s)", strerror(-ret));
         }
@@ -377,6 +441,21 @@ static void filter_mirror_set_vnet_hdr(Object *obj, bool value, Error **errp)
     s->vnet_hdr = value;
 }
 
+static bool filter_mirror_get_strip_vnet_hdr(Object *obj, Error **errp)
+{
+    MirrorState *s = FILTER_MIRROR(obj);
+
+    return s->strip_vnet_hdr;
+}
+
+static void filter_mirror_set_strip_vnet_hdr(Object *obj, bool value,
+                                             Error **errp)
+{
+    MirrorState *s = FILTER_MIRROR(obj);
+
+    s->strip_vnet_hdr = value;
+}
+
 static char *filter_redirector_get_outdev(Object *obj, Error **errp)
 {
     MirrorState *s = FILTER_REDIRECTOR(obj);
@@ -410,6 +489,21 @@ static void filter_redirector_set_vnet_hdr(Object *obj,
     s->vnet_hdr = value;
 }
 
+static bool filter_redirector_get_strip_vnet_hdr(Object *obj, Error **errp)
+{
+    MirrorState *s = FILTER_REDIRECTOR(obj);
+
+    return s->strip_vnet_hdr;
+}
+
+static void filter_redirector_set_strip_vnet_hdr(Object *obj, bool value,
+                                                 Error **errp)
+{
+    MirrorState *s = FILTER_REDIRECTOR(obj);
+
+    s->strip_vnet_hdr = value;
+}
+
 static void filter_mirror_class_init(ObjectClass *oc, void *data)
 {
     NetFilterClass *nfc = NETFILTER_CLASS(oc);
@@ -419,6 +513,9 @@ static void filter_mirror_class_init(ObjectClass *oc, void *data)
     object_class_property_add_bool(oc, "vnet_hdr_support",
                                    filter_mirror_get_vnet_hdr,
                                    filter_mirror_set_vnet_hdr);
+    object_class_property_add_bool(oc, "strip_vnet_hdr",
+                                   filter_mirror_get_strip_vnet_hdr,
+                                   filter_mirror_set_strip_vnet_hdr);
 
     nfc->setup = filter_mirror_setup;
     nfc->cleanup = filter_mirror_cleanup;
@@ -436,6 +533,9 @@ static void filter_redirector_class_init(ObjectClass *oc, void *data)
     object_class_property_add_bool(oc, "vnet_hdr_support",
                                    filter_redirector_get_vnet_hdr,
                                    filter_redirector_set_vnet_hdr);
+    object_class_property_add_bool(oc, "strip_vnet_hdr",
+                                   filter_redirector_get_strip_vnet_hdr,
+                                   filter_redirector_set_strip_vnet_hdr);
 
     nfc->setup = filter_redirector_setup;
     nfc->cleanup = filter_redirector_cleanup;
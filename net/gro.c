@@ -0,0 +1,408 @@
+/*
+ * Software coalescing of received TCP segments
+ *
+ * Copyright (c) 2022 The QEMU Project Developers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Backends without virtio-net header support hand us wire-sized packets
+ * even when the guest could take much larger ones.  This merges in-order
+ * segments of a bulk TCP stream into one packet before it is injected, so
+ * the device model and the guest handle one large packet instead of
+ * dozens of small ones.  The merge rules follow the Linux GRO ones: only
+ * pure ACK segments with identical headers apart from sequence number,
+ * lengths and checksums are merged.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "net/eth.h"
+#include "net/checksum.h"
+#include "net/gro.h"
+#include "trace.h"
+
+#define NET_GRO_MAX_FLOWS    8
+#define NET_GRO_MAX_HDR_LEN  128
+#define NET_GRO_MAX_FRAME    (ETH_MAX_L2_HDR_LEN + ETH_MAX_IP_DGRAM_LEN)
+
+typedef struct NetGroFlow {
+    bool active;
+    bool is_ip4;
+    size_t l3_off;
+    size_t l4_off;
+    size_t l5_off;
+
+    uint32_t next_seq;
+    /* One's complement sum of the payload merged so far, folded */
+    uint32_t payload_csum;
+    unsigned segs;
+    uint16_t mss;
+
+    size_t size;
+    uint8_t *buf;
+} NetGroFlow;
+
+struct NetGro {
+    NetGroFlushFn *flush;
+    void *opaque;
+    unsigned next_evict;
+    NetGroFlow flows[NET_GRO_MAX_FLOWS];
+};
+
+/* A received segment, parsed in place */
+typedef struct NetGroSeg {
+    const uint8_t *buf;
+    bool is_ip4;
+    size_t l3_off;
+    size_t l4_off;
+    size_t l5_off;
+    size_t payload_len;
+    const struct tcp_header *tcp;
+    uint32_t payload_csum;
+} NetGroSeg;
+
+static uint32_t net_gro_csum_fold(uint32_t sum)
+{
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return sum;
+}
+
+static bool net_gro_parse(const uint8_t *buf, size_t size, NetGroSeg *seg)
+{
+    struct iovec iov = { .iov_base = (void *)buf, .iov_len = size };
+    size_t l2_len, end, thlen;
+
+    if (size < ETH_HLEN) {
+        return false;
+    }
+
+    l2_len = eth_get_l2_hdr_length(buf);
+    switch (eth_get_l3_proto(&iov, 1, l2_len)) {
+    case ETH_P_IP: {
+        const struct ip_header *ip = (const struct ip_header *)(buf + l2_len);
+        size_t ip_len;
+
+        if (size < l2_len + sizeof(*ip) ||
+            IP_HEADER_VERSION(ip) != IP_HEADER_VERSION_4 ||
+            IP_HDR_GET_LEN((const uint8_t *)ip) != sizeof(*ip) ||
+            ip->ip_p != IP_PROTO_TCP || IP4_IS_FRAGMENT(ip)) {
+            return false;
+        }
+        ip_len = be16_to_cpu(ip->ip_len);
+        if (ip_len < sizeof(*ip) || l2_len + ip_len > size) {
+            return false;
+        }
+        seg->is_ip4 = true;
+        seg->l4_off = l2_len + sizeof(*ip);
+        end = l2_len + ip_len;
+        break;
+    }
+    case ETH_P_IPV6: {
+        const struct ip6_header *ip6 =
+            (const struct ip6_header *)(buf + l2_len);
+
+        /* Extension headers are not merged */
+        if (size < l2_len + sizeof(*ip6) ||
+            (ip6->ip6_ctlun.ip6_un2_vfc >> 4) != 6 ||
+            ip6->ip6_nxt != IP_PROTO_TCP) {
+            return false;
+        }
+        end = l2_len + sizeof(*ip6) + be16_to_cpu(ip6->ip6_plen);
+        if (end > size) {
+            return false;
+        }
+        seg->is_ip4 = false;
+        seg->l4_off = l2_len + sizeof(*ip6);
+        break;
+    }
+    default:
+        return false;
+    }
+
+    if (end < seg->l4_off + sizeof(struct tcp_header)) {
+        return false;
+    }
+    seg->tcp = (const struct tcp_header *)(buf + seg->l4_off);
+    thlen = TCP_HEADER_DATA_OFFSET(seg->tcp);
+    if (thlen < sizeof(struct tcp_header) || seg->l4_off + thlen > end ||
+        seg->l4_off + thlen > NET_GRO_MAX_HDR_LEN) {
+        return false;
+    }
+
+    seg->buf = buf;
+    seg->l3_off = l2_len;
+    seg->l5_off = seg->l4_off + thlen;
+    seg->payload_len = end - seg->l5_off;
+    return true;
+}
+
+static uint32_t net_gro_pseudo_csum(const uint8_t *l3hdr, bool is_ip4,
+                                    uint16_t l4_len)
+{
+    uint32_t cso;
+
+    if (is_ip4) {
+        return eth_calc_ip4_pseudo_hdr_csum((struct ip_header *)l3hdr,
+                                            l4_len, &cso);
+    }
+    return eth_calc_ip6_pseudo_hdr_csum((struct ip6_header *)l3hdr,
+                                        l4_len, IP_PROTO_TCP, &cso);
+}
+
+/* Verify the TCP checksum and remember the payload sum for merging */
+static bool net_gro_csum_ok(NetGroSeg *seg)
+{
+    size_t thlen = seg->l5_off - seg->l4_off;
+    uint32_t sum;
+
+    seg->payload_csum = net_gro_csum_fold(
+        net_checksum_add(seg->payload_len, (uint8_t *)seg->buf + seg->l5_off));
+    sum = net_gro_pseudo_csum(seg->buf + seg->l3_off, seg->is_ip4,
+                              thlen + seg->payload_len);
+    sum += net_checksum_add(thlen, (uint8_t *)seg->tcp);
+    sum += seg->payload_csum;
+    return net_checksum_finish(sum) == 0;
+}
+
+static bool net_gro_same_flow(NetGroFlow *f, NetGroSeg *seg)
+{
+    const uint8_t *fl3 = f->buf + f->l3_off;
+    const uint8_t *sl3 = seg->buf + seg->l3_off;
+
+    if (f->is_ip4 != seg->is_ip4 || f->l3_off != seg->l3_off) {
+        return false;
+    }
+    if (f->is_ip4) {
+        if (memcmp(fl3 + offsetof(struct ip_header, ip_src),
+                   sl3 + offsetof(struct ip_header, ip_src), 8)) {
+            return false;
+        }
+    } else if (memcmp(fl3 + offsetof(struct ip6_header, ip6_src),
+                      sl3 + offsetof(struct ip6_header, ip6_src), 32)) {
+        return false;
+    }
+    /* Source and destination ports */
+    return !memcmp(f->buf + f->l4_off, seg->tcp, 4);
+}
+
+static bool net_gro_can_merge(NetGroFlow *f, NetGroSeg *seg)
+{
+    const struct tcp_header *ftcp =
+        (const struct tcp_header *)(f->buf + f->l4_off);
+    size_t thlen = seg->l5_off - seg->l4_off;
+
+    if (f->l5_off != seg->l5_off ||
+        (TCP_HEADER_FLAGS(seg->tcp) & ~TH_PUSH) != TH_ACK ||
+        be32_to_cpu(seg->tcp->th_seq) != f->next_seq ||
+        seg->payload_len == 0 || seg->payload_len > f->mss ||
+        f->size + seg->payload_len > f->l3_off + ETH_MAX_IP_DGRAM_LEN) {
+        return false;
+    }
+
+    /* Ack, window and options must all match */
+    if (ftcp->th_ack != seg->tcp->th_ack || ftcp->th_win != seg->tcp->th_win ||
+        memcmp(ftcp + 1, seg->tcp + 1, thlen - sizeof(*ftcp))) {
+        return false;
+    }
+
+    if (memcmp(f->buf, seg->buf, f->l3_off)) {
+        return false;
+    }
+    if (f->is_ip4) {
+        const struct ip_header *fip =
+            (const struct ip_header *)(f->buf + f->l3_off);
+        const struct ip_header *sip =
+            (const struct ip_header *)(seg->buf + seg->l3_off);
+
+        return fip->ip_tos == sip->ip_tos && fip->ip_ttl == sip->ip_ttl &&
+               fip->ip_off == sip->ip_off;
+    } else {
+        const struct ip6_header *fip6 =
+            (const struct ip6_header *)(f->buf + f->l3_off);
+        const struct ip6_header *sip6 =
+            (const struct ip6_header *)(seg->buf + seg->l3_off);
+
+        return fip6->ip6_ctlun.ip6_un1.ip6_un1_flow ==
+               sip6->ip6_ctlun.ip6_un1.ip6_un1_flow &&
+               fip6->ip6_ctlun.ip6_un1.ip6_un1_hlim ==
+               sip6->ip6_ctlun.ip6_un1.ip6_un1_hlim;
+    }
+}
+
+static void net_gro_flush_flow(NetGro *gro, NetGroFlow *f)
+{
+    if (!f->active) {
+        return;
+    }
+
+    if (f->segs > 1) {
+        uint8_t *l3hdr = f->buf + f->l3_off;
+        struct tcp_header *tcp = (struct tcp_header *)(f->buf + f->l4_off);
+        size_t thlen = f->l5_off - f->l4_off;
+        size_t l4_len = f->size - f->l4_off;
+        uint32_t sum;
+
+        if (f->is_ip4) {
+            struct ip_header *ip = (struct ip_header *)l3hdr;
+
+            ip->ip_len = cpu_to_be16(f->size - f->l3_off);
+            eth_fix_ip4_checksum(ip, sizeof(*ip));
+        } else {
+            struct ip6_header *ip6 = (struct ip6_header *)l3hdr;
+
+            ip6->ip6_plen = cpu_to_be16(l4_len);
+        }
+
+        tcp->th_sum = 0;
+        sum = net_gro_pseudo_csum(l3hdr, f->is_ip4, l4_len);
+        sum += net_checksum_add(thlen, (uint8_t *)tcp);
+        sum += f->payload_csum;
+        tcp->th_sum = cpu_to_be16(net_checksum_finish(sum));
+    }
+
+    trace_net_gro_flush(gro, f->segs, f->size);
+    f->active = false;
+    gro->flush(gro->opaque, f->buf, f->size, f->segs, f->mss);
+}
+
+static void net_gro_merge(NetGroFlow *f, NetGroSeg *seg)
+{
+    uint32_t csum = seg->payload_csum;
+
+    memcpy(f->buf + f->size, seg->buf + seg->l5_off, seg->payload_len);
+
+    /* Data starting at an odd offset is summed with its bytes swapped */
+    if ((f->size - f->l5_off) & 1) {
+        csum = bswap16(csum);
+    }
+    f->payload_csum = net_gro_csum_fold(f->payload_csum + csum);
+
+    if (TCP_HEADER_FLAGS(seg->tcp) & TH_PUSH) {
+        struct tcp_header *tcp = (struct tcp_header *)(f->buf + f->l4_off);
+
+        tcp->th_offset_flags |= cpu_to_be16(TH_PUSH);
+    }
+
+    f->size += seg->payload_len;
+    f->next_seq += seg->payload_len;
+    f->segs++;
+}
+
+static NetGroFlow *net_gro_alloc_flow(NetGro *gro)
+{
+    NetGroFlow *f;
+    int i;
+
+    for (i = 0; i < NET_GRO_MAX_FLOWS; i++) {
+        if (!gro->flows[i].active) {
+            f = &gro->flows[i];
+            goto found;
+        }
+    }
+
+    f = &gro->flows[gro->next_evict];
+    gro->next_evict = (gro->next_evict + 1) % NET_GRO_MAX_FLOWS;
+    net_gro_flush_flow(gro, f);
+
+found:
+    if (!f->buf) {
+        f->buf = g_malloc(NET_GRO_MAX_FRAME);
+    }
+    return f;
+}
+
+static void net_gro_start_flow(NetGroFlow *f, NetGroSeg *seg)
+{
+    f->active = true;
+    f->is_ip4 = seg->is_ip4;
+    f->l3_off = seg->l3_off;
+    f->l4_off = seg->l4_off;
+    f->l5_off = seg->l5_off;
+    f->size = seg->l5_off;
+    f->segs = 0;
+    f->mss = seg->payload_len;
+    f->next_seq = be32_to_cpu(seg->tcp->th_seq);
+    f->payload_csum = 0;
+
+    memcpy(f->buf, seg->buf, seg->l5_off);
+    net_gro_merge(f, seg);
+}
+
+bool net_gro_receive(NetGro *gro, const uint8_t *buf, size_t size)
+{
+    NetGroFlow *f = NULL;
+    NetGroSeg seg;
+    bool csum_checked = false;
+    int i;
+
+    if (!net_gro_parse(buf, size, &seg)) {
+        return false;
+    }
+
+    for (i = 0; i < NET_GRO_MAX_FLOWS; i++) {
+        if (gro->flows[i].active && net_gro_same_flow(&gro->flows[i], &seg)) {
+            f = &gro->flows[i];
+            break;
+        }
+    }
+
+    if (f) {
+        if (net_gro_can_merge(f, &seg)) {
+            csum_checked = true;
+            if (net_gro_csum_ok(&seg)) {
+                net_gro_merge(f, &seg);
+                if ((TCP_HEADER_FLAGS(seg.tcp) & TH_PUSH) ||
+                    seg.payload_len < f->mss) {
+                    net_gro_flush_flow(gro, f);
+                }
+                return true;
+            }
+        }
+        net_gro_flush_flow(gro, f);
+    }
+
+    /* Only plain full-sized data segments are worth holding back */
+    if (TCP_HEADER_FLAGS(seg.tcp) != TH_ACK || seg.payload_len == 0 ||
+        csum_checked || !net_gro_csum_ok(&seg)) {
+        return false;
+    }
+
+    f = net_gro_alloc_flow(gro);
+    net_gro_start_flow(f, &seg);
+    return true;
+}
+
+void net_gro_flush(NetGro *gro)
+{
+    int i;
+
+    for (i = 0; i < NET_GRO_MAX_FLOWS; i++) {
+        net_gro_flush_flow(gro, &gro->flows[i]);
+    }
+}
+
+NetGro *net_gro_new(NetGroFlushFn *flush, void *opaque)
+{
+    NetGro *gro = g_new0(NetGro, 1);
+
+    gro->flush = flush;
+    gro->opaque = opaque;
+    return gro;
+}
+
+void net_gro_free(NetGro *gro)
+{
+    int i;
+
+    if (!gro) {
+        return;
+    }
+
+    for (i = 0; i < NET_GRO_MAX_FLOWS; i++) {
+        g_free(gro->flows[i].buf);
+    }
+    g_free(gro);
+}
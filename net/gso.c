@@ -0,0 +1,252 @@
+/*
+ * Software segmentation of offloaded packets
+ *
+ * Copyright (c) 2022 The QEMU Project Developers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Guests and NIC models hand us TCP packets of up to 64 KiB together with a
+ * segment size, expecting whoever puts them on the wire to split them.  When
+ * the backend (or a filter) cannot take the virtio-net header along with the
+ * packet, the split has to happen here.  Headers are copied once and patched
+ * for each segment; payload is never copied, each segment's iovec points
+ * into the original packet.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/iov.h"
+#include "net/eth.h"
+#include "net/checksum.h"
+#include "net/gso.h"
+#include "trace.h"
+
+typedef struct NetGsoPacket {
+    const struct iovec *iov;
+    int iovcnt;
+    size_t size;
+
+    /* Headers up to and including L4, patched for each segment */
+    uint8_t hdr[NET_GSO_MAX_HDR_LEN];
+    size_t l3_off;
+    size_t l4_off;
+    size_t l5_off;
+    bool is_ip4;
+
+    /* Scratch vector for one segment, sized for the worst case */
+    struct iovec *seg;
+} NetGsoPacket;
+
+static bool net_gso_parse(NetGsoPacket *p, uint8_t gso_type)
+{
+    bool isip4, isip6, isudp, istcp;
+    size_t l3_off, l4_off = 0, l5_off = 0;
+    eth_ip6_hdr_info ip6hdr_info;
+    eth_ip4_hdr_info ip4hdr_info;
+    eth_l4_hdr_info l4hdr_info;
+
+    eth_get_protocols(p->iov, p->iovcnt, &isip4, &isip6, &isudp, &istcp,
+                      &l3_off, &l4_off, &l5_off,
+                      &ip6hdr_info, &ip4hdr_info, &l4hdr_info);
+
+    switch (gso_type) {
+    case VIRTIO_NET_HDR_GSO_TCPV4:
+        if (!isip4 || !istcp) {
+            return false;
+        }
+        break;
+    case VIRTIO_NET_HDR_GSO_TCPV6:
+        if (!isip6 || !istcp) {
+            return false;
+        }
+        break;
+    case VIRTIO_NET_HDR_GSO_UDP:
+        /* UDP is split into IP fragments, which IPv6 routers do not do */
+        if (!isip4 || !isudp) {
+            return false;
+        }
+        break;
+    default:
+        return false;
+    }
+
+    if (l5_off > sizeof(p->hdr) || l5_off > p->size) {
+        return false;
+    }
+
+    p->l3_off = l3_off;
+    p->l4_off = l4_off;
+    p->l5_off = l5_off;
+    p->is_ip4 = isip4;
+    iov_to_buf(p->iov, p->iovcnt, 0, p->hdr, l5_off);
+    return true;
+}
+
+/*
+ * Point @p->seg[1..] at @len bytes of the original packet starting at @off.
+ * Returns the number of elements used.
+ */
+static unsigned net_gso_map_payload(NetGsoPacket *p, size_t off, size_t len)
+{
+    return iov_copy(&p->seg[1], p->iovcnt, p->iov, p->iovcnt, off, len);
+}
+
+static int net_gso_segment_tcp(NetGsoPacket *p, uint16_t mss,
+                               NetGsoSegmentFn *cb, void *opaque)
+{
+    size_t payload_len = p->size - p->l5_off;
+    size_t l4hdr_len = p->l5_off - p->l4_off;
+    uint8_t *l3hdr = p->hdr + p->l3_off;
+    struct tcp_header *tcp = (struct tcp_header *)(p->hdr + p->l4_off);
+    uint16_t orig_flags = be16_to_cpu(tcp->th_offset_flags);
+    uint32_t seq = be32_to_cpu(tcp->th_seq);
+    uint16_t ip_id = 0;
+    size_t off = 0;
+    int segs = 0;
+
+    if (p->is_ip4) {
+        ip_id = be16_to_cpu(((struct ip_header *)l3hdr)->ip_id);
+    }
+
+    do {
+        size_t len = MIN(mss, payload_len - off);
+        bool last = off + len == payload_len;
+        uint16_t flags = orig_flags;
+        uint32_t csum, cso;
+        unsigned cnt;
+
+        if (!last) {
+            flags &= ~(TH_FIN | TH_PUSH);
+        }
+        if (segs) {
+            flags &= ~TH_CWR;
+        }
+        tcp->th_offset_flags = cpu_to_be16(flags);
+        tcp->th_seq = cpu_to_be32(seq + off);
+        tcp->th_sum = 0;
+
+        if (p->is_ip4) {
+            struct ip_header *ip = (struct ip_header *)l3hdr;
+            size_t l3hdr_len = p->l4_off - p->l3_off;
+
+            ip->ip_len = cpu_to_be16(l3hdr_len + l4hdr_len + len);
+            ip->ip_id = cpu_to_be16(ip_id + segs);
+            eth_fix_ip4_checksum(ip, l3hdr_len);
+            csum = eth_calc_ip4_pseudo_hdr_csum(ip, l4hdr_len + len, &cso);
+        } else {
+            struct ip6_header *ip6 = (struct ip6_header *)l3hdr;
+
+            ip6->ip6_plen = cpu_to_be16(p->l5_off - p->l3_off -
+                                        sizeof(*ip6) + len);
+            csum = eth_calc_ip6_pseudo_hdr_csum(ip6, l4hdr_len + len,
+                                                IP_PROTO_TCP, &cso);
+        }
+
+        p->seg[0].iov_base = p->hdr;
+        p->seg[0].iov_len = p->l5_off;
+        cnt = net_gso_map_payload(p, p->l5_off + off, len);
+
+        csum += net_checksum_add(l4hdr_len, (uint8_t *)tcp);
+        csum += net_checksum_add_iov(&p->seg[1], cnt, 0, len, l4hdr_len);
+        tcp->th_sum = cpu_to_be16(net_checksum_finish(csum));
+
+        cb(opaque, p->seg, cnt + 1);
+
+        off += len;
+        segs++;
+    } while (off < payload_len);
+
+    return segs;
+}
+
+static int net_gso_fragment_udp(NetGsoPacket *p, uint16_t frag_size,
+                                bool needs_csum,
+                                NetGsoSegmentFn *cb, void *opaque)
+{
+    size_t l3hdr_len = p->l4_off - p->l3_off;
+    size_t l3payload_len = p->size - p->l4_off;
+    size_t udphdr_len = p->l5_off - p->l4_off;
+    struct ip_header *ip = (struct ip_header *)(p->hdr + p->l3_off);
+    struct udp_header *udp = (struct udp_header *)(p->hdr + p->l4_off);
+    size_t off = 0;
+    int segs = 0;
+
+    if (frag_size < udphdr_len) {
+        return -EINVAL;
+    }
+
+    if (needs_csum) {
+        uint32_t csum, cso;
+        unsigned cnt;
+
+        udp->uh_sum = 0;
+        csum = eth_calc_ip4_pseudo_hdr_csum(ip, l3payload_len, &cso);
+        csum += net_checksum_add(udphdr_len, (uint8_t *)udp);
+        cnt = net_gso_map_payload(p, p->l5_off, p->size - p->l5_off);
+        csum += net_checksum_add_iov(&p->seg[1], cnt, 0,
+                                     p->size - p->l5_off, udphdr_len);
+        udp->uh_sum = cpu_to_be16(net_checksum_finish_nozero(csum));
+    }
+
+    do {
+        size_t len = MIN(frag_size, l3payload_len - off);
+        bool more_frags = off + len < l3payload_len;
+        unsigned cnt;
+
+        eth_setup_ip4_fragmentation(p->hdr, p->l3_off, ip, l3hdr_len,
+                                    len, off, more_frags);
+        eth_fix_ip4_checksum(ip, l3hdr_len);
+
+        /* The first fragment carries the (possibly rewritten) UDP header */
+        p->seg[0].iov_base = p->hdr;
+        if (!off) {
+            p->seg[0].iov_len = p->l5_off;
+            cnt = net_gso_map_payload(p, p->l5_off, len - udphdr_len);
+        } else {
+            p->seg[0].iov_len = p->l4_off;
+            cnt = net_gso_map_payload(p, p->l4_off + off, len);
+        }
+
+        cb(opaque, p->seg, cnt + 1);
+
+        off += len;
+        segs++;
+    } while (off < l3payload_len);
+
+    return segs;
+}
+
+int net_gso_segment(const struct iovec *iov, int iovcnt,
+                    const struct virtio_net_hdr *vhdr,
+                    NetGsoSegmentFn *cb, void *opaque)
+{
+    uint8_t gso_type = vhdr->gso_type & ~VIRTIO_NET_HDR_GSO_ECN;
+    NetGsoPacket p = {
+        .iov = iov,
+        .iovcnt = iovcnt,
+        .size = iov_size(iov, iovcnt),
+    };
+    int ret;
+
+    if (!net_gso_parse(&p, gso_type) || p.size - p.l3_off >
+        ETH_MAX_IP_DGRAM_LEN) {
+        trace_net_gso_segment(vhdr->gso_type, p.size, -EINVAL);
+        return -EINVAL;
+    }
+
+    p.seg = g_new(struct iovec, iovcnt + 1);
+    if (gso_type == VIRTIO_NET_HDR_GSO_UDP) {
+        ret = IP_FRAG_ALIGN_SIZE(vhdr->gso_size) ?
+            net_gso_fragment_udp(&p, IP_FRAG_ALIGN_SIZE(vhdr->gso_size),
+                                 vhdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM,
+                                 cb, opaque) :
+            -EINVAL;
+    } else {
+        ret = vhdr->gso_size ?
+            net_gso_segment_tcp(&p, vhdr->gso_size, cb, opaque) : -EINVAL;
+    }
+    g_free(p.seg);
+
+    trace_net_gso_segment(vhdr->gso_type, p.size, ret);
+    return ret;
+}
@@ -483,6 +483,25 @@ bool qemu_has_vnet_hdr(NetClientState *nc)
     return nc->info->has_vnet_hdr(nc);
 }
 
+bool qemu_can_set_net_aio_context(NetClientState *nc)
+{
+    return nc && nc->info->set_aio_context;
+}
+
+/*
+ * Move the backend's I/O handlers to @ctx, or back to the main loop if @ctx
+ * is NULL.  While an AioContext is set, the backend's handlers run with it
+ * acquired and other threads must acquire it before touching the client.
+ */
+void qemu_set_net_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    if (!qemu_can_set_net_aio_context(nc)) {
+        return;
+    }
+
+    nc->info->set_aio_context(nc, ctx);
+}
+
 bool qemu_has_vnet_hdr_len(NetClientState *nc, int len)
 {
     if (!nc || !nc->info->has_vnet_hdr_len) {
@@ -630,6 +649,29 @@ void qemu_purge_queued_packets(NetClientState *nc)
     qemu_net_queue_purge(nc->peer->incoming_queue, nc);
 }
 
+/*
+ * Tell the peer of @nc that a burst of packets follows, so that it may
+ * batch them until the matching qemu_net_io_unplug().  Calls nest.
+ *
+ * A backend such as tap may keep referring to the buffers of the packets it
+ * accepted until the outermost qemu_net_io_unplug(), so a NIC must not
+ * release or reuse its transmit buffers before that.  NICs copy what they
+ * receive before returning, so backends may reuse their buffers at once.
+ */
+void qemu_net_io_plug(NetClientState *nc)
+{
+    if (nc->peer && nc->peer->info->io_plug) {
+        nc->peer->info->io_plug(nc->peer);
+    }
+}
+
+void qemu_net_io_unplug(NetClientState *nc)
+{
+    if (nc->peer && nc->peer->info->io_unplug) {
+        nc->peer->info->io_unplug(nc->peer);
+    }
+}
+
 void qemu_flush_or_purge_queued_packets(NetClientState *nc, bool purge)
 {
     nc->receive_disabled = 0;
@@ -0,0 +1,314 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Batched tap I/O using Linux io_uring
+ *
+ * A tap file descriptor transfers one packet per read(2) or write(2), so the
+ * packet rate of the tap backend is bounded by the system call rate.  This
+ * file submits many reads or writes with a single io_uring_enter(2).
+ *
+ * Requests in a batch are linked with IOSQE_IO_LINK so that they execute in
+ * order.  The tap fd is non-blocking: the first request that would block
+ * fails with -EAGAIN and the rest of the chain is cancelled.  The whole chain
+ * therefore completes without sleeping and io_uring_submit_and_wait() only
+ * returns after every request in the batch has completed.
+ *
+ * Linux 5.6 to 5.9 do not honour O_NONBLOCK for io_uring reads and writes:
+ * instead of failing with -EAGAIN, a request on an empty or full tap is
+ * handed to an io-wq worker that sleeps until it can complete, and the
+ * batch blocks with it.  The ring is only used on Linux 5.10 and later.
+ *
+ * Writes refer to the sender's buffers, which stay valid until the sender
+ * unplugs the tap (see qemu_net_io_plug()).  Writes that fail with -EAGAIN
+ * or are cancelled stay queued, in order, until the next
+ * tap_io_uring_submit_writes() call; tap_io_uring_own_writes() copies them
+ * before the sender's buffers go away.
+ */
+
+#include "qemu/osdep.h"
+#include <sys/utsname.h>
+#include <liburing.h>
+#include "qapi/error.h"
+#include "qemu/iov.h"
+#include "net/net.h"
+#include "tap_int.h"
+#include "trace.h"
+
+typedef struct TapIOUringWrite {
+    struct iovec *iov;
+    int iovcnt;
+    bool owned; /* iov refers to a copy of the packet, not to the sender */
+} TapIOUringWrite;
+
+struct TapIOUring {
+    struct io_uring ring;
+    int fd;
+
+    /* Receive buffers, filled by tap_io_uring_read_batch() */
+    uint8_t *rx_bufs[TAP_IO_URING_BATCH];
+    ssize_t rx_lens[TAP_IO_URING_BATCH];
+
+    /* Queued packets */
+    TapIOUringWrite tx[TAP_IO_URING_BATCH];
+    unsigned tx_count;
+};
+
+/* See the comment at the top of the file */
+static bool tap_io_uring_kernel_supported(void)
+{
+    struct utsname uts;
+    unsigned int major, minor;
+
+    if (uname(&uts) < 0 ||
+        sscanf(uts.release, "%u.%u", &major, &minor) != 2) {
+        return false;
+    }
+    return major > 5 || (major == 5 && minor >= 10);
+}
+
+/*
+ * The version alone does not say which opcodes are available, e.g. when a
+ * distribution kernel restricts io_uring, so check for them too.
+ */
+static bool tap_io_uring_probe(struct io_uring *ring)
+{
+#ifdef CONFIG_LIBURING_PROBE
+    struct io_uring_probe *probe = io_uring_get_probe_ring(ring);
+    bool ret;
+
+    if (!probe) {
+        return false;
+    }
+    ret = io_uring_opcode_supported(probe, IORING_OP_READ) &&
+          io_uring_opcode_supported(probe, IORING_OP_WRITEV);
+    io_uring_free_probe(probe);
+    return ret;
+#else
+    return false;
+#endif
+}
+
+TapIOUring *tap_io_uring_new(int fd, Error **errp)
+{
+    TapIOUring *s;
+    int i, ret;
+
+    if (!tap_io_uring_kernel_supported()) {
+        error_setg(errp, "io-uring requires Linux 5.10 or later");
+        return NULL;
+    }
+
+    /* Each batch needs one sqe per packet and completes before the next */
+    s = g_new0(TapIOUring, 1);
+    ret = io_uring_queue_init(TAP_IO_URING_BATCH, &s->ring, 0);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "failed to init io_uring");
+        g_free(s);
+        return NULL;
+    }
+    if (!tap_io_uring_probe(&s->ring)) {
+        error_setg(errp, "io_uring does not support tap reads and writes");
+        io_uring_queue_exit(&s->ring);
+        g_free(s);
+        return NULL;
+    }
+
+    s->fd = fd;
+    for (i = 0; i < TAP_IO_URING_BATCH; i++) {
+        s->rx_bufs[i] = g_malloc(NET_BUFSIZE);
+    }
+    return s;
+}
+
+static void tap_io_uring_write_free(TapIOUringWrite *w)
+{
+    if (w->owned) {
+        g_free(w->iov[0].iov_base);
+    }
+    g_free(w->iov);
+}
+
+void tap_io_uring_free(TapIOUring *s)
+{
+    unsigned i;
+
+    if (!s) {
+        return;
+    }
+
+    for (i = 0; i < TAP_IO_URING_BATCH; i++) {
+        g_free(s->rx_bufs[i]);
+    }
+    for (i = 0; i < s->tx_count; i++) {
+        tap_io_uring_write_free(&s->tx[i]);
+    }
+    io_uring_queue_exit(&s->ring);
+    g_free(s);
+}
+
+/*
+ * Submit @count linked requests that were prepared with user_data set to
+ * their index, and store each result in @res.  Returns a negative errno if
+ * the batch could not be submitted.
+ */
+static int tap_io_uring_run(TapIOUring *s, unsigned count, ssize_t *res)
+{
+    struct io_uring_cqe *cqe;
+    unsigned seen = 0;
+    int ret;
+
+    do {
+        ret = io_uring_submit_and_wait(&s->ring, count);
+    } while (ret == -EINTR);
+    if (ret < 0) {
+        return ret;
+    }
+
+    while (seen < count) {
+        ret = io_uring_wait_cqe(&s->ring, &cqe);
+        if (ret == -EINTR) {
+            continue;
+        }
+        if (ret < 0) {
+            return ret;
+        }
+        res[(uintptr_t)io_uring_cqe_get_data(cqe)] = cqe->res;
+        io_uring_cqe_seen(&s->ring, cqe);
+        seen++;
+    }
+    return 0;
+}
+
+int tap_io_uring_read_batch(TapIOUring *s, unsigned max)
+{
+    unsigned i;
+    int ret;
+
+    max = MIN(max, TAP_IO_URING_BATCH);
+    for (i = 0; i < max; i++) {
+        struct io_uring_sqe *sqe = io_uring_get_sqe(&s->ring);
+
+        io_uring_prep_read(sqe, s->fd, s->rx_bufs[i], NET_BUFSIZE, 0);
+        io_uring_sqe_set_data(sqe, (void *)(uintptr_t)i);
+        if (i + 1 < max) {
+            sqe->flags |= IOSQE_IO_LINK;
+        }
+    }
+
+    ret = tap_io_uring_run(s, max, s->rx_lens);
+    if (ret < 0) {
+        return ret;
+    }
+
+    /* Packets are only valid up to the first failed read */
+    for (i = 0; i < max && s->rx_lens[i] > 0; i++) {
+        /* nothing */
+    }
+    trace_tap_io_uring_read_batch(s, max, i);
+    return i;
+}
+
+uint8_t *tap_io_uring_rx_packet(TapIOUring *s, unsigned i, ssize_t *len)
+{
+    assert(i < TAP_IO_URING_BATCH);
+    *len = s->rx_lens[i];
+    return s->rx_bufs[i];
+}
+
+/* Queue a write of @iov, whose buffers must stay valid until it completes */
+bool tap_io_uring_queue_write(TapIOUring *s, const struct iovec *iov,
+                              int iovcnt)
+{
+    TapIOUringWrite *w;
+
+    if (s->tx_count == TAP_IO_URING_BATCH) {
+        return false;
+    }
+
+    w = &s->tx[s->tx_count++];
+    w->iov = g_memdup2(iov, iovcnt * sizeof(*iov));
+    w->iovcnt = iovcnt;
+    w->owned = false;
+    return true;
+}
+
+/* Copy the packets that are still queued out of the sender's buffers */
+void tap_io_uring_own_writes(TapIOUring *s)
+{
+    unsigned i;
+
+    for (i = 0; i < s->tx_count; i++) {
+        TapIOUringWrite *w = &s->tx[i];
+        size_t len;
+        void *buf;
+
+        if (w->owned) {
+            continue;
+        }
+        len = iov_size(w->iov, w->iovcnt);
+        buf = g_malloc(len);
+        iov_to_buf(w->iov, w->iovcnt, 0, buf, len);
+        g_free(w->iov);
+
+        w->iov = g_new(struct iovec, 1);
+        w->iov[0].iov_base = buf;
+        w->iov[0].iov_len = len;
+        w->iovcnt = 1;
+        w->owned = true;
+    }
+    trace_tap_io_uring_own_writes(s, s->tx_count);
+}
+
+unsigned tap_io_uring_pending_writes(TapIOUring *s)
+{
+    return s->tx_count;
+}
+
+int tap_io_uring_submit_writes(TapIOUring *s)
+{
+    ssize_t res[TAP_IO_URING_BATCH];
+    unsigned submitted, done, i;
+    bool blocked;
+    int ret;
+
+    while (s->tx_count) {
+        submitted = s->tx_count;
+        for (i = 0; i < submitted; i++) {
+            struct io_uring_sqe *sqe = io_uring_get_sqe(&s->ring);
+
+            io_uring_prep_writev(sqe, s->fd, s->tx[i].iov, s->tx[i].iovcnt, 0);
+            io_uring_sqe_set_data(sqe, (void *)(uintptr_t)i);
+            if (i + 1 < submitted) {
+                sqe->flags |= IOSQE_IO_LINK;
+            }
+        }
+
+        ret = tap_io_uring_run(s, submitted, res);
+        if (ret < 0) {
+            return ret;
+        }
+
+        for (done = 0; done < submitted && res[done] >= 0; done++) {
+            tap_io_uring_write_free(&s->tx[done]);
+        }
+
+        /*
+         * A packet that failed for a reason other than a full tap queue is
+         * dropped, like a failing writev(2) would drop it, and the packets
+         * cancelled behind it are resubmitted.
+         */
+        blocked = done < submitted && res[done] == -EAGAIN;
+        if (done < submitted && !blocked) {
+            tap_io_uring_write_free(&s->tx[done]);
+            done++;
+        }
+
+        memmove(s->tx, s->tx + done, (s->tx_count - done) * sizeof(s->tx[0]));
+        s->tx_count -= done;
+        trace_tap_io_uring_submit_writes(s, submitted, done);
+
+        if (blocked) {
+            break;
+        }
+    }
+    return s->tx_count;
+}
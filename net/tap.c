@@ -40,6 +40,7 @@
 #include "qapi/error.h"
 #include "qemu/cutils.h"
 #include "qemu/error-report.h"
+#include "qemu/iov.h"
 #include "qemu/main-loop.h"
 #include "qemu/sockets.h"
 
@@ -61,6 +62,12 @@ typedef struct TAPState {
     VHostNetState *vhost_net;
     unsigned host_vnet_hdr_len;
     Notifier exit;
+    AioContext *ctx; /* NULL means the main loop */
+    TapIOUring *uring; /* batched I/O, NULL unless io-uring=on */
+    bool uring_rx_failed; /* fall back to read(2) for receiving */
+    unsigned io_plugged;
+    unsigned rx_batch_next; /* next packet to deliver from the rx batch */
+    unsigned rx_batch_count;
 } TAPState;
 
 static void launch_script(const char *setup_script, const char *ifname,
@@ -71,10 +78,15 @@ static void tap_writable(void *opaque);
 
 static void tap_update_fd_handler(TAPState *s)
 {
-    qemu_set_fd_handler(s->fd,
-                        s->read_poll && s->enabled ? tap_send : NULL,
-                        s->write_poll && s->enabled ? tap_writable : NULL,
-                        s);
+    IOHandler *fd_read = s->read_poll && s->enabled ? tap_send : NULL;
+    IOHandler *fd_write = s->write_poll && s->enabled ? tap_writable : NULL;
+
+    if (s->ctx) {
+        aio_set_fd_handler(s->ctx, s->fd, false, fd_read, fd_write,
+                           NULL, NULL, s);
+    } else {
+        qemu_set_fd_handler(s->fd, fd_read, fd_write, s);
+    }
 }
 
 static void tap_read_poll(TAPState *s, bool enable)
@@ -89,19 +101,77 @@ static void tap_write_poll(TAPState *s, bool enable)
     tap_update_fd_handler(s);
 }
 
+/*
+ * Submit batched writes, waiting for the tap to drain if they don't fit.
+ * Unless the sender keeps its buffers until it unplugs the tap, the writes
+ * that are left must not refer to them anymore.
+ */
+static void tap_flush_batch(TAPState *s)
+{
+    if (!s->uring || !tap_io_uring_pending_writes(s->uring)) {
+        return;
+    }
+
+    if (tap_io_uring_submit_writes(s->uring) != 0) {
+        tap_write_poll(s, true);
+        if (!s->io_plugged) {
+            tap_io_uring_own_writes(s->uring);
+        }
+    }
+}
+
 static void tap_writable(void *opaque)
 {
     TAPState *s = opaque;
+    AioContext *ctx = s->ctx;
+
+    if (ctx) {
+        aio_context_acquire(ctx);
+    }
 
     tap_write_poll(s, false);
 
-    qemu_flush_queued_packets(&s->nc);
+    /* Packets that were already batched go out before queued ones */
+    tap_flush_batch(s);
+    if (!s->write_poll) {
+        qemu_flush_queued_packets(&s->nc);
+    }
+
+    if (ctx) {
+        aio_context_release(ctx);
+    }
+}
+
+static ssize_t tap_write_packet_batched(TAPState *s, const struct iovec *iov,
+                                        int iovcnt)
+{
+    /* Keep packets in order behind writes waiting for the tap to drain */
+    if (s->write_poll) {
+        return 0;
+    }
+
+    if (!tap_io_uring_queue_write(s->uring, iov, iovcnt)) {
+        tap_flush_batch(s);
+        if (s->write_poll || !tap_io_uring_queue_write(s->uring, iov, iovcnt)) {
+            return 0;
+        }
+    }
+
+    if (!s->io_plugged) {
+        tap_flush_batch(s);
+    }
+    return iov_size(iov, iovcnt);
 }
 
 static ssize_t tap_write_packet(TAPState *s, const struct iovec *iov, int iovcnt)
 {
     ssize_t len;
 
+    if (s->uring &&
+        (s->io_plugged || tap_io_uring_pending_writes(s->uring))) {
+        return tap_write_packet_batched(s, iov, iovcnt);
+    }
+
     do {
         len = writev(s->fd, iov, iovcnt);
     } while (len == -1 && errno == EINTR);
@@ -114,16 +184,18 @@ static ssize_t tap_write_packet(TAPState *s, const struct iovec *iov, int iovcnt
     return len;
 }
 
+/* Batched writes refer to the header after tap_receive*() returns */
+static const struct virtio_net_hdr_mrg_rxbuf tap_zero_hdr;
+
 static ssize_t tap_receive_iov(NetClientState *nc, const struct iovec *iov,
                                int iovcnt)
 {
     TAPState *s = DO_UPCAST(TAPState, nc, nc);
     const struct iovec *iovp = iov;
     struct iovec iov_copy[iovcnt + 1];
-    struct virtio_net_hdr_mrg_rxbuf hdr = { };
 
     if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
-        iov_copy[0].iov_base = &hdr;
+        iov_copy[0].iov_base = (void *)&tap_zero_hdr;
         iov_copy[0].iov_len =  s->host_vnet_hdr_len;
         memcpy(&iov_copy[1], iov, iovcnt * sizeof(*iov));
         iovp = iov_copy;
@@ -138,10 +210,9 @@ static ssize_t tap_receive_raw(NetClientState *nc, const uint8_t *buf, size_t si
     TAPState *s = DO_UPCAST(TAPState, nc, nc);
     struct iovec iov[2];
     int iovcnt = 0;
-    struct virtio_net_hdr_mrg_rxbuf hdr = { };
 
     if (s->host_vnet_hdr_len) {
-        iov[iovcnt].iov_base = &hdr;
+        iov[iovcnt].iov_base = (void *)&tap_zero_hdr;
         iov[iovcnt].iov_len  = s->host_vnet_hdr_len;
         iovcnt++;
     }
@@ -175,61 +246,137 @@ ssize_t tap_read_packet(int tapfd, uint8_t *buf, int maxlen)
 }
 #endif
 
+static void tap_send_packets(TAPState *s);
+
 static void tap_send_completed(NetClientState *nc, ssize_t len)
 {
     TAPState *s = DO_UPCAST(TAPState, nc, nc);
     tap_read_poll(s, true);
+
+    /* The fd may not become readable again for packets already read */
+    if (s->rx_batch_next < s->rx_batch_count) {
+        tap_send_packets(s);
+    }
 }
 
-static void tap_send(void *opaque)
+/* Returns false if no more packets should be sent for now */
+static bool tap_send_packet(TAPState *s, uint8_t *buf, int size)
 {
-    TAPState *s = opaque;
-    int size;
-    int packets = 0;
+    uint8_t min_pkt[ETH_ZLEN];
+    size_t min_pktsz = sizeof(min_pkt);
 
-    while (true) {
-        uint8_t *buf = s->buf;
-        uint8_t min_pkt[ETH_ZLEN];
-        size_t min_pktsz = sizeof(min_pkt);
+    if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
+        buf  += s->host_vnet_hdr_len;
+        size -= s->host_vnet_hdr_len;
+    }
 
-        size = tap_read_packet(s->fd, s->buf, sizeof(s->buf));
-        if (size <= 0) {
-            break;
+    if (net_peer_needs_padding(&s->nc)) {
+        if (eth_pad_short_frame(min_pkt, &min_pktsz, buf, size)) {
+            buf = min_pkt;
+            size = min_pktsz;
         }
+    }
 
-        if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
-            buf  += s->host_vnet_hdr_len;
-            size -= s->host_vnet_hdr_len;
-        }
+    size = qemu_send_packet_async(&s->nc, buf, size, tap_send_completed);
+    if (size == 0) {
+        tap_read_poll(s, false);
+        return false;
+    }
+    return size > 0;
+}
+
+/*
+ * When the host keeps receiving more packets while tap_send() is running we
+ * can hog the QEMU global mutex.  Limit the number of packets that are
+ * processed per tap_send() callback to prevent stalling the guest.
+ */
+#define TAP_SEND_MAX_PACKETS 50
+
+/* Read packets in batches, one system call per TAP_IO_URING_BATCH packets */
+static void tap_send_packets_batched(TAPState *s)
+{
+    int packets = 0;
+
+    for (;;) {
+        uint8_t *buf;
+        ssize_t size;
+
+        /*
+         * Packets already read are always delivered, as the fd may not
+         * become readable again; the limit only stops reading more.
+         */
+        if (s->rx_batch_next == s->rx_batch_count) {
+            int n;
 
-        if (net_peer_needs_padding(&s->nc)) {
-            if (eth_pad_short_frame(min_pkt, &min_pktsz, buf, size)) {
-                buf = min_pkt;
-                size = min_pktsz;
+            if (packets >= TAP_SEND_MAX_PACKETS) {
+                break;
             }
+            n = tap_io_uring_read_batch(s->uring, TAP_IO_URING_BATCH);
+
+            if (n < 0) {
+                warn_report_once("tap: batched receive failed (%s), "
+                                 "falling back to read()", strerror(-n));
+                s->uring_rx_failed = true;
+                break;
+            }
+            if (n == 0) {
+                break;
+            }
+            s->rx_batch_next = 0;
+            s->rx_batch_count = n;
         }
 
-        size = qemu_send_packet_async(&s->nc, buf, size, tap_send_completed);
-        if (size == 0) {
-            tap_read_poll(s, false);
+        buf = tap_io_uring_rx_packet(s->uring, s->rx_batch_next++, &size);
+        packets++;
+        if (!tap_send_packet(s, buf, size) && !s->read_poll) {
+            /* Queued by the peer, tap_send_completed() delivers the rest */
             break;
-        } else if (size < 0) {
+        }
+    }
+}
+
+static void tap_send_packets(TAPState *s)
+{
+    int size;
+    int packets = 0;
+
+    if (s->uring && !s->uring_rx_failed) {
+        tap_send_packets_batched(s);
+        return;
+    }
+
+    while (packets < TAP_SEND_MAX_PACKETS) {
+        size = tap_read_packet(s->fd, s->buf, sizeof(s->buf));
+        if (size <= 0) {
             break;
         }
 
-        /*
-         * When the host keeps receiving more packets while tap_send() is
-         * running we can hog the QEMU global mutex.  Limit the number of
-         * packets that are processed per tap_send() callback to prevent
-         * stalling the guest.
-         */
         packets++;
-        if (packets >= 50) {
+        if (!tap_send_packet(s, s->buf, size)) {
             break;
         }
     }
 }
 
+static void tap_send(void *opaque)
+{
+    TAPState *s = opaque;
+    AioContext *ctx = s->ctx;
+
+    if (ctx) {
+        aio_context_acquire(ctx);
+    }
+
+    /* Let the peer coalesce what is read in one go */
+    qemu_net_io_plug(&s->nc);
+    tap_send_packets(s);
+    qemu_net_io_unplug(&s->nc);
+
+    if (ctx) {
+        aio_context_release(ctx);
+    }
+}
+
 static bool tap_has_ufo(NetClientState *nc)
 {
     TAPState *s = DO_UPCAST(TAPState, nc, nc);
@@ -335,6 +482,8 @@ static void tap_cleanup(NetClientState *nc)
 
     tap_read_poll(s, false);
     tap_write_poll(s, false);
+    tap_io_uring_free(s->uring);
+    s->uring = NULL;
     close(s->fd);
     s->fd = -1;
 }
@@ -354,6 +503,43 @@ static bool tap_set_steering_ebpf(NetClientState *nc, int prog_fd)
     return tap_fd_set_steering_ebpf(s->fd, prog_fd) == 0;
 }
 
+static void tap_io_plug(NetClientState *nc)
+{
+    TAPState *s = DO_UPCAST(TAPState, nc, nc);
+
+    s->io_plugged++;
+}
+
+static void tap_io_unplug(NetClientState *nc)
+{
+    TAPState *s = DO_UPCAST(TAPState, nc, nc);
+
+    assert(s->io_plugged > 0);
+    if (--s->io_plugged == 0) {
+        tap_flush_batch(s);
+    }
+}
+
+static void tap_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    TAPState *s = DO_UPCAST(TAPState, nc, nc);
+    assert(nc->info->type == NET_CLIENT_DRIVER_TAP);
+
+    if (s->ctx == ctx) {
+        return;
+    }
+
+    /* Unregister from the old event loop before switching */
+    if (s->ctx) {
+        aio_set_fd_handler(s->ctx, s->fd, false, NULL, NULL, NULL, NULL, NULL);
+    } else {
+        qemu_set_fd_handler(s->fd, NULL, NULL, NULL);
+    }
+
+    s->ctx = ctx;
+    tap_update_fd_handler(s);
+}
+
 int tap_get_fd(NetClientState *nc)
 {
     TAPState *s = DO_UPCAST(TAPState, nc, nc);
@@ -380,6 +566,9 @@ static NetClientInfo net_tap_info = {
     .set_vnet_le = tap_set_vnet_le,
     .set_vnet_be = tap_set_vnet_be,
     .set_steering_ebpf = tap_set_steering_ebpf,
+    .set_aio_context = tap_set_aio_context,
+    .io_plug = tap_io_plug,
+    .io_unplug = tap_io_unplug,
 };
 
 static TAPState *net_tap_fd_init(NetClientState *peer,
@@ -689,6 +878,13 @@ static void net_init_tap_one(const NetdevTapOptions *tap, NetClientState *peer,
         return;
     }
 
+    if (tap->has_io_uring && tap->io_uring) {
+        s->uring = tap_io_uring_new(s->fd, errp);
+        if (!s->uring) {
+            return;
+        }
+    }
+
     if (tap->has_fd || tap->has_fds) {
         snprintf(s->nc.info_str, sizeof(s->nc.info_str), "fd=%d", fd);
     } else if (tap->has_helper) {
@@ -1053,6 +1249,7 @@ int tap_disable(NetClientState *nc)
         ret = tap_fd_disable(s->fd);
         if (ret == 0) {
             qemu_purge_queued_packets(nc);
+            s->rx_batch_next = s->rx_batch_count = 0;
             s->enabled = false;
             tap_update_fd_handler(s);
         }
@@ -26,6 +26,7 @@
 #ifndef NET_TAP_INT_H
 #define NET_TAP_INT_H
 
+#include "qapi/error.h"
 #include "qapi/qapi-types-net.h"
 
 int tap_open(char *ifname, int ifname_size, int *vnet_hdr,
@@ -46,4 +47,63 @@ int tap_fd_disable(int fd);
 int tap_fd_get_ifname(int fd, char *ifname);
 int tap_fd_set_steering_ebpf(int fd, int prog_fd);
 
+/* Number of packets transferred with a single io_uring submission */
+#define TAP_IO_URING_BATCH 16
+
+typedef struct TapIOUring TapIOUring;
+
+#ifdef CONFIG_LINUX_IO_URING
+TapIOUring *tap_io_uring_new(int fd, Error **errp);
+void tap_io_uring_free(TapIOUring *s);
+int tap_io_uring_read_batch(TapIOUring *s, unsigned max);
+uint8_t *tap_io_uring_rx_packet(TapIOUring *s, unsigned i, ssize_t *len);
+bool tap_io_uring_queue_write(TapIOUring *s, const struct iovec *iov,
+                              int iovcnt);
+void tap_io_uring_own_writes(TapIOUring *s);
+unsigned tap_io_uring_pending_writes(TapIOUring *s);
+int tap_io_uring_submit_writes(TapIOUring *s);
+#else
+static inline TapIOUring *tap_io_uring_new(int fd, Error **errp)
+{
+    error_setg(errp, "io-uring is not supported by this QEMU build");
+    return NULL;
+}
+
+static inline void tap_io_uring_free(TapIOUring *s)
+{
+}
+
+static inline int tap_io_uring_read_batch(TapIOUring *s, unsigned max)
+{
+    return -ENOSYS;
+}
+
+static inline uint8_t *tap_io_uring_rx_packet(TapIOUring *s, unsigned i,
+                                              ssize_t *len)
+{
+    g_assert_not_reached();
+}
+
+static inline bool tap_io_uring_queue_write(TapIOUring *s,
+                                            const struct iovec *iov,
+                                            int iovcnt)
+{
+    return false;
+}
+
+static inline void tap_io_uring_own_writes(TapIOUring *s)
+{
+}
+
+static inline unsigned tap_io_uring_pending_writes(TapIOUring *s)
+{
+    return 0;
+}
+
+static inline int tap_io_uring_submit_writes(TapIOUring *s)
+{
+    return -ENOSYS;
+}
+#endif /* !CONFIG_LINUX_IO_URING */
+
 #endif /* NET_TAP_INT_H */
@@ -0,0 +1,153 @@
+/*
+ * Toeplitz hash for receive side scaling
+ *
+ * Copyright (c) 2022 The QEMU Project Developers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Bit i of the hash input selects the 32 key bits starting at key bit i,
+ * and the hash is the XOR of all selected windows.  Walking the input one
+ * bit at a time costs hundreds of cycles per packet.  Since the hash is
+ * linear in the input, the contribution of every byte value at every input
+ * position can be tabulated once per key, leaving one lookup per byte.
+ *
+ * The same sum is a carry-less product: with the key window of each 32-bit
+ * input word stored bit-reversed, bits 31..62 of the product of the word
+ * and its window are the hash bits in reverse order.  Hosts with PCLMULQDQ
+ * compute a whole IPv6 tuple in nine multiplications and skip the tables.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/host-utils.h"
+#include "net/toeplitz.h"
+
+#if defined(CONFIG_AVX2_OPT) && defined(__x86_64__)
+#include "qemu/cpuid.h"
+#define NET_TOEPLITZ_CLMUL
+#endif
+
+static bool net_toeplitz_use_clmul;
+
+static void net_toeplitz_build_table(NetToeplitz *t)
+{
+    size_t pos;
+    unsigned v, bit;
+
+    for (pos = 0; pos < NET_TOEPLITZ_MAX_INPUT; pos++) {
+        /* Key bits 8 * pos .. 8 * pos + 39 */
+        uint64_t w = ((uint64_t)ldl_be_p(t->key + pos) << 8) |
+                     t->key[pos + sizeof(uint32_t)];
+        uint32_t *row = t->table[pos];
+
+        row[0] = 0;
+        for (bit = 0; bit < 8; bit++) {
+            row[0x80 >> bit] = w >> (8 - bit);
+        }
+        for (v = 1; v < 256; v++) {
+            if (v & (v - 1)) {
+                row[v] = row[v & (v - 1)] ^ row[v & -v];
+            }
+        }
+    }
+}
+
+void net_toeplitz_set_key(NetToeplitz *t, const uint8_t *key)
+{
+    size_t i;
+
+    if (t->valid && !memcmp(t->key, key, NET_TOEPLITZ_KEY_LEN)) {
+        return;
+    }
+
+    memcpy(t->key, key, NET_TOEPLITZ_KEY_LEN);
+    for (i = 0; i < ARRAY_SIZE(t->windows); i++) {
+        t->windows[i] = revbit64(ldq_be_p(t->key + i * sizeof(uint32_t)));
+    }
+    if (!net_toeplitz_use_clmul) {
+        net_toeplitz_build_table(t);
+    }
+    t->valid = true;
+}
+
+static uint32_t net_toeplitz_hash_table(const NetToeplitz *t,
+                                        const uint8_t *input, size_t len)
+{
+    uint32_t hash = 0;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= t->table[i][input[i]];
+    }
+    return hash;
+}
+
+#ifdef NET_TOEPLITZ_CLMUL
+#pragma GCC push_options
+#pragma GCC target("pclmul")
+#include <immintrin.h>
+
+static uint32_t net_toeplitz_hash_clmul(const NetToeplitz *t,
+                                        const uint8_t *input, size_t len)
+{
+    __m128i acc = _mm_setzero_si128();
+    size_t i;
+
+    for (i = 0; i < len; i += sizeof(uint32_t)) {
+        uint32_t word;
+        __m128i d, k;
+
+        if (likely(len - i >= sizeof(uint32_t))) {
+            word = ldl_be_p(input + i);
+        } else {
+            uint8_t tail[sizeof(uint32_t)] = { 0 };
+
+            memcpy(tail, input + i, len - i);
+            word = ldl_be_p(tail);
+        }
+        d = _mm_cvtsi32_si128(word);
+        k = _mm_cvtsi64_si128(t->windows[i / sizeof(uint32_t)]);
+        acc = _mm_xor_si128(acc, _mm_clmulepi64_si128(d, k, 0x00));
+    }
+
+    return revbit32(_mm_cvtsi128_si64(acc) >> 31);
+}
+
+#pragma GCC pop_options
+
+static void __attribute__((constructor)) net_toeplitz_init_accel(void)
+{
+    unsigned max = __get_cpuid_max(0, NULL);
+    int a, b, c, d;
+
+    if (max >= 1) {
+        __cpuid(1, a, b, c, d);
+        net_toeplitz_use_clmul = c & bit_PCLMUL;
+    }
+}
+#endif
+
+uint32_t net_toeplitz_hash(const NetToeplitz *t, const uint8_t *input,
+                           size_t len)
+{
+    assert(t->valid && len <= NET_TOEPLITZ_MAX_INPUT);
+
+#ifdef NET_TOEPLITZ_CLMUL
+    if (net_toeplitz_use_clmul) {
+        return net_toeplitz_hash_clmul(t, input, len);
+    }
+#endif
+    return net_toeplitz_hash_table(t, input, len);
+}
+
+bool test_net_toeplitz_next_accel(void)
+{
+#ifdef NET_TOEPLITZ_CLMUL
+    if (net_toeplitz_use_clmul) {
+        net_toeplitz_use_clmul = false;
+        return true;
+    }
+#endif
+    return false;
+}
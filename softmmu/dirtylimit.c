@@ -42,6 +42,16 @@
  * composed of dirty ring full and sleep time.
  */
 #define DIRTYLIMIT_THROTTLE_PCT_MAX 99
+/*
+ * Lowest quota handed out by the automatic mode, so that a heavily
+ * throttled vcpu still makes progress.
+ */
+#define DIRTYLIMIT_AUTO_QUOTA_MIN   1   /* MB/s */
+/*
+ * A vcpu limited automatically whose dirty page rate reaches this
+ * percentage of its quota is assumed to want more than the quota.
+ */
+#define DIRTYLIMIT_AUTO_SATURATED_PCT   90
 
 struct {
     VcpuStat stat;
@@ -57,6 +67,8 @@ typedef struct VcpuDirtyLimitState {
      * zero if not enabled.
      */
     uint64_t quota;
+    /* quota was set by dirtylimit_set_budget() rather than by the user */
+    bool automatic;
 } VcpuDirtyLimitState;
 
 struct {
@@ -385,6 +397,7 @@ void dirtylimit_set_vcpu(int cpu_index,
     }
 
     dirtylimit_state->states[cpu_index].enabled = enable;
+    dirtylimit_state->states[cpu_index].automatic = false;
 }
 
 void dirtylimit_set_all(uint64_t quota,
@@ -426,6 +439,118 @@ static void dirtylimit_cleanup(void)
     dirtylimit_state_finalize();
 }
 
+typedef struct DirtyLimitDemand {
+    VcpuDirtyLimitState *state;
+    uint64_t rate;
+} DirtyLimitDemand;
+
+static int dirtylimit_demand_cmp(const void *a, const void *b)
+{
+    const DirtyLimitDemand *da = a, *db = b;
+
+    return da->rate < db->rate ? -1 : da->rate > db->rate;
+}
+
+/*
+ * Dirty page rate a vcpu would reach without an automatic limit.  The
+ * measured rate of a vcpu that keeps hitting its quota says nothing about
+ * how much more it wants, so such a vcpu is ranked above all others.
+ */
+static uint64_t dirtylimit_auto_demand(VcpuDirtyLimitState *state)
+{
+    uint64_t rate = vcpu_dirty_rate_get(state->cpu_index);
+
+    if (state->enabled && state->automatic &&
+        rate * 100 >= state->quota * DIRTYLIMIT_AUTO_SATURATED_PCT) {
+        return UINT64_MAX;
+    }
+    return rate;
+}
+
+/*
+ * Share @budget MB/s of dirty page rate among the vcpus that the user did
+ * not limit explicitly.  vcpus dirtying less than an equal share of what
+ * is left keep running unthrottled and their unused share goes to the
+ * others; the remaining vcpus are all limited to the same quota.  Must be
+ * called with the iothread lock held.
+ */
+void dirtylimit_set_budget(uint64_t budget)
+{
+    g_autofree DirtyLimitDemand *demand = NULL;
+    uint64_t total = budget, share = 0;
+    int i, n = 0, limited = 0;
+
+    dirtylimit_state_lock();
+
+    if (!dirtylimit_in_service()) {
+        dirtylimit_init();
+    }
+
+    demand = g_new(DirtyLimitDemand, dirtylimit_state->max_cpus);
+    for (i = 0; i < dirtylimit_state->max_cpus; i++) {
+        VcpuDirtyLimitState *state = dirtylimit_vcpu_get_state(i);
+
+        if (state->enabled && !state->automatic) {
+            budget -= MIN(budget, state->quota);
+            continue;
+        }
+        demand[n].state = state;
+        demand[n].rate = dirtylimit_auto_demand(state);
+        n++;
+    }
+    qsort(demand, n, sizeof(*demand), dirtylimit_demand_cmp);
+
+    for (i = 0; i < n; i++) {
+        VcpuDirtyLimitState *state = demand[i].state;
+
+        share = budget / (n - i);
+        if (demand[i].rate <= share) {
+            budget -= demand[i].rate;
+            if (state->enabled) {
+                dirtylimit_set_vcpu(state->cpu_index, 0, false);
+            }
+            continue;
+        }
+
+        share = MAX(share, DIRTYLIMIT_AUTO_QUOTA_MIN);
+        dirtylimit_set_vcpu(state->cpu_index, share, true);
+        state->automatic = true;
+        limited++;
+    }
+
+    trace_dirtylimit_set_budget(total, limited, share);
+    dirtylimit_state_unlock();
+}
+
+/*
+ * Drop the limits installed by dirtylimit_set_budget(), and stop the
+ * service unless the user still limits some vcpu.  Must be called with
+ * the iothread lock held.
+ */
+void dirtylimit_cancel_budget(void)
+{
+    int i;
+
+    dirtylimit_state_lock();
+
+    if (!dirtylimit_in_service()) {
+        dirtylimit_state_unlock();
+        return;
+    }
+
+    for (i = 0; i < dirtylimit_state->max_cpus; i++) {
+        if (dirtylimit_vcpu_get_state(i)->automatic) {
+            dirtylimit_set_vcpu(i, 0, false);
+        }
+    }
+
+    if (!dirtylimit_state->limited_nvcpu) {
+        dirtylimit_cleanup();
+    }
+
+    dirtylimit_state_unlock();
+}
+
 void qmp_cancel_vcpu_dirty_limit(bool has_cpu_index,
                                  int64_t cpu_index,
                                  Error **errp)
@@ -20,8 +20,10 @@
 #include "qapi/visitor.h"
 #include "qemu/bitops.h"
 #include "qemu/error-report.h"
+#include "qemu/lockable.h"
 #include "qemu/main-loop.h"
 #include "qemu/qemu-print.h"
+#include "qemu/timer.h"
 #include "qom/object.h"
 #include "trace.h"
 
@@ -39,6 +41,31 @@
 static unsigned memory_region_transaction_depth;
 static bool memory_region_update_pending;
 static bool ioeventfd_update_pending;
+
+/*
+ * Topology changes made by the current transaction.  A changed region and
+ * each of its containers map to the ranges that changed, in the
+ * coordinates of a FlatView rooted at that container.  Keys are compared
+ * as pointers only; the regions may be gone by the time of the commit.
+ */
+static GHashTable *topology_changes;
+static bool topology_changed_all;
+
+/* Beyond this many separate changed ranges a FlatView is rendered anew */
+#define FLATVIEW_MAX_PARTIAL_RANGES 16
+
+/* Serializes lazy construction of dispatch tables */
+static QemuMutex flatview_dispatch_lock;
+
+static struct {
+    uint64_t commits;
+    uint64_t views_reused;
+    uint64_t views_partial;
+    uint64_t views_full;
+    uint64_t dispatch_builds;
+    uint64_t time_ns;
+    uint64_t max_time_ns;
+} topology_stats;
 unsigned int global_dirty_tracking;
 
 static QTAILQ_HEAD(, MemoryListener) memory_listeners
@@ -126,6 +153,24 @@ enum ListenerDirection { Forward, Reverse };
         }                                                               \
     } while (0)
 
+/*
+ * Like MEMORY_LISTENER_CALL_GLOBAL(_callback, Forward), but only for the
+ * listeners of address spaces that switch FlatView in this commit.  The
+ * others see no region callbacks, and begin/commit alone would make them
+ * think their address space became empty.
+ */
+#define MEMORY_LISTENER_CALL_CHANGING(_callback)                        \
+    do {                                                                \
+        MemoryListener *_listener;                                      \
+                                                                        \
+        QTAILQ_FOREACH(_listener, &memory_listeners, link) {            \
+            if (_listener->_callback &&                                 \
+                _listener->address_space->flatview_changing) {          \
+                _listener->_callback(_listener);                        \
+            }                                                           \
+        }                                                               \
+    } while (0)
+
 #define MEMORY_LISTENER_CALL(_as, _callback, _direction, _section, _args...) \
     do {                                                                \
         MemoryListener *_listener;                                      \
@@ -294,6 +339,9 @@ static void flatview_destroy(FlatView *view)
         memory_region_unref(view->ranges[i].mr);
     }
     g_free(view->ranges);
+    if (view->alias_targets) {
+        g_hash_table_unref(view->alias_targets);
+    }
     memory_region_unref(view->root);
     g_free(view);
 }
@@ -608,6 +656,10 @@ static void render_memory_region(FlatView *view,
     clip = addrrange_intersection(tmp, clip);
 
     if (mr->alias) {
+        if (!view->alias_targets) {
+            view->alias_targets = g_hash_table_new(NULL, NULL);
+        }
+        g_hash_table_add(view->alias_targets, mr->alias);
         int128_subfrom(&base, int128_make64(mr->alias->addr));
         int128_subfrom(&base, int128_make64(mr->alias_offset));
         render_memory_region(view, mr->alias, base, clip,
@@ -724,10 +776,67 @@ static MemoryRegion *memory_region_get_flatview_root(MemoryRegion *mr)
     return NULL;
 }
 
+/*
+ * Build the dispatch table of @view on its first use; see
+ * flatview_to_dispatch().  May be called from any thread within an RCU
+ * critical section, because views that need subpages, and thus new
+ * MemoryRegions, got their table from flatview_publish() under the BQL.
+ */
+AddressSpaceDispatch *flatview_build_dispatch(FlatView *view)
+{
+    AddressSpaceDispatch *d;
+    int i;
+
+    QEMU_LOCK_GUARD(&flatview_dispatch_lock);
+    d = view->dispatch;
+    if (d) {
+        return d;
+    }
+
+    d = address_space_dispatch_new(view);
+    for (i = 0; i < view->nr; i++) {
+        MemoryRegionSection mrs =
+            section_from_flat_range(&view->ranges[i], view);
+        flatview_add_to_dispatch(view, d, &mrs);
+    }
+    address_space_dispatch_compact(d);
+    topology_stats.dispatch_builds++;
+
+    qatomic_rcu_set(&view->dispatch, d);
+    return d;
+}
+
+/* Whether the dispatch table of @view needs subpages */
+static bool flatview_has_subpages(FlatView *view)
+{
+    FlatRange *fr;
+
+    FOR_EACH_FLAT_RANGE(fr, view) {
+        if ((int128_getlo(fr->addr.start) | int128_getlo(fr->addr.size)) &
+            ~TARGET_PAGE_MASK) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Simplify a freshly rendered view and make it current.  Creating
+ * subpages initializes QOM objects, which needs the BQL, so a view that
+ * needs them gets its dispatch table right away.
+ */
+static void flatview_publish(FlatView *view)
+{
+    flatview_simplify(view);
+    g_hash_table_replace(flat_views, view->root, view);
+    if (flatview_has_subpages(view)) {
+        flatview_build_dispatch(view);
+    }
+}
+
 /* Render a memory topology into a list of disjoint absolute ranges. */
 static FlatView *generate_memory_topology(MemoryRegion *mr)
 {
-    int i;
     FlatView *view;
 
     view = flatview_new(mr);
@@ -737,16 +846,69 @@ static FlatView *generate_memory_topology(MemoryRegion *mr)
                              addrrange_make(int128_zero(), int128_2_64()),
                              false, false);
     }
-    flatview_simplify(view);
+    flatview_publish(view);
 
-    view->dispatch = address_space_dispatch_new(view);
-    for (i = 0; i < view->nr; i++) {
-        MemoryRegionSection mrs =
-            section_from_flat_range(&view->ranges[i], view);
-        flatview_add_to_dispatch(view, &mrs);
+    return view;
+}
+
+/*
+ * Render @mr again, taking the ranges of @old_view that lie outside
+ * @dirty as they are.  @dirty holds disjoint AddrRanges sorted by address.
+ * Rendering is pointwise, so rendering @mr clipped to each dirty range into
+ * the holes gives the same view as a full render.
+ */
+static FlatView *regenerate_memory_topology(MemoryRegion *mr,
+                                            FlatView *old_view,
+                                            GArray *dirty)
+{
+    AddrRange *d = &g_array_index(dirty, AddrRange, 0);
+    FlatView *view;
+    unsigned i, j = 0;
+
+    view = flatview_new(mr);
+    if (old_view->alias_targets) {
+        GHashTableIter iter;
+        gpointer key;
+
+        view->alias_targets = g_hash_table_new(NULL, NULL);
+        g_hash_table_iter_init(&iter, old_view->alias_targets);
+        while (g_hash_table_iter_next(&iter, &key, NULL)) {
+            g_hash_table_add(view->alias_targets, key);
+        }
+    }
+
+    for (i = 0; i < old_view->nr; i++) {
+        FlatRange fr = old_view->ranges[i];
+        Int128 start = fr.addr.start;
+        Int128 end = addrrange_end(fr.addr);
+
+        while (int128_lt(start, end)) {
+            FlatRange piece = fr;
+            Int128 stop = end;
+
+            while (j < dirty->len && int128_le(addrrange_end(d[j]), start)) {
+                j++;
+            }
+            if (j < dirty->len) {
+                if (int128_le(d[j].start, start)) {
+                    start = int128_min(end, addrrange_end(d[j]));
+                    continue;
+                }
+                stop = int128_min(end, d[j].start);
+            }
+
+            piece.offset_in_region +=
+                int128_get64(int128_sub(start, fr.addr.start));
+            piece.addr = addrrange_make(start, int128_sub(stop, start));
+            flatview_insert(view, view->nr, &piece);
+            start = stop;
+        }
     }
-    address_space_dispatch_compact(view->dispatch);
-    g_hash_table_replace(flat_views, mr, view);
+
+    for (i = 0; i < dirty->len; i++) {
+        render_memory_region(view, mr, int128_zero(), d[i], false, false);
+    }
+    flatview_publish(view);
 
     return view;
 }
@@ -824,6 +986,11 @@ static void address_space_update_ioeventfds(AddressSpace *as)
     AddrRange tmp;
     unsigned i;
 
+    /* Address spaces nobody listens to for ioeventfds need no list */
+    if (!as->ioeventfd_notifiers) {
+        return;
+    }
+
     /*
      * It is likely that the number of ioeventfds hasn't changed much, so use
      * the previous size as the starting value, with some headroom to avoid
@@ -992,6 +1159,7 @@ static void flatviews_init(void)
     flat_views = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
                                        (GDestroyNotify) flatview_unref);
     if (!empty_view) {
+        qemu_mutex_init(&flatview_dispatch_lock);
         empty_view = generate_memory_topology(NULL);
         /* We keep it alive forever in the global variable.  */
         flatview_ref(empty_view);
@@ -1001,29 +1169,174 @@ static void flatviews_init(void)
     }
 }
 
+/* Record that @mr changed, see topology_changes */
+static void memory_region_topology_changed(MemoryRegion *mr)
+{
+    AddrRange range = addrrange_make(int128_zero(), mr->size);
+    MemoryRegion *container;
+
+    memory_region_update_pending = true;
+    if (topology_changed_all) {
+        return;
+    }
+
+    if (!topology_changes) {
+        topology_changes = g_hash_table_new_full(NULL, NULL, NULL,
+                                                 (GDestroyNotify)g_array_unref);
+    }
+    for (container = mr; container; container = container->container) {
+        GArray *ranges = g_hash_table_lookup(topology_changes, container);
+
+        if (!ranges) {
+            ranges = g_array_new(false, false, sizeof(AddrRange));
+            g_hash_table_insert(topology_changes, container, ranges);
+        }
+        int128_addto(&range.start, int128_make64(container->addr));
+        g_array_append_val(ranges, range);
+    }
+}
+
+/* Record a change that affects every FlatView */
+static void memory_region_topology_changed_all(void)
+{
+    memory_region_update_pending = true;
+    topology_changed_all = true;
+}
+
+static gint addrrange_compare_start(gconstpointer a, gconstpointer b)
+{
+    const AddrRange *r1 = a, *r2 = b;
+
+    if (int128_lt(r1->start, r2->start)) {
+        return -1;
+    }
+    return int128_eq(r1->start, r2->start) ? 0 : 1;
+}
+
+/*
+ * Return the ranges of @view that the current transaction changed, merged
+ * and sorted, or NULL if @view has to be rendered from scratch.  An empty
+ * array means @view can be reused.
+ */
+static GArray *flatview_changed_ranges(FlatView *view)
+{
+    GArray *changes, *merged;
+    GHashTableIter iter;
+    gpointer key;
+    unsigned i;
+
+    if (topology_changed_all) {
+        return NULL;
+    }
+
+    merged = g_array_new(false, false, sizeof(AddrRange));
+    if (!topology_changes) {
+        return merged;
+    }
+
+    /* Alias targets are rendered at other offsets, don't bother */
+    if (view->alias_targets) {
+        g_hash_table_iter_init(&iter, view->alias_targets);
+        while (g_hash_table_iter_next(&iter, &key, NULL)) {
+            if (g_hash_table_contains(topology_changes, key)) {
+                g_array_unref(merged);
+                return NULL;
+            }
+        }
+    }
+
+    changes = g_hash_table_lookup(topology_changes, view->root);
+    if (!changes) {
+        return merged;
+    }
+
+    g_array_sort(changes, addrrange_compare_start);
+    for (i = 0; i < changes->len; i++) {
+        AddrRange r = g_array_index(changes, AddrRange, i);
+        AddrRange *last = merged->len ?
+            &g_array_index(merged, AddrRange, merged->len - 1) : NULL;
+
+        if (!int128_nz(r.size)) {
+            continue;
+        }
+        if (last && int128_le(r.start, addrrange_end(*last))) {
+            Int128 end = int128_max(addrrange_end(*last), addrrange_end(r));
+
+            last->size = int128_sub(end, last->start);
+        } else {
+            g_array_append_val(merged, r);
+        }
+    }
+
+    if (merged->len > FLATVIEW_MAX_PARTIAL_RANGES) {
+        g_array_unref(merged);
+        return NULL;
+    }
+    return merged;
+}
+
+/*
+ * Bring the FlatViews of all address spaces up to date.  Views that the
+ * current transaction did not touch are carried over, the others are
+ * rendered again, only in the ranges that changed if possible.
+ */
 static void flatviews_reset(void)
 {
+    GHashTable *old_views = flat_views;
     AddressSpace *as;
 
-    if (flat_views) {
-        g_hash_table_unref(flat_views);
-        flat_views = NULL;
-    }
+    flat_views = NULL;
     flatviews_init();
 
     /* Render unique FVs */
     QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
         MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
+        FlatView *old_view;
+        GArray *dirty;
 
         if (g_hash_table_lookup(flat_views, physmr)) {
             continue;
         }
 
-        generate_memory_topology(physmr);
+        old_view = old_views ? g_hash_table_lookup(old_views, physmr) : NULL;
+        dirty = old_view ? flatview_changed_ranges(old_view) : NULL;
+        if (!dirty) {
+            generate_memory_topology(physmr);
+            topology_stats.views_full++;
+        } else if (!dirty->len) {
+            flatview_ref(old_view);
+            g_hash_table_replace(flat_views, physmr, old_view);
+            topology_stats.views_reused++;
+        } else {
+            regenerate_memory_topology(physmr, old_view, dirty);
+            topology_stats.views_partial++;
+        }
+        if (dirty) {
+            g_array_unref(dirty);
+        }
+    }
+
+    if (old_views) {
+        g_hash_table_unref(old_views);
     }
+    if (topology_changes) {
+        g_hash_table_unref(topology_changes);
+        topology_changes = NULL;
+    }
+    topology_changed_all = false;
 }
 
-static void address_space_set_flatview(AddressSpace *as)
+/* Returns true if flatviews_reset() gave @as a different FlatView */
+static bool address_space_flatview_changing(AddressSpace *as)
+{
+    MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
+
+    return address_space_to_flatview(as) !=
+           g_hash_table_lookup(flat_views, physmr);
+}
+
+/* Returns true if @as switched to a different FlatView */
+static bool address_space_set_flatview(AddressSpace *as)
 {
     FlatView *old_view = address_space_to_flatview(as);
     MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
@@ -1032,7 +1345,7 @@ static void address_space_set_flatview(AddressSpace *as)
     assert(new_view);
 
     if (old_view == new_view) {
-        return;
+        return false;
     }
 
     if (old_view) {
@@ -1066,6 +1379,7 @@ static void address_space_set_flatview(AddressSpace *as)
     if (old_view) {
         flatview_unref(old_view);
     }
+    return true;
 }
 
 static void address_space_update_topology(AddressSpace *as)
@@ -1095,17 +1409,42 @@ void memory_region_transaction_commit(void)
     --memory_region_transaction_depth;
     if (!memory_region_transaction_depth) {
         if (memory_region_update_pending) {
+            int64_t start_ns = get_clock();
+            uint64_t reused = topology_stats.views_reused;
+            uint64_t partial = topology_stats.views_partial;
+            uint64_t full = topology_stats.views_full;
+            uint64_t elapsed_ns;
+
             flatviews_reset();
 
-            MEMORY_LISTENER_CALL_GLOBAL(begin, Forward);
+            QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+                as->flatview_changing = address_space_flatview_changing(as);
+            }
+            MEMORY_LISTENER_CALL_CHANGING(begin);
 
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
-                address_space_set_flatview(as);
-                address_space_update_ioeventfds(as);
+                if (address_space_set_flatview(as) ||
+                    ioeventfd_update_pending) {
+                    address_space_update_ioeventfds(as);
+                }
             }
             memory_region_update_pending = false;
             ioeventfd_update_pending = false;
-            MEMORY_LISTENER_CALL_GLOBAL(commit, Forward);
+            MEMORY_LISTENER_CALL_CHANGING(commit);
+
+            QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+                as->flatview_changing = false;
+            }
+
+            elapsed_ns = get_clock() - start_ns;
+            topology_stats.commits++;
+            topology_stats.time_ns += elapsed_ns;
+            topology_stats.max_time_ns = MAX(topology_stats.max_time_ns,
+                                             elapsed_ns);
+            trace_memory_region_transaction_commit(
+                topology_stats.views_reused - reused,
+                topology_stats.views_partial - partial,
+                topology_stats.views_full - full, elapsed_ns);
         } else if (ioeventfd_update_pending) {
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
                 address_space_update_ioeventfds(as);
@@ -2135,7 +2474,9 @@ void memory_region_set_log(MemoryRegion *mr, bool log, unsigned client)
 
     memory_region_transaction_begin();
     mr->dirty_log_mask = (mr->dirty_log_mask & ~mask) | (log * mask);
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_topology_changed(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2265,7 +2606,9 @@ void memory_region_set_readonly(MemoryRegion *mr, bool readonly)
     if (mr->readonly != readonly) {
         memory_region_transaction_begin();
         mr->readonly = readonly;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_topology_changed(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2275,7 +2618,9 @@ void memory_region_set_nonvolatile(MemoryRegion *mr, bool nonvolatile)
     if (mr->nonvolatile != nonvolatile) {
         memory_region_transaction_begin();
         mr->nonvolatile = nonvolatile;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_topology_changed(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2285,7 +2630,9 @@ void memory_region_rom_device_set_romd(MemoryRegion *mr, bool romd_mode)
     if (mr->romd_mode != romd_mode) {
         memory_region_transaction_begin();
         mr->romd_mode = romd_mode;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_topology_changed(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2537,7 +2884,9 @@ static void memory_region_update_container_subregions(MemoryRegion *subregion)
     }
     QTAILQ_INSERT_TAIL(&mr->subregions, subregion, subregions_link);
 done:
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
+    if (mr->enabled && subregion->enabled) {
+        memory_region_topology_changed(subregion);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2580,6 +2929,9 @@ void memory_region_del_subregion(MemoryRegion *mr,
 
     memory_region_transaction_begin();
     assert(subregion->container == mr);
+    if (mr->enabled && subregion->enabled) {
+        memory_region_topology_changed(subregion);
+    }
     subregion->container = NULL;
     for (alias = subregion->alias; alias; alias = alias->alias) {
         alias->mapped_via_alias--;
@@ -2587,7 +2939,6 @@ void memory_region_del_subregion(MemoryRegion *mr,
     }
     QTAILQ_REMOVE(&mr->subregions, subregion, subregions_link);
     memory_region_unref(subregion);
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
     memory_region_transaction_commit();
 }
 
@@ -2598,7 +2949,7 @@ void memory_region_set_enabled(MemoryRegion *mr, bool enabled)
     }
     memory_region_transaction_begin();
     mr->enabled = enabled;
-    memory_region_update_pending = true;
+    memory_region_topology_changed(mr);
     memory_region_transaction_commit();
 }
 
@@ -2613,8 +2964,10 @@ void memory_region_set_size(MemoryRegion *mr, uint64_t size)
         return;
     }
     memory_region_transaction_begin();
+    /* Both the old and the new extent change */
+    memory_region_topology_changed(mr);
     mr->size = s;
-    memory_region_update_pending = true;
+    memory_region_topology_changed(mr);
     memory_region_transaction_commit();
 }
 
@@ -2650,7 +3003,9 @@ void memory_region_set_alias_offset(MemoryRegion *mr, hwaddr offset)
 
     memory_region_transaction_begin();
     mr->alias_offset = offset;
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_topology_changed(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2821,7 +3176,7 @@ void memory_global_dirty_log_start(unsigned int flags)
     if (!old_flags) {
         MEMORY_LISTENER_CALL_GLOBAL(log_global_start, Forward);
         memory_region_transaction_begin();
-        memory_region_update_pending = true;
+        memory_region_topology_changed_all();
         memory_region_transaction_commit();
     }
 }
@@ -2836,7 +3191,7 @@ static void memory_global_dirty_log_do_stop(unsigned int flags)
 
     if (!global_dirty_tracking) {
         memory_region_transaction_begin();
-        memory_region_update_pending = true;
+        memory_region_topology_changed_all();
         memory_region_transaction_commit();
         MEMORY_LISTENER_CALL_GLOBAL(log_global_stop, Reverse);
     }
@@ -2917,6 +3272,12 @@ static void listener_add_address_space(MemoryListener *listener,
         listener->commit(listener);
     }
     flatview_unref(view);
+
+    if ((listener->eventfd_add || listener->eventfd_del) &&
+        as->ioeventfd_notifiers++ == 0) {
+        /* The list is not kept while nobody listens, build it now */
+        address_space_update_ioeventfds(as);
+    }
 }
 
 static void listener_del_address_space(MemoryListener *listener,
@@ -2943,6 +3304,14 @@ static void listener_del_address_space(MemoryListener *listener,
         listener->commit(listener);
     }
     flatview_unref(view);
+
+    if ((listener->eventfd_add || listener->eventfd_del) &&
+        !--as->ioeventfd_notifiers) {
+        /* Whoever registers next starts from an empty list */
+        g_free(as->ioeventfds);
+        as->ioeventfds = NULL;
+        as->ioeventfd_nb = 0;
+    }
 }
 
 void memory_listener_register(MemoryListener *listener, AddressSpace *as)
@@ -3006,6 +3375,7 @@ void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name)
     as->current_map = NULL;
     as->ioeventfd_nb = 0;
     as->ioeventfds = NULL;
+    as->ioeventfd_notifiers = 0;
     QTAILQ_INIT(&as->listeners);
     QTAILQ_INSERT_TAIL(&address_spaces, as, address_spaces_link);
     as->name = g_strdup(name ? name : "anonymous");
@@ -3305,7 +3675,7 @@ static void mtree_print_flatview(gpointer key, gpointer value,
 
 #if !defined(CONFIG_USER_ONLY)
     if (fvi->dispatch_tree && view->root) {
-        mtree_print_dispatch(view->dispatch, view->root);
+        mtree_print_dispatch(flatview_to_dispatch(view), view->root);
     }
 #endif
 
@@ -3357,6 +3727,18 @@ static void mtree_info_flatview(bool dispatch_tree, bool owner)
     /* Print */
     g_hash_table_foreach(views, mtree_print_flatview, &fvi);
 
+    qemu_printf("Topology commits: %" PRIu64 ", FlatViews reused %" PRIu64
+                ", partially rendered %" PRIu64 ", fully rendered %" PRIu64
+                "\n", topology_stats.commits, topology_stats.views_reused,
+                topology_stats.views_partial, topology_stats.views_full);
+    qemu_printf("Dispatch tables built: %" PRIu64 "\n",
+                topology_stats.dispatch_builds);
+    if (topology_stats.commits) {
+        qemu_printf("Commit time: avg %" PRIu64 " us, max %" PRIu64 " us\n",
+                    topology_stats.time_ns / topology_stats.commits / 1000,
+                    topology_stats.max_time_ns / 1000);
+    }
+
     /* Free */
     g_hash_table_foreach_remove(views, mtree_info_flatview_free, 0);
     g_hash_table_unref(views);
@@ -1204,9 +1204,9 @@ static void phys_sections_free(PhysPageMap *map)
     g_free(map->nodes);
 }
 
-static void register_subpage(FlatView *fv, MemoryRegionSection *section)
+static void register_subpage(FlatView *fv, AddressSpaceDispatch *d,
+                             MemoryRegionSection *section)
 {
-    AddressSpaceDispatch *d = flatview_to_dispatch(fv);
     subpage_t *subpage;
     hwaddr base = section->offset_within_address_space
         & TARGET_PAGE_MASK;
@@ -1235,10 +1235,9 @@ static void register_subpage(FlatView *fv, MemoryRegionSection *section)
 }
 
 
-static void register_multipage(FlatView *fv,
+static void register_multipage(AddressSpaceDispatch *d,
                                MemoryRegionSection *section)
 {
-    AddressSpaceDispatch *d = flatview_to_dispatch(fv);
     hwaddr start_addr = section->offset_within_address_space;
     uint16_t section_index = phys_section_add(&d->map, section);
     uint64_t num_pages = int128_get64(int128_rshift(section->size,
@@ -1255,7 +1254,8 @@ static void register_multipage(FlatView *fv,
  *
  * where s stands for subpage and P for page.
  */
-void flatview_add_to_dispatch(FlatView *fv, MemoryRegionSection *section)
+void flatview_add_to_dispatch(FlatView *fv, AddressSpaceDispatch *d,
+                              MemoryRegionSection *section)
 {
     MemoryRegionSection remain = *section;
     Int128 page_size = int128_make64(TARGET_PAGE_SIZE);
@@ -1267,7 +1267,7 @@ void flatview_add_to_dispatch(FlatView *fv, MemoryRegionSection *section)
 
         MemoryRegionSection now = remain;
         now.size = int128_min(int128_make64(left), now.size);
-        register_subpage(fv, &now);
+        register_subpage(fv, d, &now);
         if (int128_eq(remain.size, now.size)) {
             return;
         }
@@ -1280,7 +1280,7 @@ void flatview_add_to_dispatch(FlatView *fv, MemoryRegionSection *section)
     if (int128_ge(remain.size, page_size)) {
         MemoryRegionSection now = remain;
         now.size = int128_and(now.size, int128_neg(page_size));
-        register_multipage(fv, &now);
+        register_multipage(d, &now);
         if (int128_eq(remain.size, now.size)) {
             return;
         }
@@ -1290,7 +1290,7 @@ void flatview_add_to_dispatch(FlatView *fv, MemoryRegionSection *section)
     }
 
     /* register last subpage */
-    register_subpage(fv, &remain);
+    register_subpage(fv, d, &remain);
 }
 
 void qemu_flush_coalesced_mmio_buffer(void)
@@ -3846,6 +3846,25 @@ int ram_block_coordinated_discard_require(bool state)
     return ret;
 }
 
+/*
+ * Like ram_block_discard_range(), but fail with -EBUSY if discards are
+ * disabled.  ram_block_discard_disable() waits for a discard in progress,
+ * so discarding never overlaps with a user that relies on pinned pages.
+ * Meant for threads that do not hold the BQL.
+ */
+int ram_block_discard_range_unless_disabled(RAMBlock *rb, uint64_t start,
+                                            size_t length)
+{
+    int ret = -EBUSY;
+
+    ram_block_discard_disable_mutex_lock();
+    if (!ram_block_discard_is_disabled()) {
+        ret = ram_block_discard_range(rb, start, length);
+    }
+    ram_block_discard_disable_mutex_unlock();
+    return ret;
+}
+
 bool ram_block_discard_is_disabled(void)
 {
     return qatomic_read(&ram_block_discard_disabled_cnt) ||
@@ -37,6 +37,7 @@
 #include "qemu/qemu-print.h"
 #include "qemu/option_int.h"
 #include "sysemu/block-backend.h"
+#include "sysemu/sysemu.h"
 #include "migration/misc.h"
 #include "migration/migration.h"
 #include "qemu/cutils.h"
@@ -1062,5 +1063,12 @@ bool qmp_command_available(const QmpCommand *cmd, Error **errp)
                    cmd->name);
         return false;
     }
+    /* The machine is about to be created, leave only read-only access */
+    if (startup_prealloc_pending && !g_str_has_prefix(cmd->name, "query-") &&
+        strcmp(cmd->name, "qmp_capabilities")) {
+        error_setg(errp, "The command '%s' is not permitted while memory "
+                   "is being preallocated", cmd->name);
+        return false;
+    }
     return true;
 }
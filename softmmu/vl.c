@@ -170,6 +170,7 @@ static QTAILQ_HEAD(, DeviceOption) device_opts = QTAILQ_HEAD_INITIALIZER(device_
 static int display_remote;
 static int snapshot;
 static bool preconfig_requested;
+bool startup_prealloc_pending;
 static QemuPluginList plugin_list = QTAILQ_HEAD_INITIALIZER(plugin_list);
 static BlockdevOptionsQueue bdo_queue = QSIMPLEQ_HEAD_INITIALIZER(bdo_queue);
 static bool nographic = false;
@@ -3583,6 +3584,18 @@ void qemu_init(int argc, char **argv, char **envp)
     }
 
     if (!preconfig_requested) {
+        /*
+         * Serve the monitor, so that management can follow the progress
+         * with query-memory-prealloc, while memory backends are being
+         * preallocated.  Only queries are accepted meanwhile, anything
+         * else could change the configuration or create the machine
+         * under our feet.
+         */
+        startup_prealloc_pending = true;
+        while (!os_mem_prealloc_async_done()) {
+            main_loop_wait(false);
+        }
+        startup_prealloc_pending = false;
         qmp_x_exit_preconfig(&error_fatal);
     }
     qemu_init_displays();
@@ -0,0 +1,142 @@
+/*
+ * Coroutine switch microbenchmark
+ *
+ * Copyright (C) 2022 The QEMU Project Developers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Build QEMU with different --with-coroutine backends and run this in each
+ * build directory to compare them; the backend name is part of the output.
+ */
+#include "qemu/osdep.h"
+#include "qemu/coroutine.h"
+#include "qemu/timer.h"
+
+static unsigned long n_iter = 10000000;
+static unsigned int depth = 100;
+
+static const char commands_string[] =
+    " -n = number of iterations\n"
+    " -d = nesting depth for the nesting test";
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+}
+
+static void report(const char *name, unsigned long switches, int64_t ns)
+{
+    printf("%-10s %12lu switches %10.3f s %8.2f ns/switch\n", name, switches,
+           ns / 1e9, (double)ns / switches);
+}
+
+static void coroutine_fn yield_loop(void *opaque)
+{
+    bool *done = opaque;
+
+    while (!*done) {
+        qemu_coroutine_yield();
+    }
+}
+
+/* One enter and one yield per iteration */
+static void bench_yield(void)
+{
+    bool done = false;
+    Coroutine *co = qemu_coroutine_create(yield_loop, &done);
+    unsigned long i;
+    int64_t start;
+
+    start = get_clock();
+    for (i = 0; i < n_iter; i++) {
+        qemu_coroutine_enter(co);
+    }
+    report("yield", 2 * n_iter, get_clock() - start);
+
+    done = true;
+    qemu_coroutine_enter(co);
+}
+
+static void coroutine_fn empty_coroutine(void *opaque)
+{
+}
+
+/* Create from the pool, enter and terminate */
+static void bench_lifecycle(void)
+{
+    unsigned long i;
+    int64_t start;
+
+    start = get_clock();
+    for (i = 0; i < n_iter; i++) {
+        qemu_coroutine_enter(qemu_coroutine_create(empty_coroutine, NULL));
+    }
+    report("lifecycle", 2 * n_iter, get_clock() - start);
+}
+
+static void coroutine_fn nest(void *opaque)
+{
+    unsigned int *level = opaque;
+
+    if (--*level) {
+        qemu_coroutine_enter(qemu_coroutine_create(nest, level));
+    }
+}
+
+/* Chains of nested coroutines, which touch more stacks than bench_yield */
+static void bench_nesting(void)
+{
+    unsigned long i, n = MAX(n_iter / depth, 1);
+    int64_t start;
+
+    start = get_clock();
+    for (i = 0; i < n; i++) {
+        unsigned int level = depth;
+
+        qemu_coroutine_enter(qemu_coroutine_create(nest, &level));
+    }
+    report("nesting", 2 * n * depth, get_clock() - start);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "hn:d:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            usage_complete(argv);
+            exit(0);
+        case 'n':
+            n_iter = atol(optarg);
+            break;
+        case 'd':
+            depth = atoi(optarg);
+            break;
+        default:
+            usage_complete(argv);
+            exit(1);
+        }
+    }
+    if (!n_iter || !depth) {
+        usage_complete(argv);
+        exit(1);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    parse_args(argc, argv);
+
+    printf("coroutine backend: %s\n", COROUTINE_BACKEND);
+    bench_yield();
+    bench_lifecycle();
+    bench_nesting();
+    return 0;
+}
@@ -0,0 +1,152 @@
+/*
+ * QEMUTimerList microbenchmark
+ *
+ * Copyright (C) 2022 The QEMU Project Developers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Arms, queries and fires many timers on one timer list, to measure how
+ * the cost of timer_mod and of finding the next deadline scales with the
+ * number of active timers.
+ */
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+
+static unsigned int n_timers = 10000;
+static unsigned long n_ops = 1000000;
+static unsigned long fired;
+
+static const char commands_string[] =
+    " -n = number of active timers\n"
+    " -o = number of operations per test";
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+}
+
+/*
+ * From: https://en.wikipedia.org/wiki/Xorshift
+ * This is faster than rand_r(), and gives us a wider range (RAND_MAX is only
+ * guaranteed to be >= INT_MAX).
+ */
+static uint64_t xorshift64star(uint64_t x)
+{
+    x ^= x >> 12; /* a */
+    x ^= x << 25; /* b */
+    x ^= x >> 27; /* c */
+    return x * UINT64_C(2685821657736338717);
+}
+
+static void report(const char *name, unsigned long ops, int64_t ns)
+{
+    printf("%-10s %10lu ops %10.3f s %8.2f ns/op\n", name, ops, ns / 1e9,
+           (double)ns / ops);
+}
+
+/* Deadlines an hour away, so that nothing fires before the last test */
+static int64_t far_deadline(int64_t now, uint64_t r)
+{
+    return now + 3600 * NANOSECONDS_PER_SECOND + r % NANOSECONDS_PER_SECOND;
+}
+
+static void timer_cb(void *opaque)
+{
+    fired++;
+}
+
+int main(int argc, char *argv[])
+{
+    QEMUTimerListGroup tlg;
+    QEMUTimerList *tl;
+    QEMUTimer *timers;
+    uint64_t r = 1;
+    int64_t now, start;
+    unsigned long i;
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "hn:o:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            usage_complete(argv);
+            return 0;
+        case 'n':
+            n_timers = atoi(optarg);
+            break;
+        case 'o':
+            n_ops = atol(optarg);
+            break;
+        default:
+            usage_complete(argv);
+            return 1;
+        }
+    }
+    if (!n_timers || !n_ops) {
+        usage_complete(argv);
+        return 1;
+    }
+
+    init_clocks(NULL);
+    timerlistgroup_init(&tlg, NULL, NULL);
+    tl = tlg.tl[QEMU_CLOCK_REALTIME];
+    timers = g_new0(QEMUTimer, n_timers);
+    now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+    for (i = 0; i < n_timers; i++) {
+        timer_init_full(&timers[i], &tlg, QEMU_CLOCK_REALTIME, SCALE_NS, 0,
+                        timer_cb, NULL);
+        r = xorshift64star(r);
+        timer_mod_ns(&timers[i], far_deadline(now, r));
+    }
+
+    printf("%u active timers\n", n_timers);
+
+    start = get_clock();
+    for (i = 0; i < n_ops; i++) {
+        r = xorshift64star(r);
+        timer_mod_ns(&timers[r % n_timers], far_deadline(now, r >> 32));
+    }
+    report("timer_mod", n_ops, get_clock() - start);
+
+    start = get_clock();
+    for (i = 0; i < n_ops; i++) {
+        r = xorshift64star(r);
+        timer_del(&timers[r % n_timers]);
+        timer_mod_ns(&timers[r % n_timers], far_deadline(now, r >> 32));
+    }
+    report("del+mod", n_ops, get_clock() - start);
+
+    start = get_clock();
+    for (i = 0; i < n_ops; i++) {
+        if (timerlist_deadline_ns(tl) < 0) {
+            abort();
+        }
+    }
+    report("deadline", n_ops, get_clock() - start);
+
+    /* Move every deadline into the past and fire them all */
+    for (i = 0; i < n_timers; i++) {
+        r = xorshift64star(r);
+        timer_mod_ns(&timers[i], now - (int64_t)(r % NANOSECONDS_PER_SECOND));
+    }
+    start = get_clock();
+    timerlist_run_timers(tl);
+    report("expire", n_timers, get_clock() - start);
+    if (fired != n_timers) {
+        fprintf(stderr, "%lu of %u timers fired\n", fired, n_timers);
+        return 1;
+    }
+
+    for (i = 0; i < n_timers; i++) {
+        timer_deinit(&timers[i]);
+    }
+    g_free(timers);
+    timerlistgroup_deinit(&tlg);
+    return 0;
+}
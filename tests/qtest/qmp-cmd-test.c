@@ -11,10 +11,12 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/units.h"
 #include "libqtest.h"
 #include "qapi/error.h"
 #include "qapi/qapi-visit-introspect.h"
 #include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qlist.h"
 #include "qapi/qobject-input-visitor.h"
 
 const char common_args[] = "-nodefaults -machine none";
@@ -341,6 +343,55 @@ static void test_object_add_failure_modes(void)
     qtest_quit(qts);
 }
 
+/*
+ * Memory backends created on the command line are preallocated while the
+ * monitor is served; the machine must not be created from the monitor
+ * meanwhile.
+ */
+static void test_query_memory_prealloc(void)
+{
+    QTestState *qts;
+    QDict *resp, *info;
+    QList *list;
+
+    qts = qtest_initf("%s -object memory-backend-ram,id=mem0,size=64M,"
+                      "prealloc=on", common_args);
+
+    for (;;) {
+        resp = qtest_qmp(qts, "{'execute': 'query-memory-prealloc'}");
+        list = qdict_get_qlist(resp, "return");
+        g_assert_nonnull(list);
+        if (qlist_empty(list)) {
+            qobject_unref(resp);
+            break;
+        }
+
+        info = qobject_to(QDict, qlist_peek(list));
+        g_assert_cmpstr(qdict_get_str(info, "id"), ==, "mem0");
+        g_assert_cmpint(qdict_get_int(info, "size"), ==, 64 * MiB);
+        g_assert_cmpint(qdict_get_int(info, "done"), <=, 64 * MiB);
+        g_assert_cmpint(qdict_get_int(info, "threads"), >=, 1);
+        qobject_unref(resp);
+
+        resp = qtest_qmp(qts, "{'execute': 'x-exit-preconfig'}");
+        qmp_expect_error_and_unref(resp, "GenericError");
+        g_usleep(1000);
+    }
+
+    /* Either way, main() has created the machine by now */
+    resp = qtest_qmp(qts, "{'execute': 'x-exit-preconfig'}");
+    qmp_expect_error_and_unref(resp, "GenericError");
+
+    resp = qtest_qmp(qts, "{'execute': 'query-memdev'}");
+    list = qdict_get_qlist(resp, "return");
+    g_assert_nonnull(list);
+    info = qobject_to(QDict, qlist_peek(list));
+    g_assert_true(qdict_get_bool(info, "prealloc"));
+    qobject_unref(resp);
+
+    qtest_quit(qts);
+}
+
 int main(int argc, char *argv[])
 {
     QmpSchema schema;
@@ -353,6 +404,8 @@ int main(int argc, char *argv[])
 
     qtest_add_func("qmp/object-add-failure-modes",
                    test_object_add_failure_modes);
+    qtest_add_func("qmp/query-memory-prealloc",
+                   test_query_memory_prealloc);
 
     ret = g_test_run();
 
@@ -148,6 +148,7 @@ typedef struct TestServer {
     int fds_num;
     int fds[VHOST_MEMORY_MAX_NREGIONS];
     VhostUserMemory memory;
+    int mem_tables;
     GMainContext *context;
     GMainLoop *loop;
     GThread *thread;
@@ -381,6 +382,7 @@ static void chr_read(void *opaque, const uint8_t *buf, int size)
         memcpy(&s->memory, &msg.payload.memory, sizeof(msg.payload.memory));
         s->fds_num = qemu_chr_fe_get_msgfds(chr, s->fds,
                                             G_N_ELEMENTS(s->fds));
+        s->mem_tables++;
 
         /* signal the test that it can continue */
         g_cond_broadcast(&s->data_cond);
@@ -716,6 +718,49 @@ static void test_read_guest_mem(void *obj, void *arg, QGuestAllocator *alloc)
     read_guest_mem_server(global_qtest, server);
 }
 
+/*
+ * A topology change that leaves system memory alone must not send the
+ * backend a new memory table.
+ */
+static void test_mem_table_kept(void *obj, void *arg, QGuestAllocator *alloc)
+{
+    TestServer *s = arg;
+    gint64 end_time;
+    int mem_tables, nregions;
+    QDict *rsp;
+
+    if (!wait_for_fds(s)) {
+        return;
+    }
+
+    g_mutex_lock(&s->data_mutex);
+    mem_tables = s->mem_tables;
+    nregions = s->memory.nregions;
+    g_mutex_unlock(&s->data_mutex);
+
+    /* Only the new device's bus master address space changes */
+    rsp = qmp("{ 'execute': 'device_add',"
+              "'arguments': { 'driver': 'pci-testdev', 'id': 'testdev' } }");
+    if (qdict_haskey(rsp, "error")) {
+        qobject_unref(rsp);
+        g_test_skip("Cannot hot-plug a PCI device");
+        return;
+    }
+    qobject_unref(rsp);
+
+    /* A new table would have been sent already, give it time to arrive */
+    g_mutex_lock(&s->data_mutex);
+    end_time = g_get_monotonic_time() + G_TIME_SPAN_SECOND;
+    while (s->mem_tables == mem_tables) {
+        if (!g_cond_wait_until(&s->data_cond, &s->data_mutex, end_time)) {
+            break;
+        }
+    }
+    g_assert_cmpint(s->memory.nregions, ==, nregions);
+    g_assert_cmpint(s->fds_num, ==, nregions);
+    g_mutex_unlock(&s->data_mutex);
+}
+
 static void test_migrate(void *obj, void *arg, QGuestAllocator *alloc)
 {
     TestServer *s = arg;
@@ -996,6 +1041,10 @@ static void register_vhost_user_test(void)
                  "virtio-net",
                  test_migrate, &opts);
 
+    qos_add_test("vhost-user/mem-table-kept",
+                 "virtio-net",
+                 test_mem_table_kept, &opts);
+
     opts.before = vhost_user_test_setup_reconnect;
     qos_add_test("vhost-user/reconnect", "virtio-net",
                  test_reconnect, &opts);
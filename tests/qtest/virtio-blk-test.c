@@ -12,6 +12,7 @@
 #include "libqtest-single.h"
 #include "qemu/bswap.h"
 #include "qemu/module.h"
+#include "qapi/qmp/qdict.h"
 #include "standard-headers/linux/virtio_blk.h"
 #include "standard-headers/linux/virtio_pci.h"
 #include "libqos/qgraph.h"
@@ -23,6 +24,8 @@
 #define TEST_IMAGE_SIZE         (64 * 1024 * 1024)
 #define QVIRTIO_BLK_TIMEOUT_US  (30 * 1000 * 1000)
 #define PCI_SLOT_HP             0x06
+#define IRQ_COALESCE_DELAY_US   1000
+#define MQ_NUM_QUEUES           4
 
 typedef struct QVirtioBlkReq {
     uint32_t type;
@@ -771,6 +774,287 @@ static void resize(void *obj, void *data, QGuestAllocator *t_alloc)
 
 }
 
+static uint64_t irq_coalesce_stat(const char *name)
+{
+    QDict *response, *stats;
+    uint64_t ret;
+
+    response = qmp("{ 'execute': 'qom-get', 'arguments': { "
+                   "'path': '/machine/peripheral/drv0/virtio-backend', "
+                   "'property': 'x-irq-coalesce-stats' } }");
+    g_assert(qdict_haskey(response, "return"));
+    stats = qdict_get_qdict(qdict_get_qdict(response, "return"), "vq0");
+    ret = qdict_get_int(stats, name);
+    qobject_unref(response);
+    return ret;
+}
+
+/* Submit a write and wait until it is used, without advancing the clock */
+static uint64_t irq_coalesce_write(QVirtioDevice *dev, QGuestAllocator *alloc,
+                                   QVirtQueue *vq)
+{
+    QVirtioBlkReq req;
+    uint64_t req_addr;
+    uint32_t free_head, desc_idx;
+    QTestState *qts = global_qtest;
+    gint64 start_time = g_get_monotonic_time();
+
+    req.type = VIRTIO_BLK_T_OUT;
+    req.ioprio = 1;
+    req.sector = 0;
+    req.data = g_malloc0(512);
+    strcpy(req.data, "TEST");
+
+    req_addr = virtio_blk_request(alloc, dev, &req, 512);
+
+    g_free(req.data);
+
+    free_head = qvirtqueue_add(qts, vq, req_addr, 16, false, true);
+    qvirtqueue_add(qts, vq, req_addr + 16, 512, false, true);
+    qvirtqueue_add(qts, vq, req_addr + 528, 1, true, false);
+    qvirtqueue_kick(qts, dev, vq, free_head);
+
+    while (!qvirtqueue_get_buf(qts, vq, &desc_idx, NULL)) {
+        g_assert(g_get_monotonic_time() - start_time <=
+                 QVIRTIO_BLK_TIMEOUT_US);
+        g_usleep(1000);
+    }
+    g_assert_cmpint(desc_idx, ==, free_head);
+    g_assert_cmpint(readb(req_addr + 528), ==, 0);
+
+    return req_addr;
+}
+
+static void irq_coalesce(void *obj, void *u_data, QGuestAllocator *t_alloc)
+{
+    QVirtioBlkPCI *blk = obj;
+    QVirtioDevice *dev = &blk->pci_vdev.vdev;
+    QTestState *qts = global_qtest;
+    QVirtQueue *vq;
+    uint64_t features;
+    uint64_t req_addr;
+
+    features = qvirtio_get_features(dev);
+    features = features & ~(QVIRTIO_F_BAD_FEATURE |
+                            (1u << VIRTIO_RING_F_INDIRECT_DESC) |
+                            (1u << VIRTIO_RING_F_EVENT_IDX) |
+                            (1u << VIRTIO_BLK_F_SCSI));
+    qvirtio_set_features(dev, features);
+
+    vq = qvirtqueue_setup(dev, t_alloc, 0);
+    qvirtio_set_driver_ok(dev);
+
+    /* The request is used, but its interrupt waits for max-delay */
+    req_addr = irq_coalesce_write(dev, t_alloc, vq);
+    g_assert_false(dev->bus->get_queue_isr_status(dev, vq));
+    qtest_clock_step(qts, IRQ_COALESCE_DELAY_US * 1000);
+    g_assert_true(dev->bus->get_queue_isr_status(dev, vq));
+    guest_free(t_alloc, req_addr);
+
+    g_assert_cmpuint(irq_coalesce_stat("deferred"), ==, 1);
+    g_assert_cmpuint(irq_coalesce_stat("max-delay-flushes"), ==, 1);
+
+    /* Reset drops the interrupt that is being held back */
+    req_addr = irq_coalesce_write(dev, t_alloc, vq);
+    g_assert_false(dev->bus->get_queue_isr_status(dev, vq));
+    qvirtio_reset(dev);
+    qtest_clock_step(qts, IRQ_COALESCE_DELAY_US * 1000);
+    g_assert_false(dev->bus->get_queue_isr_status(dev, vq));
+    guest_free(t_alloc, req_addr);
+
+    g_assert_cmpuint(irq_coalesce_stat("deferred"), ==, 2);
+    g_assert_cmpuint(irq_coalesce_stat("max-delay-flushes"), ==, 1);
+
+    qvirtqueue_cleanup(dev->bus, vq, t_alloc);
+}
+
+#define BATCH_REQS 8
+
+/*
+ * Submit BATCH_REQS read requests, either all behind a single kick or one at
+ * a time, and record the used length reported for each of them.
+ */
+static void batch_submit(QVirtioDevice *dev, QGuestAllocator *alloc,
+                         QVirtQueue *vq, bool one_kick,
+                         uint32_t lens[BATCH_REQS])
+{
+    QTestState *qts = global_qtest;
+    QVirtioBlkReq req;
+    uint64_t req_addr[BATCH_REQS];
+    uint32_t free_head[BATCH_REQS];
+    uint32_t desc_idx, len;
+    uint16_t used_idx;
+    gint64 start_time;
+    int i, j, done;
+
+    used_idx = qvirtio_readw(dev, qts,
+                             vq->used + offsetof(struct vring_used, idx));
+
+    for (i = 0; i < BATCH_REQS; i++) {
+        req.type = VIRTIO_BLK_T_IN;
+        req.ioprio = 1;
+        req.sector = i;
+        req.data = g_malloc0(512);
+        req_addr[i] = virtio_blk_request(alloc, dev, &req, 512);
+        g_free(req.data);
+
+        free_head[i] = qvirtqueue_add(qts, vq, req_addr[i], 16, false, true);
+        qvirtqueue_add(qts, vq, req_addr[i] + 16, 512, true, true);
+        qvirtqueue_add(qts, vq, req_addr[i] + 528, 1, true, false);
+        if (!one_kick) {
+            qvirtqueue_kick(qts, dev, vq, free_head[i]);
+            qvirtio_wait_used_elem(qts, dev, vq, free_head[i], &lens[i],
+                                   QVIRTIO_BLK_TIMEOUT_US);
+        }
+    }
+
+    if (one_kick) {
+        qvirtqueue_kick(qts, dev, vq, free_head[0]);
+        start_time = g_get_monotonic_time();
+        for (done = 0; done < BATCH_REQS; ) {
+            if (!qvirtqueue_get_buf(qts, vq, &desc_idx, &len)) {
+                g_assert(g_get_monotonic_time() - start_time <=
+                         QVIRTIO_BLK_TIMEOUT_US);
+                g_usleep(1000);
+                continue;
+            }
+            for (j = 0; j < BATCH_REQS; j++) {
+                if (free_head[j] == desc_idx) {
+                    break;
+                }
+            }
+            g_assert_cmpint(j, <, BATCH_REQS);
+            lens[j] = len;
+            done++;
+        }
+    }
+
+    /* Every request is used exactly once */
+    g_assert_false(qvirtqueue_get_buf(qts, vq, NULL, NULL));
+    g_assert_cmpint(qvirtio_readw(dev, qts,
+                                  vq->used + offsetof(struct vring_used, idx)),
+                    ==, (uint16_t)(used_idx + BATCH_REQS));
+
+    for (i = 0; i < BATCH_REQS; i++) {
+        g_assert_cmpint(readb(req_addr[i] + 528), ==, 0);
+        guest_free(alloc, req_addr[i]);
+    }
+}
+
+static void batch(void *obj, void *u_data, QGuestAllocator *t_alloc)
+{
+    QVirtioBlk *blk_if = obj;
+    QVirtioDevice *dev = blk_if->vdev;
+    QVirtQueue *vq;
+    uint32_t single_lens[BATCH_REQS], batch_lens[BATCH_REQS];
+    uint64_t features;
+    int i;
+
+    features = qvirtio_get_features(dev);
+    features = features & ~(QVIRTIO_F_BAD_FEATURE |
+                            (1u << VIRTIO_RING_F_INDIRECT_DESC) |
+                            (1u << VIRTIO_RING_F_EVENT_IDX) |
+                            (1u << VIRTIO_BLK_F_SCSI));
+    qvirtio_set_features(dev, features);
+
+    vq = qvirtqueue_setup(dev, t_alloc, 0);
+    qvirtio_set_driver_ok(dev);
+
+    /*
+     * Completions published together must fill the used ring just like
+     * completions published one by one.
+     */
+    batch_submit(dev, t_alloc, vq, false, single_lens);
+    batch_submit(dev, t_alloc, vq, true, batch_lens);
+    for (i = 0; i < BATCH_REQS; i++) {
+        g_assert_cmpint(single_lens[i], ==, 513);
+        g_assert_cmpint(batch_lens[i], ==, single_lens[i]);
+    }
+
+    qvirtqueue_cleanup(dev->bus, vq, t_alloc);
+}
+
+/* Write @sector through @vq, or read it back and check the data */
+static void mq_rw(QVirtioDevice *dev, QGuestAllocator *alloc, QVirtQueue *vq,
+                  uint64_t sector, bool write)
+{
+    QTestState *qts = global_qtest;
+    g_autofree char *expected = g_strdup_printf("TEST%" PRIu64, sector);
+    QVirtioBlkReq req;
+    uint64_t req_addr;
+    uint32_t free_head;
+    char *data;
+
+    req.type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    req.ioprio = 1;
+    req.sector = sector;
+    req.data = g_malloc0(512);
+    if (write) {
+        strcpy(req.data, expected);
+    }
+
+    req_addr = virtio_blk_request(alloc, dev, &req, 512);
+
+    g_free(req.data);
+
+    free_head = qvirtqueue_add(qts, vq, req_addr, 16, false, true);
+    qvirtqueue_add(qts, vq, req_addr + 16, 512, !write, true);
+    qvirtqueue_add(qts, vq, req_addr + 528, 1, true, false);
+
+    qvirtqueue_kick(qts, dev, vq, free_head);
+
+    qvirtio_wait_used_elem(qts, dev, vq, free_head, NULL,
+                           QVIRTIO_BLK_TIMEOUT_US);
+    g_assert_cmpint(readb(req_addr + 528), ==, 0);
+
+    if (!write) {
+        data = g_malloc0(512);
+        memread(req_addr + 16, data, 512);
+        g_assert_cmpstr(data, ==, expected);
+        g_free(data);
+    }
+
+    guest_free(alloc, req_addr);
+}
+
+/*
+ * Queues 0 and 2 are serviced by iothread0, where the BlockBackend lives,
+ * and queues 1 and 3 by iothread1, which completes their requests itself.
+ */
+static void mq_iothreads(void *obj, void *u_data, QGuestAllocator *t_alloc)
+{
+    QVirtioBlkPCI *blk = obj;
+    QVirtioDevice *dev = &blk->pci_vdev.vdev;
+    QVirtQueue *vqs[MQ_NUM_QUEUES];
+    uint64_t features;
+    int i;
+
+    features = qvirtio_get_features(dev);
+    g_assert(features & (1u << VIRTIO_BLK_F_MQ));
+    features = features & ~(QVIRTIO_F_BAD_FEATURE |
+                            (1u << VIRTIO_RING_F_INDIRECT_DESC) |
+                            (1u << VIRTIO_RING_F_EVENT_IDX) |
+                            (1u << VIRTIO_BLK_F_SCSI));
+    qvirtio_set_features(dev, features);
+
+    for (i = 0; i < MQ_NUM_QUEUES; i++) {
+        vqs[i] = qvirtqueue_setup(dev, t_alloc, i);
+    }
+    qvirtio_set_driver_ok(dev);
+
+    /* Read each sector back through a queue of the other IOThread */
+    for (i = 0; i < MQ_NUM_QUEUES; i++) {
+        mq_rw(dev, t_alloc, vqs[i], i, true);
+    }
+    for (i = 0; i < MQ_NUM_QUEUES; i++) {
+        mq_rw(dev, t_alloc, vqs[(i + 1) % MQ_NUM_QUEUES], i, false);
+    }
+
+    for (i = 0; i < MQ_NUM_QUEUES; i++) {
+        qvirtqueue_cleanup(dev->bus, vqs[i], t_alloc);
+    }
+}
+
 static void *virtio_blk_test_setup(GString *cmd_line, void *arg)
 {
     char *tmp_path = drive_create();
@@ -785,6 +1069,14 @@ static void *virtio_blk_test_setup(GString *cmd_line, void *arg)
     return arg;
 }
 
+static void *virtio_blk_iothreads_setup(GString *cmd_line, void *arg)
+{
+    g_string_append(cmd_line,
+                    " -object iothread,id=iothread0"
+                    " -object iothread,id=iothread1 ");
+    return virtio_blk_test_setup(cmd_line, arg);
+}
+
 static void register_virtio_blk_test(void)
 {
     QOSGraphTestOptions opts = {
@@ -795,6 +1087,7 @@ static void register_virtio_blk_test(void)
     qos_add_test("config", "virtio-blk", config, &opts);
     qos_add_test("basic", "virtio-blk", basic, &opts);
     qos_add_test("resize", "virtio-blk", resize, &opts);
+    qos_add_test("batch", "virtio-blk", batch, &opts);
 
     /* tests just for virtio-blk-pci */
     qos_add_test("msix", "virtio-blk-pci", msix, &opts);
@@ -802,6 +1095,17 @@ static void register_virtio_blk_test(void)
     qos_add_test("nxvirtq", "virtio-blk-pci",
                       test_nonexistent_virtqueue, &opts);
     qos_add_test("hotplug", "virtio-blk-pci", pci_hotplug, &opts);
+
+    opts.edge.extra_device_opts =
+        "x-irq-coalesce-max-delay-us=" stringify(IRQ_COALESCE_DELAY_US)
+        ",x-irq-coalesce-adaptive=off";
+    qos_add_test("irq-coalesce", "virtio-blk-pci", irq_coalesce, &opts);
+
+    opts.before = virtio_blk_iothreads_setup;
+    opts.edge.extra_device_opts =
+        "num-queues=" stringify(MQ_NUM_QUEUES)
+        ",iothread-vq-mapping=iothread0:iothread1";
+    qos_add_test("mq-iothreads", "virtio-blk-pci", mq_iothreads, &opts);
 }
 
 libqos_init(register_virtio_blk_test);
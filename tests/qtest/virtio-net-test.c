@@ -186,6 +186,29 @@ static void hotplug(void *obj, void *data, QGuestAllocator *t_alloc)
     }
 }
 
+static void iothread_filters(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioPCIDevice *dev = obj;
+    QTestState *qts = dev->pdev->bus->qts;
+    QDict *response;
+    const char *desc;
+
+    if (dev->pdev->bus->not_hotpluggable) {
+        g_test_skip("pci bus does not support hotplug");
+        return;
+    }
+
+    /* Filters would run in the IOThread without the global mutex */
+    response = qtest_qmp(qts, "{'execute': 'device_add', 'arguments': {"
+                         " 'driver': 'virtio-net-pci', 'id': 'net1',"
+                         " 'netdev': 'hs1', 'iothread-queue-mapping': 'io0',"
+                         " 'addr': %s } }", stringify(PCI_SLOT_HP));
+    g_assert(qdict_haskey(response, "error"));
+    desc = qdict_get_str(qdict_get_qdict(response, "error"), "desc");
+    g_assert(strstr(desc, "filters"));
+    qobject_unref(response);
+}
+
 static void announce_self(void *obj, void *data, QGuestAllocator *t_alloc)
 {
     int *sv = data;
@@ -286,6 +309,14 @@ static void *virtio_net_test_setup(GString *cmd_line, void *arg)
     return sv;
 }
 
+static void *virtio_net_test_setup_filters(GString *cmd_line, void *arg)
+{
+    g_string_append(cmd_line, " -object iothread,id=io0"
+                    " -netdev hubport,hubid=1,id=hs1"
+                    " -object filter-buffer,id=f0,netdev=hs1,interval=1000 ");
+    return virtio_net_test_setup(cmd_line, arg);
+}
+
 static void large_tx(void *obj, void *data, QGuestAllocator *t_alloc)
 {
     QVirtioNet *dev = obj;
@@ -330,6 +361,10 @@ static void register_virtio_net_test(void)
 #endif
     qos_add_test("announce-self", "virtio-net", announce_self, &opts);
 
+    opts.before = virtio_net_test_setup_filters;
+    qos_add_test("iothread-filters", "virtio-net-pci", iothread_filters,
+                 &opts);
+
     /* These tests do not need a loopback backend.  */
     opts.before = virtio_net_test_setup_nosocket;
     opts.arg = (gpointer)UINT_MAX;
@@ -0,0 +1,286 @@
+/*
+ * COLO proxy packet ring tests
+ *
+ * Copyright (c) 2022 The QEMU Project Developers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "../net/colo.h"
+
+static Packet *make_pkt(uint32_t seq)
+{
+    Packet *pkt = packet_new("x", 1, 0);
+
+    pkt->tcp_seq = seq;
+    return pkt;
+}
+
+/* Check that the ring holds packets with sequence numbers @seqs, in order */
+static void check_ring(const PacketRing *ring, const uint32_t *seqs,
+                       uint32_t n)
+{
+    uint32_t i;
+
+    g_assert_cmpuint(packet_ring_length(ring), ==, n);
+    g_assert_cmpint(packet_ring_is_empty(ring), ==, n == 0);
+    g_assert_cmpuint(ring->count, <=, ring->capacity);
+    for (i = 0; i < n; i++) {
+        g_assert_cmphex(packet_ring_get(ring, i)->tcp_seq, ==, seqs[i]);
+    }
+}
+
+static void pop_check(PacketRing *ring, uint32_t seq)
+{
+    Packet *pkt = packet_ring_pop_head(ring);
+
+    g_assert_nonnull(pkt);
+    g_assert_cmphex(pkt->tcp_seq, ==, seq);
+    packet_destroy(pkt, NULL);
+}
+
+static void test_empty(void)
+{
+    PacketRing ring;
+
+    packet_ring_init(&ring);
+    check_ring(&ring, NULL, 0);
+    g_assert_null(packet_ring_pop_head(&ring));
+
+    /* Empty again after the last packet is gone */
+    packet_ring_push_tail(&ring, make_pkt(1));
+    pop_check(&ring, 1);
+    check_ring(&ring, NULL, 0);
+    g_assert_null(packet_ring_pop_head(&ring));
+
+    packet_ring_destroy(&ring);
+    packet_ring_destroy(&ring);
+}
+
+static void test_fifo_wrap(void)
+{
+    PacketRing ring;
+    uint32_t seqs[64];
+    uint32_t capacity, next = 0, head = 0;
+    uint32_t i, round;
+
+    packet_ring_init(&ring);
+    packet_ring_push_tail(&ring, make_pkt(next++));
+    capacity = ring.capacity;
+
+    /*
+     * Keep the ring half full while head and tail go around it several
+     * times, without growing it.
+     */
+    for (round = 0; round < 4 * capacity; round++) {
+        while (next - head < capacity / 2) {
+            packet_ring_push_tail(&ring, make_pkt(next++));
+        }
+        pop_check(&ring, head++);
+    }
+    g_assert_cmpuint(ring.capacity, ==, capacity);
+
+    for (i = 0; i < next - head; i++) {
+        seqs[i] = head + i;
+    }
+    check_ring(&ring, seqs, next - head);
+    packet_ring_destroy(&ring);
+    check_ring(&ring, NULL, 0);
+}
+
+static void test_full_grow(void)
+{
+    PacketRing ring;
+    uint32_t seqs[64];
+    uint32_t capacity, n = 0;
+    uint32_t i;
+
+    packet_ring_init(&ring);
+    packet_ring_push_tail(&ring, make_pkt(0));
+    capacity = ring.capacity;
+    pop_check(&ring, 0);
+
+    /* Fill the ring with the head in the middle, so that it wraps */
+    for (i = 0; i < capacity / 2; i++) {
+        packet_ring_push_tail(&ring, make_pkt(1000));
+        pop_check(&ring, 1000);
+    }
+    while (n < capacity) {
+        seqs[n] = n;
+        packet_ring_push_tail(&ring, make_pkt(n++));
+    }
+    g_assert_cmpuint(ring.capacity, ==, capacity);
+    check_ring(&ring, seqs, n);
+
+    /* One more packet grows the full ring and keeps the order */
+    seqs[n] = n;
+    packet_ring_push_tail(&ring, make_pkt(n++));
+    g_assert_cmpuint(ring.capacity, >, capacity);
+    check_ring(&ring, seqs, n);
+
+    for (i = 0; i < n; i++) {
+        pop_check(&ring, i);
+    }
+    check_ring(&ring, NULL, 0);
+    packet_ring_destroy(&ring);
+}
+
+static void test_push_head(void)
+{
+    PacketRing ring;
+    uint32_t seqs[64];
+    uint32_t i, n = 40;
+
+    /* The first push_head wraps the head to the end of the array */
+    packet_ring_init(&ring);
+    for (i = 0; i < n / 2; i++) {
+        packet_ring_push_head(&ring, make_pkt(n / 2 - 1 - i));
+        packet_ring_push_tail(&ring, make_pkt(n / 2 + i));
+    }
+    for (i = 0; i < n; i++) {
+        seqs[i] = i;
+    }
+    check_ring(&ring, seqs, n);
+
+    /* A popped packet can be put back */
+    for (i = 0; i < n; i++) {
+        Packet *pkt = packet_ring_pop_head(&ring);
+
+        g_assert_cmphex(pkt->tcp_seq, ==, 0);
+        packet_ring_push_head(&ring, pkt);
+    }
+    check_ring(&ring, seqs, n);
+    packet_ring_destroy(&ring);
+}
+
+static void test_remove(void)
+{
+    PacketRing ring;
+    uint32_t seqs[16];
+    uint32_t capacity, n = 0;
+    uint32_t i, pos;
+    Packet *pkt;
+
+    packet_ring_init(&ring);
+    packet_ring_push_tail(&ring, make_pkt(0));
+    capacity = ring.capacity;
+    pop_check(&ring, 0);
+
+    /* Wrapped ring: the head is close to the end of the array */
+    for (i = 0; i < capacity - 3; i++) {
+        packet_ring_push_tail(&ring, make_pkt(1000));
+        pop_check(&ring, 1000);
+    }
+    for (i = 0; i < 12; i++) {
+        seqs[n] = n;
+        packet_ring_push_tail(&ring, make_pkt(n++));
+    }
+
+    /* Remove from the front half, the back half, and both ends */
+    for (pos = 1; n > 0; pos = (pos * 5 + 3) % n) {
+        pkt = packet_ring_remove(&ring, pos);
+        g_assert_cmphex(pkt->tcp_seq, ==, seqs[pos]);
+        packet_destroy(pkt, NULL);
+        memmove(&seqs[pos], &seqs[pos + 1], (--n - pos) * sizeof(seqs[0]));
+        check_ring(&ring, seqs, n);
+        if (!n) {
+            break;
+        }
+    }
+    g_assert_cmpuint(ring.capacity, ==, capacity);
+    packet_ring_destroy(&ring);
+}
+
+static void test_insert_sorted(void)
+{
+    PacketRing ring;
+    const uint32_t base = 0xfffffff0;   /* sequence numbers wrap */
+    uint32_t seqs[200];
+    uint32_t n = ARRAY_SIZE(seqs);
+    uint32_t i, j;
+    GRand *rand = g_rand_new_with_seed(42);
+
+    /* Mostly in order, with reordered packets and duplicates */
+    for (i = 0; i < n; i++) {
+        seqs[i] = base + i * 10;
+        if (g_rand_int_range(rand, 0, 4) == 0 && i > 0) {
+            uint32_t tmp = seqs[i];
+
+            j = g_rand_int_range(rand, 0, i);
+            seqs[i] = seqs[j];
+            seqs[j] = tmp;
+        }
+        if (g_rand_int_range(rand, 0, 10) == 0) {
+            seqs[i] = seqs[g_rand_int_range(rand, 0, i + 1)];
+        }
+    }
+
+    packet_ring_init(&ring);
+    for (i = 0; i < n; i++) {
+        Packet *pkt = make_pkt(seqs[i]);
+
+        pkt->size = i;   /* insertion order, to check stability */
+        packet_ring_insert_sorted(&ring, pkt);
+    }
+
+    g_assert_cmpuint(packet_ring_length(&ring), ==, n);
+    for (i = 1; i < n; i++) {
+        Packet *prev = packet_ring_get(&ring, i - 1);
+        Packet *pkt = packet_ring_get(&ring, i);
+
+        g_assert_cmpuint(prev->tcp_seq - base, <=, pkt->tcp_seq - base);
+        if (prev->tcp_seq == pkt->tcp_seq) {
+            g_assert_cmpint(prev->size, <, pkt->size);
+        }
+    }
+
+    g_rand_free(rand);
+    packet_ring_destroy(&ring);
+}
+
+/* Out-of-order packets land at either end of a wrapped ring */
+static void test_insert_sorted_wrap(void)
+{
+    static const uint32_t order[] = { 5, 0, 9, 3, 7, 1 };
+    PacketRing ring;
+    uint32_t i;
+
+    packet_ring_init(&ring);
+    for (i = 0; i < 12; i++) {
+        packet_ring_push_tail(&ring, make_pkt(i));
+    }
+    for (i = 0; i < 12; i++) {
+        packet_destroy(packet_ring_pop_head(&ring), NULL);
+    }
+
+    /* Even sequence numbers, in order, straddling the end of the array */
+    for (i = 0; i < 10; i++) {
+        packet_ring_insert_sorted(&ring, make_pkt(i * 10));
+    }
+    for (i = 0; i < ARRAY_SIZE(order); i++) {
+        packet_ring_insert_sorted(&ring, make_pkt(order[i] * 10 + 5));
+    }
+
+    g_assert_cmpuint(packet_ring_length(&ring), ==, 16);
+    for (i = 1; i < packet_ring_length(&ring); i++) {
+        g_assert_cmpuint(packet_ring_get(&ring, i - 1)->tcp_seq, <,
+                         packet_ring_get(&ring, i)->tcp_seq);
+    }
+    packet_ring_destroy(&ring);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/colo/packet-ring/empty", test_empty);
+    g_test_add_func("/colo/packet-ring/fifo-wrap", test_fifo_wrap);
+    g_test_add_func("/colo/packet-ring/full-grow", test_full_grow);
+    g_test_add_func("/colo/packet-ring/push-head", test_push_head);
+    g_test_add_func("/colo/packet-ring/remove", test_remove);
+    g_test_add_func("/colo/packet-ring/insert-sorted", test_insert_sorted);
+    g_test_add_func("/colo/packet-ring/insert-sorted-wrap",
+                    test_insert_sorted_wrap);
+    return g_test_run();
+}
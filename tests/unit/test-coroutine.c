@@ -451,6 +451,31 @@ static void test_lifecycle(void)
     g_assert(done); /* expect done to be true (second time) */
 }
 
+/*
+ * Check that terminated coroutines are reused from the pool
+ */
+
+static void test_pool_reuse(void)
+{
+    CoroutinePoolStats before, after;
+    bool done;
+    int i;
+
+    qemu_coroutine_get_pool_stats(&before);
+    for (i = 0; i < 1000; i++) {
+        Coroutine *coroutine = qemu_coroutine_create(set_and_exit, &done);
+
+        done = false;
+        qemu_coroutine_enter(coroutine);
+        g_assert(done);
+    }
+    qemu_coroutine_get_pool_stats(&after);
+
+    /* At most the first one needs a new stack */
+    g_assert_cmpuint(after.allocated - before.allocated, <=, 1);
+    g_assert_cmpuint(after.pool_hits - before.pool_hits, >=, 999);
+    g_assert_cmpuint(after.freed, ==, before.freed);
+}
 
 #define RECORD_SIZE 10 /* Leave some room for expansion */
 struct coroutine_position {
@@ -658,6 +683,9 @@ int main(int argc, char **argv)
     g_test_add_func("/basic/entered", test_entered);
     g_test_add_func("/basic/in_coroutine", test_in_coroutine);
     g_test_add_func("/basic/order", test_order);
+    if (CONFIG_COROUTINE_POOL) {
+        g_test_add_func("/basic/pool-reuse", test_pool_reuse);
+    }
     g_test_add_func("/locking/co-mutex", test_co_mutex);
     g_test_add_func("/locking/co-mutex/lockable", test_co_mutex_lockable);
     g_test_add_func("/locking/co-rwlock/upgrade", test_co_rwlock_upgrade);
@@ -0,0 +1,536 @@
+/*
+ * Software segmentation and coalescing of TCP/UDP packets
+ *
+ * Copyright (c) 2022 The QEMU Project Developers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/iov.h"
+#include "net/eth.h"
+#include "net/gso.h"
+#include "net/gro.h"
+
+#define PKT_MAX         (ETH_MAX_L2_HDR_LEN + ETH_MAX_IP_DGRAM_LEN)
+#define TEST_SEQ        0x12345678
+#define TEST_IP_ID      0x4321
+
+typedef struct TestPkt {
+    uint8_t *buf;
+    size_t size;
+    unsigned segs;
+    uint16_t mss;
+} TestPkt;
+
+/* Packets handed to the segmentation or flush callback, in order */
+typedef struct TestSink {
+    TestPkt pkts[128];
+    unsigned count;
+} TestSink;
+
+static void sink_add(TestSink *sink, const struct iovec *iov, int iovcnt,
+                     unsigned segs, uint16_t mss)
+{
+    TestPkt *pkt;
+
+    g_assert_cmpuint(sink->count, <, ARRAY_SIZE(sink->pkts));
+    pkt = &sink->pkts[sink->count++];
+    pkt->size = iov_size(iov, iovcnt);
+    pkt->buf = g_malloc(pkt->size);
+    iov_to_buf(iov, iovcnt, 0, pkt->buf, pkt->size);
+    pkt->segs = segs;
+    pkt->mss = mss;
+}
+
+static void sink_free(TestSink *sink)
+{
+    unsigned i;
+
+    for (i = 0; i < sink->count; i++) {
+        g_free(sink->pkts[i].buf);
+    }
+    sink->count = 0;
+}
+
+static void gso_cb(void *opaque, const struct iovec *iov, int iovcnt)
+{
+    sink_add(opaque, iov, iovcnt, 1, 0);
+}
+
+static void gro_cb(void *opaque, const uint8_t *buf, size_t size,
+                   unsigned segs, uint16_t mss)
+{
+    struct iovec iov = { .iov_base = (void *)buf, .iov_len = size };
+
+    sink_add(opaque, &iov, 1, segs, mss);
+}
+
+/*
+ * Reference checksum code, independent from net/checksum.c
+ */
+static uint32_t ref_sum(uint32_t sum, const uint8_t *buf, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i + 1 < len; i += 2) {
+        sum += (buf[i] << 8) | buf[i + 1];
+    }
+    if (len & 1) {
+        sum += buf[len - 1] << 8;
+    }
+    return sum;
+}
+
+static uint16_t ref_fold(uint32_t sum)
+{
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return ~sum & 0xffff;
+}
+
+/* Sum of the pseudo header and the L4 header and payload at @l4 */
+static uint16_t ref_l4_csum(const uint8_t *l3, bool ip6, uint8_t proto,
+                            const uint8_t *l4, size_t l4_len)
+{
+    uint8_t tail[4] = { 0, 0, 0, proto };
+    uint32_t sum;
+
+    if (ip6) {
+        sum = ref_sum(0, l3 + offsetof(struct ip6_header, ip6_src), 32);
+    } else {
+        sum = ref_sum(0, l3 + offsetof(struct ip_header, ip_src), 8);
+    }
+    sum += l4_len;
+    sum = ref_sum(sum, tail, sizeof(tail));
+    return ref_fold(ref_sum(sum, l4, l4_len));
+}
+
+static size_t l3_hdr_len(bool ip6)
+{
+    return ip6 ? sizeof(struct ip6_header) : sizeof(struct ip_header);
+}
+
+static uint8_t payload_byte(size_t i)
+{
+    return i * 7 + 3;
+}
+
+/*
+ * Build an Ethernet frame with a TCP or UDP packet carrying @payload_len
+ * bytes of payload_byte(), with valid checksums.
+ */
+static size_t build_pkt(uint8_t *buf, bool ip6, uint8_t proto,
+                        size_t payload_len, uint32_t seq, uint8_t flags)
+{
+    struct eth_header *eth = (struct eth_header *)buf;
+    uint8_t *l3 = buf + sizeof(*eth);
+    uint8_t *l4 = l3 + l3_hdr_len(ip6);
+    size_t l4hdr_len = proto == IP_PROTO_TCP ? sizeof(struct tcp_header) :
+                                               sizeof(struct udp_header);
+    size_t l4_len = l4hdr_len + payload_len;
+    size_t i;
+
+    memset(buf, 0, l4 - buf + l4hdr_len);
+    memcpy(eth->h_dest, "\x52\x54\x00\x12\x34\x56", ETH_ALEN);
+    memcpy(eth->h_source, "\x52\x54\x00\x65\x43\x21", ETH_ALEN);
+    eth->h_proto = cpu_to_be16(ip6 ? ETH_P_IPV6 : ETH_P_IP);
+
+    if (ip6) {
+        struct ip6_header *ip6h = (struct ip6_header *)l3;
+
+        ip6h->ip6_ctlun.ip6_un1.ip6_un1_flow = cpu_to_be32(0x60000000);
+        ip6h->ip6_plen = cpu_to_be16(l4_len);
+        ip6h->ip6_nxt = proto;
+        ip6h->ip6_ctlun.ip6_un1.ip6_un1_hlim = 64;
+        ip6h->ip6_src.__in6_u.__u6_addr8[0] = 0xfe;
+        ip6h->ip6_src.__in6_u.__u6_addr8[15] = 1;
+        ip6h->ip6_dst.__in6_u.__u6_addr8[0] = 0xfe;
+        ip6h->ip6_dst.__in6_u.__u6_addr8[15] = 2;
+    } else {
+        struct ip_header *ip = (struct ip_header *)l3;
+
+        ip->ip_ver_len = 0x45;
+        ip->ip_len = cpu_to_be16(sizeof(*ip) + l4_len);
+        ip->ip_id = cpu_to_be16(TEST_IP_ID);
+        ip->ip_ttl = 64;
+        ip->ip_p = proto;
+        ip->ip_src = cpu_to_be32(0x0a000001);
+        ip->ip_dst = cpu_to_be32(0x0a000002);
+        ip->ip_sum = cpu_to_be16(ref_fold(ref_sum(0, l3, sizeof(*ip))));
+    }
+
+    for (i = 0; i < payload_len; i++) {
+        l4[l4hdr_len + i] = payload_byte(i);
+    }
+
+    if (proto == IP_PROTO_TCP) {
+        struct tcp_header *tcp = (struct tcp_header *)l4;
+
+        tcp->th_sport = cpu_to_be16(1234);
+        tcp->th_dport = cpu_to_be16(80);
+        tcp->th_seq = cpu_to_be32(seq);
+        tcp->th_ack = cpu_to_be32(0xabcdef);
+        tcp->th_offset_flags = cpu_to_be16((5 << 12) | flags);
+        tcp->th_win = cpu_to_be16(0xffff);
+        tcp->th_sum = cpu_to_be16(ref_l4_csum(l3, ip6, proto, l4, l4_len));
+    } else {
+        struct udp_header *udp = (struct udp_header *)l4;
+
+        udp->uh_sport = cpu_to_be16(1234);
+        udp->uh_dport = cpu_to_be16(53);
+        udp->uh_ulen = cpu_to_be16(l4_len);
+        udp->uh_sum = cpu_to_be16(ref_l4_csum(l3, ip6, proto, l4, l4_len));
+    }
+
+    return l4 - buf + l4_len;
+}
+
+static void check_ip4_csum(const uint8_t *l3)
+{
+    g_assert_cmphex(ref_fold(ref_sum(0, l3, sizeof(struct ip_header))), ==, 0);
+}
+
+/*
+ * Segment a TCP packet with @payload_len bytes of payload on @mss and check
+ * every resulting segment.
+ */
+static void do_test_gso_tcp(bool ip6, size_t payload_len, uint16_t mss,
+                            uint8_t flags)
+{
+    g_autofree uint8_t *buf = g_malloc(PKT_MAX);
+    size_t hdr_len = sizeof(struct eth_header) + l3_hdr_len(ip6) +
+                     sizeof(struct tcp_header);
+    size_t size = build_pkt(buf, ip6, IP_PROTO_TCP, payload_len, TEST_SEQ,
+                            flags);
+    struct iovec iov[3];
+    struct virtio_net_hdr vhdr = {
+        .flags = VIRTIO_NET_HDR_F_NEEDS_CSUM,
+        .gso_type = ip6 ? VIRTIO_NET_HDR_GSO_TCPV6 : VIRTIO_NET_HDR_GSO_TCPV4,
+        .gso_size = mss,
+    };
+    TestSink sink = { 0 };
+    unsigned expected = DIV_ROUND_UP(payload_len, mss);
+    size_t off = 0;
+    unsigned i;
+    int ret;
+
+    /* Split headers and payload across several elements */
+    iov[0] = (struct iovec) { .iov_base = buf, .iov_len = hdr_len - 4 };
+    iov[1] = (struct iovec) { .iov_base = buf + hdr_len - 4,
+                              .iov_len = 4 + payload_len / 2 };
+    iov[2] = (struct iovec) { .iov_base = buf + hdr_len + payload_len / 2,
+                              .iov_len = size - hdr_len - payload_len / 2 };
+
+    ret = net_gso_segment(iov, ARRAY_SIZE(iov), &vhdr, gso_cb, &sink);
+    g_assert_cmpint(ret, ==, expected);
+    g_assert_cmpuint(sink.count, ==, expected);
+
+    for (i = 0; i < sink.count; i++) {
+        TestPkt *seg = &sink.pkts[i];
+        uint8_t *l3 = seg->buf + sizeof(struct eth_header);
+        struct tcp_header *tcp =
+            (struct tcp_header *)(l3 + l3_hdr_len(ip6));
+        size_t len = MIN(mss, payload_len - off);
+        bool last = i == sink.count - 1;
+        uint16_t seg_flags = TCP_HEADER_FLAGS(tcp);
+
+        g_assert_cmpuint(seg->size, ==, hdr_len + len);
+        g_assert(!memcmp(seg->buf, buf, sizeof(struct eth_header)));
+        if (ip6) {
+            struct ip6_header *ip6h = (struct ip6_header *)l3;
+
+            g_assert_cmpuint(be16_to_cpu(ip6h->ip6_plen), ==,
+                             sizeof(*tcp) + len);
+        } else {
+            struct ip_header *ip = (struct ip_header *)l3;
+
+            g_assert_cmpuint(be16_to_cpu(ip->ip_len), ==,
+                             sizeof(*ip) + sizeof(*tcp) + len);
+            g_assert_cmpuint(be16_to_cpu(ip->ip_id), ==, TEST_IP_ID + i);
+            check_ip4_csum(l3);
+        }
+
+        g_assert_cmphex(be32_to_cpu(tcp->th_seq), ==, TEST_SEQ + off);
+        g_assert_cmphex(seg_flags & ~(TH_PUSH | TH_FIN), ==,
+                        flags & ~(TH_PUSH | TH_FIN));
+        g_assert_cmphex(seg_flags & (TH_PUSH | TH_FIN), ==,
+                        last ? flags & (TH_PUSH | TH_FIN) : 0);
+        g_assert_cmphex(ref_l4_csum(l3, ip6, IP_PROTO_TCP, (uint8_t *)tcp,
+                                    sizeof(*tcp) + len), ==, 0);
+        g_assert(!memcmp(seg->buf + hdr_len, buf + hdr_len + off, len));
+
+        off += len;
+    }
+    g_assert_cmpuint(off, ==, payload_len);
+
+    sink_free(&sink);
+}
+
+static void test_gso_tcp4(void)
+{
+    do_test_gso_tcp(false, 4000, 1448, TH_ACK | TH_PUSH);
+}
+
+static void test_gso_tcp6(void)
+{
+    do_test_gso_tcp(true, 4000, 1428, TH_ACK | TH_PUSH | TH_FIN);
+}
+
+static void test_gso_tcp_boundary(void)
+{
+    int ip6;
+
+    for (ip6 = 0; ip6 <= 1; ip6++) {
+        /* Exactly one segment, a multiple of the MSS, one byte over */
+        do_test_gso_tcp(ip6, 1448, 1448, TH_ACK);
+        do_test_gso_tcp(ip6, 3 * 1448, 1448, TH_ACK | TH_PUSH);
+        do_test_gso_tcp(ip6, 1448 + 1, 1448, TH_ACK);
+        /* Odd MSS, so that payload checksums start at odd offsets */
+        do_test_gso_tcp(ip6, 5000, 1447, TH_ACK);
+        do_test_gso_tcp(ip6, 7, 1, TH_ACK);
+        /* Largest packet that fits an IP datagram */
+        do_test_gso_tcp(ip6, ETH_MAX_IP_DGRAM_LEN - l3_hdr_len(ip6) -
+                        sizeof(struct tcp_header), 1448, TH_ACK);
+    }
+}
+
+static void do_test_gso_udp(size_t payload_len, uint16_t gso_size)
+{
+    g_autofree uint8_t *buf = g_malloc(PKT_MAX);
+    g_autofree uint8_t *l4 = g_malloc(PKT_MAX);
+    size_t size = build_pkt(buf, false, IP_PROTO_UDP, payload_len, 0, 0);
+    size_t l4_off = sizeof(struct eth_header) + sizeof(struct ip_header);
+    size_t l4_len = size - l4_off;
+    struct udp_header *udp = (struct udp_header *)(buf + l4_off);
+    struct iovec iov = { .iov_base = buf, .iov_len = size };
+    struct virtio_net_hdr vhdr = {
+        .flags = VIRTIO_NET_HDR_F_NEEDS_CSUM,
+        .gso_type = VIRTIO_NET_HDR_GSO_UDP,
+        .gso_size = gso_size,
+    };
+    uint16_t frag_size = IP_FRAG_ALIGN_SIZE(gso_size);
+    TestSink sink = { 0 };
+    size_t off = 0;
+    unsigned i;
+    int ret;
+
+    /* The checksum must be computed by net_gso_segment() */
+    udp->uh_sum = cpu_to_be16(0xdead);
+
+    ret = net_gso_segment(&iov, 1, &vhdr, gso_cb, &sink);
+    g_assert_cmpint(ret, ==, DIV_ROUND_UP(l4_len, frag_size));
+    g_assert_cmpuint(sink.count, ==, ret);
+
+    for (i = 0; i < sink.count; i++) {
+        TestPkt *frag = &sink.pkts[i];
+        uint8_t *l3 = frag->buf + sizeof(struct eth_header);
+        struct ip_header *ip = (struct ip_header *)l3;
+        size_t len = MIN(frag_size, l4_len - off);
+        uint16_t ip_off = be16_to_cpu(ip->ip_off);
+
+        g_assert_cmpuint(frag->size, ==, l4_off + len);
+        g_assert_cmpuint(be16_to_cpu(ip->ip_len), ==, sizeof(*ip) + len);
+        g_assert_cmpuint((ip_off & IP_OFFMASK) * 8, ==, off);
+        g_assert_cmpuint(!!(ip_off & IP_MF), ==, i != sink.count - 1);
+        check_ip4_csum(l3);
+
+        memcpy(l4 + off, frag->buf + l4_off, len);
+        off += len;
+    }
+    g_assert_cmpuint(off, ==, l4_len);
+
+    /* The reassembled datagram has the original payload and a valid sum */
+    g_assert(!memcmp(l4 + sizeof(*udp), buf + l4_off + sizeof(*udp),
+                     payload_len));
+    g_assert_cmphex(ref_l4_csum(buf + sizeof(struct eth_header), false,
+                                IP_PROTO_UDP, l4, l4_len), ==, 0);
+
+    sink_free(&sink);
+}
+
+static void test_gso_udp(void)
+{
+    do_test_gso_udp(3000, 1480);
+    /* gso_size is rounded down to a multiple of 8 */
+    do_test_gso_udp(3000, 1483);
+    /* The UDP header alone fills the first fragment */
+    do_test_gso_udp(100, 8);
+    /* Fits in a single fragment */
+    do_test_gso_udp(1000, 1480);
+    do_test_gso_udp(1480 - sizeof(struct udp_header), 1480);
+}
+
+static void test_gso_invalid(void)
+{
+    g_autofree uint8_t *buf = g_malloc(PKT_MAX);
+    struct iovec iov = { .iov_base = buf };
+    struct virtio_net_hdr vhdr = {
+        .gso_type = VIRTIO_NET_HDR_GSO_TCPV4,
+    };
+    TestSink sink = { 0 };
+
+    /* No segment size */
+    iov.iov_len = build_pkt(buf, false, IP_PROTO_TCP, 3000, TEST_SEQ, TH_ACK);
+    g_assert_cmpint(net_gso_segment(&iov, 1, &vhdr, gso_cb, &sink), ==,
+                    -EINVAL);
+
+    /* Offload type does not match the packet */
+    vhdr.gso_size = 1448;
+    vhdr.gso_type = VIRTIO_NET_HDR_GSO_TCPV6;
+    g_assert_cmpint(net_gso_segment(&iov, 1, &vhdr, gso_cb, &sink), ==,
+                    -EINVAL);
+
+    /* UDP is not fragmented over IPv6 */
+    iov.iov_len = build_pkt(buf, true, IP_PROTO_UDP, 3000, 0, 0);
+    vhdr.gso_type = VIRTIO_NET_HDR_GSO_UDP;
+    g_assert_cmpint(net_gso_segment(&iov, 1, &vhdr, gso_cb, &sink), ==,
+                    -EINVAL);
+
+    /* Truncated headers */
+    iov.iov_len = sizeof(struct eth_header) + 10;
+    vhdr.gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
+    g_assert_cmpint(net_gso_segment(&iov, 1, &vhdr, gso_cb, &sink), ==,
+                    -EINVAL);
+
+    g_assert_cmpuint(sink.count, ==, 0);
+}
+
+/*
+ * Segment a TCP packet, feed the segments to the coalescer and check that
+ * the original packet comes out.
+ */
+static void do_test_gro_roundtrip(bool ip6, size_t payload_len, uint16_t mss)
+{
+    g_autofree uint8_t *buf = g_malloc(PKT_MAX);
+    size_t size = build_pkt(buf, ip6, IP_PROTO_TCP, payload_len, TEST_SEQ,
+                            TH_ACK);
+    struct iovec iov = { .iov_base = buf, .iov_len = size };
+    struct virtio_net_hdr vhdr = {
+        .gso_type = ip6 ? VIRTIO_NET_HDR_GSO_TCPV6 : VIRTIO_NET_HDR_GSO_TCPV4,
+        .gso_size = mss,
+    };
+    NetGro *gro;
+    TestSink segs = { 0 };
+    TestSink *out = g_new0(TestSink, 1);
+    bool full = payload_len % mss == 0;
+    unsigned i;
+
+    gro = net_gro_new(gro_cb, out);
+    g_assert_cmpint(net_gso_segment(&iov, 1, &vhdr, gso_cb, &segs), >, 1);
+
+    for (i = 0; i < segs.count; i++) {
+        g_assert_true(net_gro_receive(gro, segs.pkts[i].buf,
+                                      segs.pkts[i].size));
+    }
+
+    /* A short last segment ends the flow, full-sized ones are held */
+    g_assert_cmpuint(out->count, ==, full ? 0 : 1);
+    net_gro_flush(gro);
+    g_assert_cmpuint(out->count, ==, 1);
+
+    g_assert_cmpuint(out->pkts[0].segs, ==, segs.count);
+    g_assert_cmpuint(out->pkts[0].mss, ==, mss);
+    g_assert_cmpuint(out->pkts[0].size, ==, size);
+    g_assert(!memcmp(out->pkts[0].buf, buf, size));
+
+    net_gro_free(gro);
+    sink_free(&segs);
+    sink_free(out);
+    g_free(out);
+}
+
+static void test_gro_tcp(void)
+{
+    int ip6;
+
+    for (ip6 = 0; ip6 <= 1; ip6++) {
+        do_test_gro_roundtrip(ip6, 8 * 1448, 1448);
+        do_test_gro_roundtrip(ip6, 8 * 1448 + 100, 1448);
+        /* Odd MSS, so that merged payload starts at odd offsets */
+        do_test_gro_roundtrip(ip6, 5 * 1447, 1447);
+        do_test_gro_roundtrip(ip6, 5 * 1447 + 1, 1447);
+        /* Up to the largest IP datagram */
+        do_test_gro_roundtrip(ip6, 45 * 1448, 1448);
+    }
+}
+
+static void test_gro_push(void)
+{
+    g_autofree uint8_t *buf = g_malloc(PKT_MAX);
+    TestSink out = { 0 };
+    NetGro *gro = net_gro_new(gro_cb, &out);
+    size_t size;
+
+    size = build_pkt(buf, false, IP_PROTO_TCP, 1000, TEST_SEQ, TH_ACK);
+    g_assert_true(net_gro_receive(gro, buf, size));
+    g_assert_cmpuint(out.count, ==, 0);
+
+    /* PSH is merged and releases the flow */
+    size = build_pkt(buf, false, IP_PROTO_TCP, 1000, TEST_SEQ + 1000,
+                     TH_ACK | TH_PUSH);
+    g_assert_true(net_gro_receive(gro, buf, size));
+    g_assert_cmpuint(out.count, ==, 1);
+    g_assert_cmpuint(out.pkts[0].segs, ==, 2);
+    g_assert_cmphex(TCP_HEADER_FLAGS((struct tcp_header *)
+                        (out.pkts[0].buf + sizeof(struct eth_header) +
+                         sizeof(struct ip_header))), ==, TH_ACK | TH_PUSH);
+
+    net_gro_free(gro);
+    sink_free(&out);
+}
+
+static void test_gro_not_merged(void)
+{
+    g_autofree uint8_t *buf = g_malloc(PKT_MAX);
+    TestSink out = { 0 };
+    NetGro *gro = net_gro_new(gro_cb, &out);
+    size_t size;
+
+    /* UDP is left to the caller */
+    size = build_pkt(buf, false, IP_PROTO_UDP, 1000, 0, 0);
+    g_assert_false(net_gro_receive(gro, buf, size));
+
+    /* So are TCP segments with a bad checksum... */
+    size = build_pkt(buf, false, IP_PROTO_TCP, 1000, TEST_SEQ, TH_ACK);
+    buf[size - 1] ^= 1;
+    g_assert_false(net_gro_receive(gro, buf, size));
+
+    /* ... or without payload */
+    size = build_pkt(buf, true, IP_PROTO_TCP, 0, TEST_SEQ, TH_ACK);
+    g_assert_false(net_gro_receive(gro, buf, size));
+    g_assert_cmpuint(out.count, ==, 0);
+
+    /* A segment out of sequence releases the flow and starts a new one */
+    size = build_pkt(buf, false, IP_PROTO_TCP, 1000, TEST_SEQ, TH_ACK);
+    g_assert_true(net_gro_receive(gro, buf, size));
+    size = build_pkt(buf, false, IP_PROTO_TCP, 1000, TEST_SEQ + 2000, TH_ACK);
+    g_assert_true(net_gro_receive(gro, buf, size));
+    g_assert_cmpuint(out.count, ==, 1);
+    g_assert_cmpuint(out.pkts[0].segs, ==, 1);
+
+    net_gro_flush(gro);
+    g_assert_cmpuint(out.count, ==, 2);
+    g_assert_cmpuint(out.pkts[1].segs, ==, 1);
+    g_assert(!memcmp(out.pkts[1].buf, buf, size));
+
+    net_gro_free(gro);
+    sink_free(&out);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/net/gso/tcp4", test_gso_tcp4);
+    g_test_add_func("/net/gso/tcp6", test_gso_tcp6);
+    g_test_add_func("/net/gso/tcp-boundary", test_gso_tcp_boundary);
+    g_test_add_func("/net/gso/udp", test_gso_udp);
+    g_test_add_func("/net/gso/invalid", test_gso_invalid);
+    g_test_add_func("/net/gro/tcp", test_gro_tcp);
+    g_test_add_func("/net/gro/push", test_gro_push);
+    g_test_add_func("/net/gro/not-merged", test_gro_not_merged);
+    return g_test_run();
+}
@@ -116,8 +116,11 @@ static void test_submit_co(void)
 static void test_submit_many(void)
 {
     WorkerTestData data[100];
+    ThreadPoolStats before, after;
     int i;
 
+    thread_pool_get_stats(pool, &before);
+
     /* Start more work items than there will be threads.  */
     for (i = 0; i < 100; i++) {
         data[i].n = 0;
@@ -133,6 +136,13 @@ static void test_submit_many(void)
         g_assert_cmpint(data[i].n, ==, 1);
         g_assert_cmpint(data[i].ret, ==, 0);
     }
+
+    thread_pool_get_stats(pool, &after);
+    g_assert_cmpuint(after.submitted - before.submitted, ==, 100);
+    g_assert_cmpuint(after.completed - before.completed, ==, 100);
+    g_assert_cmpuint(after.queue_depth, ==, 0);
+    g_assert_cmpuint(after.max_queue_depth, >=, 1);
+    g_assert_cmpuint(after.batches, >, before.batches);
 }
 
 static void do_test_cancel(bool sync)
@@ -0,0 +1,171 @@
+/*
+ * Toeplitz hash tests
+ *
+ * Copyright (c) 2022 The QEMU Project Developers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "net/toeplitz.h"
+
+/* Verification suite from the Microsoft RSS specification */
+static const uint8_t ms_key[NET_TOEPLITZ_KEY_LEN] = {
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+    0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+    0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+    0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+    0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa,
+};
+
+typedef struct ToeplitzVector {
+    size_t addr_len;
+    uint8_t src[16];
+    uint8_t dst[16];
+    uint16_t sport;
+    uint16_t dport;
+    uint32_t hash_ip;       /* addresses only */
+    uint32_t hash_tcp;      /* addresses and ports */
+} ToeplitzVector;
+
+static const ToeplitzVector ms_vectors[] = {
+    {
+        4, { 0x42, 0x09, 0x95, 0xbb }, { 0xa1, 0x8e, 0x64, 0x50 },
+        2794, 1766, 0x323e8fc2, 0x51ccc178
+    }, {
+        4, { 0xc7, 0x5c, 0x6f, 0x02 }, { 0x41, 0x45, 0x8c, 0x53 },
+        14230, 4739, 0xd718262a, 0xc626b0ea
+    }, {
+        4, { 0x18, 0x13, 0xc6, 0x5f }, { 0x0c, 0x16, 0xcf, 0xb8 },
+        12898, 38024, 0xd2d0a5de, 0x5c2b394a
+    }, {
+        4, { 0x26, 0x1b, 0xcd, 0x1e }, { 0xd1, 0x8e, 0xa3, 0x06 },
+        48228, 2217, 0x82989176, 0xafc7327f
+    }, {
+        4, { 0x99, 0x27, 0xa3, 0xbf }, { 0xca, 0xbc, 0x7f, 0x02 },
+        44251, 1303, 0x5d1809c5, 0x10e828a2
+    }, {
+        /* 3ffe:2501:200:1fff::7 -> 3ffe:2501:200:3::1 */
+        16, {
+            0x3f, 0xfe, 0x25, 0x01, 0x02, 0x00, 0x1f, 0xff,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x07
+        }, {
+            0x3f, 0xfe, 0x25, 0x01, 0x02, 0x00, 0x00, 0x03,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01
+        },
+        2794, 1766, 0x2cc18cd5, 0x40207d3d
+    }, {
+        /* 3ffe:501:8::260:97ff:fe40:efab -> ff02::1 */
+        16, {
+            0x3f, 0xfe, 0x05, 0x01, 0x00, 0x08, 0x00, 0x00,
+            0x02, 0x60, 0x97, 0xff, 0xfe, 0x40, 0xef, 0xab
+        }, {
+            0xff, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01
+        },
+        14230, 4739, 0x0f0c461c, 0xdde51bbf
+    }, {
+        /* 3ffe:1900:4545:3:200:f8ff:fe21:67cf -> fe80::200:f8ff:fe21:67cf */
+        16, {
+            0x3f, 0xfe, 0x19, 0x00, 0x45, 0x45, 0x00, 0x03,
+            0x02, 0x00, 0xf8, 0xff, 0xfe, 0x21, 0x67, 0xcf
+        }, {
+            0xfe, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x02, 0x00, 0xf8, 0xff, 0xfe, 0x21, 0x67, 0xcf
+        },
+        44251, 38024, 0x4b61e985, 0x02d1feef
+    },
+};
+
+/* One key bit per input bit, straight from the definition */
+static uint32_t toeplitz_ref(const uint8_t *key, const uint8_t *input,
+                             size_t len)
+{
+    uint32_t window = ldl_be_p(key);
+    uint32_t hash = 0;
+    size_t i;
+    int bit;
+
+    for (i = 0; i < len; i++) {
+        for (bit = 7; bit >= 0; bit--) {
+            if (input[i] & (1 << bit)) {
+                hash ^= window;
+            }
+            window = (window << 1) | ((key[i + 4] >> bit) & 1);
+        }
+    }
+    return hash;
+}
+
+static void test_ms_vectors(void)
+{
+    NetToeplitz *t = g_new0(NetToeplitz, 1);
+    uint8_t input[NET_TOEPLITZ_MAX_INPUT];
+    size_t i, len;
+
+    net_toeplitz_set_key(t, ms_key);
+    for (i = 0; i < ARRAY_SIZE(ms_vectors); i++) {
+        const ToeplitzVector *v = &ms_vectors[i];
+
+        memcpy(input, v->src, v->addr_len);
+        memcpy(input + v->addr_len, v->dst, v->addr_len);
+        len = 2 * v->addr_len;
+        g_assert_cmphex(toeplitz_ref(ms_key, input, len), ==, v->hash_ip);
+        g_assert_cmphex(net_toeplitz_hash(t, input, len), ==, v->hash_ip);
+
+        stw_be_p(input + len, v->sport);
+        stw_be_p(input + len + 2, v->dport);
+        len += 4;
+        g_assert_cmphex(toeplitz_ref(ms_key, input, len), ==, v->hash_tcp);
+        g_assert_cmphex(net_toeplitz_hash(t, input, len), ==, v->hash_tcp);
+    }
+    g_free(t);
+}
+
+static void test_random(void)
+{
+    NetToeplitz *t = g_new0(NetToeplitz, 1);
+    uint8_t key[NET_TOEPLITZ_KEY_LEN];
+    uint8_t input[NET_TOEPLITZ_MAX_INPUT];
+    GRand *rand = g_rand_new_with_seed(1);
+    int i, j, n;
+    size_t len;
+
+    for (i = 0; i < 64; i++) {
+        for (j = 0; j < sizeof(key); j++) {
+            key[j] = g_rand_int(rand);
+        }
+        net_toeplitz_set_key(t, key);
+
+        /* Lengths include ones that end in the middle of a 32-bit word */
+        for (n = 0; n < 16; n++) {
+            len = g_rand_int_range(rand, 0, NET_TOEPLITZ_MAX_INPUT + 1);
+            for (j = 0; j < len; j++) {
+                input[j] = g_rand_int(rand);
+            }
+            g_assert_cmphex(net_toeplitz_hash(t, input, len), ==,
+                            toeplitz_ref(key, input, len));
+        }
+    }
+    g_rand_free(rand);
+    g_free(t);
+}
+
+/* Run every implementation the host supports, fastest first */
+static void test_toeplitz(void)
+{
+    do {
+        test_ms_vectors();
+        test_random();
+    } while (test_net_toeplitz_next_accel());
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/net/toeplitz", test_toeplitz);
+
+    return g_test_run();
+}
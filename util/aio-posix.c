@@ -150,6 +150,14 @@ void aio_set_fd_handler(AioContext *ctx,
             new_node->pfd.fd = fd;
         } else {
             new_node->pfd = node->pfd;
+
+            /* Keep the polling history when handler functions are updated */
+            new_node->poll_ns = node->poll_ns;
+            stat64_init(&new_node->poll_hits, stat64_get(&node->poll_hits));
+            stat64_init(&new_node->poll_misses,
+                        stat64_get(&node->poll_misses));
+            stat64_init(&new_node->poll_time_ns,
+                        stat64_get(&node->poll_time_ns));
         }
         g_source_add_poll(&ctx->source, &new_node->pfd);
 
@@ -439,6 +447,7 @@ static bool run_poll_handlers_once(AioContext *ctx,
         if (aio_node_check(ctx, node->is_external) &&
             node->io_poll(node->opaque)) {
             aio_add_poll_ready_handler(ready_list, node);
+            stat64_add(&node->poll_hits, 1);
 
             node->poll_idle_timeout = now + POLL_IDLE_INTERVAL_NS;
 
@@ -523,6 +532,7 @@ static bool run_poll_handlers(AioContext *ctx, AioHandlerList *ready_list,
 {
     bool progress;
     int64_t start_time, elapsed_time;
+    AioHandler *node;
 
     assert(qemu_lockcnt_count(&ctx->list_lock) > 0);
 
@@ -547,6 +557,10 @@ static bool run_poll_handlers(AioContext *ctx, AioHandlerList *ready_list,
         assert(!(max_ns && progress));
     } while (elapsed_time < max_ns && !ctx->fdmon_ops->need_wait(ctx));
 
+    QLIST_FOREACH(node, &ctx->poll_aio_handlers, node_poll) {
+        stat64_add(&node->poll_time_ns, elapsed_time);
+    }
+
     if (remove_idle_poll_handlers(ctx, ready_list,
                                   start_time + elapsed_time)) {
         *timeout = 0;
@@ -577,12 +591,19 @@ static bool run_poll_handlers(AioContext *ctx, AioHandlerList *ready_list,
 static bool try_poll_mode(AioContext *ctx, AioHandlerList *ready_list,
                           int64_t *timeout)
 {
-    int64_t max_ns;
+    AioHandler *node;
+    int64_t max_ns = 0;
 
     if (QLIST_EMPTY_RCU(&ctx->poll_aio_handlers)) {
         return false;
     }
 
+    /* Poll for as long as the busiest handler wants to */
+    QLIST_FOREACH(node, &ctx->poll_aio_handlers, node_poll) {
+        max_ns = MAX(max_ns, node->poll_ns);
+    }
+    ctx->poll_ns = MIN(max_ns, ctx->poll_max_ns);
+
     max_ns = qemu_soonest_timeout(*timeout, ctx->poll_ns);
     if (max_ns && !ctx->fdmon_ops->need_wait(ctx)) {
         poll_set_started(ctx, ready_list, true);
@@ -600,6 +621,83 @@ static bool try_poll_mode(AioContext *ctx, AioHandlerList *ready_list,
     return false;
 }
 
+static void adjust_handler_polling_time(AioContext *ctx, AioHandler *node,
+                                        int64_t block_ns)
+{
+    if (block_ns <= node->poll_ns) {
+        /* This is the sweet spot, no adjustment needed */
+    } else if (block_ns > ctx->poll_max_ns) {
+        /* We'd have to poll for too long, poll less */
+        int64_t old = node->poll_ns;
+
+        if (ctx->poll_shrink) {
+            node->poll_ns /= ctx->poll_shrink;
+        } else {
+            node->poll_ns = 0;
+        }
+
+        trace_poll_shrink(ctx, node, old, node->poll_ns);
+    } else if (node->poll_ns < ctx->poll_max_ns &&
+               block_ns < ctx->poll_max_ns) {
+        /* There is room to grow, poll longer */
+        int64_t old = node->poll_ns;
+        int64_t grow = ctx->poll_grow;
+
+        if (grow == 0) {
+            grow = 2;
+        }
+
+        if (node->poll_ns) {
+            node->poll_ns *= grow;
+        } else {
+            node->poll_ns = 4000; /* start polling at 4 microseconds */
+        }
+
+        if (node->poll_ns > ctx->poll_max_ns) {
+            node->poll_ns = ctx->poll_max_ns;
+        }
+
+        trace_poll_grow(ctx, node, old, node->poll_ns);
+    }
+}
+
+/*
+ * Each handler keeps its own polling time so that a busy handler (e.g. a
+ * virtqueue ioeventfd under load) keeps polling for long even when a quiet
+ * handler in the same AioContext only fires after long sleeps.  The
+ * AioContext then polls for as long as the busiest handler wants to.
+ */
+static void adjust_polling_time(AioContext *ctx, AioHandlerList *ready_list,
+                                int64_t block_ns)
+{
+    AioHandler *node;
+
+    QLIST_FOREACH(node, ready_list, node_ready) {
+        if (!node->io_poll || QLIST_IS_INSERTED(node, node_deleted)) {
+            continue;
+        }
+
+        /* The handler was being polled but its fd caught the event */
+        if (!node->poll_ready && QLIST_IS_INSERTED(node, node_poll)) {
+            stat64_add(&node->poll_misses, 1);
+        }
+
+        adjust_handler_polling_time(ctx, node, block_ns);
+    }
+
+    /*
+     * Handlers that stayed quiet for longer than poll_max_ns would have had
+     * to poll for too long as well.
+     */
+    if (block_ns > ctx->poll_max_ns) {
+        QLIST_FOREACH(node, &ctx->poll_aio_handlers, node_poll) {
+            if (!QLIST_IS_INSERTED(node, node_ready)) {
+                adjust_handler_polling_time(ctx, node, block_ns);
+            }
+        }
+    }
+}
+
 bool aio_poll(AioContext *ctx, bool blocking)
 {
     AioHandlerList ready_list = QLIST_HEAD_INITIALIZER(ready_list);
@@ -672,41 +770,7 @@ bool aio_poll(AioContext *ctx, bool blocking)
     if (ctx->poll_max_ns) {
         int64_t block_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start;
 
-        if (block_ns <= ctx->poll_ns) {
-            /* This is the sweet spot, no adjustment needed */
-        } else if (block_ns > ctx->poll_max_ns) {
-            /* We'd have to poll for too long, poll less */
-            int64_t old = ctx->poll_ns;
-
-            if (ctx->poll_shrink) {
-                ctx->poll_ns /= ctx->poll_shrink;
-            } else {
-                ctx->poll_ns = 0;
-            }
-
-            trace_poll_shrink(ctx, old, ctx->poll_ns);
-        } else if (ctx->poll_ns < ctx->poll_max_ns &&
-                   block_ns < ctx->poll_max_ns) {
-            /* There is room to grow, poll longer */
-            int64_t old = ctx->poll_ns;
-            int64_t grow = ctx->poll_grow;
-
-            if (grow == 0) {
-                grow = 2;
-            }
-
-            if (ctx->poll_ns) {
-                ctx->poll_ns *= grow;
-            } else {
-                ctx->poll_ns = 4000; /* start polling at 4 microseconds */
-            }
-
-            if (ctx->poll_ns > ctx->poll_max_ns) {
-                ctx->poll_ns = ctx->poll_max_ns;
-            }
-
-            trace_poll_grow(ctx, old, ctx->poll_ns);
-        }
+        adjust_polling_time(ctx, &ready_list, block_ns);
     }
 
     progress |= aio_bh_poll(ctx);
@@ -767,6 +831,38 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
     aio_notify(ctx);
 }
 
+void aio_context_foreach_poll_handler(AioContext *ctx,
+                                      AioPollHandlerStatsFn *fn,
+                                      void *opaque)
+{
+    AioHandler *node;
+
+    /* Deleted nodes are not freed while list_lock is held */
+    qemu_lockcnt_inc(&ctx->list_lock);
+    QLIST_FOREACH_RCU(node, &ctx->aio_handlers, node) {
+        AioPollHandlerStats stats;
+
+        if (!node->io_poll || node->opaque == &ctx->notifier ||
+            QLIST_IS_INSERTED(node, node_deleted)) {
+            continue;
+        }
+
+        /*
+         * No thread synchronization for poll_ns, it is only informational
+         * and a stale value is harmless.
+         */
+        stats = (AioPollHandlerStats) {
+            .fd = node->pfd.fd,
+            .poll_ns = node->poll_ns,
+            .poll_hits = stat64_get(&node->poll_hits),
+            .poll_misses = stat64_get(&node->poll_misses),
+            .poll_time_ns = stat64_get(&node->poll_time_ns),
+        };
+        fn(&stats, opaque);
+    }
+    qemu_lockcnt_dec(&ctx->list_lock);
+}
+
 void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch,
                                 Error **errp)
 {
@@ -18,6 +18,7 @@
 #define AIO_POSIX_H
 
 #include "block/aio.h"
+#include "qemu/stats64.h"
 
 struct AioHandler {
     GPollFD pfd;
@@ -37,6 +38,10 @@ struct AioHandler {
     unsigned flags; /* see fdmon-io_uring.c */
 #endif
     int64_t poll_idle_timeout; /* when to stop userspace polling */
+    int64_t poll_ns; /* adaptive polling time for this handler */
+    Stat64 poll_hits; /* events detected by userspace polling */
+    Stat64 poll_misses; /* events that polling missed and the fd caught */
+    Stat64 poll_time_ns; /* time spent polling while in the poll list */
     bool poll_ready; /* has polling detected an event? */
     bool is_external;
 };
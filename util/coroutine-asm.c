@@ -0,0 +1,345 @@
+/*
+ * Host-specific assembly coroutine backend
+ *
+ * Copyright (C) 2022 The QEMU Project Developers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/coroutine_int.h"
+#include "qemu/coroutine-tls.h"
+
+#ifdef CONFIG_VALGRIND_H
+#include <valgrind/valgrind.h>
+#endif
+
+#ifdef QEMU_SANITIZE_ADDRESS
+#ifdef CONFIG_ASAN_IFACE_FIBER
+#define CONFIG_ASAN 1
+#include <sanitizer/asan_interface.h>
+#endif
+#endif
+
+#ifdef CONFIG_TSAN
+#include <sanitizer/tsan_interface.h>
+#endif
+
+typedef struct {
+    Coroutine base;
+
+    /* Stack pointer of the coroutine while it is not running */
+    void *sp;
+
+    void *stack;
+    size_t stack_size;
+
+#ifdef CONFIG_TSAN
+    void *tsan_co_fiber;
+#endif
+
+#ifdef CONFIG_VALGRIND_H
+    unsigned int valgrind_stack_id;
+#endif
+} CoroutineAsm;
+
+/**
+ * Per-thread coroutine bookkeeping
+ */
+QEMU_DEFINE_STATIC_CO_TLS(Coroutine *, current);
+QEMU_DEFINE_STATIC_CO_TLS(CoroutineAsm, leader);
+
+/*
+ * CO_SWITCH saves the stack pointer of the running coroutine in *from_sp,
+ * loads *to_sp and resumes the other coroutine, passing it @action.
+ *
+ * Instead of saving every register like sigsetjmp() does, the asm
+ * statement marks all registers that may be live across it as clobbered,
+ * so the compiler only spills the callee-saved registers that the calling
+ * function actually uses.  Only the frame pointer, which cannot be
+ * clobbered, is saved explicitly.  The address to resume at is pushed on
+ * the stack, so a new coroutine starts running coroutine_trampoline() by
+ * "returning" into it from a stack prepared by qemu_coroutine_new().
+ */
+#if defined(__x86_64__)
+
+/*
+ * The resume address and %rbp go below the 128-byte red zone, which may
+ * hold live data of the calling function.  Vector registers are all
+ * caller-saved in the SysV ABI.
+ */
+#define CO_SWITCH(from_sp, to_sp, action) ({                                \
+    uintptr_t action_ = (action);                                           \
+    void **from_ = (from_sp);                                               \
+    void **to_ = (to_sp);                                                   \
+    asm volatile(                                                           \
+        "leaq -128(%%rsp), %%rsp\n\t"                                       \
+        "pushq %%rbp\n\t"                                                   \
+        "leaq 1f(%%rip), %%rcx\n\t"                                         \
+        "pushq %%rcx\n\t"                                                   \
+        "movq %%rsp, (%[FROM])\n\t"                                         \
+        "movq (%[TO]), %%rsp\n\t"                                           \
+        "ret\n"                                                             \
+        "1:\n\t"                                                            \
+        "popq %%rbp\n\t"                                                    \
+        "leaq 128(%%rsp), %%rsp\n\t"                                        \
+        : "+a" (action_), [FROM] "+S" (from_), [TO] "+D" (to_)              \
+        :                                                                   \
+        : "rbx", "rcx", "rdx", "r8", "r9", "r10", "r11",                    \
+          "r12", "r13", "r14", "r15",                                       \
+          "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7",   \
+          "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14",      \
+          "xmm15", "memory", "cc");                                         \
+    (CoroutineAction)action_;                                               \
+})
+
+/*
+ * A new coroutine "returns" into the trampoline with a 16-byte aligned
+ * stack pointer minus the return address, as if it had been called.
+ */
+static void *co_init_stack(void *top, void (*entry)(void))
+{
+    void **sp = top - 16;
+
+    sp[0] = entry;
+    return sp;
+}
+
+#elif defined(__aarch64__)
+
+/*
+ * AAPCS64 has no red zone.  d8-d15 are callee-saved, and are spilled by
+ * the compiler because v8-v15 are clobbered.  "ret" rather than "br" keeps
+ * BTI happy, since RET is not a checked indirect branch.
+ */
+#define CO_SWITCH(from_sp, to_sp, action) ({                                \
+    register uintptr_t action_ asm("x0") = (action);                        \
+    register void **from_ asm("x1") = (from_sp);                            \
+    register void **to_ asm("x2") = (to_sp);                                \
+    asm volatile(                                                           \
+        "adr x30, 1f\n\t"                                                   \
+        "stp x29, x30, [sp, #-16]!\n\t"                                     \
+        "mov x3, sp\n\t"                                                    \
+        "str x3, [%[FROM]]\n\t"                                             \
+        "ldr x3, [%[TO]]\n\t"                                               \
+        "mov sp, x3\n\t"                                                    \
+        "ldp x29, x30, [sp], #16\n\t"                                       \
+        "ret\n"                                                             \
+        "1:\n\t"                                                            \
+        : "+r" (action_), [FROM] "+r" (from_), [TO] "+r" (to_)              \
+        :                                                                   \
+        : "x3", "x4", "x5", "x6", "x7", "x8", "x9", "x10", "x11", "x12",    \
+          "x13", "x14", "x15", "x16", "x17", "x18", "x19", "x20", "x21",    \
+          "x22", "x23", "x24", "x25", "x26", "x27", "x28", "x30",           \
+          "v0", "v1", "v2", "v3", "v4", "v5", "v6", "v7",                   \
+          "v8", "v9", "v10", "v11", "v12", "v13", "v14", "v15",             \
+          "v16", "v17", "v18", "v19", "v20", "v21", "v22", "v23",           \
+          "v24", "v25", "v26", "v27", "v28", "v29", "v30", "v31",           \
+          "memory", "cc");                                                  \
+    (CoroutineAction)action_;                                               \
+})
+
+/* The first switch pops a zero frame pointer and the trampoline address */
+static void *co_init_stack(void *top, void (*entry)(void))
+{
+    void **sp = top - 16;
+
+    sp[0] = NULL;
+    sp[1] = entry;
+    return sp;
+}
+
+#else
+#error "The asm coroutine backend only supports x86_64 and aarch64 hosts"
+#endif
+
+/*
+ * QEMU_ALWAYS_INLINE only does so if __OPTIMIZE__, so we cannot use it.
+ * always_inline is required to avoid TSan runtime fatal errors.
+ */
+static inline __attribute__((always_inline))
+void on_new_fiber(CoroutineAsm *co)
+{
+#ifdef CONFIG_TSAN
+    co->tsan_co_fiber = __tsan_create_fiber(0); /* flags: sync on switch */
+#endif
+}
+
+/* always_inline is required to avoid TSan runtime fatal errors. */
+static inline __attribute__((always_inline))
+void finish_switch_fiber(void *fake_stack_save)
+{
+#ifdef CONFIG_ASAN
+    CoroutineAsm *leaderp = get_ptr_leader();
+    const void *bottom_old;
+    size_t size_old;
+
+    __sanitizer_finish_switch_fiber(fake_stack_save, &bottom_old, &size_old);
+
+    if (!leaderp->stack) {
+        leaderp->stack = (void *)bottom_old;
+        leaderp->stack_size = size_old;
+    }
+#endif
+#ifdef CONFIG_TSAN
+    if (fake_stack_save) {
+        __tsan_release(fake_stack_save);
+        __tsan_switch_to_fiber(fake_stack_save, 0);  /* 0=synchronize */
+    }
+#endif
+}
+
+/* always_inline is required to avoid TSan runtime fatal errors. */
+static inline __attribute__((always_inline))
+void start_switch_fiber_asan(CoroutineAction action, void **fake_stack_save,
+                             const void *bottom, size_t size)
+{
+#ifdef CONFIG_ASAN
+    __sanitizer_start_switch_fiber(
+            action == COROUTINE_TERMINATE ? NULL : fake_stack_save,
+            bottom, size);
+#endif
+}
+
+/* always_inline is required to avoid TSan runtime fatal errors. */
+static inline __attribute__((always_inline))
+void start_switch_fiber_tsan(void **fake_stack_save, CoroutineAsm *co)
+{
+#ifdef CONFIG_TSAN
+    void *curr_fiber = __tsan_get_current_fiber();
+    __tsan_acquire(curr_fiber);
+
+    *fake_stack_save = curr_fiber;
+    __tsan_switch_to_fiber(co->tsan_co_fiber, 0);  /* 0=synchronize */
+#endif
+}
+
+/*
+ * Entered by the first switch to a new coroutine, and never returns: once
+ * the coroutine terminates it sits in qemu_coroutine_switch() until it is
+ * taken from the pool and entered again.
+ */
+static G_NORETURN void coroutine_trampoline(void)
+{
+    Coroutine *co = get_current();
+
+    finish_switch_fiber(NULL);
+
+    while (true) {
+        co->entry(co->entry_arg);
+        qemu_coroutine_switch(co, co->caller, COROUTINE_TERMINATE);
+    }
+}
+
+Coroutine *qemu_coroutine_new(void)
+{
+    CoroutineAsm *co;
+
+    co = g_malloc0(sizeof(*co));
+    co->stack_size = COROUTINE_STACK_SIZE;
+    co->stack = qemu_alloc_stack(&co->stack_size);
+    co->sp = co_init_stack(co->stack + co->stack_size, coroutine_trampoline);
+
+#ifdef CONFIG_VALGRIND_H
+    co->valgrind_stack_id =
+        VALGRIND_STACK_REGISTER(co->stack, co->stack + co->stack_size);
+#endif
+
+    on_new_fiber(co);
+    return &co->base;
+}
+
+#ifdef CONFIG_VALGRIND_H
+/* Work around an unused variable in the valgrind.h macro... */
+#if !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-but-set-variable"
+#endif
+static inline void valgrind_stack_deregister(CoroutineAsm *co)
+{
+    VALGRIND_STACK_DEREGISTER(co->valgrind_stack_id);
+}
+#if !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+void qemu_coroutine_delete(Coroutine *co_)
+{
+    CoroutineAsm *co = DO_UPCAST(CoroutineAsm, base, co_);
+
+#ifdef CONFIG_VALGRIND_H
+    valgrind_stack_deregister(co);
+#endif
+
+#ifdef CONFIG_TSAN
+    __tsan_destroy_fiber(co->tsan_co_fiber);
+#endif
+
+    qemu_coroutine_note_stack_usage(qemu_stack_usage(co->stack,
+                                                     co->stack_size),
+                                    co->stack_size);
+    qemu_free_stack(co->stack, co->stack_size);
+    g_free(co);
+}
+
+/*
+ * Like in the ucontext backend, this must not be inlined into
+ * coroutine_trampoline(): the switch may return in a different thread,
+ * so the address of the TLS variable "current" must not be cached
+ * across it.
+ */
+CoroutineAction __attribute__((noinline))
+qemu_coroutine_switch(Coroutine *from_, Coroutine *to_,
+                      CoroutineAction action)
+{
+    CoroutineAsm *from = DO_UPCAST(CoroutineAsm, base, from_);
+    CoroutineAsm *to = DO_UPCAST(CoroutineAsm, base, to_);
+    void *fake_stack_save = NULL;
+
+    set_current(to_);
+
+    start_switch_fiber_asan(action, &fake_stack_save, to->stack,
+                            to->stack_size);
+    start_switch_fiber_tsan(&fake_stack_save, to);
+    action = CO_SWITCH(&from->sp, &to->sp, action);
+
+    finish_switch_fiber(fake_stack_save);
+
+    return action;
+}
+
+Coroutine *qemu_coroutine_self(void)
+{
+    Coroutine *self = get_current();
+    CoroutineAsm *leaderp = get_ptr_leader();
+
+    if (!self) {
+        self = &leaderp->base;
+        set_current(self);
+    }
+#ifdef CONFIG_TSAN
+    if (!leaderp->tsan_co_fiber) {
+        leaderp->tsan_co_fiber = __tsan_get_current_fiber();
+    }
+#endif
+    return self;
+}
+
+bool qemu_in_coroutine(void)
+{
+    Coroutine *self = get_current();
+
+    return self && self->caller;
+}
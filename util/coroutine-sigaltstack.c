@@ -266,6 +266,9 @@ void qemu_coroutine_delete(Coroutine *co_)
 {
     CoroutineSigAltStack *co = DO_UPCAST(CoroutineSigAltStack, base, co_);
 
+    qemu_coroutine_note_stack_usage(qemu_stack_usage(co->stack,
+                                                     co->stack_size),
+                                    co->stack_size);
     qemu_free_stack(co->stack, co->stack_size);
     g_free(co);
 }
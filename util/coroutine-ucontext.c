@@ -277,6 +277,9 @@ void qemu_coroutine_delete(Coroutine *co_)
     valgrind_stack_deregister(co);
 #endif
 
+    qemu_coroutine_note_stack_usage(qemu_stack_usage(co->stack,
+                                                     co->stack_size),
+                                    co->stack_size);
     qemu_free_stack(co->stack, co->stack_size);
 #ifdef CONFIG_SAFESTACK
     qemu_free_stack(co->unsafe_stack, co->unsafe_stack_size);
@@ -42,8 +42,11 @@
 #include "qemu/cutils.h"
 #include "qemu/compiler.h"
 #include "qemu/units.h"
+#include "qemu/bitops.h"
+#include "qemu/rcu_queue.h"
 
 #ifdef CONFIG_LINUX
+#include <sched.h>
 #include <sys/syscall.h>
 #endif
 
@@ -70,19 +73,37 @@
 
 #define MAX_MEM_PREALLOC_THREAD_COUNT 16
 
+/* Threads of a context take pages to preallocate in chunks of this size */
+#define MEM_PREALLOC_CHUNK_SIZE (64 * MiB)
+
 struct MemsetThread;
 
 typedef struct MemsetContext {
     bool all_threads_created;
-    bool any_thread_failed;
     struct MemsetThread *threads;
     int num_threads;
+
+    char *name;
+    char *area;
+    size_t hpagesize;
+    size_t numpages;
+    size_t chunk_pages;
+    bool use_madv_populate_write;
+#ifdef CONFIG_LINUX
+    /* CPUs local to the memory, or NULL to leave the affinity alone */
+    cpu_set_t *cpus;
+#endif
+
+    /* Updated atomically by the threads */
+    size_t next_page;
+    size_t done_pages;
+    int running;
+    int ret;
+
+    QLIST_ENTRY(MemsetContext) next;
 } MemsetContext;
 
 struct MemsetThread {
-    char *addr;
-    size_t numpages;
-    size_t hpagesize;
     QemuThread pgthread;
     sigjmp_buf env;
     MemsetContext *context;
@@ -91,8 +112,11 @@ typedef struct MemsetThread MemsetThread;
 
 /* used by sigbus_handler() */
 static MemsetContext *sigbus_memset_context;
+static QLIST_HEAD(, MemsetContext) memset_async_contexts =
+    QLIST_HEAD_INITIALIZER(memset_async_contexts);
 struct sigaction sigbus_oldact;
 static QemuMutex sigbus_mutex;
+static int sigbus_users;
 
 static QemuMutex page_mutex;
 static QemuCond page_cond;
@@ -278,22 +302,32 @@ void qemu_set_tty_echo(int fd, bool echo)
     tcsetattr(fd, TCSANOW, &tty);
 }
 
+static void memset_context_siglongjmp(MemsetContext *context)
+{
+    int i;
+
+    for (i = 0; i < context->num_threads; i++) {
+        MemsetThread *thread = &context->threads[i];
+
+        if (qemu_thread_is_self(&thread->pgthread)) {
+            siglongjmp(thread->env, 1);
+        }
+    }
+}
+
 #ifdef CONFIG_LINUX
 static void sigbus_handler(int signal, siginfo_t *siginfo, void *ctx)
 #else /* CONFIG_LINUX */
 static void sigbus_handler(int signal)
 #endif /* CONFIG_LINUX */
 {
-    int i;
+    MemsetContext *context;
 
     if (sigbus_memset_context) {
-        for (i = 0; i < sigbus_memset_context->num_threads; i++) {
-            MemsetThread *thread = &sigbus_memset_context->threads[i];
-
-            if (qemu_thread_is_self(&thread->pgthread)) {
-                siglongjmp(thread->env, 1);
-            }
-        }
+        memset_context_siglongjmp(sigbus_memset_context);
+    }
+    QLIST_FOREACH_RCU(context, &memset_async_contexts, next) {
+        memset_context_siglongjmp(context);
     }
 
 #ifdef CONFIG_LINUX
@@ -317,9 +351,77 @@ static void sigbus_handler(int signal)
     warn_report("os_mem_prealloc: unrelated SIGBUS detected and ignored");
 }
 
+static void memset_init(void)
+{
+    static gsize initialized;
+
+    if (g_once_init_enter(&initialized)) {
+        qemu_mutex_init(&page_mutex);
+        qemu_cond_init(&page_cond);
+        qemu_mutex_init(&sigbus_mutex);
+        g_once_init_leave(&initialized, 1);
+    }
+}
+
+/*
+ * Install sigbus_handler() for threads that touch pages; the previous
+ * handler comes back when the last user is gone.  Called with sigbus_mutex
+ * held.
+ */
+static int sigbus_handler_get(Error **errp)
+{
+    struct sigaction act;
+
+    if (sigbus_users++) {
+        return 0;
+    }
+
+    memset(&act, 0, sizeof(act));
+#ifdef CONFIG_LINUX
+    act.sa_sigaction = &sigbus_handler;
+    act.sa_flags = SA_SIGINFO;
+#else /* CONFIG_LINUX */
+    act.sa_handler = &sigbus_handler;
+    act.sa_flags = 0;
+#endif /* CONFIG_LINUX */
+
+    if (sigaction(SIGBUS, &act, &sigbus_oldact)) {
+        sigbus_users--;
+        error_setg_errno(errp, errno,
+            "os_mem_prealloc: failed to install signal handler");
+        return -1;
+    }
+    return 0;
+}
+
+static void sigbus_handler_put(void)
+{
+    if (--sigbus_users) {
+        return;
+    }
+
+    if (sigaction(SIGBUS, &sigbus_oldact, NULL)) {
+        /* Terminate QEMU since it can't recover from error */
+        perror("os_mem_prealloc: failed to reinstall signal handler");
+        exit(1);
+    }
+}
+
+/* Returns the number of pages in the next chunk, 0 when all are taken */
+static size_t memset_next_chunk(MemsetContext *context, size_t *first)
+{
+    *first = qatomic_fetch_add(&context->next_page, context->chunk_pages);
+    if (*first >= context->numpages) {
+        return 0;
+    }
+    return MIN(context->chunk_pages, context->numpages - *first);
+}
+
 static void *do_touch_pages(void *arg)
 {
     MemsetThread *memset_args = (MemsetThread *)arg;
+    MemsetContext *context = memset_args->context;
+    const size_t hpagesize = context->hpagesize;
     sigset_t set, oldset;
     int ret = 0;
 
@@ -329,11 +431,22 @@ static void *do_touch_pages(void *arg)
      * clearing until all threads have been created.
      */
     qemu_mutex_lock(&page_mutex);
-    while (!memset_args->context->all_threads_created) {
+    while (!context->all_threads_created) {
         qemu_cond_wait(&page_cond, &page_mutex);
     }
     qemu_mutex_unlock(&page_mutex);
 
+#ifdef CONFIG_LINUX
+    /*
+     * Fault the pages in from the nodes the memory is bound to, so that
+     * neither the kernel's zeroing nor the allocation crosses the
+     * interconnect.  This is only an optimization, so ignore failures.
+     */
+    if (context->cpus) {
+        sched_setaffinity(0, sizeof(*context->cpus), context->cpus);
+    }
+#endif
+
     /* unblock SIGBUS */
     sigemptyset(&set);
     sigaddset(&set, SIGBUS);
@@ -342,45 +455,51 @@ static void *do_touch_pages(void *arg)
     if (sigsetjmp(memset_args->env, 1)) {
         ret = -EFAULT;
     } else {
-        char *addr = memset_args->addr;
-        size_t numpages = memset_args->numpages;
-        size_t hpagesize = memset_args->hpagesize;
-        size_t i;
-        for (i = 0; i < numpages; i++) {
-            /*
-             * Read & write back the same value, so we don't
-             * corrupt existing user/app data that might be
-             * stored.
-             *
-             * 'volatile' to stop compiler optimizing this away
-             * to a no-op
-             */
-            *(volatile char *)addr = *addr;
-            addr += hpagesize;
+        size_t first, numpages, i;
+
+        /*
+         * Chunks are taken on demand rather than split evenly up front, so
+         * threads that run on a busy CPU or hit slower memory do less.
+         */
+        while ((numpages = memset_next_chunk(context, &first))) {
+            char *addr = context->area + first * hpagesize;
+
+            if (context->use_madv_populate_write) {
+                if (qemu_madvise(addr, numpages * hpagesize,
+                                 QEMU_MADV_POPULATE_WRITE)) {
+                    ret = -errno;
+                    break;
+                }
+            } else {
+                for (i = 0; i < numpages; i++) {
+                    /*
+                     * Read & write back the same value, so we don't
+                     * corrupt existing user/app data that might be
+                     * stored.
+                     *
+                     * 'volatile' to stop compiler optimizing this away
+                     * to a no-op
+                     */
+                    *(volatile char *)addr = *addr;
+                    addr += hpagesize;
+                }
+            }
+            qatomic_add(&context->done_pages, numpages);
         }
     }
-    pthread_sigmask(SIG_SETMASK, &oldset, NULL);
-    return (void *)(uintptr_t)ret;
-}
 
-static void *do_madv_populate_write_pages(void *arg)
-{
-    MemsetThread *memset_args = (MemsetThread *)arg;
-    const size_t size = memset_args->numpages * memset_args->hpagesize;
-    char * const addr = memset_args->addr;
-    int ret = 0;
+    pthread_sigmask(SIG_SETMASK, &oldset, NULL);
 
-    /* See do_touch_pages(). */
-    qemu_mutex_lock(&page_mutex);
-    while (!memset_args->context->all_threads_created) {
-        qemu_cond_wait(&page_cond, &page_mutex);
+    if (ret) {
+        /* Keep the first error and stop the other threads */
+        qatomic_cmpxchg(&context->ret, 0, ret);
+        qatomic_set(&context->next_page, context->numpages);
     }
-    qemu_mutex_unlock(&page_mutex);
-
-    if (size && qemu_madvise(addr, size, QEMU_MADV_POPULATE_WRITE)) {
-        ret = -errno;
+    if (qatomic_fetch_dec(&context->running) == 1) {
+        /* Wake up a main loop waiting for os_mem_prealloc_async_done() */
+        qemu_notify_event();
     }
-    return (void *)(uintptr_t)ret;
+    return NULL;
 }
 
 static inline int get_memset_num_threads(size_t hpagesize, size_t numpages,
@@ -402,73 +521,88 @@ static inline int get_memset_num_threads(size_t hpagesize, size_t numpages,
     return ret;
 }
 
-static int touch_all_pages(char *area, size_t hpagesize, size_t numpages,
-                           int smp_cpus, bool use_madv_populate_write)
+static MemsetContext *memset_context_new(char *area, size_t hpagesize,
+                                         size_t numpages, int smp_cpus,
+                                         bool use_madv_populate_write)
 {
-    static gsize initialized = 0;
-    MemsetContext context = {
-        .num_threads = get_memset_num_threads(hpagesize, numpages, smp_cpus),
-    };
-    size_t numpages_per_thread, leftover;
-    void *(*touch_fn)(void *);
-    int ret = 0, i = 0;
-    char *addr = area;
+    MemsetContext *context = g_new0(MemsetContext, 1);
+
+    context->area = area;
+    context->hpagesize = hpagesize;
+    context->numpages = numpages;
+    context->chunk_pages = MAX(1, MEM_PREALLOC_CHUNK_SIZE / hpagesize);
+    context->use_madv_populate_write = use_madv_populate_write;
+    context->num_threads = get_memset_num_threads(hpagesize, numpages,
+                                                  smp_cpus);
+    context->threads = g_new0(MemsetThread, context->num_threads);
+    return context;
+}
 
-    if (g_once_init_enter(&initialized)) {
-        qemu_mutex_init(&page_mutex);
-        qemu_cond_init(&page_cond);
-        g_once_init_leave(&initialized, 1);
-    }
+static void memset_context_free(MemsetContext *context)
+{
+#ifdef CONFIG_LINUX
+    g_free(context->cpus);
+#endif
+    g_free(context->name);
+    g_free(context->threads);
+    g_free(context);
+}
 
-    if (use_madv_populate_write) {
-        /* Avoid creating a single thread for MADV_POPULATE_WRITE */
-        if (context.num_threads == 1) {
-            if (qemu_madvise(area, hpagesize * numpages,
-                             QEMU_MADV_POPULATE_WRITE)) {
-                return -errno;
-            }
-            return 0;
-        }
-        touch_fn = do_madv_populate_write_pages;
-    } else {
-        touch_fn = do_touch_pages;
-    }
-
-    context.threads = g_new0(MemsetThread, context.num_threads);
-    numpages_per_thread = numpages / context.num_threads;
-    leftover = numpages % context.num_threads;
-    for (i = 0; i < context.num_threads; i++) {
-        context.threads[i].addr = addr;
-        context.threads[i].numpages = numpages_per_thread + (i < leftover);
-        context.threads[i].hpagesize = hpagesize;
-        context.threads[i].context = &context;
-        qemu_thread_create(&context.threads[i].pgthread, "touch_pages",
-                           touch_fn, &context.threads[i],
-                           QEMU_THREAD_JOINABLE);
-        addr += context.threads[i].numpages * hpagesize;
-    }
+static void memset_context_start(MemsetContext *context)
+{
+    int i;
 
-    if (!use_madv_populate_write) {
-        sigbus_memset_context = &context;
+    context->running = context->num_threads;
+    for (i = 0; i < context->num_threads; i++) {
+        context->threads[i].context = context;
+        qemu_thread_create(&context->threads[i].pgthread, "touch_pages",
+                           do_touch_pages, &context->threads[i],
+                           QEMU_THREAD_JOINABLE);
     }
 
     qemu_mutex_lock(&page_mutex);
-    context.all_threads_created = true;
+    context->all_threads_created = true;
     qemu_cond_broadcast(&page_cond);
     qemu_mutex_unlock(&page_mutex);
+}
+
+static int memset_context_join(MemsetContext *context)
+{
+    int i;
 
-    for (i = 0; i < context.num_threads; i++) {
-        int tmp = (uintptr_t)qemu_thread_join(&context.threads[i].pgthread);
+    for (i = 0; i < context->num_threads; i++) {
+        qemu_thread_join(&context->threads[i].pgthread);
+    }
+    return context->ret;
+}
 
-        if (tmp) {
-            ret = tmp;
+static int touch_all_pages(char *area, size_t hpagesize, size_t numpages,
+                           int smp_cpus, bool use_madv_populate_write)
+{
+    MemsetContext *context;
+    int ret;
+
+    context = memset_context_new(area, hpagesize, numpages, smp_cpus,
+                                 use_madv_populate_write);
+    if (use_madv_populate_write && context->num_threads == 1) {
+        /* Avoid creating a single thread for MADV_POPULATE_WRITE */
+        memset_context_free(context);
+        if (qemu_madvise(area, hpagesize * numpages,
+                         QEMU_MADV_POPULATE_WRITE)) {
+            return -errno;
         }
+        return 0;
     }
 
+    if (!use_madv_populate_write) {
+        sigbus_memset_context = context;
+    }
+    memset_context_start(context);
+    ret = memset_context_join(context);
     if (!use_madv_populate_write) {
         sigbus_memset_context = NULL;
     }
-    g_free(context.threads);
+    memset_context_free(context);
 
     return ret;
 }
@@ -482,12 +616,12 @@ static bool madv_populate_write_possible(char *area, size_t pagesize)
 void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
                      Error **errp)
 {
-    static gsize initialized;
     int ret;
     size_t hpagesize = qemu_fd_getpagesize(fd);
     size_t numpages = DIV_ROUND_UP(memory, hpagesize);
     bool use_madv_populate_write;
-    struct sigaction act;
+
+    memset_init();
 
     /*
      * Sense on every invocation, as MADV_POPULATE_WRITE cannot be used for
@@ -496,26 +630,9 @@ void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
     use_madv_populate_write = madv_populate_write_possible(area, hpagesize);
 
     if (!use_madv_populate_write) {
-        if (g_once_init_enter(&initialized)) {
-            qemu_mutex_init(&sigbus_mutex);
-            g_once_init_leave(&initialized, 1);
-        }
-
         qemu_mutex_lock(&sigbus_mutex);
-        memset(&act, 0, sizeof(act));
-#ifdef CONFIG_LINUX
-        act.sa_sigaction = &sigbus_handler;
-        act.sa_flags = SA_SIGINFO;
-#else /* CONFIG_LINUX */
-        act.sa_handler = &sigbus_handler;
-        act.sa_flags = 0;
-#endif /* CONFIG_LINUX */
-
-        ret = sigaction(SIGBUS, &act, &sigbus_oldact);
-        if (ret) {
+        if (sigbus_handler_get(errp)) {
             qemu_mutex_unlock(&sigbus_mutex);
-            error_setg_errno(errp, errno,
-                "os_mem_prealloc: failed to install signal handler");
             return;
         }
     }
@@ -529,13 +646,144 @@ void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
     }
 
     if (!use_madv_populate_write) {
-        ret = sigaction(SIGBUS, &sigbus_oldact, NULL);
-        if (ret) {
-            /* Terminate QEMU since it can't recover from error */
-            perror("os_mem_prealloc: failed to reinstall signal handler");
-            exit(1);
+        sigbus_handler_put();
+        qemu_mutex_unlock(&sigbus_mutex);
+    }
+}
+
+#ifdef CONFIG_LINUX
+/* Returns the CPUs of the host NUMA nodes set in @host_nodes, or NULL */
+static cpu_set_t *host_nodes_to_cpus(const unsigned long *host_nodes,
+                                     unsigned long max_node)
+{
+    g_autofree cpu_set_t *cpus = g_new0(cpu_set_t, 1);
+    unsigned long node, first, last, cpu;
+    bool found = false;
+
+    for (node = find_first_bit(host_nodes, max_node); node < max_node;
+         node = find_next_bit(host_nodes, max_node, node + 1)) {
+        g_autofree char *path = NULL;
+        g_autofree char *cpulist = NULL;
+        const char *p;
+
+        path = g_strdup_printf("/sys/devices/system/node/node%lu/cpulist",
+                               node);
+        if (!g_file_get_contents(path, &cpulist, NULL, NULL)) {
+            return NULL;
+        }
+
+        /* Comma-separated list of CPUs and ranges, e.g. "0-7,16-23" */
+        for (p = cpulist; !qemu_strtoul(p, &p, 10, &first); p++) {
+            last = first;
+            if (*p == '-' && qemu_strtoul(p + 1, &p, 10, &last)) {
+                break;
+            }
+            for (cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+                CPU_SET(cpu, cpus);
+                found = true;
+            }
+            if (*p != ',') {
+                break;
+            }
         }
+    }
+
+    return found ? g_steal_pointer(&cpus) : NULL;
+}
+#endif
+
+void os_mem_prealloc_async(const char *name, int fd, char *area, size_t sz,
+                           int smp_cpus, const unsigned long *host_nodes,
+                           unsigned long max_node, Error **errp)
+{
+    size_t hpagesize = qemu_fd_getpagesize(fd);
+    size_t numpages = DIV_ROUND_UP(sz, hpagesize);
+    bool use_madv_populate_write;
+    MemsetContext *context;
+
+    memset_init();
+
+    use_madv_populate_write = madv_populate_write_possible(area, hpagesize);
+    if (!use_madv_populate_write) {
+        int ret;
+
+        qemu_mutex_lock(&sigbus_mutex);
+        ret = sigbus_handler_get(errp);
         qemu_mutex_unlock(&sigbus_mutex);
+        if (ret) {
+            return;
+        }
+    }
+
+    context = memset_context_new(area, hpagesize, numpages, smp_cpus,
+                                 use_madv_populate_write);
+    context->name = g_strdup(name);
+#ifdef CONFIG_LINUX
+    if (host_nodes && max_node) {
+        context->cpus = host_nodes_to_cpus(host_nodes, max_node);
+    }
+#endif
+
+    /* sigbus_handler() must find the threads before they touch any page */
+    QLIST_INSERT_HEAD_RCU(&memset_async_contexts, context, next);
+    memset_context_start(context);
+}
+
+bool os_mem_prealloc_async_done(void)
+{
+    MemsetContext *context;
+
+    QLIST_FOREACH(context, &memset_async_contexts, next) {
+        if (qatomic_read(&context->running)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool os_mem_prealloc_async_finish(Error **errp)
+{
+    MemsetContext *context, *tmp;
+    bool ok = true;
+
+    QLIST_FOREACH(context, &memset_async_contexts, next) {
+        int ret = memset_context_join(context);
+
+        if (ret && ok) {
+            error_setg_errno(errp, -ret,
+                             "preallocating memory for '%s' failed",
+                             context->name);
+            ok = false;
+        }
+    }
+
+    /*
+     * All threads are gone; restore the previous SIGBUS handler before
+     * freeing the contexts that sigbus_handler() walks.
+     */
+    QLIST_FOREACH(context, &memset_async_contexts, next) {
+        if (!context->use_madv_populate_write) {
+            qemu_mutex_lock(&sigbus_mutex);
+            sigbus_handler_put();
+            qemu_mutex_unlock(&sigbus_mutex);
+        }
+    }
+
+    QLIST_FOREACH_SAFE(context, &memset_async_contexts, next, tmp) {
+        QLIST_REMOVE(context, next);
+        memset_context_free(context);
+    }
+    return ok;
+}
+
+void os_mem_prealloc_foreach(OsMemPreallocFunc *func, void *opaque)
+{
+    MemsetContext *context;
+
+    QLIST_FOREACH(context, &memset_async_contexts, next) {
+        func(context->name, context->numpages * context->hpagesize,
+             qatomic_read(&context->done_pages) * context->hpagesize,
+             context->num_threads, opaque);
     }
 }
 
@@ -694,6 +942,32 @@ void *qemu_alloc_stack(size_t *sz)
     return ptr;
 }
 
+size_t qemu_stack_usage(void *stack, size_t sz)
+{
+#if defined(CONFIG_LINUX) && !defined(CONFIG_DEBUG_STACK_USAGE) && \
+    !defined(HOST_IA64) && !defined(HOST_HPPA)
+    /*
+     * Stacks are mapped lazily and grow down towards the guard page, so the
+     * lowest resident page marks the deepest point the stack ever reached.
+     * Pages that were swapped out are missed, which only underestimates.
+     */
+    size_t pagesz = qemu_real_host_page_size();
+    size_t npages = sz / pagesz, i;
+    g_autofree unsigned char *vec = g_malloc(npages);
+
+    if (mincore(stack, sz, vec) < 0) {
+        return 0;
+    }
+    /* Skip the guard page */
+    for (i = 1; i < npages; i++) {
+        if (vec[i] & 1) {
+            return (npages - i) * pagesz;
+        }
+    }
+#endif
+    return 0;
+}
+
 #ifdef CONFIG_DEBUG_STACK_USAGE
 static __thread unsigned int max_stack_usage;
 #endif
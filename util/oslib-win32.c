@@ -280,6 +280,27 @@ void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
     }
 }
 
+void os_mem_prealloc_async(const char *name, int fd, char *area, size_t sz,
+                           int smp_cpus, const unsigned long *host_nodes,
+                           unsigned long max_node, Error **errp)
+{
+    os_mem_prealloc(fd, area, sz, smp_cpus, errp);
+}
+
+bool os_mem_prealloc_async_done(void)
+{
+    return true;
+}
+
+bool os_mem_prealloc_async_finish(Error **errp)
+{
+    return true;
+}
+
+void os_mem_prealloc_foreach(OsMemPreallocFunc *func, void *opaque)
+{
+}
+
 char *qemu_get_pid_name(pid_t pid)
 {
     /* XXX Implement me */
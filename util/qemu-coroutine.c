@@ -19,6 +19,8 @@
 #include "qemu/coroutine.h"
 #include "qemu/coroutine_int.h"
 #include "qemu/coroutine-tls.h"
+#include "qemu/error-report.h"
+#include "qemu/stats64.h"
 #include "block/aio.h"
 
 /**
@@ -42,6 +44,25 @@ QEMU_DEFINE_STATIC_CO_TLS(CoroutineQSList, alloc_pool);
 QEMU_DEFINE_STATIC_CO_TLS(unsigned int, alloc_pool_size);
 QEMU_DEFINE_STATIC_CO_TLS(Notifier, coroutine_pool_cleanup_notifier);
 
+/*
+ * Pool hits are counted per thread and added to pool_stats every
+ * POOL_MIN_BATCH_SIZE hits, so that the fast path stays free of atomics.
+ * Everything else is counted where a stack is allocated or freed anyway.
+ */
+QEMU_DEFINE_STATIC_CO_TLS(unsigned int, local_pool_hits);
+static struct {
+    Stat64 allocated;
+    Stat64 freed;
+    Stat64 pool_hits;
+    Stat64 stack_high_water;
+} pool_stats;
+
+static void coroutine_free(Coroutine *co)
+{
+    stat64_add(&pool_stats.freed, 1);
+    qemu_coroutine_delete(co);
+}
+
 static void coroutine_pool_cleanup(Notifier *n, void *value)
 {
     Coroutine *co;
@@ -50,10 +71,49 @@ static void coroutine_pool_cleanup(Notifier *n, void *value)
 
     QSLIST_FOREACH_SAFE(co, alloc_pool, pool_next, tmp) {
         QSLIST_REMOVE_HEAD(alloc_pool, pool_next);
-        qemu_coroutine_delete(co);
+        coroutine_free(co);
+    }
+    stat64_add(&pool_stats.pool_hits, get_local_pool_hits());
+    set_local_pool_hits(0);
+}
+
+/* The alloc_pool of a thread must be emptied when the thread exits */
+static void coroutine_pool_register_cleanup(void)
+{
+    Notifier *notifier = get_ptr_coroutine_pool_cleanup_notifier();
+
+    if (!notifier->notify) {
+        notifier->notify = coroutine_pool_cleanup;
+        qemu_thread_atexit_add(notifier);
+    }
+}
+
+void qemu_coroutine_note_stack_usage(size_t usage, size_t stack_size)
+{
+    if (usage <= stat64_get(&pool_stats.stack_high_water)) {
+        return;
+    }
+
+    stat64_max(&pool_stats.stack_high_water, usage);
+    trace_qemu_coroutine_stack_high_water(usage, stack_size);
+
+    /* The guard page turns an overflow into a crash; warn while we can */
+    if (usage > stack_size - stack_size / 8) {
+        warn_report_once("coroutine stack usage reached %zu of %zu bytes, "
+                         "consider a larger --coroutine-stack-size",
+                         usage, stack_size);
     }
 }
 
+void qemu_coroutine_get_pool_stats(CoroutinePoolStats *stats)
+{
+    stats->allocated = stat64_get(&pool_stats.allocated);
+    stats->freed = stat64_get(&pool_stats.freed);
+    stats->pool_hits = stat64_get(&pool_stats.pool_hits) +
+                       get_local_pool_hits();
+    stats->stack_high_water = stat64_get(&pool_stats.stack_high_water);
+}
+
 Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
 {
     Coroutine *co = NULL;
@@ -65,11 +125,7 @@ Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
         if (!co) {
             if (release_pool_size > POOL_MIN_BATCH_SIZE) {
                 /* Slow path; a good place to register the destructor, too.  */
-                Notifier *notifier = get_ptr_coroutine_pool_cleanup_notifier();
-                if (!notifier->notify) {
-                    notifier->notify = coroutine_pool_cleanup;
-                    qemu_thread_atexit_add(notifier);
-                }
+                coroutine_pool_register_cleanup();
 
                 /* This is not exact; there could be a little skew between
                  * release_pool_size and the actual size of release_pool.  But
@@ -81,12 +137,20 @@ Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
             }
         }
         if (co) {
+            unsigned int hits = get_local_pool_hits() + 1;
+
             QSLIST_REMOVE_HEAD(alloc_pool, pool_next);
             set_alloc_pool_size(get_alloc_pool_size() - 1);
+            if (hits == POOL_MIN_BATCH_SIZE) {
+                stat64_add(&pool_stats.pool_hits, hits);
+                hits = 0;
+            }
+            set_local_pool_hits(hits);
         }
     }
 
     if (!co) {
+        stat64_add(&pool_stats.allocated, 1);
         co = qemu_coroutine_new();
     }
 
@@ -101,19 +165,26 @@ static void coroutine_delete(Coroutine *co)
     co->caller = NULL;
 
     if (CONFIG_COROUTINE_POOL) {
-        if (release_pool_size < qatomic_read(&pool_max_size) * 2) {
-            QSLIST_INSERT_HEAD_ATOMIC(&release_pool, co, pool_next);
-            qatomic_inc(&release_pool_size);
-            return;
-        }
+        /*
+         * Keep the stack in this thread first: it is likely to be reused by
+         * the next coroutine created here, and its pages are already local
+         * to this thread's NUMA node.  Only spill to the shared pool once
+         * the local one is full.
+         */
         if (get_alloc_pool_size() < qatomic_read(&pool_max_size)) {
+            coroutine_pool_register_cleanup();
             QSLIST_INSERT_HEAD(get_ptr_alloc_pool(), co, pool_next);
             set_alloc_pool_size(get_alloc_pool_size() + 1);
             return;
         }
+        if (release_pool_size < qatomic_read(&pool_max_size) * 2) {
+            QSLIST_INSERT_HEAD_ATOMIC(&release_pool, co, pool_next);
+            qatomic_inc(&release_pool_size);
+            return;
+        }
     }
 
-    qemu_coroutine_delete(co);
+    coroutine_free(co);
 }
 
 void qemu_aio_coroutine_enter(AioContext *ctx, Coroutine *co)
@@ -32,6 +32,9 @@
 #include "qemu/thread.h"
 #include "qemu/main-loop.h"
 #include "qemu/lockable.h"
+#include "qemu/stats64.h"
+#include "qemu/timer.h"
+#include "trace.h"
 #if defined(CONFIG_MALLOC_TRIM)
 #include <malloc.h>
 #endif
@@ -46,10 +49,25 @@
 unsigned long rcu_gp_ctr = RCU_GP_LOCKED;
 
 QemuEvent rcu_gp_event;
-static int in_drain_call_rcu;
+
+/*
+ * Nonzero while someone waits for a grace period to end as soon as possible:
+ * readers are asked to leave their critical section, and the call_rcu thread
+ * does not wait for more callbacks to pile up.
+ */
+static int rcu_expedite;
 static QemuMutex rcu_registry_lock;
 static QemuMutex rcu_sync_lock;
 
+/* Statistics, read with rcu_get_stats() */
+static Stat64 rcu_gp_count;
+static Stat64 rcu_gp_expedited_count;
+static Stat64 rcu_gp_ns;
+static Stat64 rcu_gp_max_ns;
+static Stat64 rcu_batch_count;
+static Stat64 rcu_cb_queued;
+static Stat64 rcu_cb_invoked;
+
 /*
  * Check whether a quiescent state was crossed between the beginning of
  * update_counter_and_wait and now.
@@ -108,7 +126,7 @@ static void wait_for_readers(void)
                  * get some extra futex wakeups.
                  */
                 qatomic_set(&index->waiting, false);
-            } else if (qatomic_read(&in_drain_call_rcu)) {
+            } else if (qatomic_read(&rcu_expedite)) {
                 notifier_list_notify(&index->force_rcu, NULL);
             }
         }
@@ -143,7 +161,7 @@ static void wait_for_readers(void)
     QLIST_SWAP(&registry, &qsreaders, node);
 }
 
-void synchronize_rcu(void)
+static void wait_for_grace_period(void)
 {
     QEMU_LOCK_GUARD(&rcu_sync_lock);
 
@@ -175,6 +193,31 @@ void synchronize_rcu(void)
     }
 }
 
+void synchronize_rcu(void)
+{
+    bool expedited = qatomic_read(&rcu_expedite);
+    int64_t start = get_clock();
+    uint64_t ns;
+
+    wait_for_grace_period();
+
+    ns = get_clock() - start;
+    stat64_inc(&rcu_gp_count);
+    if (expedited) {
+        stat64_inc(&rcu_gp_expedited_count);
+    }
+    stat64_add(&rcu_gp_ns, ns);
+    stat64_max(&rcu_gp_max_ns, ns);
+    trace_synchronize_rcu(ns, expedited);
+}
+
+void synchronize_rcu_expedited(void)
+{
+    qatomic_inc(&rcu_expedite);
+    synchronize_rcu();
+    qatomic_dec(&rcu_expedite);
+}
+
 
 #define RCU_CALL_MIN_SIZE        30
 
@@ -186,13 +229,63 @@ static struct rcu_head *head = &dummy, **tail = &dummy.next;
 static int rcu_call_count;
 static QemuEvent rcu_call_ready_event;
 
-static void enqueue(struct rcu_head *node)
+/* Append the chain of nodes from @first to @last.  */
+static void enqueue_list(struct rcu_head *first, struct rcu_head *last)
 {
     struct rcu_head **old_tail;
 
-    node->next = NULL;
-    old_tail = qatomic_xchg(&tail, &node->next);
-    qatomic_mb_set(old_tail, node);
+    last->next = NULL;
+    old_tail = qatomic_xchg(&tail, &last->next);
+    qatomic_mb_set(old_tail, first);
+}
+
+static void enqueue(struct rcu_head *node)
+{
+    enqueue_list(node, node);
+}
+
+/*
+ * Move a batch of callbacks that a thread queued, newest first, to the
+ * queue of the call_rcu thread.  Returns the number of callbacks.
+ */
+static int enqueue_batch(struct rcu_head *node)
+{
+    struct rcu_head *first = NULL, *last = node, *next;
+    int n = 0;
+
+    /* Callbacks from one thread run in the order they were queued.  */
+    while (node) {
+        next = node->next;
+        node->next = first;
+        first = node;
+        node = next;
+        n++;
+    }
+    if (n) {
+        enqueue_list(first, last);
+        stat64_inc(&rcu_batch_count);
+        stat64_add(&rcu_cb_queued, n);
+        qatomic_add(&rcu_call_count, n);
+    }
+    return n;
+}
+
+/*
+ * Take over the callbacks batched by registered threads.  Holding
+ * rcu_sync_lock ensures that no reader is hidden from the registry
+ * by wait_for_readers().
+ */
+static void collect_batches(void)
+{
+    struct rcu_reader_data *index;
+
+    QEMU_LOCK_GUARD(&rcu_sync_lock);
+    QEMU_LOCK_GUARD(&rcu_registry_lock);
+    QLIST_FOREACH(index, &registry, node) {
+        if (qatomic_read(&index->batch)) {
+            enqueue_batch(qatomic_xchg(&index->batch, NULL));
+        }
+    }
 }
 
 static struct rcu_head *try_dequeue(void)
@@ -243,16 +336,22 @@ static void *call_rcu_thread(void *opaque)
 
     for (;;) {
         int tries = 0;
-        int n = qatomic_read(&rcu_call_count);
+        int n;
 
-        /* Heuristically wait for a decent number of callbacks to pile up.
+        collect_batches();
+        n = qatomic_read(&rcu_call_count);
+
+        /* Heuristically wait for a decent number of callbacks to pile up,
+         * unless somebody is waiting for them in drain_call_rcu().
          * Fetch rcu_call_count now, we only must process elements that were
          * added before synchronize_rcu() starts.
          */
-        while (n == 0 || (n < RCU_CALL_MIN_SIZE && ++tries <= 5)) {
+        while (n == 0 || (n < RCU_CALL_MIN_SIZE && ++tries <= 5 &&
+                          !qatomic_read(&rcu_expedite))) {
             g_usleep(10000);
             if (n == 0) {
                 qemu_event_reset(&rcu_call_ready_event);
+                collect_batches();
                 n = qatomic_read(&rcu_call_count);
                 if (n == 0) {
 #if defined(CONFIG_MALLOC_TRIM)
@@ -261,10 +360,12 @@ static void *call_rcu_thread(void *opaque)
                     qemu_event_wait(&rcu_call_ready_event);
                 }
             }
+            collect_batches();
             n = qatomic_read(&rcu_call_count);
         }
 
         qatomic_sub(&rcu_call_count, n);
+        trace_call_rcu_thread_run(n);
         synchronize_rcu();
         qemu_mutex_lock_iothread();
         while (n > 0) {
@@ -281,6 +382,7 @@ static void *call_rcu_thread(void *opaque)
             }
 
             n--;
+            stat64_inc(&rcu_cb_invoked);
             node->func(node);
         }
         qemu_mutex_unlock_iothread();
@@ -290,10 +392,46 @@ static void *call_rcu_thread(void *opaque)
 
 void call_rcu1(struct rcu_head *node, void (*func)(struct rcu_head *node))
 {
+    struct rcu_reader_data *p_rcu_reader = get_ptr_rcu_reader();
+    struct rcu_head *old;
+
     node->func = func;
-    enqueue(node);
-    qatomic_inc(&rcu_call_count);
-    qemu_event_set(&rcu_call_ready_event);
+    if (!p_rcu_reader->registered) {
+        enqueue(node);
+        stat64_inc(&rcu_cb_queued);
+        qatomic_inc(&rcu_call_count);
+        qemu_event_set(&rcu_call_ready_event);
+        return;
+    }
+
+    /*
+     * Registered threads queue callbacks in their own batch, which the
+     * call_rcu thread takes over as a whole.  This keeps writes to the
+     * shared queue and counter off the fast path, and only the first
+     * callback of a batch needs to wake up the call_rcu thread.
+     */
+    do {
+        old = qatomic_read(&p_rcu_reader->batch);
+        node->next = old;
+    } while (qatomic_cmpxchg(&p_rcu_reader->batch, old, node) != old);
+
+    if (!old) {
+        qemu_event_set(&rcu_call_ready_event);
+    }
+}
+
+void rcu_get_stats(RcuStats *stats)
+{
+    /* Read this first, so that pending_callbacks cannot go negative */
+    uint64_t invoked = stat64_get(&rcu_cb_invoked);
+
+    stats->grace_periods = stat64_get(&rcu_gp_count);
+    stats->expedited_grace_periods = stat64_get(&rcu_gp_expedited_count);
+    stats->grace_period_ns = stat64_get(&rcu_gp_ns);
+    stats->max_grace_period_ns = stat64_get(&rcu_gp_max_ns);
+    stats->batches = stat64_get(&rcu_batch_count);
+    stats->callbacks = invoked;
+    stats->pending_callbacks = stat64_get(&rcu_cb_queued) - invoked;
 }
 
 
@@ -336,16 +474,15 @@ void drain_call_rcu(void)
      * is called, all RCU callbacks that were registered on this thread
      * prior to calling this function are completed.
      *
-     * Note that since we have only one global queue of the RCU callbacks,
-     * we also end up waiting for most of RCU callbacks that were registered
+     * We may also end up waiting for RCU callbacks that were registered
      * on the other threads, but this is a side effect that shoudn't be
      * assumed.
      */
 
-    qatomic_inc(&in_drain_call_rcu);
+    qatomic_inc(&rcu_expedite);
     call_rcu1(&rcu_drain.rcu, drain_rcu_callback);
     qemu_event_wait(&rcu_drain.drain_complete_event);
-    qatomic_dec(&in_drain_call_rcu);
+    qatomic_dec(&rcu_expedite);
 
     if (locked) {
         qemu_mutex_lock_iothread();
@@ -355,17 +492,28 @@ void drain_call_rcu(void)
 
 void rcu_register_thread(void)
 {
-    assert(get_ptr_rcu_reader()->ctr == 0);
+    struct rcu_reader_data *p_rcu_reader = get_ptr_rcu_reader();
+
+    assert(p_rcu_reader->ctr == 0);
     qemu_mutex_lock(&rcu_registry_lock);
-    QLIST_INSERT_HEAD(&registry, get_ptr_rcu_reader(), node);
+    QLIST_INSERT_HEAD(&registry, p_rcu_reader, node);
+    p_rcu_reader->registered = true;
     qemu_mutex_unlock(&rcu_registry_lock);
 }
 
 void rcu_unregister_thread(void)
 {
+    struct rcu_reader_data *p_rcu_reader = get_ptr_rcu_reader();
+
     qemu_mutex_lock(&rcu_registry_lock);
-    QLIST_REMOVE(get_ptr_rcu_reader(), node);
+    QLIST_REMOVE(p_rcu_reader, node);
+    p_rcu_reader->registered = false;
     qemu_mutex_unlock(&rcu_registry_lock);
+
+    /* The call_rcu thread cannot see the batch anymore, hand it over.  */
+    if (enqueue_batch(qatomic_xchg(&p_rcu_reader->batch, NULL))) {
+        qemu_event_set(&rcu_call_ready_event);
+    }
 }
 
 void rcu_add_force_rcu_notifier(Notifier *n)
@@ -436,10 +584,17 @@ static void rcu_init_unlock(void)
 
 static void rcu_init_child(void)
 {
+    struct rcu_reader_data *index;
+
     if (atfork_depth < 1) {
         return;
     }
 
+    /* The other threads are gone, but their callbacks must still run.  */
+    QLIST_FOREACH(index, &registry, node) {
+        enqueue_batch(index->batch);
+        index->batch = NULL;
+    }
     memset(&registry, 0, sizeof(registry));
     rcu_init_complete();
 }
@@ -18,6 +18,7 @@
 #include "qemu/queue.h"
 #include "qemu/thread.h"
 #include "qemu/coroutine.h"
+#include "qemu/timer.h"
 #include "trace.h"
 #include "block/thread-pool.h"
 #include "qemu/main-loop.h"
@@ -45,9 +46,18 @@ struct ThreadPoolElement {
     enum ThreadState state;
     int ret;
 
+    /* Written before the request is put on the done list.  */
+    int64_t submit_ns;
+    int64_t start_ns;
+    int64_t done_ns;
+
     /* Access to this list is protected by lock.  */
     QTAILQ_ENTRY(ThreadPoolElement) reqs;
 
+    /* Lock-free list of finished requests, then the completed queue.  */
+    QSLIST_ENTRY(ThreadPoolElement) done_next;
+    QSIMPLEQ_ENTRY(ThreadPoolElement) completed_next;
+
     /* Access to this list is protected by the global mutex.  */
     QLIST_ENTRY(ThreadPoolElement) all;
 };
@@ -60,11 +70,22 @@ struct ThreadPool {
     QemuCond request_cond;
     QEMUBH *new_thread_bh;
 
+    /*
+     * Finished requests, pushed by workers without taking the lock.  Only
+     * the request that finds the list empty schedules completion_bh, so a
+     * burst of completions costs a single notification.
+     */
+    QSLIST_HEAD(, ThreadPoolElement) done_list;
+
     /* The following variables are only accessed from one AioContext. */
     QLIST_HEAD(, ThreadPoolElement) head;
+    QSIMPLEQ_HEAD(, ThreadPoolElement) completed;
+    ThreadPoolStats stats;
 
     /* The following variables are protected by lock.  */
     QTAILQ_HEAD(, ThreadPoolElement) request_list;
+    unsigned int queue_depth;
+    unsigned int max_queue_depth;
     int cur_threads;
     int idle_threads;
     int new_threads;     /* backlog of threads we need to create */
@@ -73,6 +94,25 @@ struct ThreadPool {
     int max_threads;
 };
 
+/* Hand a finished or canceled request over to the AioContext.  */
+static void thread_pool_done(ThreadPool *pool, ThreadPoolElement *req)
+{
+    ThreadPoolElement *old;
+
+    /*
+     * Open-coded QSLIST_INSERT_HEAD_ATOMIC: req may be completed and freed
+     * as soon as it is on the list, so remember whether the list was empty.
+     */
+    do {
+        old = qatomic_read(&pool->done_list.slh_first);
+        req->done_next.sle_next = old;
+    } while (qatomic_cmpxchg(&pool->done_list.slh_first, old, req) != old);
+
+    if (!old) {
+        qemu_bh_schedule(pool->completion_bh);
+    }
+}
+
 static void *worker_thread(void *opaque)
 {
     ThreadPool *pool = opaque;
@@ -104,17 +144,20 @@ static void *worker_thread(void *opaque)
 
         req = QTAILQ_FIRST(&pool->request_list);
         QTAILQ_REMOVE(&pool->request_list, req, reqs);
+        pool->queue_depth--;
         req->state = THREAD_ACTIVE;
         qemu_mutex_unlock(&pool->lock);
 
+        req->start_ns = get_clock();
         ret = req->func(req->arg);
+        req->done_ns = get_clock();
 
         req->ret = ret;
         /* Write ret before state.  */
         smp_wmb();
         req->state = THREAD_DONE;
 
-        qemu_bh_schedule(pool->completion_bh);
+        thread_pool_done(pool, req);
         qemu_mutex_lock(&pool->lock);
     }
 
@@ -170,21 +213,73 @@ static void spawn_thread(ThreadPool *pool)
     }
 }
 
+/*
+ * Move the requests that workers finished since the last call to the tail
+ * of pool->completed, oldest first.
+ */
+static bool thread_pool_collect_done(ThreadPool *pool)
+{
+    QSLIST_HEAD(, ThreadPoolElement) done;
+    QSIMPLEQ_HEAD(, ThreadPoolElement) batch =
+        QSIMPLEQ_HEAD_INITIALIZER(batch);
+    ThreadPoolElement *elem;
+    unsigned int n = 0;
+
+    QSLIST_MOVE_ATOMIC(&done, &pool->done_list);
+    if (QSLIST_EMPTY(&done)) {
+        return false;
+    }
+
+    /* The done list is LIFO; reverse it.  */
+    while ((elem = QSLIST_FIRST(&done))) {
+        QSLIST_REMOVE_HEAD(&done, done_next);
+        QSIMPLEQ_INSERT_HEAD(&batch, elem, completed_next);
+        n++;
+    }
+    QSIMPLEQ_CONCAT(&pool->completed, &batch);
+
+    pool->stats.batches++;
+    trace_thread_pool_completion_batch(pool, n);
+    return true;
+}
+
+static void thread_pool_account(ThreadPool *pool, ThreadPoolElement *elem)
+{
+    ThreadPoolStats *stats = &pool->stats;
+    uint64_t queue_ns;
+
+    if (elem->ret == -ECANCELED && !elem->start_ns) {
+        stats->canceled++;
+        return;
+    }
+
+    queue_ns = elem->start_ns - elem->submit_ns;
+    stats->completed++;
+    stats->queue_ns += queue_ns;
+    stats->max_queue_ns = MAX(stats->max_queue_ns, queue_ns);
+    stats->run_ns += elem->done_ns - elem->start_ns;
+}
+
 static void thread_pool_completion_bh(void *opaque)
 {
     ThreadPool *pool = opaque;
-    ThreadPoolElement *elem, *next;
+    ThreadPoolElement *elem;
 
     aio_context_acquire(pool->ctx);
-restart:
-    QLIST_FOREACH_SAFE(elem, &pool->head, all, next) {
-        if (elem->state != THREAD_DONE) {
+    for (;;) {
+        elem = QSIMPLEQ_FIRST(&pool->completed);
+        if (!elem) {
+            if (!thread_pool_collect_done(pool)) {
+                break;
+            }
             continue;
         }
 
+        QSIMPLEQ_REMOVE_HEAD(&pool->completed, completed_next);
         trace_thread_pool_complete(pool, elem, elem->common.opaque,
                                    elem->ret);
         QLIST_REMOVE(elem, all);
+        thread_pool_account(pool, elem);
 
         if (elem->common.cb) {
             /* Read state before ret.  */
@@ -200,16 +295,12 @@ restart:
             aio_context_acquire(pool->ctx);
 
             /* We can safely cancel the completion_bh here regardless of someone
-             * else having scheduled it meanwhile because we reenter the
-             * completion function anyway (goto restart).
+             * else having scheduled it meanwhile because we keep looping until
+             * both pool->completed and pool->done_list are empty.
              */
             qemu_bh_cancel(pool->completion_bh);
-
-            qemu_aio_unref(elem);
-            goto restart;
-        } else {
-            qemu_aio_unref(elem);
         }
+        qemu_aio_unref(elem);
     }
     aio_context_release(pool->ctx);
 }
@@ -224,10 +315,11 @@ static void thread_pool_cancel(BlockAIOCB *acb)
     QEMU_LOCK_GUARD(&pool->lock);
     if (elem->state == THREAD_QUEUED) {
         QTAILQ_REMOVE(&pool->request_list, elem, reqs);
-        qemu_bh_schedule(pool->completion_bh);
+        pool->queue_depth--;
 
         elem->state = THREAD_DONE;
         elem->ret = -ECANCELED;
+        thread_pool_done(pool, elem);
     }
 
 }
@@ -250,14 +342,18 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
         BlockCompletionFunc *cb, void *opaque)
 {
     ThreadPoolElement *req;
+    bool wake;
 
     req = qemu_aio_get(&thread_pool_aiocb_info, NULL, cb, opaque);
     req->func = func;
     req->arg = arg;
     req->state = THREAD_QUEUED;
     req->pool = pool;
+    req->submit_ns = get_clock();
+    req->start_ns = 0;
 
     QLIST_INSERT_HEAD(&pool->head, req, all);
+    pool->stats.submitted++;
 
     trace_thread_pool_submit(pool, req, arg);
 
@@ -266,8 +362,14 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
         spawn_thread(pool);
     }
     QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
+    pool->queue_depth++;
+    pool->max_queue_depth = MAX(pool->max_queue_depth, pool->queue_depth);
+    /* Busy workers pick the request up before going idle again.  */
+    wake = pool->idle_threads > 0;
     qemu_mutex_unlock(&pool->lock);
-    qemu_cond_signal(&pool->request_cond);
+    if (wake) {
+        qemu_cond_signal(&pool->request_cond);
+    }
     return &req->common;
 }
 
@@ -299,6 +401,16 @@ void thread_pool_submit(ThreadPool *pool, ThreadPoolFunc *func, void *arg)
     thread_pool_submit_aio(pool, func, arg, NULL, NULL);
 }
 
+void thread_pool_get_stats(ThreadPool *pool, ThreadPoolStats *stats)
+{
+    *stats = pool->stats;
+
+    QEMU_LOCK_GUARD(&pool->lock);
+    stats->queue_depth = pool->queue_depth;
+    stats->max_queue_depth = pool->max_queue_depth;
+    stats->threads = pool->cur_threads;
+}
+
 void thread_pool_update_params(ThreadPool *pool, AioContext *ctx)
 {
     qemu_mutex_lock(&pool->lock);
@@ -340,7 +452,9 @@ static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
     qemu_cond_init(&pool->request_cond);
     pool->new_thread_bh = aio_bh_new(ctx, spawn_thread_bh_fn, pool);
 
+    QSLIST_INIT(&pool->done_list);
     QLIST_INIT(&pool->head);
+    QSIMPLEQ_INIT(&pool->completed);
     QTAILQ_INIT(&pool->request_list);
 
     thread_pool_update_params(pool, ctx);